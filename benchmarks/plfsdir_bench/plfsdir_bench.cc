@@ -0,0 +1,808 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "deltafs_plfsio.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Comma-separated list of operations to run in the specified order
+//   write      -- insert num keys per epoch from all producer threads
+//   read       -- point-read reads keys, one key per op
+//   multiread  -- read reads keys in batches of batch keys, one batch per op,
+//                 with the keys of each batch fanned out to all threads
+//   scan       -- read every key id in ascending order
+static const char* FLAGS_benchmarks = "write,read,multiread,scan";
+
+// Number of keys inserted per epoch
+static int FLAGS_num = 1 << 20;
+
+// Number of epochs to write
+static int FLAGS_epochs = 1;
+
+// Number of read operations to do. If negative, do FLAGS_num reads.
+static int FLAGS_reads = -1;
+
+// Number of keys per multiread op
+static int FLAGS_batch = 64;
+
+// Number of concurrent producer (and reader) threads
+static int FLAGS_threads = 1;
+
+// Number of background compaction threads. Zero runs compactions
+// inline in the writer's context.
+static int FLAGS_compaction_threads = 4;
+
+// Key distribution: "uniform", "zipfian", or "sequential"
+static const char* FLAGS_key_dist = "uniform";
+
+// Skew of the zipfian distribution
+static double FLAGS_zipf_theta = 0.99;
+
+// Size of each key
+static int FLAGS_key_size = 16;
+
+// Average size of each value
+static int FLAGS_value_size = 32;
+
+// Value size distribution: "fixed", or "variable" (uniform
+// in [value_size/2, value_size*3/2])
+static const char* FLAGS_value_dist = "fixed";
+
+// Number of memtable partitions in logarithmic scale
+static int FLAGS_lg_parts = 2;
+
+// Total memtable budget in MiB
+static int FLAGS_memtable_mb = 32;
+
+// Bloom filter bits per key
+static int FLAGS_bf_bits = 10;
+
+// Directory mode: "multimap", "override", "drop", or "unique". The
+// "unique" mode requires duplicate-free keys and therefore the
+// "sequential" key distribution.
+static const char* FLAGS_mode = "multimap";
+
+// Enable in-memtable deduplication
+static bool FLAGS_memtable_dedup = false;
+
+// Env type: "posix", or "mem"
+static const char* FLAGS_env = "posix";
+
+// Output format: "text", or "json" (one result object per line)
+static const char* FLAGS_format = "text";
+
+// Use the dir with the following name.
+static const char* FLAGS_dir = NULL;
+
+namespace pdlfs {
+namespace plfsio {
+
+namespace {
+
+// A simple in-memory Env so that benchmarks can exclude storage costs.
+class MemEnv : public EnvWrapper {
+ public:
+  MemEnv() : EnvWrapper(Env::Default()) {}
+
+  virtual ~MemEnv() {
+    for (FSIter it = fs_.begin(); it != fs_.end(); ++it) {
+      delete it->second;
+    }
+  }
+
+  virtual Status NewWritableFile(const char* f, WritableFile** r) {
+    MutexLock ml(&mu_);
+    std::string*& buf = fs_[f];
+    if (buf == NULL) buf = new std::string;
+    buf->clear();
+    *r = new MemWritableFile(buf);
+    return Status::OK();
+  }
+
+  virtual Status NewRandomAccessFile(const char* f, RandomAccessFile** r) {
+    const std::string* buf = Find(f);
+    if (buf == NULL) {
+      *r = NULL;
+      return Status::NotFound(Slice());
+    } else {
+      *r = new MemFile(buf);
+      return Status::OK();
+    }
+  }
+
+  virtual Status NewSequentialFile(const char* f, SequentialFile** r) {
+    const std::string* buf = Find(f);
+    if (buf == NULL) {
+      *r = NULL;
+      return Status::NotFound(Slice());
+    } else {
+      *r = new MemFile(buf);
+      return Status::OK();
+    }
+  }
+
+  virtual Status GetFileSize(const char* f, uint64_t* s) {
+    const std::string* buf = Find(f);
+    if (buf == NULL) {
+      *s = 0;
+      return Status::NotFound(Slice());
+    } else {
+      *s = buf->size();
+      return Status::OK();
+    }
+  }
+
+  virtual bool FileExists(const char* f) { return Find(f) != NULL; }
+
+  virtual Status DeleteFile(const char* f) {
+    MutexLock ml(&mu_);
+    FSIter it = fs_.find(f);
+    if (it == fs_.end()) {
+      return Status::NotFound(Slice());
+    } else {
+      delete it->second;
+      fs_.erase(it);
+      return Status::OK();
+    }
+  }
+
+ private:
+  class MemWritableFile : public WritableFileWrapper {
+   public:
+    explicit MemWritableFile(std::string* buf) : buf_(buf) {}
+    virtual ~MemWritableFile() {}
+
+    virtual Status Append(const Slice& data) {
+      buf_->append(data.data(), data.size());
+      return Status::OK();
+    }
+
+   private:
+    std::string* buf_;
+  };
+
+  class MemFile : public SequentialFile, public RandomAccessFile {
+   public:
+    explicit MemFile(const std::string* buf) : buf_(buf), off_(0) {}
+    virtual ~MemFile() {}
+
+    virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                        char* scratch) const {
+      if (offset > buf_->size()) offset = buf_->size();
+      if (n > buf_->size() - offset) n = buf_->size() - offset;
+      *result = Slice(buf_->data() + offset, n);
+      return Status::OK();
+    }
+
+    virtual Status Read(size_t n, Slice* result, char* scratch) {
+      if (n > buf_->size() - off_) n = buf_->size() - off_;
+      *result = Slice(buf_->data() + off_, n);
+      off_ += n;
+      return Status::OK();
+    }
+
+    virtual Status Skip(uint64_t n) {
+      if (n > buf_->size() - off_) n = buf_->size() - off_;
+      off_ += n;
+      return Status::OK();
+    }
+
+   private:
+    const std::string* buf_;
+    size_t off_;
+  };
+
+  const std::string* Find(const char* f) {
+    MutexLock ml(&mu_);
+    FSIter it = fs_.find(f);
+    if (it != fs_.end()) {
+      return it->second;
+    } else {
+      return NULL;
+    }
+  }
+
+  typedef std::map<std::string, std::string*> FS;
+  typedef FS::iterator FSIter;
+  port::Mutex mu_;
+  FS fs_;
+};
+
+// Zipfian generator following Gray et al. "Quickly generating billion-record
+// synthetic databases", as used by YCSB. Returns ids in [0, n).
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+    zeta2_ = Zeta(2, theta_);
+    zetan_ = Zeta(n_, theta_);
+    alpha_ = 1.0 / (1.0 - theta_);
+    eta_ = (1 - pow(2.0 / n_, 1 - theta_)) / (1 - zeta2_ / zetan_);
+  }
+
+  uint64_t Next(Random* rnd) const {
+    const double u = double(rnd->Next()) / 2147483647.0;
+    const double uz = u * zetan_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, theta_)) return 1;
+    uint64_t r = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1, alpha_));
+    if (r >= n_) r = n_ - 1;
+    return r;
+  }
+
+ private:
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += 1 / pow(double(i + 1), theta);
+    }
+    return sum;
+  }
+
+  uint64_t n_;
+  double theta_;
+  double zeta2_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+};
+
+enum KeyDist { kUniform, kZipfian, kSequential };
+
+class KeyGenerator {
+ public:
+  KeyGenerator(KeyDist dist, uint64_t n, const ZipfianGenerator* zipf)
+      : dist_(dist), n_(n), zipf_(zipf) {}
+
+  // Return the id of the i-th key issued by a given thread.
+  uint64_t NextId(Random* rnd, uint64_t i) const {
+    switch (dist_) {
+      case kZipfian:
+        return zipf_->Next(rnd);
+      case kSequential:
+        return i % n_;
+      case kUniform:
+      default:
+        return rnd->Next64() % n_;
+    }
+  }
+
+  // Sequential ids map to ordered keys. Others are scrambled so
+  // that hot keys are spread across partitions.
+  void MakeKey(uint64_t id, char* dst) const {
+    char buf[8];
+    if (dist_ == kSequential) {
+      for (int i = 0; i < 8; i++) {  // Big-endian so that keys sort by id
+        buf[i] = static_cast<char>(id >> (56 - 8 * i));
+      }
+    } else {
+      const uint64_t x = xxhash64(&id, sizeof(id), 0);
+      memcpy(buf, &x, sizeof(x));
+    }
+    for (int i = 0; i < FLAGS_key_size; i += 8) {
+      memcpy(dst + i, buf, std::min(8, FLAGS_key_size - i));
+    }
+  }
+
+ private:
+  KeyDist dist_;
+  uint64_t n_;
+  const ZipfianGenerator* zipf_;
+};
+
+class Stats {
+ public:
+  Stats() : ops_(0), bytes_(0), found_(0), start_(0), finish_(0) {
+    hist_.Clear();
+  }
+
+  void Start() { start_ = Env::Default()->NowMicros(); }
+  void Stop() { finish_ = Env::Default()->NowMicros(); }
+
+  void FinishedOp(uint64_t micros, size_t bytes) {
+    hist_.Add(double(micros));
+    bytes_ += bytes;
+    ops_++;
+  }
+
+  void AddFound(uint64_t n) { found_ += n; }
+
+  void Merge(const Stats& other) {
+    hist_.Merge(other.hist_);
+    ops_ += other.ops_;
+    bytes_ += other.bytes_;
+    found_ += other.found_;
+  }
+
+  void Report(const char* name) const {
+    const double secs = (finish_ - start_) * 1e-6;
+    const double ops_per_sec = secs > 0 ? ops_ / secs : 0;
+    const double mb_per_sec = secs > 0 ? bytes_ / 1048576.0 / secs : 0;
+    if (strcmp(FLAGS_format, "json") == 0) {
+      fprintf(stdout,
+              "{\"benchmark\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,"
+              "\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f,\"found\":%llu,"
+              "\"avg_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+              "\"p999_us\":%.3f,\"key_dist\":\"%s\",\"value_dist\":\"%s\","
+              "\"threads\":%d,\"lg_parts\":%d,\"epochs\":%d,\"env\":\"%s\"}\n",
+              name, static_cast<unsigned long long>(ops_), secs, ops_per_sec,
+              mb_per_sec, static_cast<unsigned long long>(found_),
+              hist_.Average(), hist_.Percentile(50), hist_.Percentile(99),
+              hist_.Percentile(99.9), FLAGS_key_dist, FLAGS_value_dist,
+              FLAGS_threads, FLAGS_lg_parts, FLAGS_epochs, FLAGS_env);
+    } else {
+      fprintf(stdout,
+              "%-10s : %11.3f micros/op; %10.1f ops/s; %8.1f MB/s; "
+              "p50 %.1f p99 %.1f p999 %.1f us; %llu found\n",
+              name, ops_ != 0 ? secs * 1e6 / ops_ : 0, ops_per_sec,
+              mb_per_sec, hist_.Percentile(50), hist_.Percentile(99),
+              hist_.Percentile(99.9), static_cast<unsigned long long>(found_));
+    }
+    fflush(stdout);
+  }
+
+ private:
+  Histogram hist_;
+  uint64_t ops_;
+  uint64_t bytes_;
+  uint64_t found_;
+  uint64_t start_;
+  uint64_t finish_;
+};
+
+class Benchmark;
+
+// State shared by all concurrent workers of the same phase.
+struct SharedState {
+  SharedState() : cv(&mu), num_done(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_done;
+};
+
+struct ThreadState {
+  ThreadState(int index, uint32_t seed)
+      : tid(index), rnd(seed), shared(NULL) {}
+  int tid;
+  Random rnd;
+  Stats stats;
+  SharedState* shared;
+  Benchmark* bench;
+  void (Benchmark::*method)(ThreadState*);
+};
+
+class Benchmark {
+ public:
+  Benchmark()
+      : key_dist_(kUniform),
+        zipf_(NULL),
+        keygen_(NULL),
+        env_(NULL),
+        pool_(NULL),
+        writer_(NULL),
+        reader_(NULL),
+        epoch_(0),
+        num_reads_(FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads) {
+    if (strcmp(FLAGS_key_dist, "zipfian") == 0) {
+      key_dist_ = kZipfian;
+      zipf_ = new ZipfianGenerator(FLAGS_num, FLAGS_zipf_theta);
+    } else if (strcmp(FLAGS_key_dist, "sequential") == 0) {
+      key_dist_ = kSequential;
+    }
+    keygen_ = new KeyGenerator(key_dist_, FLAGS_num, zipf_);
+    if (strcmp(FLAGS_env, "mem") == 0) {
+      env_ = new MemEnv;
+    } else {
+      env_ = Env::Default();
+    }
+    if (FLAGS_compaction_threads > 0) {
+      pool_ = ThreadPool::NewFixed(FLAGS_compaction_threads, true);
+    }
+    options_.env = env_;
+    options_.is_env_pfs = (env_ == Env::Default());
+    options_.lg_parts = FLAGS_lg_parts;
+    options_.total_memtable_budget = static_cast<size_t>(FLAGS_memtable_mb)
+                                     << 20;
+    options_.bf_bits_per_key = static_cast<size_t>(FLAGS_bf_bits);
+    options_.key_size = static_cast<size_t>(FLAGS_key_size);
+    options_.value_size = static_cast<size_t>(FLAGS_value_size);
+    options_.memtable_dedup = FLAGS_memtable_dedup;
+    options_.compaction_pool = pool_;
+    if (strcmp(FLAGS_mode, "override") == 0) {
+      options_.mode = kUniqueOverride;
+    } else if (strcmp(FLAGS_mode, "drop") == 0) {
+      options_.mode = kUniqueDrop;
+    } else if (strcmp(FLAGS_mode, "unique") == 0) {
+      options_.mode = kUnique;
+    } else {
+      options_.mode = kMultiMap;
+    }
+    // Reusable value contents
+    Random rnd(301);
+    while (values_.size() < (1u << 20)) {
+      values_.push_back(static_cast<char>(' ' + rnd.Uniform(95)));
+    }
+  }
+
+  ~Benchmark() {
+    delete reader_;
+    delete keygen_;
+    delete zipf_;
+    delete pool_;
+    if (env_ != Env::Default()) {
+      delete env_;
+    }
+  }
+
+  void Run() {
+    PrintHeader();
+    const char* benchmarks = FLAGS_benchmarks;
+    while (benchmarks != NULL) {
+      const char* sep = strchr(benchmarks, ',');
+      Slice name;
+      if (sep == NULL) {
+        name = benchmarks;
+        benchmarks = NULL;
+      } else {
+        name = Slice(benchmarks, sep - benchmarks);
+        benchmarks = sep + 1;
+      }
+      if (name == Slice("write")) {
+        DoWrite();
+      } else if (name == Slice("read")) {
+        RunReads("read", &Benchmark::PointRead, FLAGS_threads);
+      } else if (name == Slice("multiread")) {
+        RunReads("multiread", &Benchmark::MultiRead, 1);
+      } else if (name == Slice("scan")) {
+        RunReads("scan", &Benchmark::Scan, 1);
+      } else if (!name.empty()) {
+        fprintf(stderr, "unknown benchmark '%s'\n", name.ToString().c_str());
+      }
+    }
+  }
+
+ private:
+  void PrintHeader() {
+    fprintf(stderr, "Dir:        %s (env=%s)\n", FLAGS_dir, FLAGS_env);
+    fprintf(stderr, "Keys:       %d bytes each (%s)\n", FLAGS_key_size,
+            FLAGS_key_dist);
+    fprintf(stderr, "Values:     %d bytes each (%s)\n", FLAGS_value_size,
+            FLAGS_value_dist);
+    fprintf(stderr, "Entries:    %d x %d epochs\n", FLAGS_num, FLAGS_epochs);
+    fprintf(stderr, "Threads:    %d\n", FLAGS_threads);
+    fprintf(stderr, "Parts:      %d\n", 1 << FLAGS_lg_parts);
+#ifndef NDEBUG
+    fprintf(stderr,
+            "WARNING: Assertions are enabled; benchmarks unnecessarily slow\n");
+#endif
+    fprintf(stderr, "------------------------------------------------\n");
+  }
+
+  Slice NextValue(Random* rnd) {
+    size_t n = static_cast<size_t>(FLAGS_value_size);
+    if (strcmp(FLAGS_value_dist, "variable") == 0 && n > 1) {
+      n = n / 2 + rnd->Uniform(static_cast<int>(n));
+    }
+    const size_t pos = rnd->Uniform(static_cast<int>(values_.size() - n));
+    return Slice(values_.data() + pos, n);
+  }
+
+  static void ThreadBody(void* arg) {
+    ThreadState* thread = reinterpret_cast<ThreadState*>(arg);
+    (thread->bench->*(thread->method))(thread);
+    SharedState* shared = thread->shared;
+    MutexLock ml(&shared->mu);
+    shared->num_done++;
+    shared->cv.SignalAll();
+  }
+
+  // Run a given method on n threads and merge their stats into *stats.
+  void RunThreads(int n, void (Benchmark::*method)(ThreadState*),
+                  Stats* stats) {
+    SharedState shared;
+    std::vector<ThreadState*> threads;
+    for (int i = 0; i < n; i++) {
+      ThreadState* t = new ThreadState(i, 1000 + i + 37 * epoch_);
+      t->shared = &shared;
+      t->bench = this;
+      t->method = method;
+      threads.push_back(t);
+      Env::Default()->StartThread(ThreadBody, t);
+    }
+    shared.mu.Lock();
+    while (shared.num_done < n) {
+      shared.cv.Wait();
+    }
+    shared.mu.Unlock();
+    for (int i = 0; i < n; i++) {
+      stats->Merge(threads[i]->stats);
+      delete threads[i];
+    }
+  }
+
+  void DoWrite() {
+    delete reader_;
+    reader_ = NULL;
+    DestroyDir(FLAGS_dir, options_);
+    DirWriter* writer;
+    Status s = DirWriter::Open(options_, FLAGS_dir, &writer);
+    if (!s.ok()) {
+      fprintf(stderr, "open error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    writer_ = writer;
+    Stats stats;
+    stats.Start();
+    for (epoch_ = 0; epoch_ < FLAGS_epochs; epoch_++) {
+      RunThreads(FLAGS_threads, &Benchmark::Write, &stats);
+      s = writer_->EpochFlush(epoch_);
+      if (!s.ok()) break;
+    }
+    if (s.ok()) {
+      s = writer_->Finish();
+    }
+    stats.Stop();
+    if (!s.ok()) {
+      fprintf(stderr, "write error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    stats.Report("write");
+    delete writer_;
+    writer_ = NULL;
+  }
+
+  void Write(ThreadState* thread) {
+    const int n = FLAGS_num / FLAGS_threads;
+    char key[64];
+    Env* const env = Env::Default();
+    for (int i = 0; i < n; i++) {
+      const uint64_t seq = uint64_t(thread->tid) * n + i;
+      keygen_->MakeKey(keygen_->NextId(&thread->rnd, seq), key);
+      const Slice val = NextValue(&thread->rnd);
+      const uint64_t start = env->NowMicros();
+      Status s = writer_->Append(Slice(key, FLAGS_key_size), val, epoch_);
+      if (!s.ok()) {
+        fprintf(stderr, "append error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+      thread->stats.FinishedOp(env->NowMicros() - start,
+                               FLAGS_key_size + val.size());
+    }
+  }
+
+  void OpenReader() {
+    if (reader_ == NULL) {
+      DirReader* reader;
+      Status s = DirReader::Open(options_, FLAGS_dir, &reader);
+      if (!s.ok()) {
+        fprintf(stderr, "open error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+      reader_ = reader;
+    }
+  }
+
+  void RunReads(const char* name, void (Benchmark::*method)(ThreadState*),
+                int n) {
+    OpenReader();
+    Stats stats;
+    stats.Start();
+    RunThreads(n, method, &stats);
+    stats.Stop();
+    stats.Report(name);
+  }
+
+  uint64_t ReadOne(uint64_t id, std::string* dst, char* tmp) {
+    char key[64];
+    keygen_->MakeKey(id, key);
+    dst->clear();
+    Status s = reader_->ReadAll(Slice(key, FLAGS_key_size), dst, tmp,
+                                options_.block_size);
+    if (!s.ok()) {
+      fprintf(stderr, "read error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    return dst->empty() ? 0 : 1;
+  }
+
+  void PointRead(ThreadState* thread) {
+    const int n = num_reads_ / FLAGS_threads;
+    std::string tmp(options_.block_size, 0);
+    std::string dst;
+    Env* const env = Env::Default();
+    for (int i = 0; i < n; i++) {
+      const uint64_t id = keygen_->NextId(&thread->rnd, i);
+      const uint64_t start = env->NowMicros();
+      thread->stats.AddFound(ReadOne(id, &dst, &tmp[0]));
+      thread->stats.FinishedOp(env->NowMicros() - start,
+                               FLAGS_key_size + dst.size());
+    }
+  }
+
+  struct MultiReadState {
+    explicit MultiReadState(Benchmark* b)
+        : cv(&mu), bench(b), next(0), num_done(0), found(0), bytes(0) {}
+    port::Mutex mu;
+    port::CondVar cv;
+    Benchmark* bench;
+    std::vector<uint64_t> ids;
+    int next;      // Next key to claim
+    int num_done;  // Number of workers that have run out of keys
+    uint64_t found;
+    uint64_t bytes;
+  };
+
+  static void MultiReadWork(void* arg) {
+    MultiReadState* state = reinterpret_cast<MultiReadState*>(arg);
+    std::string tmp(state->bench->options_.block_size, 0);
+    std::string dst;
+    MutexLock ml(&state->mu);
+    while (state->next < static_cast<int>(state->ids.size())) {
+      const uint64_t id = state->ids[state->next++];
+      state->mu.Unlock();
+      const uint64_t found = state->bench->ReadOne(id, &dst, &tmp[0]);
+      state->mu.Lock();
+      state->found += found;
+      state->bytes += FLAGS_key_size + dst.size();
+    }
+    state->num_done++;
+    state->cv.SignalAll();
+  }
+
+  void MultiRead(ThreadState* thread) {
+    const int n = num_reads_ / FLAGS_batch;
+    ThreadPool* const pool = ThreadPool::NewFixed(FLAGS_threads, true);
+    Env* const env = Env::Default();
+    for (int i = 0; i < n; i++) {
+      MultiReadState state(this);
+      for (int j = 0; j < FLAGS_batch; j++) {
+        state.ids.push_back(
+            keygen_->NextId(&thread->rnd, uint64_t(i) * FLAGS_batch + j));
+      }
+      const uint64_t start = env->NowMicros();
+      for (int j = 0; j < FLAGS_threads; j++) {
+        pool->Schedule(MultiReadWork, &state);
+      }
+      state.mu.Lock();
+      while (state.num_done < FLAGS_threads) {
+        state.cv.Wait();
+      }
+      state.mu.Unlock();
+      thread->stats.AddFound(state.found);
+      thread->stats.FinishedOp(env->NowMicros() - start, state.bytes);
+    }
+    delete pool;
+  }
+
+  void Scan(ThreadState* thread) {
+    std::string tmp(options_.block_size, 0);
+    std::string dst;
+    Env* const env = Env::Default();
+    for (int id = 0; id < FLAGS_num; id++) {
+      const uint64_t start = env->NowMicros();
+      thread->stats.AddFound(ReadOne(id, &dst, &tmp[0]));
+      thread->stats.FinishedOp(env->NowMicros() - start,
+                               FLAGS_key_size + dst.size());
+    }
+  }
+
+  DirOptions options_;
+  KeyDist key_dist_;
+  ZipfianGenerator* zipf_;
+  KeyGenerator* keygen_;
+  Env* env_;
+  ThreadPool* pool_;
+  DirWriter* writer_;
+  DirReader* reader_;
+  int epoch_;
+  int num_reads_;
+  std::string values_;
+};
+
+}  // namespace
+}  // namespace plfsio
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  std::string default_dir;
+  for (int i = 1; i < argc; i++) {
+    double d;
+    int n;
+    char junk;
+    if (pdlfs::Slice(argv[i]).starts_with("--benchmarks=")) {
+      FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--epochs=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_epochs = n;
+    } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
+      FLAGS_reads = n;
+    } else if (sscanf(argv[i], "--batch=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_batch = n;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_threads = n;
+    } else if (sscanf(argv[i], "--compaction_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_compaction_threads = n;
+    } else if (strcmp(argv[i], "--key_dist=uniform") == 0 ||
+               strcmp(argv[i], "--key_dist=zipfian") == 0 ||
+               strcmp(argv[i], "--key_dist=sequential") == 0) {
+      FLAGS_key_dist = argv[i] + 11;
+    } else if (sscanf(argv[i], "--zipf_theta=%lf%c", &d, &junk) == 1) {
+      FLAGS_zipf_theta = d;
+    } else if (sscanf(argv[i], "--key_size=%d%c", &n, &junk) == 1 && n > 0 &&
+               n <= 64) {
+      FLAGS_key_size = n;
+    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1 && n > 0 &&
+               n <= (1 << 19)) {  // Must fit in the shared value buffer
+      FLAGS_value_size = n;
+    } else if (strcmp(argv[i], "--value_dist=fixed") == 0 ||
+               strcmp(argv[i], "--value_dist=variable") == 0) {
+      FLAGS_value_dist = argv[i] + 13;
+    } else if (sscanf(argv[i], "--lg_parts=%d%c", &n, &junk) == 1 && n >= 0 &&
+               n <= 8) {
+      FLAGS_lg_parts = n;
+    } else if (sscanf(argv[i], "--memtable_mb=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_memtable_mb = n;
+    } else if (sscanf(argv[i], "--bf_bits=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_bf_bits = n;
+    } else if (strncmp(argv[i], "--mode=", 7) == 0) {
+      FLAGS_mode = argv[i] + 7;
+    } else if (sscanf(argv[i], "--memtable_dedup=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_memtable_dedup = n;
+    } else if (strcmp(argv[i], "--env=posix") == 0 ||
+               strcmp(argv[i], "--env=mem") == 0) {
+      FLAGS_env = argv[i] + 6;
+    } else if (strcmp(argv[i], "--format=text") == 0 ||
+               strcmp(argv[i], "--format=json") == 0) {
+      FLAGS_format = argv[i] + 9;
+    } else if (strncmp(argv[i], "--dir=", 6) == 0) {
+      FLAGS_dir = argv[i] + 6;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  if (strcmp(FLAGS_mode, "multimap") != 0 &&
+      strcmp(FLAGS_mode, "override") != 0 &&
+      strcmp(FLAGS_mode, "drop") != 0 && strcmp(FLAGS_mode, "unique") != 0) {
+    fprintf(stderr, "Invalid mode '%s'\n", FLAGS_mode);
+    exit(1);
+  } else if (strcmp(FLAGS_mode, "unique") == 0 &&
+             strcmp(FLAGS_key_dist, "sequential") != 0) {
+    fprintf(stderr, "--mode=unique requires --key_dist=sequential\n");
+    exit(1);
+  }
+
+  // Choose a location for the test dir if none given with --dir=<path>
+  if (FLAGS_dir == NULL) {
+    pdlfs::Env::Default()->GetTestDirectory(&default_dir);
+    default_dir += "/plfsdir_bench";
+    FLAGS_dir = default_dir.c_str();
+  }
+
+  pdlfs::plfsio::Benchmark benchmark;
+  benchmark.Run();
+  return 0;
+}
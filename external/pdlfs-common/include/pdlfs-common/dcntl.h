@@ -15,6 +15,9 @@
 #include "pdlfs-common/mdb.h"
 #include "pdlfs-common/port.h"
 
+#include <map>
+#include <string>
+
 namespace pdlfs {
 
 class DirTable;
@@ -38,8 +41,15 @@ struct Dir {
 
 #if defined(DELTAFS)
   uint64_t seq;  // Incremented whenever a sub-directory's lookup state changes
+  uint64_t node_seq;  // Incremented whenever cached entries may become stale
   port::AtomicPointer tx;  // Either NULL or an on-going write transaction
   class Tx;
+  class Group;
+  Group* group;       // Either NULL or a group open for new mutations
+  Group* committing;  // Either NULL or a group being committed
+  // Number of entries in each local GIGA+ partition. Partitions are only
+  // counted once needed for split decisions and absent otherwise.
+  std::map<int, int> partition_sizes;
 #endif
   port::CondVar cv;
   DirIndex index;  // GIGA+ index
@@ -114,6 +124,50 @@ class Dir::Tx {
     delete this;
   }
 };
+
+// A set of mutations against a single directory that are merged into one
+// write batch and committed together. The directory size and mtime changes
+// made by all mutations in a group are written as a single info record.
+class Dir::Group {
+  MDB::Tx* const rep_;
+  int refs_;
+  void operator=(const Group&);
+  Group(const Group&);
+  ~Group() {}
+
+ public:
+  explicit Group(MDB* mdb)
+      : rep_(mdb->CreateTx(false)),
+        refs_(0),
+        size_delta(0),
+        mtime(0),
+        done(false) {}
+  MDB::Tx* rep() const { return rep_; }
+
+  // The latest state of each name mutated by the group
+  struct Node {
+    bool exists;
+    Stat stat;
+  };
+  std::map<std::string, Node> nodes;  // Keyed by name hash
+  int size_delta;                     // Net change to the directory size
+  uint64_t mtime;                     // Latest modification time
+  bool done;                          // True after the group is committed
+  Status status;                      // Commit result
+
+  void Ref() { ++refs_; }
+  bool Unref() {
+    --refs_;
+    assert(refs_ >= 0);
+    return refs_ == 0;
+  }
+
+  void Dispose(MDB* mdb) {
+    assert(refs_ == 0);
+    mdb->Release(rep_);
+    delete this;
+  }
+};
 #endif
 
 // An LRU-cache of directory states.
@@ -348,6 +348,11 @@ class ThreadPool {
   // serialized.
   virtual void Schedule(void (*function)(void*), void* arg) = 0;
 
+  // Same as Schedule(), but "(*function)(arg)" should run ahead of work
+  // scheduled through Schedule(). The default implementation simply
+  // calls Schedule().
+  virtual void SchedulePriority(void (*function)(void*), void* arg);
+
   // Return a description of the pool implementation.
   virtual std::string ToDebugString() = 0;
 
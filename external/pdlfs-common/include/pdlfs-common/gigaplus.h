@@ -10,6 +10,7 @@
  */
 
 #include <stdint.h>
+#include <string>
 #include <utility>
 
 #include "pdlfs-common/slice.h"
@@ -113,6 +114,12 @@ class DirIndex {
   // Return true if the given hash will belong to the given child partition.
   static bool ToBeMigrated(int index, const char* hash);
 
+  // Append the smallest hash of the given partition to *start and the
+  // smallest hash beyond the partition to *limit. Nothing is appended to
+  // *limit if the partition extends to the largest hash. The range also
+  // covers all future children of the partition.
+  static void PutHashRange(int index, std::string* start, std::string* limit);
+
   // Put the corresponding hash value into *dst.
   static void PutHash(std::string* dst, const Slice& name);
 
@@ -21,10 +21,10 @@ class IndexCache {
   typedef LRUEntry<DirIndex> IndexEntry;
 
  public:
-  // If mu is NULL, the resulting IndexCache requires external synchronization.
-  // If mu is not NULL, the resulting IndexCache is implicitly synchronized
-  // via it and is thread-safe.
-  explicit IndexCache(size_t capacity = 4096, port::Mutex* mu = NULL);
+  // The resulting IndexCache is thread-safe. Entries are spread over a fixed
+  // number of shards, each guarded by its own mutex, so concurrent
+  // accesses to different entries rarely contend.
+  explicit IndexCache(size_t capacity = 4096);
   ~IndexCache();
 
   struct Handle {};
@@ -37,8 +37,10 @@ class IndexCache {
 
  private:
   static Slice LRUKey(const DirId&, char* scratch);
-  LRUCache<IndexEntry> lru_;
-  port::Mutex* mu_;
+  enum { kNumShardBits = 4, kNumShards = 1 << kNumShardBits };
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  LRUCache<IndexEntry> lru_[kNumShards];
+  port::Mutex mu_[kNumShards];
 
   // No copying allowed
   void operator=(const IndexCache&);
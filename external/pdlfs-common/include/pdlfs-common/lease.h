@@ -68,6 +68,10 @@ struct Lease {
   const Dir* parent;
   uint64_t due;
   LeaseState state;
+  // Position of the lease in the timer wheel of its table
+  LeaseEntry* entry;
+  Lease* wheel_next;
+  Lease** wheel_pprev;  // NULL if not in any slot
 };
 
 struct LeaseEntry {
@@ -95,7 +99,9 @@ struct LeaseEntry {
   }
 };
 
-// An LRU-cache of directory lookup state leases.
+// An LRU-cache of directory lookup state leases. Leases are also
+// hashed into a timer wheel by due so expired leases can be reclaimed
+// even when they sit behind active leases in the LRU order.
 class LeaseTable {
  public:
   // If mu is NULL, this LeaseTable requires external synchronization.
@@ -109,11 +115,34 @@ class LeaseTable {
   Lease::Ref* Insert(const DirId& pid, const Slice& nhash, Lease* lease);
   void Erase(const DirId& pid, const Slice& nhash);
 
+  // Remove all leases that are neither locked nor referenced and
+  // whose due has passed. Invoked automatically by Insert().
+  // Return the number of leases removed.
+  size_t Expire(uint64_t now);
+
+  struct Stats {
+    Stats() : expired(0), full(0) {}
+    uint64_t expired;  // Leases removed by the timer wheel
+    uint64_t full;     // Inserts rejected due to too many active leases
+  };
+  // Add the counters of this table to *stats.
+  void AddStats(Stats* stats);
+
  private:
   static Slice LRUKey(const DirId&, const Slice&, char* scratch);
+  // Timer wheel. Each slot covers tick_ micros and the whole wheel
+  // covers twice the max lease duration. A lease is rescheduled when
+  // its slot is visited but its due has since been extended.
+  enum { kWheelSlots = 64 };
+  void Schedule(Lease* lease, uint64_t due);
+  size_t ExpireLocked(uint64_t now);
+  uint64_t tick_;
+  uint64_t wheel_time_;  // Index of the first tick not yet expired
+  Lease* wheel_[kWheelSlots];  // Heads of per-slot lease lists
   LeaseOptions options_;
   LRUCache<Lease::Ref> lru_;
   port::Mutex* mu_;
+  Stats stats_;
 
   // No copying allowed
   void operator=(const LeaseTable&);
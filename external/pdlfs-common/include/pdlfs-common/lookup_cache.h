@@ -21,10 +21,10 @@ class LookupCache {
   typedef LRUEntry<LookupStat> LookupEntry;
 
  public:
-  // If mu is NULL, the resulting LookupCache requires external synchronization.
-  // If mu is not NULL, the resulting LookupCache is implicitly synchronized
-  // via it and is thread-safe.
-  explicit LookupCache(size_t capacity = 4096, port::Mutex* mu = NULL);
+  // The resulting LookupCache is thread-safe. Entries are spread over a fixed
+  // number of shards, each guarded by its own mutex, so concurrent
+  // accesses to different entries rarely contend.
+  explicit LookupCache(size_t capacity = 4096);
   ~LookupCache();
 
   struct Handle {};
@@ -37,8 +37,10 @@ class LookupCache {
 
  private:
   static Slice LRUKey(const DirId&, const Slice&, char* scratch);
-  LRUCache<LookupEntry> lru_;
-  port::Mutex* mu_;
+  enum { kNumShardBits = 4, kNumShards = 1 << kNumShardBits };
+  static uint32_t Shard(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+  LRUCache<LookupEntry> lru_[kNumShards];
+  port::Mutex mu_[kNumShards];
 
   // No copying allowed
   void operator=(const LookupCache&);
@@ -126,9 +126,34 @@ class MDB {
   typedef std::vector<std::string> NameList;
   typedef std::vector<Stat> StatList;
   size_t List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
-              size_t limit);
+              size_t limit) {
+    return List(id, Slice(), stats, names, NULL, tx, limit);
+  }
+  // List at most "limit" entries of a directory starting from the entry
+  // with the given name hash. An empty start means the first entry.
+  // If more entries remain, the hash of the next entry is stored in *next
+  // so listing may resume from there. Otherwise *next is cleared.
+  // Return the number of entries listed.
+  size_t List(const DirId& id, const Slice& start, StatList* stats,
+              NameList* names, std::string* next, Tx* tx, size_t limit);
   bool Exists(const DirId& id, const Slice& hash, Tx* tx);
 
+  // Store the name hashes of all entries of a directory whose hashes fall
+  // within [start, limit) into *hashes. An empty limit means no upper bound.
+  // Return the number of hashes stored.
+  size_t ListHashes(const DirId& id, const Slice& start, const Slice& limit,
+                    std::vector<std::string>* hashes, Tx* tx);
+  // Extract all entries of a directory whose hashes fall within
+  // [start, limit) into raw table files stored under dst_dir.
+  // Entries are not removed from the DB.
+  Status DumpEntries(const DirId& id, const Slice& start, const Slice& limit,
+                     const std::string& dst_dir, Tx* tx);
+  // Bulk insert the table files produced by DumpEntries() from another DB.
+  // Files are moved from src_dir into the DB.
+  Status AddEntries(const std::string& src_dir) {
+    return db_->AddL0Tables(InsertOptions(), src_dir);
+  }
+
   Status Commit(Tx* tx) {
     if (tx != NULL) {
       WriteOptions options;
@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/fstypes.h"
+#include "pdlfs-common/lru.h"
+#include "pdlfs-common/mdb.h"
+#include "pdlfs-common/port.h"
+
+namespace pdlfs {
+
+// An LRU-cache of directory entries read from the metadata DB. Names known
+// to be absent are cached as negative entries. Capacity is in bytes.
+class NodeCache {
+  typedef LRUEntry<Stat> NodeEntry;
+
+ public:
+  // If mu is NULL, the resulting NodeCache requires external synchronization.
+  // If mu is not NULL, the resulting NodeCache is implicitly synchronized
+  // via it and is thread-safe.
+  explicit NodeCache(size_t capacity = 4 << 20, port::Mutex* mu = NULL);
+  ~NodeCache();
+
+  struct Handle {};
+  void Release(Handle* handle);
+  // Return NULL if the handle refers to a negative entry.
+  const Stat* Value(Handle* handle);
+
+  Handle* Lookup(const DirId& pid, const Slice& nhash);
+  // Insert a negative entry if stat is NULL.
+  Handle* Insert(const DirId& pid, const Slice& nhash, const Stat* stat);
+  void Erase(const DirId& pid, const Slice& nhash);
+
+  struct Stats {
+    Stats() : hits(0), negative_hits(0), misses(0) {}
+    uint64_t hits;  // Including negative hits
+    uint64_t negative_hits;
+    uint64_t misses;
+  };
+  // Add the lookup counters of this cache to *stats.
+  void AddStats(Stats* stats);
+
+ private:
+  static Slice LRUKey(const DirId&, const Slice&, char* scratch);
+  LRUCache<NodeEntry> lru_;
+  port::Mutex* mu_;
+  Stats stats_;
+
+  // No copying allowed
+  void operator=(const NodeCache&);
+  NodeCache(const NodeCache&);
+};
+
+}  // namespace pdlfs
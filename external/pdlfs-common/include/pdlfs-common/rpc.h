@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
 #include "pdlfs-common/status.h"
 
 namespace pdlfs {
@@ -34,7 +35,8 @@ namespace rpc {
 class If;
 }
 
-enum RPCImpl { kMargoRPC, kMercuryRPC, kThriftRPC };
+// Uris starting with "inproc" always select kInprocRPC.
+enum RPCImpl { kMargoRPC, kMercuryRPC, kThriftRPC, kInprocRPC };
 
 enum RPCMode { kServerClient, kClientOnly };
 
@@ -90,9 +92,16 @@ class RPC {
   RPC(const RPC&);
 };
 
+namespace rpc {
+class WorkStealingPool;
+}
+
 // Helper class that binds multiple RPC listening ports to a single
 // logical server, with each listening port associated with
-// dedicated pools of I/O threads and worker threads.
+// dedicated pools of I/O threads and worker threads. If shared_workers
+// is not 0, all listening ports instead feed a single work-stealing
+// pool of that many workers, so a busy port may use the workers of
+// idle ones.
 class RPCServer {
   struct RPCInfo {
     ThreadPool* pool;
@@ -104,16 +113,23 @@ class RPCServer {
   Status Start();
   Status Stop();
 
+  // Workers are ignored if workers are shared.
   void AddChannel(const std::string& uri, int workers);
-  RPCServer(rpc::If* fs, Env* env = NULL) : fs_(fs), env_(env) {}
+  RPCServer(rpc::If* fs, Env* env = NULL, int shared_workers = 0);
   ~RPCServer();
 
+  // Append the queue depth and the throughput of each listening port
+  // since the last report to *report. Nothing is appended unless workers
+  // are shared.
+  void AppendReport(std::string* report);
+
  private:
   // No copying allowed
   void operator=(const RPCServer&);
   RPCServer(const RPCServer&);
 
   std::vector<RPCInfo> rpcs_;
+  rpc::WorkStealingPool* shared_pool_;  // NULL if workers are not shared
   rpc::If* fs_;
   Env* env_;
 };
@@ -136,6 +152,25 @@ class If {
 
   // Return OK on success, or a non-OK status on errors.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT = 0;
+
+  // Callback of an asynchronous call. Invoked exactly once with the
+  // status the same call would have returned had it been synchronous.
+  typedef void (*Callback)(void* arg, const Status&);
+
+  // Send a message without waiting for the reply. Both messages must stay
+  // valid until the callback is invoked. The callback may be invoked by
+  // the calling thread before the call returns, or by an RPC thread, in
+  // which case it must not block. The default implementation makes a
+  // synchronous call and then invokes the callback.
+  virtual void AsyncCall(Message& in, Message& out, Callback cb,
+                         void* arg) RPCNOEXCEPT;
+
+  // Return true if an incoming call should be executed ahead of other
+  // calls waiting for a worker. Consulted by servers before they hand a
+  // decoded call to a worker pool. The default implementation returns
+  // false.
+  virtual bool IsUrgent(const Message& in) RPCNOEXCEPT;
+
   virtual ~If();
   If() {}
 
@@ -145,5 +180,34 @@ class If {
   If(const If&);
 };
 
+// A pool of reusable buffers for message bodies too large for
+// Message::buf. Pooled buffers keep their capacity, so large messages
+// stop allocating memory once the pool is warm. Buffers that have grown
+// beyond max_buffer_size are freed instead of pooled.
+// Implementation is thread-safe.
+class BufferPool {
+ public:
+  explicit BufferPool(size_t max_buffers = 8,
+                      size_t max_buffer_size = 4 << 20);
+  ~BufferPool();
+
+  // Swap a pooled buffer, if any, into *dst. *dst is cleared.
+  void Get(std::string* dst);
+  // Return the buffer held by *src to the pool. *src is left empty.
+  void Put(std::string* src);
+
+ private:
+  // No copying allowed
+  void operator=(const BufferPool&);
+  BufferPool(const BufferPool&);
+
+  // Constant after construction
+  const size_t max_buffers_;
+  const size_t max_buffer_size_;
+
+  port::Mutex mu_;
+  std::vector<std::string> buffers_;
+};
+
 }  // namespace rpc
 }  // namespace pdlfs
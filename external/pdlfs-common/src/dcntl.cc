@@ -40,6 +40,8 @@ bool Dir::busy() const {
 #if defined(DELTAFS)
   if (tx.NoBarrier_Load() != NULL) {
     return true;
+  } else if (group != NULL || committing != NULL) {
+    return true;
   }
 #endif
   if (locked) {
@@ -49,6 +49,10 @@ FileLock::~FileLock() {}
 
 ThreadPool::~ThreadPool() {}
 
+void ThreadPool::SchedulePriority(void (*function)(void*), void* arg) {
+  Schedule(function, arg);
+}
+
 EnvWrapper::~EnvWrapper() {}
 
 Env* Env::Open(const char* name, const char* conf, bool* is_system) {
@@ -570,6 +570,36 @@ bool DirIndex::ToBeMigrated(int index, const char* hash) {
   return ComputeIndexFromHash(hash, ToRadix(index)) == index;
 }
 
+// All hashes of a partition share the same first "radix" bits, which
+// are the bits of the partition index in reverse order. Sorted hashes of a
+// partition therefore form a contiguous range.
+void DirIndex::PutHashRange(int index, std::string* start,
+                            std::string* limit) {
+  const int r = ToRadix(index);
+  char tmp[8];
+  memset(tmp, 0, sizeof(tmp));
+  for (int i = 0; i < r; i++) {
+    if ((index & (1 << i)) != 0) {
+      tmp[i / 8] |= kBits[7 - i % 8];
+    }
+  }
+  start->append(tmp, 8);
+  // The limit is the start with its first "radix" bits incremented by one
+  int i = r - 1;
+  for (; i >= 0; i--) {
+    const unsigned char bit = kBits[7 - i % 8];
+    if ((tmp[i / 8] & bit) != 0) {
+      tmp[i / 8] &= ~bit;
+    } else {
+      tmp[i / 8] |= bit;
+      break;
+    }
+  }
+  if (i >= 0) {
+    limit->append(tmp, 8);
+  }
+}
+
 // Insert the corresponding hash value into *dst.
 void DirIndex::PutHash(std::string* dst, const Slice& name) {
   char tmp[8];
@@ -463,6 +463,30 @@ TEST(DirIndexTest, Migration4) {
   ASSERT_TRUE(moved > 0 && moved < 10000);
 }
 
+TEST(DirIndexTest, HashRange) {
+  const int indexes[] = {0, 1, 2, 3, 4, 6, 255, 256, 511, 4097};
+  for (size_t k = 0; k < sizeof(indexes) / sizeof(indexes[0]); k++) {
+    std::string start;
+    std::string limit;
+    DirIndex::PutHashRange(indexes[k], &start, &limit);
+    ASSERT_EQ(start.size(), 8);
+    ASSERT_TRUE(limit.empty() || limit.size() == 8);
+    ASSERT_TRUE(Migrate(indexes[k], start.data()));
+    for (int i = 0; i < 10000; i++) {
+      char hash[40];
+      Slice h = DirIndex::Hash(File(i), hash);
+      bool in_range =
+          h.compare(start) >= 0 && (limit.empty() || h.compare(limit) < 0);
+      ASSERT_EQ(in_range, Migrate(indexes[k], hash));
+    }
+  }
+  std::string start;
+  std::string limit;
+  DirIndex::PutHashRange(0, &start, &limit);
+  ASSERT_EQ(start, std::string(8, 0));
+  ASSERT_TRUE(limit.empty());
+}
+
 static void PrintStates(const std::vector<int>& states) {
   static int run = 0;
   fprintf(stderr, "case %02d: ", ++run);
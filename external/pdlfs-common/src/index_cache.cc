@@ -12,6 +12,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/index_cache.h"
+#include "pdlfs-common/mutexlock.h"
 
 namespace pdlfs {
 
@@ -19,22 +20,25 @@ static void (*Deleter)(const Slice&, DirIndex*) = LRUValueDeleter<DirIndex>;
 
 IndexCache::~IndexCache() {
 #ifndef NDEBUG
-  lru_.Prune();
-  assert(lru_.Empty());
+  for (int s = 0; s < kNumShards; s++) {
+    lru_[s].Prune();
+    assert(lru_[s].Empty());
+  }
 #endif
 }
 
-IndexCache::IndexCache(size_t capacity, port::Mutex* mu)
-    : lru_(capacity), mu_(mu) {}
+IndexCache::IndexCache(size_t capacity) {
+  const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+  for (int s = 0; s < kNumShards; s++) {
+    lru_[s].SetCapacity(per_shard);
+  }
+}
 
 void IndexCache::Release(Handle* handle) {
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Release(reinterpret_cast<IndexEntry*>(handle));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  IndexEntry* const e = reinterpret_cast<IndexEntry*>(handle);
+  const uint32_t s = Shard(e->hash);
+  MutexLock l(&mu_[s]);
+  lru_[s].Release(e);
 }
 
 const DirIndex* IndexCache::Value(Handle* handle) {
@@ -58,45 +62,31 @@ IndexCache::Handle* IndexCache::Lookup(const DirId& id) {
   char tmp[30];
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h = reinterpret_cast<Handle*>(lru_.Lookup(key, hash));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
-  return h;
+  MutexLock l(&mu_[s]);
+  return reinterpret_cast<Handle*>(lru_[s].Lookup(key, hash));
 }
 
 IndexCache::Handle* IndexCache::Insert(const DirId& id, DirIndex* index) {
   char tmp[30];
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h =
-      reinterpret_cast<Handle*>(lru_.Insert(key, hash, index, 1, Deleter));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
-  return h;
+  MutexLock l(&mu_[s]);
+  return reinterpret_cast<Handle*>(
+      lru_[s].Insert(key, hash, index, 1, Deleter));
 }
 
 void IndexCache::Erase(const DirId& id) {
   char tmp[30];
   Slice key = LRUKey(id, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Erase(key, hash);
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  MutexLock l(&mu_[s]);
+  lru_[s].Erase(key, hash);
 }
 
 }  // namespace pdlfs
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "inproc_rpc.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <map>
+
+namespace pdlfs {
+namespace rpc {
+
+namespace {
+const char kPrefix[] = "inproc://";
+
+// All channels of the process, keyed by name
+port::OnceType registry_once = PDLFS_ONCE_INIT;
+port::Mutex* registry_mu = NULL;
+std::map<std::string, InprocRPC::Channel*>* registry = NULL;
+
+void InitRegistry() {
+  registry_mu = new port::Mutex;
+  registry = new std::map<std::string, InprocRPC::Channel*>;
+}
+
+std::string NameOf(const std::string& uri) {
+  Slice name = uri;
+  if (name.starts_with(kPrefix)) {
+    name.remove_prefix(sizeof(kPrefix) - 1);
+  }
+  return name.ToString();
+}
+}  // namespace
+
+InprocRPC::Channel* InprocRPC::Channel::Open(const std::string& name) {
+  port::InitOnce(&registry_once, InitRegistry);
+  MutexLock ml(registry_mu);
+  Channel* channel;
+  std::map<std::string, Channel*>::iterator it = registry->find(name);
+  if (it != registry->end()) {
+    channel = it->second;
+  } else {
+    channel = new Channel(name);
+    registry->insert(std::make_pair(name, channel));
+  }
+  channel->refs_++;
+  return channel;
+}
+
+void InprocRPC::Channel::Unref() {
+  MutexLock ml(registry_mu);
+  assert(refs_ > 0);
+  if (--refs_ == 0) {
+    registry->erase(name_);
+    delete this;
+  }
+}
+
+InprocRPC::Channel::Channel(const std::string& name)
+    : name_(name),
+      refs_(0),
+      work_cv_(&mu_),
+      exit_cv_(&mu_),
+      num_loopers_(0),
+      fs_(NULL),
+      pool_(NULL) {
+  for (int i = 0; i < kRingSize; i++) {
+    ring_[i].seq.store(i, std::memory_order_relaxed);
+    ring_[i].call = NULL;
+  }
+  head_.store(0, std::memory_order_relaxed);
+  tail_.store(0, std::memory_order_relaxed);
+  num_senders_.store(0, std::memory_order_relaxed);
+  num_idle_.store(0, std::memory_order_relaxed);
+  num_execs_.store(0, std::memory_order_relaxed);
+  serving_.store(false, std::memory_order_relaxed);
+  shutting_down_.store(false, std::memory_order_relaxed);
+}
+
+InprocRPC::Channel::~Channel() { assert(fs_ == NULL); }
+
+// Claim the slot at head by advancing head, then publish the call by
+// advancing the sequence number of the slot. Return false if the ring
+// is full.
+bool InprocRPC::Channel::TryPush(Call* call) {
+  uint64_t pos = head_.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &ring_[pos & (kRingSize - 1)];
+    const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    const int64_t diff = int64_t(seq) - int64_t(pos);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->call = call;
+  slot->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+// Claim the slot at tail, then hand it back to pushers for the next lap
+// of the ring. Return NULL if the ring is empty.
+InprocRPC::Channel::Call* InprocRPC::Channel::TryPop() {
+  uint64_t pos = tail_.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &ring_[pos & (kRingSize - 1)];
+    const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    const int64_t diff = int64_t(seq) - int64_t(pos + 1);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  Call* const call = slot->call;
+  slot->seq.store(pos + kRingSize, std::memory_order_release);
+  return call;
+}
+
+bool InprocRPC::Channel::Send(Call* call) {
+  call->channel = this;
+  num_senders_.fetch_add(1);
+  const bool ok = serving_.load();
+  if (ok) {
+    while (!TryPush(call)) {
+      sched_yield();  // Wait for loopers to catch up
+    }
+    // Pairs with the fence in Loop() so that either a looper about to
+    // sleep finds the call, or we find the looper and wake it up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_idle_.load() != 0) {
+      MutexLock ml(&mu_);
+      work_cv_.Signal();
+    }
+  }
+  num_senders_.fetch_sub(1);
+  return ok;
+}
+
+void InprocRPC::Channel::Finish(Call* call, const Status& status) {
+  if (call->cb != NULL) {
+    If::Callback cb = call->cb;
+    void* arg = call->arg;
+    delete call;
+    cb(arg, status);
+  } else {
+    MutexLock ml(call->mu);
+    call->status = status;
+    call->done = true;
+    call->cv->Signal();
+  }
+}
+
+void InprocRPC::Channel::Exec(Call* call) {
+  Status s = fs_->Call(*call->in, *call->out);
+  Finish(call, s);
+}
+
+void InprocRPC::Channel::ExecWrapper(void* arg) {
+  Call* call = reinterpret_cast<Call*>(arg);
+  Channel* const channel = call->channel;
+  channel->Exec(call);
+  // The channel may be deleted as soon as StopServing() sees no more
+  // pending calls, so the count is only dropped with mu_ held
+  MutexLock ml(&channel->mu_);
+  if (channel->num_execs_.fetch_sub(1) == 1 &&
+      channel->shutting_down_.load()) {
+    channel->exit_cv_.SignalAll();
+  }
+}
+
+void InprocRPC::Channel::LoopWrapper(void* arg) {
+  reinterpret_cast<Channel*>(arg)->Loop();
+}
+
+// Pop calls until the channel is shut down and no calls are left. Calls
+// are executed by the looper itself unless there is a pool.
+void InprocRPC::Channel::Loop() {
+  for (;;) {
+    Call* call = TryPop();
+    if (call == NULL) {
+      MutexLock ml(&mu_);
+      num_idle_.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      call = TryPop();
+      while (call == NULL && !shutting_down_.load()) {
+        work_cv_.Wait();
+        call = TryPop();
+      }
+      num_idle_.fetch_sub(1);
+      if (call == NULL) {
+        assert(num_loopers_ > 0);
+        num_loopers_--;
+        exit_cv_.SignalAll();
+        return;
+      }
+    }
+    if (pool_ != NULL) {
+      num_execs_.fetch_add(1);
+      if (fs_->IsUrgent(*call->in)) {
+        pool_->SchedulePriority(ExecWrapper, call);
+      } else {
+        pool_->Schedule(ExecWrapper, call);
+      }
+    } else {
+      Exec(call);
+    }
+  }
+}
+
+bool InprocRPC::Channel::Serve(If* fs, ThreadPool* pool, Env* env,
+                               int num_loopers) {
+  assert(fs != NULL);
+  MutexLock ml(&mu_);
+  if (fs_ != NULL) {
+    return false;
+  }
+  fs_ = fs;
+  pool_ = pool;
+  shutting_down_.store(false);
+  num_loopers_ = num_loopers;
+  for (int i = 0; i < num_loopers; i++) {
+    env->StartThread(LoopWrapper, this);
+  }
+  serving_.store(true);
+  return true;
+}
+
+// Calls already sent are executed before loopers exit. Calls sent after
+// this are rejected.
+void InprocRPC::Channel::StopServing() {
+  serving_.store(false);
+  while (num_senders_.load() != 0) {
+    sched_yield();
+  }
+  MutexLock ml(&mu_);
+  if (fs_ == NULL) {
+    return;
+  }
+  shutting_down_.store(true);
+  work_cv_.SignalAll();
+  while (num_loopers_ != 0 || num_execs_.load() != 0) {
+    exit_cv_.Wait();
+  }
+  fs_ = NULL;
+  pool_ = NULL;
+}
+
+InprocRPC::Client::~Client() { channel_->Unref(); }
+
+Status InprocRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  Channel::Call call;
+  call.in = &in;
+  call.out = &out;
+  call.cb = NULL;
+  call.arg = NULL;
+  call.mu = &mu;
+  call.cv = &cv;
+  call.done = false;
+  if (!channel_->Send(&call)) {
+    return Status::Disconnected(Slice());
+  }
+  MutexLock ml(&mu);
+  while (!call.done) {
+    cv.Wait();
+  }
+  return call.status;
+}
+
+void InprocRPC::Client::AsyncCall(Message& in, Message& out, Callback cb,
+                                  void* arg) RPCNOEXCEPT {
+  Channel::Call* call = new Channel::Call;
+  call->in = &in;
+  call->out = &out;
+  call->cb = cb;
+  call->arg = arg;
+  call->mu = NULL;
+  call->cv = NULL;
+  call->done = false;
+  if (!channel_->Send(call)) {
+    delete call;
+    cb(arg, Status::Disconnected(Slice()));
+  }
+}
+
+bool InprocRPC::Matches(const Slice& uri) {
+  return uri == "inproc" || uri.starts_with(kPrefix);
+}
+
+InprocRPC::InprocRPC(const RPCOptions& options)
+    : mode_(options.mode),
+      num_loopers_(options.num_io_threads),
+      pool_(options.extra_workers),
+      env_(options.env),
+      fs_(options.fs),
+      channel_(NULL),
+      started_(false) {
+  if (mode_ == kServerClient) {
+    channel_ = Channel::Open(NameOf(options.uri));
+  }
+}
+
+InprocRPC::~InprocRPC() {
+  if (started_) {
+    Stop();
+  }
+  if (channel_ != NULL) {
+    channel_->Unref();
+  }
+}
+
+If* InprocRPC::OpenClientFor(const std::string& uri) {
+  return new Client(Channel::Open(NameOf(uri)));
+}
+
+Status InprocRPC::status() const { return Status::OK(); }
+
+Status InprocRPC::Start() {
+  if (channel_ != NULL && !started_) {
+    if (!channel_->Serve(fs_, pool_, env_, num_loopers_)) {
+      return Status::AlreadyExists("inproc server already running");
+    }
+    started_ = true;
+  }
+  return Status::OK();
+}
+
+Status InprocRPC::Stop() {
+  if (started_) {
+    channel_->StopServing();
+    started_ = false;
+  }
+  return Status::OK();
+}
+
+}  // namespace rpc
+}  // namespace pdlfs
@@ -0,0 +1,156 @@
+#pragma once
+
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <atomic>
+#include <string>
+
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/rpc.h"
+
+namespace pdlfs {
+namespace rpc {
+
+// RPC between threads of a single process. A server listens on
+// "inproc://<name>" and clients reach it through the same uri. Calls are
+// passed by pointer through a bounded lock-free ring from client threads
+// to the looper threads of the server, so messages are neither encoded
+// nor copied. Loopers sleep when the ring stays empty and are woken up by
+// the next call. Useful when clients and servers share a process, and to
+// measure the CPU cost of an RPC stack without a network in between.
+// Calls never time out.
+class InprocRPC : public RPC {
+ public:
+  // True if uri names the inproc transport, either as a bare "inproc"
+  // protocol or as a full "inproc://<name>" address.
+  static bool Matches(const Slice& uri);
+
+  explicit InprocRPC(const RPCOptions& options);
+  virtual ~InprocRPC();
+
+  virtual If* OpenClientFor(const std::string& uri);
+  virtual Status status() const;
+  virtual Status Start();
+  virtual Status Stop();
+
+  class Channel;
+  class Client;
+
+ private:
+  // No copying allowed
+  void operator=(const InprocRPC&);
+  InprocRPC(const InprocRPC&);
+
+  // Constant after construction
+  RPCMode mode_;
+  int num_loopers_;
+  ThreadPool* pool_;
+  Env* env_;
+  If* fs_;
+
+  Channel* channel_;  // NULL for clients
+  bool started_;
+};
+
+// A named queue of calls shared by a server and all its clients.
+// Implementation is thread-safe.
+class InprocRPC::Channel {
+ public:
+  struct Call {
+    Channel* channel;  // Set by Send()
+    If::Message* in;
+    If::Message* out;
+    // Invoked once the call is done. Synchronous calls set cb to NULL
+    // and wait on cv for done to become true.
+    If::Callback cb;
+    void* arg;
+    port::Mutex* mu;
+    port::CondVar* cv;
+    bool done;
+    Status status;
+  };
+
+  // Return the channel of a given name, creating it if necessary.
+  // Each result should be released by calling Unref().
+  static Channel* Open(const std::string& name);
+  void Unref();
+
+  // Return false if there is already a server.
+  bool Serve(If* fs, ThreadPool* pool, Env* env, int num_loopers);
+  void StopServing();
+
+  // Return false if the channel has no server.
+  bool Send(Call* call);
+  static void Finish(Call* call, const Status& status);
+
+ private:
+  explicit Channel(const std::string& name);
+  ~Channel();
+
+  bool TryPush(Call* call);
+  Call* TryPop();
+  static void LoopWrapper(void* arg);
+  void Loop();
+  static void ExecWrapper(void* arg);
+  void Exec(Call* call);
+
+  // No copying allowed
+  void operator=(const Channel&);
+  Channel(const Channel&);
+
+  // Bounded ring shared by all clients and loopers. Each slot carries
+  // a sequence number telling whether it is ready to be pushed or popped
+  // for the current lap of the ring.
+  enum { kRingSize = 1024 };  // Must be a power of 2
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    Call* call;
+  };
+  Slot ring_[kRingSize];
+  std::atomic<uint64_t> head_;  // Next position to push
+  std::atomic<uint64_t> tail_;  // Next position to pop
+  std::atomic<int> num_senders_;  // Clients in the middle of a push
+  std::atomic<int> num_idle_;     // Loopers about to sleep or sleeping
+  std::atomic<int> num_execs_;    // Calls handed to the pool
+  std::atomic<bool> serving_;
+  std::atomic<bool> shutting_down_;  // Only set with mu_ held
+
+  const std::string name_;
+  int refs_;  // Protected by the mutex of the registry
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar work_cv_;  // Signaled when calls arrive
+  port::CondVar exit_cv_;  // Signaled when loopers and pooled calls finish
+  int num_loopers_;        // Loopers still running
+  If* fs_;
+  ThreadPool* pool_;
+};
+
+class InprocRPC::Client : public If {
+ public:
+  explicit Client(Channel* channel) : channel_(channel) {}
+  virtual ~Client();
+
+  // Return Disconnected if there is no server.
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+  virtual void AsyncCall(Message& in, Message& out, Callback cb,
+                         void* arg) RPCNOEXCEPT;
+
+ private:
+  // No copying allowed
+  void operator=(const Client&);
+  Client(const Client&);
+
+  Channel* channel_;
+};
+
+}  // namespace rpc
+}  // namespace pdlfs
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include "inproc_rpc.h"
+namespace pdlfs {
+namespace rpc {
+
+static const std::string kUri = "inproc://inproc_test";
+
+class InprocServer : public If {
+ public:
+  explicit InprocServer(ThreadPool* pool) {
+    env_ = Env::Default();
+    RPCOptions options;
+    options.env = env_;
+    options.extra_workers = pool;
+    options.num_io_threads = 2;
+    options.uri = kUri;
+    options.fs = this;
+    rpc_ = RPC::Open(options);
+    self_ = rpc_->OpenClientFor(kUri);
+  }
+
+  virtual ~InprocServer() {
+    delete self_;
+    delete rpc_;
+  }
+
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    out.op = in.op;
+    out.err = in.err;
+    out.contents = in.contents;
+    return Status::OK();
+  }
+
+  If* self_;
+  RPC* rpc_;
+  Env* env_;
+};
+
+class InprocTest {
+ public:
+  ThreadPool* pool_;
+  InprocServer* server_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int num_tasks_;
+  int num_calls_;  // Async calls not yet finished
+
+  InprocTest() : pool_(NULL), server_(NULL), cv_(&mu_), num_tasks_(0) {}
+
+  ~InprocTest() {
+    delete server_;
+    delete pool_;
+  }
+
+  void Open(bool with_pool) {
+    if (with_pool) {
+      pool_ = ThreadPool::NewFixed(2);
+    }
+    server_ = new InprocServer(pool_);
+    ASSERT_OK(server_->rpc_->Start());
+  }
+
+  void BGTask() {
+    Random rnd(301);
+    for (int i = 0; i < 1000; ++i) {
+      std::string buf;
+      If::Message input;
+      input.contents = test::RandomString(&rnd, 1400, &buf);
+      input.op = rnd.Uniform(128);
+      input.err = rnd.Uniform(128);
+      If::Message output;
+      ASSERT_OK(server_->self_->Call(input, output));
+      ASSERT_EQ(input.contents, output.contents);
+      ASSERT_EQ(input.op, output.op);
+      ASSERT_EQ(input.err, output.err);
+    }
+    mu_.Lock();
+    assert(num_tasks_ > 0);
+    num_tasks_--;
+    cv_.SignalAll();
+    mu_.Unlock();
+  }
+
+  static void BGTaskWrapper(void* arg) {
+    InprocTest* test = reinterpret_cast<InprocTest*>(arg);
+    test->BGTask();
+  }
+
+  void RunTasks(int num_tasks) {
+    assert(num_tasks_ == 0);
+    fprintf(stderr, "%d client threads\n", num_tasks);
+    num_tasks_ = num_tasks;
+    for (int i = 0; i < num_tasks_; ++i) {
+      server_->env_->StartThread(BGTaskWrapper, this);
+    }
+    mu_.Lock();
+    while (num_tasks_ != 0) {
+      cv_.Wait();
+    }
+    mu_.Unlock();
+  }
+
+  static void CallDone(void* arg, const Status& s) {
+    InprocTest* test = reinterpret_cast<InprocTest*>(arg);
+    ASSERT_OK(s);
+    MutexLock ml(&test->mu_);
+    test->num_calls_--;
+    test->cv_.SignalAll();
+  }
+
+  // Issue n async calls at once and wait for all of them to finish.
+  void RunAsyncCalls(int n) {
+    std::vector<If::Message> inputs(n);
+    std::vector<If::Message> outputs(n);
+    num_calls_ = n;
+    for (int i = 0; i < n; ++i) {
+      inputs[i].op = i;
+      server_->self_->AsyncCall(inputs[i], outputs[i], CallDone, this);
+    }
+    mu_.Lock();
+    while (num_calls_ != 0) {
+      cv_.Wait();
+    }
+    mu_.Unlock();
+    for (int i = 0; i < n; ++i) {
+      ASSERT_EQ(outputs[i].op, i);
+    }
+  }
+};
+
+TEST(InprocTest, SendReceive) {
+  Open(false);
+  RunTasks(1);
+  RunTasks(4);
+  RunTasks(8);
+}
+
+TEST(InprocTest, SendReceiveWithPool) {
+  Open(true);
+  RunTasks(1);
+  RunTasks(4);
+  RunTasks(8);
+}
+
+// More calls than the ring can hold at once.
+TEST(InprocTest, AsyncCalls) {
+  Open(true);
+  RunAsyncCalls(5000);
+}
+
+TEST(InprocTest, NoServer) {
+  RPCOptions options;
+  options.mode = kClientOnly;
+  options.uri = "inproc";
+  RPC* rpc = RPC::Open(options);
+  If* client = rpc->OpenClientFor("inproc://nobody");
+  If::Message input;
+  If::Message output;
+  ASSERT_TRUE(client->Call(input, output).IsDisconnected());
+  delete client;
+  delete rpc;
+}
+
+TEST(InprocTest, Restart) {
+  Open(false);
+  RunTasks(2);
+  ASSERT_OK(server_->rpc_->Stop());
+  If::Message input;
+  If::Message output;
+  ASSERT_TRUE(server_->self_->Call(input, output).IsDisconnected());
+  ASSERT_OK(server_->rpc_->Start());
+  RunTasks(2);
+}
+
+TEST(InprocTest, OneServerPerUri) {
+  Open(false);
+  InprocServer other(NULL);
+  ASSERT_TRUE(other.rpc_->Start().IsAlreadyExists());
+}
+
+}  // namespace rpc
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -10,6 +10,8 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <algorithm>
+
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/lease.h"
@@ -41,7 +43,14 @@ LeaseTable::~LeaseTable() {
 }
 
 LeaseTable::LeaseTable(const LeaseOptions& options, port::Mutex* mu)
-    : options_(options), lru_(options_.max_num_leases), mu_(mu) {}
+    : options_(options), lru_(options_.max_num_leases), mu_(mu) {
+  const uint64_t ticks_per_lease = kWheelSlots / 2;
+  tick_ = std::max<uint64_t>(1, options_.max_lease_duration / ticks_per_lease);
+  wheel_time_ = Env::Default()->NowMicros() / tick_;
+  for (int i = 0; i < kWheelSlots; i++) {
+    wheel_[i] = NULL;
+  }
+}
 
 void LeaseTable::Release(Lease::Ref* ref) {
   if (mu_ != NULL) {
@@ -82,8 +91,20 @@ Lease::Ref* LeaseTable::Lookup(const DirId& pid, const Slice& nhash) {
   return r;
 }
 
+static void Unschedule(Lease* lease) {
+  if (lease->wheel_pprev != NULL) {
+    *lease->wheel_pprev = lease->wheel_next;
+    if (lease->wheel_next != NULL) {
+      lease->wheel_next->wheel_pprev = lease->wheel_pprev;
+    }
+    lease->wheel_next = NULL;
+    lease->wheel_pprev = NULL;
+  }
+}
+
 static void DeleteLease(const Slice& key, Lease* lease) {
   assert(!lease->busy());
+  Unschedule(lease);
   const Dir* parent = lease->parent;
   parent->num_leases--;
   assert(parent->num_leases >= 0);
@@ -105,11 +126,19 @@ Lease::Ref* LeaseTable::Insert(const DirId& pid, const Slice& nhash,
   if (lru_.Exists(key, hash)) {
     error = true;
     err = EEXIST;
-  } else if (!lru_.Compact()) {
-    error = true;
-    err = ENOBUFS;
   } else {
-    r = lru_.Insert(key, hash, lease, 1, DeleteLease);
+    ExpireLocked(Env::Default()->NowMicros());
+    if (!lru_.Compact()) {
+      stats_.full++;
+      error = true;
+      err = ENOBUFS;
+    } else {
+      r = lru_.Insert(key, hash, lease, 1, DeleteLease);
+      lease->entry = r;
+      lease->wheel_next = NULL;
+      lease->wheel_pprev = NULL;
+      Schedule(lease, lease->due);
+    }
   }
   if (mu_ != NULL) {
     mu_->Unlock();
@@ -135,4 +164,80 @@ void LeaseTable::Erase(const DirId& pid, const Slice& nhash) {
   }
 }
 
+void LeaseTable::Schedule(Lease* lease, uint64_t due) {
+  assert(lease->wheel_pprev == NULL);
+  const uint64_t t = std::max(due / tick_, wheel_time_);
+  Lease** const head = &wheel_[t % kWheelSlots];
+  lease->wheel_next = *head;
+  lease->wheel_pprev = head;
+  if (*head != NULL) {
+    (*head)->wheel_pprev = &lease->wheel_next;
+  }
+  *head = lease;
+}
+
+size_t LeaseTable::Expire(uint64_t now) {
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  size_t n = ExpireLocked(now);
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+  return n;
+}
+
+// Visit all slots whose ticks have fully passed. Leases found there
+// have either expired or been extended or locked after they were
+// scheduled. The latter are moved to the slots of their current dues.
+size_t LeaseTable::ExpireLocked(uint64_t now) {
+  const uint64_t now_tick = now / tick_;
+  if (now_tick > wheel_time_ + kWheelSlots) {
+    wheel_time_ = now_tick - kWheelSlots;  // One round visits all slots
+  }
+  size_t n = 0;
+  while (wheel_time_ < now_tick) {
+    Lease** const head = &wheel_[wheel_time_ % kWheelSlots];
+    Lease* next = *head;
+    *head = NULL;
+    wheel_time_++;
+    while (next != NULL) {
+      Lease* const lease = next;
+      next = lease->wheel_next;
+      lease->wheel_next = NULL;
+      lease->wheel_pprev = NULL;
+      Lease::Ref* const e = lease->entry;
+      bool erased = false;
+      if (lease->state != kLeaseLocked && lease->due <= now) {
+        // Skip leases that are still referenced or no longer in the table
+        Lease::Ref* const r = lru_.Lookup(e->key(), e->hash);
+        if (r == e && r->refs == 2) {
+          lru_.Release(r);
+          lru_.Erase(e->key(), e->hash);  // Deletes the lease
+          erased = true;
+          n++;
+        } else if (r != NULL) {
+          lru_.Release(r);
+        }
+      }
+      if (!erased) {
+        Schedule(lease, lease->due);
+      }
+    }
+  }
+  stats_.expired += n;
+  return n;
+}
+
+void LeaseTable::AddStats(Stats* stats) {
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  stats->expired += stats_.expired;
+  stats->full += stats_.full;
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+}
+
 }  // namespace pdlfs
@@ -13,6 +13,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/lookup_cache.h"
+#include "pdlfs-common/mutexlock.h"
 
 namespace pdlfs {
 
@@ -20,22 +21,25 @@ static void (*Deleter)(const Slice&, LookupStat*) = LRUValueDeleter<LookupStat>;
 
 LookupCache::~LookupCache() {
 #ifndef NDEBUG
-  lru_.Prune();
-  assert(lru_.Empty());
+  for (int s = 0; s < kNumShards; s++) {
+    lru_[s].Prune();
+    assert(lru_[s].Empty());
+  }
 #endif
 }
 
-LookupCache::LookupCache(size_t capacity, port::Mutex* mu)
-    : lru_(capacity), mu_(mu) {}
+LookupCache::LookupCache(size_t capacity) {
+  const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+  for (int s = 0; s < kNumShards; s++) {
+    lru_[s].SetCapacity(per_shard);
+  }
+}
 
 void LookupCache::Release(Handle* handle) {
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Release(reinterpret_cast<LookupEntry*>(handle));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  LookupEntry* const e = reinterpret_cast<LookupEntry*>(handle);
+  const uint32_t s = Shard(e->hash);
+  MutexLock l(&mu_[s]);
+  lru_[s].Release(e);
 }
 
 LookupStat* LookupCache::Value(Handle* handle) {
@@ -60,15 +64,10 @@ LookupCache::Handle* LookupCache::Lookup(const DirId& pid, const Slice& nhash) {
   char tmp[50];
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h = reinterpret_cast<Handle*>(lru_.Lookup(key, hash));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
-  return h;
+  MutexLock l(&mu_[s]);
+  return reinterpret_cast<Handle*>(lru_[s].Lookup(key, hash));
 }
 
 LookupCache::Handle* LookupCache::Insert(const DirId& pid, const Slice& nhash,
@@ -76,30 +75,21 @@ LookupCache::Handle* LookupCache::Insert(const DirId& pid, const Slice& nhash,
   char tmp[50];
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  Handle* h =
-      reinterpret_cast<Handle*>(lru_.Insert(key, hash, stat, 1, Deleter));
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
-  return h;
+  MutexLock l(&mu_[s]);
+  return reinterpret_cast<Handle*>(
+      lru_[s].Insert(key, hash, stat, 1, Deleter));
 }
 
 void LookupCache::Erase(const DirId& pid, const Slice& nhash) {
   char tmp[50];
   Slice key = LRUKey(pid, nhash, tmp);
   uint32_t hash = Hash(key.data(), key.size(), 0);
+  const uint32_t s = Shard(hash);
 
-  if (mu_ != NULL) {
-    mu_->Lock();
-  }
-  lru_.Erase(key, hash);
-  if (mu_ != NULL) {
-    mu_->Unlock();
-  }
+  MutexLock l(&mu_[s]);
+  lru_[s].Erase(key, hash);
 }
 
 }  // namespace pdlfs
@@ -192,8 +192,8 @@ Status MDB::DelNode(const DirId& id, const Slice& hash, Tx* tx) {
   return s;
 }
 
-size_t MDB::List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
-                 size_t limit) {
+size_t MDB::List(const DirId& id, const Slice& start, StatList* stats,
+                 NameList* names, std::string* next, Tx* tx, size_t limit) {
   Key key(KEY_INITIALIZER(id, kDirEntType));
   ReadOptions options;
   options.verify_checksums = options_.verify_checksums;
@@ -203,13 +203,28 @@ size_t MDB::List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
   }
   Slice prefix = key.prefix();
   Iterator* iter = db_->NewIterator(options);
-  iter->Seek(prefix);
+  if (!start.empty()) {
+    key.SetHash(start);
+    iter->Seek(key.Encode());
+  } else {
+    iter->Seek(prefix);
+  }
+  if (next != NULL) {
+    next->clear();
+  }
   Slice name;
   Stat stat;
   size_t num_entries = 0;
-  for (; iter->Valid() && num_entries < limit; iter->Next()) {
+  for (; iter->Valid(); iter->Next()) {
     Slice key = iter->key();
     if (key.starts_with(prefix)) {
+      if (num_entries >= limit) {
+        if (next != NULL) {
+          key.remove_prefix(prefix.size());
+          next->assign(key.data(), key.size());
+        }
+        break;
+      }
       Slice input = iter->value();
       if (stat.DecodeFrom(&input) && GetLengthPrefixedSlice(&input, &name)) {
         if (stats != NULL) {
@@ -229,6 +244,68 @@ size_t MDB::List(const DirId& id, StatList* stats, NameList* names, Tx* tx,
   return num_entries;
 }
 
+// Translate a hash range of a directory to a key range.
+// An empty hash limit becomes the first key beyond all entries.
+static void ToKeyRange(const DirId& id, const Slice& start, const Slice& limit,
+                       std::string* start_key, std::string* limit_key) {
+  Key key(KEY_INITIALIZER(id, kDirEntType));
+  key.SetHash(start);
+  start_key->assign(key.data(), key.size());
+  if (!limit.empty()) {
+    key.SetHash(limit);
+    limit_key->assign(key.data(), key.size());
+  } else {
+    Key end(KEY_INITIALIZER(id, kDirIdxType));
+    Slice prefix = end.prefix();
+    limit_key->assign(prefix.data(), prefix.size());
+  }
+}
+
+size_t MDB::ListHashes(const DirId& id, const Slice& start, const Slice& limit,
+                       std::vector<std::string>* hashes, Tx* tx) {
+  std::string start_key;
+  std::string limit_key;
+  ToKeyRange(id, start, limit, &start_key, &limit_key);
+  ReadOptions options;
+  options.verify_checksums = options_.verify_checksums;
+  options.fill_cache = false;
+  if (tx != NULL) {
+    options.snapshot = tx->snap;
+  }
+  Key key(KEY_INITIALIZER(id, kDirEntType));
+  Slice prefix = key.prefix();
+  Iterator* iter = db_->NewIterator(options);
+  iter->Seek(start_key);
+  size_t num_hashes = 0;
+  for (; iter->Valid(); iter->Next()) {
+    Slice k = iter->key();
+    if (k.starts_with(prefix) && k.compare(limit_key) < 0) {
+      k.remove_prefix(prefix.size());
+      hashes->push_back(k.ToString());
+      num_hashes++;
+    } else {
+      break;
+    }
+  }
+  delete iter;
+
+  return num_hashes;
+}
+
+Status MDB::DumpEntries(const DirId& id, const Slice& start,
+                        const Slice& limit, const std::string& dst_dir,
+                        Tx* tx) {
+  std::string start_key;
+  std::string limit_key;
+  ToKeyRange(id, start, limit, &start_key, &limit_key);
+  DumpOptions options;
+  options.verify_checksums = options_.verify_checksums;
+  if (tx != NULL) {
+    options.snapshot = tx->snap;
+  }
+  return db_->Dump(options, Range(start_key, limit_key), dst_dir, NULL, NULL);
+}
+
 bool MDB::Exists(const DirId& id, const Slice& hash, Tx* tx) {
   Status s;
   Key key(KEY_INITIALIZER(id, kDirEntType));
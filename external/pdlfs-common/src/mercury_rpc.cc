@@ -15,6 +15,9 @@
 namespace pdlfs {
 namespace rpc {
 
+// Op code, error code, and body length
+static const size_t kMessageHeaderSize = 6;
+
 hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
   hg_return_t ret;
   If::Message* msg = reinterpret_cast<If::Message*>(data);
@@ -28,8 +31,11 @@ hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
         hg_int8_t err_code = static_cast<int8_t>(msg->err);
         ret = hg_proc_hg_int8_t(proc, &err_code);
         if (ret == HG_SUCCESS) {
-          hg_uint16_t len = static_cast<uint16_t>(msg->contents.size());
-          ret = hg_proc_hg_uint16_t(proc, &len);
+          // Request bodies too large for an eager message are moved by
+          // mercury as extra data through bulk transfers. Reply bodies
+          // are checked against max_reply_size_ before they are sent.
+          hg_uint32_t len = static_cast<uint32_t>(msg->contents.size());
+          ret = hg_proc_hg_uint32_t(proc, &len);
           if (ret == HG_SUCCESS) {
             if (len > 0) {
               char* p = const_cast<char*>(&msg->contents[0]);
@@ -50,17 +56,16 @@ hg_return_t MercuryRPC::RPCMessageCoder(hg_proc_t proc, void* data) {
         ret = hg_proc_hg_int8_t(proc, &err);
         if (ret == HG_SUCCESS) {
           msg->err = err;
-          hg_uint16_t len;
-          ret = hg_proc_hg_uint16_t(proc, &len);
+          hg_uint32_t len;
+          ret = hg_proc_hg_uint32_t(proc, &len);
           if (ret == HG_SUCCESS) {
             if (len > 0) {
               char* p;
               if (len <= sizeof(msg->buf)) {
                 p = &msg->buf[0];
               } else {
-                // XXX: Avoid an extra copy of data
-                msg->extra_buf.reserve(len);
-                msg->extra_buf.resize(1);
+                // Reuses the capacity of a pooled buffer if there is one
+                msg->extra_buf.resize(len);
                 p = &msg->extra_buf[0];
               }
               ret = hg_proc_memcpy(proc, p, len);
@@ -93,15 +98,29 @@ hg_return_t MercuryRPC::RPCCallbackDecorator(hg_handle_t handle) {
 }
 
 hg_return_t MercuryRPC::RPCCallback(hg_handle_t handle) {
+  MercuryRPC* const rpc = registered_data(handle);
   If::Message input;
   If::Message output;
+  rpc->buffers_.Get(&input.extra_buf);
+  rpc->buffers_.Get(&output.extra_buf);
   hg_return_t ret = HG_Get_input(handle, &input);
   if (ret == HG_SUCCESS) {
-    registered_data(handle)->fs_->Call(input, output);  // Execute callback
+    rpc->fs_->Call(input, output);  // Execute callback
+    if (output.contents.size() > rpc->max_reply_size_) {
+      Error(__LOG_ARGS__,
+            "rpc reply of %zu bytes exceeds the %zu-byte eager size "
+            "(op=%d)",
+            output.contents.size(), rpc->max_reply_size_, input.op);
+      output.err = Status::kBufferFull;
+      output.contents = Slice();
+    }
+    // The reply is encoded before HG_Respond() returns
     ret = HG_Respond(handle, NULL, NULL, &output);
     HG_Free_input(handle, &input);
   }
   HG_Destroy(handle);
+  rpc->buffers_.Put(&input.extra_buf);
+  rpc->buffers_.Put(&output.extra_buf);
   return ret;
 }
 
@@ -231,6 +250,66 @@ Status MercuryRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
   }
 }
 
+// Finish an asynchronous call in the looper. The timer of the call is
+// embedded in the call state so it can be removed here.
+hg_return_t MercuryRPC::Client::AsyncReply(const hg_cb_info* info) {
+  AsyncState* state = reinterpret_cast<AsyncState*>(info->arg);
+  hg_handle_t handle = info->info.forward.handle;
+  hg_return_t ret = info->ret;
+  if (ret == HG_SUCCESS) {
+    ret = HG_Get_output(handle, state->out);
+    if (ret == HG_SUCCESS) {
+      HG_Free_output(handle, state->out);  // See SaveReply() above
+    }
+  }
+  state->rpc->RemoveTimer(&state->timer);
+  HG_Destroy(handle);
+  state->rpc->Release(state->addr_entry);
+  Callback cb = state->cb;
+  void* arg = state->arg;
+  delete state;
+  if (ret != HG_SUCCESS) {
+    cb(arg, Status::Disconnected(Slice()));
+  } else {
+    cb(arg, Status::OK());
+  }
+  return HG_SUCCESS;
+}
+
+void MercuryRPC::Client::AsyncCall(Message& in, Message& out, Callback cb,
+                                   void* arg) RPCNOEXCEPT {
+  AddrEntry* addr_entry = NULL;
+  hg_return_t ret = rpc_->Lookup(addr_, &addr_entry);
+  if (ret != HG_SUCCESS) {
+    cb(arg, Status::Disconnected(Slice()));
+    return;
+  }
+  assert(addr_entry != NULL);
+  hg_addr_t addr = addr_entry->value->rep;
+  hg_handle_t handle;
+  ret = HG_Create(rpc_->hg_context_, addr, rpc_->hg_rpc_id_, &handle);
+  if (ret == HG_SUCCESS) {
+    AsyncState* state = new AsyncState;
+    state->rpc = rpc_;
+    state->addr_entry = addr_entry;
+    state->out = &out;
+    state->cb = cb;
+    state->arg = arg;
+    // The reply may arrive before HG_Forward returns so the timer
+    // must be in place before the message is sent
+    rpc_->AddTimerFor(handle, &state->timer);
+    ret = HG_Forward(handle, AsyncReply, state, &in);
+    if (ret == HG_SUCCESS) {
+      return;  // AsyncReply() will clean up
+    }
+    rpc_->RemoveTimer(&state->timer);
+    delete state;
+    HG_Destroy(handle);
+  }
+  rpc_->Release(addr_entry);
+  cb(arg, Status::Disconnected(Slice()));
+}
+
 void MercuryRPC::Ref() { ++refs_; }
 
 void MercuryRPC::Unref() {
@@ -248,6 +327,7 @@ MercuryRPC::MercuryRPC(bool listen, const RPCOptions& options)
       addr_cache_(options.addr_cache_size),
       refs_(0),
       rpc_timeout_(options.rpc_timeout),
+      max_reply_size_(0),
       pool_(options.extra_workers),
       env_(options.env),
       fs_(options.fs) {
@@ -257,6 +337,10 @@ MercuryRPC::MercuryRPC(bool listen, const RPCOptions& options)
     Error(__LOG_ARGS__, "hg init call failed");
     abort();
   } else {
+    const hg_size_t eager_size = HG_Class_get_output_eager_size(hg_class_);
+    if (eager_size > kMessageHeaderSize) {
+      max_reply_size_ = eager_size - kMessageHeaderSize;
+    }
     RegisterRPC();
   }
 
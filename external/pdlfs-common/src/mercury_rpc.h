@@ -32,6 +32,7 @@ class MercuryRPC {
   hg_return_t Lookup(const std::string& addr, AddrEntry** result);
   MercuryRPC(bool listen, const RPCOptions& options);
   bool ok() const { return !has_error_.Acquire_Load(); }
+  size_t max_reply_size() const { return max_reply_size_; }
   Status status() const {
     if (has_error_.Acquire_Load()) {
       return Status::IOError(Slice());
@@ -95,6 +96,9 @@ class MercuryRPC {
   void RemoveTimer(Timer* timer);
   void CheckTimers();
 
+  // Reused for large messages received by the server
+  BufferPool buffers_;
+
   // State below is protected by mutex_
   port::Mutex mutex_;
   port::AtomicPointer has_error_;
@@ -107,6 +111,9 @@ class MercuryRPC {
 
   // Constant after construction
   uint64_t rpc_timeout_;
+  // Largest reply body that fits in an eager message. Mercury moves large
+  // requests as extra data, but not large replies.
+  size_t max_reply_size_;
   ThreadPool* pool_;
   Env* env_;
   If* fs_;
@@ -203,6 +210,11 @@ class MercuryRPC::Client : public If {
 
   // Return OK on success, a non-OK status on RPC errors.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+  // Forward the message and return immediately. The callback is invoked
+  // by the looper once the reply arrives or the call times out.
+  // REQUIRES: the client outlives all its pending calls.
+  virtual void AsyncCall(Message& in, Message& out, Callback cb,
+                         void* arg) RPCNOEXCEPT;
 
   virtual ~Client() {
     if (rpc_ != NULL) {
@@ -211,6 +223,16 @@ class MercuryRPC::Client : public If {
   }
 
  private:
+  struct AsyncState {
+    MercuryRPC* rpc;
+    AddrEntry* addr_entry;
+    Timer timer;
+    void* out;
+    Callback cb;
+    void* arg;
+  };
+  static hg_return_t AsyncReply(const hg_cb_info* info);
+
   MercuryRPC* rpc_;
   std::string addr_;  // Unresolved target address
 
@@ -126,6 +126,27 @@ TEST(MercuryTest, SendReceive) {
   RunTasks(8);
 }
 
+// Bodies beyond 64KB used to be truncated by a 16-bit length. Requests of
+// any size are delivered, while replies that do not fit in an eager message
+// are answered with an error.
+TEST(MercuryTest, LargeMessages) {
+  Random rnd(301);
+  for (int i = 0; i < 4; ++i) {
+    std::string buf;
+    If::Message input;
+    input.contents = test::RandomString(&rnd, (1 << 16) << i, &buf);
+    If::Message output;
+    ASSERT_OK(server_->self_->Call(input, output));
+    if (input.contents.size() <= server_->rpc_->max_reply_size()) {
+      ASSERT_EQ(output.err, 0);
+      ASSERT_EQ(input.contents, output.contents);
+    } else {
+      ASSERT_EQ(output.err, Status::kBufferFull);
+      ASSERT_TRUE(output.contents.empty());
+    }
+  }
+}
+
 }  // namespace rpc
 }  // namespace pdlfs
 
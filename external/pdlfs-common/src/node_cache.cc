@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/node_cache.h"
+
+namespace pdlfs {
+
+static void (*Deleter)(const Slice&, Stat*) = LRUValueDeleter<Stat>;
+
+NodeCache::~NodeCache() {
+#ifndef NDEBUG
+  lru_.Prune();
+  assert(lru_.Empty());
+#endif
+}
+
+NodeCache::NodeCache(size_t capacity, port::Mutex* mu)
+    : lru_(capacity), mu_(mu) {}
+
+void NodeCache::Release(Handle* handle) {
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  lru_.Release(reinterpret_cast<NodeEntry*>(handle));
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+}
+
+const Stat* NodeCache::Value(Handle* handle) {
+  return reinterpret_cast<NodeEntry*>(handle)->value;
+}
+
+Slice NodeCache::LRUKey(const DirId& pid, const Slice& nhash, char* scratch) {
+  char* p = scratch;
+#if !defined(DELTAFS)
+  EncodeFixed64(p, pid.ino);
+  p += 8;
+#else
+  p = EncodeVarint64(p, pid.reg);
+  p = EncodeVarint64(p, pid.snap);
+  p = EncodeVarint64(p, pid.ino);
+#endif
+  memcpy(p, nhash.data(), nhash.size());
+  return Slice(scratch, p - scratch + nhash.size());
+}
+
+NodeCache::Handle* NodeCache::Lookup(const DirId& pid, const Slice& nhash) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  NodeEntry* e = lru_.Lookup(key, hash);
+  if (e == NULL) {
+    stats_.misses++;
+  } else {
+    stats_.hits++;
+    if (e->value == NULL) {
+      stats_.negative_hits++;
+    }
+  }
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+  return reinterpret_cast<Handle*>(e);
+}
+
+NodeCache::Handle* NodeCache::Insert(const DirId& pid, const Slice& nhash,
+                                     const Stat* stat) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+  // Charge entries by their approximate memory footprint
+  size_t charge = sizeof(NodeEntry) + key.size();
+  Stat* value = NULL;
+  if (stat != NULL) {
+    value = new Stat(*stat);
+    charge += sizeof(Stat);
+  }
+
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  Handle* h = reinterpret_cast<Handle*>(
+      lru_.Insert(key, hash, value, charge, Deleter));
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+  return h;
+}
+
+void NodeCache::Erase(const DirId& pid, const Slice& nhash) {
+  char tmp[50];
+  Slice key = LRUKey(pid, nhash, tmp);
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  lru_.Erase(key, hash);
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+}
+
+void NodeCache::AddStats(Stats* stats) {
+  if (mu_ != NULL) {
+    mu_->Lock();
+  }
+  stats->hits += stats_.hits;
+  stats->negative_hits += stats_.negative_hits;
+  stats->misses += stats_.misses;
+  if (mu_ != NULL) {
+    mu_->Unlock();
+  }
+}
+
+}  // namespace pdlfs
@@ -12,9 +12,13 @@
 #include <vector>
 
 #include "pdlfs-common/logging.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/rpc.h"
 
+#include "inproc_rpc.h"
+#include "work_stealing.h"
+
 #if defined(PDLFS_MARGO_RPC)
 #include "margo_rpc.h"
 #endif
@@ -37,19 +41,32 @@ RPCOptions::RPCOptions()
 
 RPC::~RPC() {}
 
+RPCServer::RPCServer(rpc::If* fs, Env* env, int shared_workers)
+    : shared_pool_(NULL), fs_(fs), env_(env) {
+  if (shared_workers > 0) {
+    shared_pool_ = new rpc::WorkStealingPool(
+        shared_workers, env_ != NULL ? env_ : Env::Default());
+  }
+}
+
 RPCServer::~RPCServer() {
   std::vector<RPCInfo>::iterator it;
   for (it = rpcs_.begin(); it != rpcs_.end(); ++it) {
     delete it->rpc;
     delete it->pool;
   }
+  delete shared_pool_;
 }
 
 void RPCServer::AddChannel(const std::string& listening_uri, int workers) {
   RPCInfo info;
   RPCOptions options;
   options.env = env_;
-  info.pool = ThreadPool::NewFixed(workers);
+  if (shared_pool_ != NULL) {
+    info.pool = shared_pool_->NewLane(listening_uri);
+  } else {
+    info.pool = ThreadPool::NewFixed(workers);
+  }
   options.extra_workers = info.pool;
   options.fs = fs_;
   options.uri = listening_uri;
@@ -57,6 +74,12 @@ void RPCServer::AddChannel(const std::string& listening_uri, int workers) {
   rpcs_.push_back(info);
 }
 
+void RPCServer::AppendReport(std::string* report) {
+  if (shared_pool_ != NULL) {
+    shared_pool_->AppendReport(report);
+  }
+}
+
 Status RPCServer::status() const {
   Status s;
   std::vector<RPCInfo>::const_iterator it;
@@ -100,6 +123,46 @@ namespace rpc {
 
 If::~If() {}
 
+BufferPool::BufferPool(size_t max_buffers, size_t max_buffer_size)
+    : max_buffers_(max_buffers), max_buffer_size_(max_buffer_size) {
+  buffers_.reserve(max_buffers_);
+}
+
+BufferPool::~BufferPool() {}
+
+void BufferPool::Get(std::string* dst) {
+  dst->clear();
+  MutexLock ml(&mu_);
+  if (!buffers_.empty()) {
+    dst->swap(buffers_.back());
+    buffers_.pop_back();
+  }
+}
+
+void BufferPool::Put(std::string* src) {
+  src->clear();
+  if (src->capacity() <= sizeof(If::Message().buf) ||
+      src->capacity() > max_buffer_size_) {
+    std::string().swap(*src);  // Not worth pooling
+    return;
+  }
+  MutexLock ml(&mu_);
+  if (buffers_.size() < max_buffers_) {
+    buffers_.push_back(std::string());
+    buffers_.back().swap(*src);
+  } else {
+    std::string().swap(*src);
+  }
+}
+
+bool If::IsUrgent(const Message& in) RPCNOEXCEPT { return false; }
+
+void If::AsyncCall(Message& in, Message& out, Callback cb,
+                   void* arg) RPCNOEXCEPT {
+  Status s = Call(in, out);
+  cb(arg, s);
+}
+
 namespace {
 #if defined(PDLFS_MARGO_RPC)
 class MargoRPCImpl : public RPC {
@@ -172,6 +235,9 @@ RPC* RPC::Open(const RPCOptions& raw_options) {
               : "NULL");
 #endif
   RPC* rpc = NULL;
+  if (options.impl == kInprocRPC || rpc::InprocRPC::Matches(options.uri)) {
+    return new rpc::InprocRPC(options);
+  }
 #if defined(PDLFS_MARGO_RPC)
   if (options.impl == kMargoRPC) {
     rpc = new rpc::MargoRPCImpl(options);
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "work_stealing.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "pdlfs-common/mutexlock.h"
+
+namespace pdlfs {
+namespace rpc {
+
+// Feeds the tasks of one source of work to the shared pool and counts
+// the tasks it has started.
+class WorkStealingPool::Lane : public ThreadPool {
+ public:
+  Lane(WorkStealingPool* pool, const std::string& name)
+      : pool_(pool), name_(name), last_started_(0) {
+    num_pending_.store(0);
+    num_started_.store(0);
+  }
+
+  // Wait for all tasks scheduled through us to finish.
+  virtual ~Lane() { pool_->RemoveLane(this); }
+
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    Task task;
+    task.function = function;
+    task.arg = arg;
+    task.lane = this;
+    num_pending_.fetch_add(1);
+    pool_->Submit(task, false);
+  }
+
+  virtual void SchedulePriority(void (*function)(void*), void* arg) {
+    Task task;
+    task.function = function;
+    task.arg = arg;
+    task.lane = this;
+    num_pending_.fetch_add(1);
+    pool_->Submit(task, true);
+  }
+
+  virtual std::string ToDebugString() {
+    return "work-stealing lane: " + name_;
+  }
+
+  // Lanes cannot be paused independently of each other.
+  virtual void Pause() {}
+  virtual void Resume() {}
+
+ private:
+  friend class WorkStealingPool;
+  WorkStealingPool* const pool_;
+  const std::string name_;
+  std::atomic<int> num_pending_;  // Tasks scheduled but not yet finished
+  std::atomic<uint64_t> num_started_;
+  uint64_t last_started_;  // Tasks started at the last report, under mu_
+};
+
+WorkStealingPool::WorkStealingPool(int num_workers, Env* env)
+    : work_cv_(&mu_),
+      exit_cv_(&mu_),
+      last_report_(env->NowMicros()),
+      num_started_(0),
+      num_running_(num_workers),
+      shutting_down_(false),
+      env_(env) {
+  assert(num_workers > 0);
+  next_worker_.store(0);
+  num_queued_.store(0);
+  max_queued_.store(0);
+  num_urgent_.store(0);
+  num_sleeping_.store(0);
+  num_steals_.store(0);
+  for (int i = 0; i < num_workers; i++) {
+    workers_.push_back(new Worker);
+  }
+  for (int i = 0; i < num_workers; i++) {
+    env_->StartThread(RunWrapper, this);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  MutexLock ml(&mu_);
+  assert(lanes_.empty());
+  shutting_down_ = true;
+  work_cv_.SignalAll();
+  while (num_running_ != 0) {
+    exit_cv_.Wait();
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    delete workers_[i];
+  }
+}
+
+ThreadPool* WorkStealingPool::NewLane(const std::string& name) {
+  Lane* lane = new Lane(this, name);
+  MutexLock ml(&mu_);
+  lanes_.push_back(lane);
+  return lane;
+}
+
+void WorkStealingPool::RemoveLane(Lane* lane) {
+  MutexLock ml(&mu_);
+  while (lane->num_pending_.load() != 0) {
+    exit_cv_.Wait();
+  }
+  lanes_.erase(std::find(lanes_.begin(), lanes_.end(), lane));
+}
+
+void WorkStealingPool::Submit(const Task& task, bool urgent) {
+  if (urgent) {
+    MutexLock ml(&mu_);
+    urgent_tasks_.push_back(task);
+    num_urgent_.fetch_add(1);
+  } else {
+    Worker* const w = workers_[next_worker_.fetch_add(1) % workers_.size()];
+    MutexLock ml(&w->mu);
+    w->tasks.push_back(task);
+  }
+  const int queued = num_queued_.fetch_add(1) + 1;
+  int max = max_queued_.load(std::memory_order_relaxed);
+  while (queued > max && !max_queued_.compare_exchange_weak(max, queued)) {
+  }
+  // Either a worker about to sleep sees the new task, or we see the
+  // worker and wake it up
+  if (num_sleeping_.load() != 0) {
+    MutexLock ml(&mu_);
+    work_cv_.Signal();
+  }
+}
+
+// Take urgent tasks first, then tasks from our own queue in the order
+// they were scheduled, and then tasks from the back of the queues of
+// other workers, starting with our neighbors.
+bool WorkStealingPool::TryPop(size_t self, Task* task) {
+  bool found = false;
+  if (num_urgent_.load() != 0) {
+    MutexLock ml(&mu_);
+    if (!urgent_tasks_.empty()) {
+      *task = urgent_tasks_.front();
+      urgent_tasks_.pop_front();
+      num_urgent_.fetch_sub(1);
+      found = true;
+    }
+  }
+  const size_t n = workers_.size();
+  for (size_t i = 0; i < n && !found; i++) {
+    Worker* const w = workers_[(self + i) % n];
+    MutexLock ml(&w->mu);
+    if (!w->tasks.empty()) {
+      if (i == 0) {
+        *task = w->tasks.front();
+        w->tasks.pop_front();
+      } else {
+        *task = w->tasks.back();
+        w->tasks.pop_back();
+        num_steals_.fetch_add(1, std::memory_order_relaxed);
+      }
+      found = true;
+    }
+  }
+  if (found) {
+    num_queued_.fetch_sub(1);
+  }
+  return found;
+}
+
+void WorkStealingPool::RunWrapper(void* arg) {
+  WorkStealingPool* pool = reinterpret_cast<WorkStealingPool*>(arg);
+  size_t self;
+  {
+    MutexLock ml(&pool->mu_);
+    self = pool->num_started_++;
+  }
+  pool->Run(self);
+}
+
+void WorkStealingPool::Run(size_t self) {
+  Task task;
+  for (;;) {
+    if (TryPop(self, &task)) {
+      Lane* const lane = task.lane;
+      lane->num_started_.fetch_add(1, std::memory_order_relaxed);
+      (*task.function)(task.arg);
+      if (lane->num_pending_.fetch_sub(1) == 1) {
+        MutexLock ml(&mu_);
+        exit_cv_.SignalAll();  // The lane may be waiting to be deleted
+      }
+      continue;
+    }
+    MutexLock ml(&mu_);
+    num_sleeping_.fetch_add(1);
+    while (num_queued_.load() <= 0 && !shutting_down_) {
+      work_cv_.Wait();
+    }
+    num_sleeping_.fetch_sub(1);
+    if (num_queued_.load() <= 0 && shutting_down_) {
+      num_running_--;
+      exit_cv_.SignalAll();
+      return;
+    }
+  }
+}
+
+void WorkStealingPool::AppendReport(std::string* report) {
+  char tmp[200];
+  MutexLock ml(&mu_);
+  const uint64_t now = env_->NowMicros();
+  const double secs = (now - last_report_) / 1000000.0;
+  last_report_ = now;
+  snprintf(tmp, sizeof(tmp), "queued=%d max_queued=%d steals=%llu",
+           std::max(num_queued_.load(), 0), max_queued_.load(),
+           static_cast<unsigned long long>(num_steals_.load()));
+  report->append(tmp);
+  for (size_t i = 0; i < lanes_.size(); i++) {
+    Lane* const lane = lanes_[i];
+    const uint64_t started = lane->num_started_.load();
+    const uint64_t ops = started - lane->last_started_;
+    lane->last_started_ = started;
+    snprintf(tmp, sizeof(tmp), " | %s: %llu ops (%.0f ops/s)",
+             lane->name_.c_str(), static_cast<unsigned long long>(ops),
+             secs > 0 ? ops / secs : 0.0);
+    report->append(tmp);
+  }
+}
+
+}  // namespace rpc
+}  // namespace pdlfs
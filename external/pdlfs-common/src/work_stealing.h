@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+
+namespace pdlfs {
+namespace rpc {
+
+// A pool of workers shared by multiple sources of work, such as the
+// listening ports of a server. Each source schedules work through a lane
+// obtained from NewLane(). Work is spread over per-worker queues and idle
+// workers steal from the queues of busy ones. Work scheduled with
+// SchedulePriority() goes to a separate queue that all workers check
+// first. Implementation is thread-safe.
+class WorkStealingPool {
+ public:
+  WorkStealingPool(int num_workers, Env* env);
+  // Work already scheduled is executed before the destructor returns.
+  // REQUIRES: all lanes have been deleted.
+  ~WorkStealingPool();
+
+  // Return a new lane for a source of work. The result should be deleted
+  // when it is no longer needed.
+  ThreadPool* NewLane(const std::string& name);
+
+  // Append the number of queued tasks, the max number ever queued, the
+  // number of tasks stolen, and the tasks started for each lane since
+  // the last report to *report.
+  void AppendReport(std::string* report);
+
+ private:
+  class Lane;
+  struct Task {
+    void (*function)(void*);
+    void* arg;
+    Lane* lane;
+  };
+  struct Worker {
+    port::Mutex mu;
+    std::deque<Task> tasks;  // Protected by mu
+  };
+
+  void Submit(const Task& task, bool urgent);
+  void RemoveLane(Lane* lane);
+  bool TryPop(size_t self, Task* task);
+  static void RunWrapper(void* arg);
+  void Run(size_t self);
+
+  // No copying allowed
+  void operator=(const WorkStealingPool&);
+  WorkStealingPool(const WorkStealingPool&);
+
+  // Constant after construction
+  std::vector<Worker*> workers_;
+
+  std::atomic<uint64_t> next_worker_;  // Workers are fed round robin
+  std::atomic<int> num_queued_;
+  std::atomic<int> max_queued_;
+  std::atomic<int> num_urgent_;
+  std::atomic<int> num_sleeping_;
+  std::atomic<uint64_t> num_steals_;
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar work_cv_;  // Signaled when work arrives
+  port::CondVar exit_cv_;  // Signaled when workers exit
+  std::deque<Task> urgent_tasks_;
+  std::vector<Lane*> lanes_;
+  uint64_t last_report_;  // Time of the last report
+  size_t num_started_;    // Workers that have been given an id
+  int num_running_;       // Workers not yet exited
+  bool shutting_down_;
+  Env* const env_;
+};
+
+}  // namespace rpc
+}  // namespace pdlfs
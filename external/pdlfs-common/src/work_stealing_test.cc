@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/rpc.h"
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include "work_stealing.h"
+
+#include <vector>
+
+namespace pdlfs {
+namespace rpc {
+
+class WorkStealingTest {
+ public:
+  WorkStealingTest()
+      : cv_(&mu_), gate_open_(false), num_started_(0), num_done_(0) {}
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool gate_open_;
+  int num_started_;
+  int num_done_;
+  std::vector<int> order_;  // Ids of the tasks done
+};
+
+namespace {
+struct TaskArg {
+  WorkStealingTest* test;
+  int id;
+  int wait_for;  // Block until this many tasks are done
+};
+}  // namespace
+
+static void Task(void* arg) {
+  TaskArg* a = reinterpret_cast<TaskArg*>(arg);
+  WorkStealingTest* test = a->test;
+  MutexLock ml(&test->mu_);
+  test->num_started_++;
+  test->cv_.SignalAll();
+  while (!test->gate_open_ || test->num_done_ < a->wait_for) {
+    test->cv_.Wait();
+  }
+  test->order_.push_back(a->id);
+  test->num_done_++;
+  test->cv_.SignalAll();
+}
+
+TEST(WorkStealingTest, RunAll) {
+  gate_open_ = true;
+  WorkStealingPool pool(4, Env::Default());
+  ThreadPool* lanes[2];
+  lanes[0] = pool.NewLane("a");
+  lanes[1] = pool.NewLane("b");
+  const int kTasks = 10000;
+  std::vector<TaskArg> args(kTasks);
+  for (int i = 0; i < kTasks; i++) {
+    args[i].test = this;
+    args[i].id = i;
+    args[i].wait_for = 0;
+    lanes[i % 2]->Schedule(Task, &args[i]);
+  }
+  delete lanes[0];  // Waits for all tasks of the lane
+  delete lanes[1];
+  ASSERT_EQ(num_done_, kTasks);
+}
+
+// The first task blocks its worker until all other tasks are done, so
+// tasks queued behind it must be stolen by the other worker.
+TEST(WorkStealingTest, Steal) {
+  gate_open_ = true;
+  WorkStealingPool pool(2, Env::Default());
+  ThreadPool* lane = pool.NewLane("a");
+  const int kTasks = 100;
+  std::vector<TaskArg> args(kTasks);
+  for (int i = 0; i < kTasks; i++) {
+    args[i].test = this;
+    args[i].id = i;
+    args[i].wait_for = i == 0 ? kTasks - 1 : 0;
+    lane->Schedule(Task, &args[i]);
+  }
+  delete lane;
+  ASSERT_EQ(num_done_, kTasks);
+  ASSERT_EQ(order_.back(), 0);
+  std::string report;
+  pool.AppendReport(&report);
+  fprintf(stderr, "%s\n", report.c_str());
+  ASSERT_TRUE(report.find("steals=0") == std::string::npos);
+}
+
+TEST(WorkStealingTest, Priority) {
+  WorkStealingPool pool(1, Env::Default());
+  ThreadPool* lane = pool.NewLane("a");
+  const int kTasks = 5;
+  std::vector<TaskArg> args(kTasks);
+  for (int i = 0; i < kTasks; i++) {
+    args[i].test = this;
+    args[i].id = i;
+    args[i].wait_for = 0;
+  }
+  lane->Schedule(Task, &args[0]);  // Blocks the only worker
+  {
+    MutexLock ml(&mu_);
+    while (num_started_ == 0) {
+      cv_.Wait();
+    }
+  }
+  lane->Schedule(Task, &args[1]);
+  lane->Schedule(Task, &args[2]);
+  lane->SchedulePriority(Task, &args[3]);
+  lane->Schedule(Task, &args[4]);
+  {
+    MutexLock ml(&mu_);
+    gate_open_ = true;
+    cv_.SignalAll();
+  }
+  delete lane;
+  ASSERT_EQ(order_.size(), kTasks);
+  ASSERT_EQ(order_[0], 0);
+  ASSERT_EQ(order_[1], 3);
+}
+
+namespace {
+class EchoServer : public If {
+ public:
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    out.op = in.op;
+    out.contents = in.contents;
+    return Status::OK();
+  }
+};
+}  // namespace
+
+// All listening ports of a server feed a single pool.
+TEST(WorkStealingTest, SharedByChannels) {
+  EchoServer fs;
+  RPCServer srv(&fs, NULL, 2);
+  srv.AddChannel("inproc://work_stealing_test_a", 0);
+  srv.AddChannel("inproc://work_stealing_test_b", 0);
+  ASSERT_OK(srv.Start());
+  RPCOptions options;
+  options.mode = kClientOnly;
+  options.uri = "inproc";
+  RPC* rpc = RPC::Open(options);
+  If* clis[2];
+  clis[0] = rpc->OpenClientFor("inproc://work_stealing_test_a");
+  clis[1] = rpc->OpenClientFor("inproc://work_stealing_test_b");
+  for (int i = 0; i < 100; i++) {
+    If::Message in;
+    in.op = i;
+    If::Message out;
+    ASSERT_OK(clis[i % 2]->Call(in, out));
+    ASSERT_EQ(out.op, i);
+  }
+  std::string report;
+  srv.AppendReport(&report);
+  fprintf(stderr, "%s\n", report.c_str());
+  ASSERT_TRUE(report.find("work_stealing_test_a: 50 ops") !=
+              std::string::npos);
+  ASSERT_TRUE(report.find("work_stealing_test_b: 50 ops") !=
+              std::string::npos);
+  ASSERT_OK(srv.Stop());
+  delete clis[0];
+  delete clis[1];
+  delete rpc;
+}
+
+}  // namespace rpc
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  return ::pdlfs::test::RunAllTests(&argc, &argv);
+}
@@ -35,6 +35,15 @@ extern "C" {
  */
 void deltafs_print_sysinfo();
 int deltafs_nonop(); /* Simply trigger client initialization */
+/* Returns the op latency report of a metadata server in a malloc'ed
+ * string that the caller must free. */
+int deltafs_srvstats(int __srv_id, char** __result);
+/* Returns the readahead stats of the client in a malloc'ed string that
+ * the caller must free. */
+int deltafs_clistats(char** __result);
+/* Sends all buffered file creates and waits for them. Fails with the
+ * first error hit by a buffered create since the last call. */
+int deltafs_syncmeta();
 mode_t deltafs_umask(mode_t __mode);
 int deltafs_chroot(const char* __path);
 int deltafs_chdir(const char* __path);
@@ -47,6 +56,11 @@ int deltafs_getattr(const char* __path, struct stat* __stbuf);
 int deltafs_mkfile(const char* __path, mode_t __mode);
 int deltafs_mkdirs(const char* __path, mode_t __mode);
 int deltafs_mkdir(const char* __path, mode_t __mode);
+/* Create __n files, or directories if __mode has S_IFDIR, under __dir.
+ * Return 0 if all are created, or -1 otherwise. If __errs is not NULL,
+ * the errno of each name is stored in __errs[i] (0 on success). */
+int deltafs_bcreat(const char* __dir, const char** __names, size_t __n,
+                   mode_t __mode, int* __errs);
 int deltafs_chmod(const char* __path, mode_t __mode);
 int deltafs_chown(const char* __path, uid_t __usr, gid_t __grp);
 int deltafs_stat(const char* __path, struct stat* __stbuf);
@@ -56,6 +70,10 @@ int deltafs_accessdir(const char* __path, int __mode);
 int deltafs_unlink(const char* __path);
 typedef int (*deltafs_filler_t)(const char* __name, void* __arg);
 int deltafs_listdir(const char* __path, deltafs_filler_t, void* __arg);
+typedef int (*deltafs_plusfiller_t)(const char* __name,
+                                    const struct stat* __stbuf, void* __arg);
+int deltafs_listdirplus(const char* __path, deltafs_plusfiller_t,
+                        void* __arg);
 ssize_t deltafs_pread(int __fd, void* __buf, size_t __sz, off_t __off);
 ssize_t deltafs_read(int __fd, void* __buf, size_t __sz);
 ssize_t deltafs_pwrite(int __fd, const void* __buf, size_t __sz, off_t __off);
@@ -131,12 +149,30 @@ int deltafs_plfsdir_put(deltafs_plfsdir_t* __dir, const char* __key,
    Return 0 on success, -1 on errors. */
 int deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
                            int __epoch, const void* __buf, size_t __sz);
+/* Inserts __n key-value pairs in a single call. The i-th pair is formed by
+   __keys[i] (__keylens[i] bytes) and __values[i] (__szs[i] bytes).
+   __values[i] may only be NULL when __szs[i] is 0.
+   Return 0 on success, -1 on errors. */
+int deltafs_plfsdir_put_batch(deltafs_plfsdir_t* __dir, const char** __keys,
+                              const size_t* __keylens, int __epoch,
+                              const char** __values, const size_t* __szs,
+                              size_t __n);
 /* Returns NULL if not found. A malloc()ed array otherwise.
    Stores the size of the value in *__sz.
    The result should be deleted by free(). */
 char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
                           size_t __keylen, size_t* __sz, size_t* __table_seeks,
                           size_t* __seeks);
+/* Fetches the values of __n keys in a single call. On success, __values[i]
+   is set to a malloc()ed array holding the value of __keys[i], or NULL if
+   the key is not found. If __szs is not NULL, __szs[i] is set to the size
+   of the value (0 if not found). Each value should be deleted by free().
+   Seek counts are summed over all keys. Keys are read one after another.
+   Return 0 on success, -1 on errors. */
+int deltafs_plfsdir_get_batch(deltafs_plfsdir_t* __dir, const char** __keys,
+                              const size_t* __keylens, size_t __n,
+                              char** __values, size_t* __szs,
+                              size_t* __table_seeks, size_t* __seeks);
 /* Returns NULL if not found. A malloc()ed array otherwise.
    Stores the length of the file in *__sz.
    The result should be deleted by free(). */
@@ -144,7 +180,8 @@ void* deltafs_plfsdir_readall(deltafs_plfsdir_t* __dir, const char* __fname,
                               size_t* __sz, size_t* __table_seeks,
                               size_t* __seeks);
 /* Returns NULL if not found. A malloc()ed array otherwise.
-   The result should be deleted by free(). */
+   The result should be deleted by free(). Writers and readers export
+   different properties; "json" returns a snapshot of all of them. */
 char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir, const char* __key);
 /* A helper wrapper implemented on top of deltafs_plfsdir_get_property().
    Used when the property is known to be an integer. */
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 int main(int argc, char* argv[]) {
 #if defined(PDLFS_GLOG)
   FLAGS_logtostderr = true;
@@ -44,10 +45,28 @@ int main(int argc, char* argv[]) {
       return 0;
     }
   };
+  // Stats come along with names so "-l" costs no extra lookups
+  struct StatPrinter {
+    static int Print(const char* name, const struct stat* buf, void* count) {
+      (*reinterpret_cast<int*>(count))++;
+      fprintf(stdout, "%06o %5d %5d %12llu %s\n", int(buf->st_mode),
+              int(buf->st_uid), int(buf->st_gid),
+              (unsigned long long)buf->st_size, name);
+      return 0;
+    }
+  };
+  bool long_format = false;
+  if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+    long_format = true;
+    argv++;
+    argc--;
+  }
   for (int i = 1; i < argc; i++) {
     int count = 0;
     if (argc > 2) fprintf(stdout, "%s:\n", argv[i]);
-    int r = deltafs_listdir(argv[i], NamePrinter::Print, &count);
+    int r = long_format
+                ? deltafs_listdirplus(argv[i], StatPrinter::Print, &count)
+                : deltafs_listdir(argv[i], NamePrinter::Print, &count);
     if (r != 0) {
       fprintf(stderr, "ls: cannot list directory '%s': %s\n", argv[i],
               strerror(errno));
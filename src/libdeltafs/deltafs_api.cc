@@ -13,6 +13,7 @@
 #include "deltafs_client.h"
 #include "deltafs_envs.h"
 #include "deltafs_plfsio.h"
+#include "deltafs_plfsio_batch.h"
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/dbfiles.h"
@@ -47,11 +48,6 @@ static void SetErrno(const pdlfs::Status& s);
 static pdlfs::Status bg_status;
 static pdlfs::port::OnceType once = PDLFS_ONCE_INIT;
 static pdlfs::Client* client = NULL;
-static char* MakeChar(uint64_t i) {
-  char tmp[20];
-  snprintf(tmp, sizeof(tmp), "%llu", static_cast<unsigned long long>(i));
-  return strdup(tmp);
-}
 static inline int NoClient() {
   if (!bg_status.ok()) {
     SetErrno(bg_status);
@@ -423,16 +419,52 @@ int deltafs_listdir(const char* __path, deltafs_filler_t __filler,
       return NoClient();
     }
   }
-  std::vector<std::string> names;
+  struct Filler {
+    deltafs_filler_t filler;
+    void* arg;
+    static int Fill(const pdlfs::Slice& name, const pdlfs::Stat*, void* arg) {
+      Filler* f = reinterpret_cast<Filler*>(arg);
+      return f->filler(name.ToString().c_str(), f->arg);
+    }
+  };
+  Filler f;
+  f.filler = __filler;
+  f.arg = __arg;
   pdlfs::Status s;
-  s = client->Listdir(__path, &names);
+  s = client->Listdir(__path, Filler::Fill, &f);
   if (s.ok()) {
-    for (std::vector<std::string>::iterator iter = names.begin();
-         iter != names.end(); ++iter) {
-      if (__filler(iter->c_str(), __arg) != 0) {
-        break;
-      }
+    return 0;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
+int deltafs_listdirplus(const char* __path, deltafs_plusfiller_t __filler,
+                        void* __arg) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+  struct Filler {
+    deltafs_plusfiller_t filler;
+    void* arg;
+    static int Fill(const pdlfs::Slice& name, const pdlfs::Stat* stat,
+                    void* arg) {
+      Filler* f = reinterpret_cast<Filler*>(arg);
+      struct stat buf;
+      pdlfs::__cpstat(*stat, &buf);
+      return f->filler(name.ToString().c_str(), &buf, f->arg);
     }
+  };
+  Filler f;
+  f.filler = __filler;
+  f.arg = __arg;
+  pdlfs::Status s;
+  s = client->Listdir(__path, Filler::Fill, &f, true);
+  if (s.ok()) {
     return 0;
   } else {
     SetErrno(s);
@@ -531,6 +563,49 @@ int deltafs_mkdir(const char* __path, mode_t __mode) {
   }
 }
 
+int deltafs_bcreat(const char* __dir, const char** __names, size_t __n,
+                   mode_t __mode, int* __errs) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+  pdlfs::Status s;
+  std::vector<std::string> names;
+  std::vector<pdlfs::Status> statuses;
+  for (size_t i = 0; i < __n; i++) {
+    if (__names[i] == NULL) {
+      s = BadArgs();
+      break;
+    } else {
+      names.push_back(__names[i]);
+    }
+  }
+  if (s.ok()) {
+    s = client->Bcreat(__dir, names, __mode, &statuses);
+  }
+  if (s.ok()) {
+    for (size_t i = 0; i < __n; i++) {
+      if (!statuses[i].ok()) {
+        if (s.ok()) s = statuses[i];
+        if (__errs != NULL) {
+          SetErrno(statuses[i]);
+          __errs[i] = errno;
+        }
+      } else if (__errs != NULL) {
+        __errs[i] = 0;
+      }
+    }
+  }
+  if (s.ok()) {
+    return 0;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
 int deltafs_chmod(const char* __path, mode_t __mode) {
   if (client == NULL) {
     pdlfs::port::InitOnce(&once, InitClient);
@@ -623,6 +698,58 @@ int deltafs_nonop() {
   return 0;
 }
 
+int deltafs_srvstats(int __srv_id, char** __result) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+
+  std::string info;
+  pdlfs::Status s;
+  s = client->Getstats(__srv_id, &info);
+  if (s.ok()) {
+    *__result = strdup(info.c_str());
+    return 0;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
+int deltafs_clistats(char** __result) {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+
+  std::string info;
+  client->Clistats(&info);
+  *__result = strdup(info.c_str());
+  return 0;
+}
+
+int deltafs_syncmeta() {
+  if (client == NULL) {
+    pdlfs::port::InitOnce(&once, InitClient);
+    if (client == NULL) {
+      return NoClient();
+    }
+  }
+
+  pdlfs::Status s;
+  s = client->Syncmeta();
+  if (s.ok()) {
+    return 0;
+  } else {
+    SetErrno(s);
+    return -1;
+  }
+}
+
 void deltafs_print_sysinfo() {
   // Print to system logger, usually stderr or glog
   pdlfs::PrintSysInfo();
@@ -648,6 +775,8 @@ typedef pdlfs::plfsio::DirOptions DirOptions;
 typedef pdlfs::plfsio::DirWriter DirWriter;
 // Dir Reader
 typedef pdlfs::plfsio::DirReader DirReader;
+// Batch cursor
+typedef pdlfs::plfsio::BatchCursor BatchCursor;
 
 // Default system env.
 static inline pdlfs::Env* DefaultDirEnv() {
@@ -960,6 +1089,67 @@ static bool IsDirOpened(deltafs_plfsdir_t* dir) {
   }
 }
 
+// A batch cursor over caller-owned key and value arrays. Entries are
+// addressed by their array index.
+class ArrayBatch : public BatchCursor {
+ public:
+  ArrayBatch(const char** keys, const size_t* keylens, const char** values,
+             const size_t* szs, size_t n)
+      : keys_(keys),
+        keylens_(keylens),
+        values_(values),
+        szs_(szs),
+        n_(n),
+        i_(n) {}
+  virtual ~ArrayBatch() {}
+
+  virtual bool Valid() const { return i_ < n_; }
+  virtual void Seek(uint32_t offset) { i_ = offset; }
+  virtual void Next() { i_++; }
+  virtual pdlfs::Status status() const { return pdlfs::Status::OK(); }
+  virtual uint32_t offset() const { return static_cast<uint32_t>(i_); }
+
+  virtual pdlfs::Slice fid() const {
+    return pdlfs::Slice(keys_[i_], keylens_[i_]);
+  }
+
+  virtual pdlfs::Slice data() const {
+    return pdlfs::Slice(values_[i_], szs_[i_]);
+  }
+
+ private:
+  const char** keys_;
+  const size_t* keylens_;
+  const char** values_;
+  const size_t* szs_;
+  size_t n_;
+  size_t i_;
+};
+
+static bool IsBadKeys(const char** keys, const size_t* keylens, size_t n) {
+  if (keys == NULL || keylens == NULL) {
+    return true;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (keys[i] == NULL || keylens[i] == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool IsBadValues(const char** values, const size_t* szs, size_t n) {
+  if (values == NULL || szs == NULL) {
+    return true;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (values[i] == NULL && szs[i] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name) {
@@ -1039,6 +1229,37 @@ int deltafs_plfsdir_append(deltafs_plfsdir_t* __dir, const char* __fname,
   }
 }
 
+int deltafs_plfsdir_put_batch(deltafs_plfsdir_t* __dir, const char** __keys,
+                              const size_t* __keylens, int __epoch,
+                              const char** __values, const size_t* __szs,
+                              size_t __n) {
+  pdlfs::Status s;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_WRONLY) {
+    s = BadArgs();
+  } else if (__n == 0) {
+    // Empty batch
+  } else if (static_cast<uint32_t>(__n) != __n) {
+    s = BadArgs();
+  } else if (IsBadKeys(__keys, __keylens, __n)) {
+    s = BadArgs();
+  } else if (IsBadValues(__values, __szs, __n)) {
+    s = BadArgs();
+  } else {
+    DirWriter* writer = __dir->io.writer;
+    ArrayBatch batch(__keys, __keylens, __values, __szs, __n);
+    s = writer->Write(&batch, __epoch);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch) {
   pdlfs::Status s;
 
@@ -1103,39 +1324,15 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir,
   } else if (__key == NULL || __key[0] == 0) {
     return NULL;
   } else {
-    pdlfs::Slice k(__key);
+    std::string value;
+    bool ok = false;
     if (__dir->mode == O_WRONLY) {
-      if (k == "total_user_data") {
-        uint64_t vsz = __dir->io.writer->TEST_value_bytes();
-        uint64_t ksz = __dir->io.writer->TEST_key_bytes();
-        return MakeChar(ksz + vsz);
-      } else if (k == "total_memory_usage") {
-        uint64_t mem = __dir->io.writer->TEST_total_memory_usage();
-        return MakeChar(mem);
-      } else if (k == "num_keys") {
-        uint64_t nks = __dir->io.writer->TEST_num_keys();
-        return MakeChar(nks);
-      } else if (k == "num_dropped_keys") {
-        uint64_t nds = __dir->io.writer->TEST_num_dropped_keys();
-        return MakeChar(nds);
-      } else if (k == "sstable_filter_bytes") {
-        uint64_t fsz = __dir->io.writer->TEST_raw_filter_contents();
-        return MakeChar(fsz);
-      } else if (k == "sstable_index_bytes") {
-        uint64_t isz = __dir->io.writer->TEST_raw_index_contents();
-        return MakeChar(isz);
-      } else if (k == "sstable_data_bytes") {
-        uint64_t dsz = __dir->io.writer->TEST_raw_data_contents();
-        return MakeChar(dsz);
-      } else if (k == "num_data_blocks") {
-        uint64_t nbs = __dir->io.writer->TEST_num_data_blocks();
-        return MakeChar(nbs);
-      } else if (k == "num_sstables") {
-        uint64_t tbs = __dir->io.writer->TEST_num_sstables();
-        return MakeChar(tbs);
-      }
+      ok = __dir->io.writer->GetProperty(__key, &value);
     } else if (__dir->mode == O_RDONLY) {
-      // TODO
+      ok = __dir->io.reader->GetProperty(__key, &value);
+    }
+    if (ok) {
+      return strdup(value.c_str());
     }
     return NULL;
   }
@@ -1190,6 +1387,72 @@ char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
   }
 }
 
+int deltafs_plfsdir_get_batch(deltafs_plfsdir_t* __dir, const char** __keys,
+                              const size_t* __keylens, size_t __n,
+                              char** __values, size_t* __szs,
+                              size_t* __table_seeks, size_t* __seeks) {
+  pdlfs::Status s;
+  char buf[256];  // For storing temporary block contents
+  std::string dst;
+  size_t i = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (IsBadKeys(__keys, __keylens, __n)) {
+    s = BadArgs();
+  } else if (__values == NULL) {
+    s = BadArgs();
+  } else {
+    DirReader* reader = __dir->io.reader;
+    size_t total_table_seeks = 0;
+    size_t total_seeks = 0;
+    for (; i < __n; i++) {
+      size_t table_seeks = 0;
+      size_t seeks = 0;
+      dst.clear();
+      s = reader->ReadAll(pdlfs::Slice(__keys[i], __keylens[i]), &dst, buf,
+                          sizeof(buf), &table_seeks, &seeks);
+      if (!s.ok()) {
+        break;
+      }
+      if (dst.empty()) {
+        __values[i] = NULL;  // Not found
+      } else {
+        __values[i] = static_cast<char*>(malloc(dst.size()));
+        memcpy(__values[i], dst.data(), dst.size());
+      }
+      if (__szs != NULL) {
+        __szs[i] = dst.size();
+      }
+      total_table_seeks += table_seeks;
+      total_seeks += seeks;
+    }
+    if (s.ok()) {
+      if (__table_seeks != NULL) {
+        *__table_seeks = total_table_seeks;
+      }
+      if (__seeks != NULL) {
+        *__seeks = total_seeks;
+      }
+    } else {
+      // Release the values fetched so far
+      while (i != 0) {
+        i--;
+        free(__values[i]);
+        __values[i] = NULL;
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 void* deltafs_plfsdir_readall(deltafs_plfsdir_t* __dir, const char* __fname,
                               size_t* __sz, size_t* __table_seeks,
                               size_t* __seeks) {
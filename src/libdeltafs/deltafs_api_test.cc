@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "deltafs/deltafs_api.h"
+
+#include "deltafs_client.h"
+#include "deltafs_mds.h"
+#include "mds_api.h"
+
+#include "pdlfs-common/leveldb/db/db.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+
+class PlfsDirApiTest {
+ public:
+  PlfsDirApiTest() {
+    dirname_ = test::TmpDir() + "/plfsdir_api_test";
+    conf_ = "lg_parts=0";
+  }
+
+  deltafs_plfsdir_t* Open(int mode) {
+    deltafs_plfsdir_t* dir = deltafs_plfsdir_create_handle(conf_.c_str(), mode);
+    ASSERT_TRUE(dir != NULL);
+    ASSERT_EQ(deltafs_plfsdir_open(dir, dirname_.c_str()), 0);
+    return dir;
+  }
+
+  void AddKeys(int n) {
+    char tmp[20];
+    for (int i = 0; i < n; i++) {
+      snprintf(tmp, sizeof(tmp), "k%04d", i);
+      keys_.push_back(tmp);
+      values_.push_back(std::string(tmp) + "-value");
+    }
+    for (int i = 0; i < n; i++) {
+      kp_.push_back(keys_[i].data());
+      kl_.push_back(keys_[i].size());
+      vp_.push_back(values_[i].data());
+      vl_.push_back(values_[i].size());
+    }
+  }
+
+  std::string dirname_;
+  std::string conf_;
+  std::vector<std::string> keys_;
+  std::vector<std::string> values_;
+  std::vector<const char*> kp_;
+  std::vector<size_t> kl_;
+  std::vector<const char*> vp_;
+  std::vector<size_t> vl_;
+};
+
+TEST(PlfsDirApiTest, BatchPutGet) {
+  AddKeys(1000);
+  deltafs_plfsdir_t* dir = Open(O_WRONLY);
+  ASSERT_EQ(deltafs_plfsdir_put_batch(dir, &kp_[0], &kl_[0], 0, &vp_[0],
+                                      &vl_[0], kp_.size()),
+            0);
+  ASSERT_EQ(deltafs_plfsdir_epoch_flush(dir, 0), 0);
+  ASSERT_EQ(deltafs_plfsdir_finish(dir), 0);
+  deltafs_plfsdir_free_handle(dir);
+
+  kp_.push_back("non-exists");
+  kl_.push_back(strlen("non-exists"));
+  const size_t n = kp_.size();
+  std::vector<char*> results(n);
+  std::vector<size_t> sizes(n);
+  size_t table_seeks = 0;
+  size_t seeks = 0;
+  dir = Open(O_RDONLY);
+  ASSERT_EQ(deltafs_plfsdir_get_batch(dir, &kp_[0], &kl_[0], n, &results[0],
+                                      &sizes[0], &table_seeks, &seeks),
+            0);
+  for (size_t i = 0; i < values_.size(); i++) {
+    ASSERT_TRUE(results[i] != NULL);
+    ASSERT_EQ(std::string(results[i], sizes[i]), values_[i]);
+    free(results[i]);
+  }
+  ASSERT_TRUE(results[n - 1] == NULL);
+  ASSERT_EQ(sizes[n - 1], 0);
+  ASSERT_GE(table_seeks, values_.size());
+  deltafs_plfsdir_free_handle(dir);
+}
+
+TEST(PlfsDirApiTest, Properties) {
+  AddKeys(100);
+  deltafs_plfsdir_t* dir = Open(O_WRONLY);
+  ASSERT_EQ(deltafs_plfsdir_put_batch(dir, &kp_[0], &kl_[0], 0, &vp_[0],
+                                      &vl_[0], kp_.size()),
+            0);
+  ASSERT_EQ(deltafs_plfsdir_epoch_flush(dir, 0), 0);
+  ASSERT_EQ(deltafs_plfsdir_get_integer_property(dir, "num_keys"), 100);
+  ASSERT_TRUE(deltafs_plfsdir_get_property(dir, "no-such-property") == NULL);
+  ASSERT_EQ(deltafs_plfsdir_finish(dir), 0);
+  deltafs_plfsdir_free_handle(dir);
+
+  dir = Open(O_RDONLY);
+  std::vector<char*> results(10);
+  ASSERT_EQ(deltafs_plfsdir_get_batch(dir, &kp_[0], &kl_[0], 10, &results[0],
+                                      NULL, NULL, NULL),
+            0);
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_TRUE(results[i] != NULL);
+    free(results[i]);
+  }
+  ASSERT_EQ(deltafs_plfsdir_get_integer_property(dir, "num_queries"), 10);
+  char* json = deltafs_plfsdir_get_property(dir, "json");
+  ASSERT_TRUE(json != NULL);
+  ASSERT_TRUE(strstr(json, "\"num_queries\":10") != NULL) << json;
+  free(json);
+  deltafs_plfsdir_free_handle(dir);
+}
+
+TEST(PlfsDirApiTest, BatchBadArgs) {
+  AddKeys(2);
+  deltafs_plfsdir_t* dir = Open(O_WRONLY);
+  vp_[1] = NULL;  // NULL value with a non-zero size
+  ASSERT_EQ(deltafs_plfsdir_put_batch(dir, &kp_[0], &kl_[0], 0, &vp_[0],
+                                      &vl_[0], kp_.size()),
+            -1);
+  kl_[1] = 0;  // Empty key
+  vl_[1] = 0;
+  ASSERT_EQ(deltafs_plfsdir_put_batch(dir, &kp_[0], &kl_[0], 0, &vp_[0],
+                                      &vl_[0], kp_.size()),
+            -1);
+  char* result;
+  ASSERT_EQ(deltafs_plfsdir_get_batch(dir, &kp_[0], &kl_[0], 1, &result, NULL,
+                                      NULL, NULL),
+            -1);  // Not opened for reading
+  ASSERT_EQ(deltafs_plfsdir_finish(dir), 0);
+  deltafs_plfsdir_free_handle(dir);
+}
+
+// A metadata server run in the test process and shared by all tests
+// using the client api. The api opens a single client per process, which
+// reaches the server over the in-process rpc transport.
+namespace {
+const char kUri[] = "inproc://deltafs_api_test";
+port::OnceType server_once = PDLFS_ONCE_INIT;
+port::Mutex* server_mu = NULL;
+port::CondVar* server_cv = NULL;
+MetadataServer* server = NULL;
+bool server_running = false;
+
+void RunServer(void* arg) {
+  server->RunTillInterruptionOrError();
+  MutexLock ml(server_mu);
+  server_running = false;
+  server_cv->SignalAll();
+}
+
+// Start the server and wait until it serves calls.
+void StartServer() {
+  const std::string root = test::TmpDir() + "/deltafs_api_test";
+  Env::Default()->CreateDir(root.c_str());
+  DBOptions dbopts;
+  dbopts.env = Env::Default();
+  DestroyDB(root + "/outputs/shard-00000000", dbopts);
+  setenv("DELTAFS_RPCProto", "inproc", 1);
+  setenv("DELTAFS_MetadataSrvAddrs", kUri, 1);
+  setenv("DELTAFS_Inputs", (root + "/inputs").c_str(), 1);
+  setenv("DELTAFS_Outputs", (root + "/outputs").c_str(), 1);
+  setenv("DELTAFS_RunDir", (root + "/run").c_str(), 1);
+  server_mu = new port::Mutex;
+  server_cv = new port::CondVar(server_mu);
+  ASSERT_OK(MetadataServer::Open(&server));
+  server_running = true;
+  Env::Default()->StartThread(RunServer, NULL);
+  RPCOptions options;
+  options.mode = kClientOnly;
+  options.uri = "inproc";
+  RPC* rpc = RPC::Open(options);
+  rpc::If* stub = rpc->OpenClientFor(kUri);
+  MDS::RPC::CLI cli(stub);
+  MDS::OpensessionOptions sessopts;
+  MDS::OpensessionRet ret;
+  while (cli.Opensession(sessopts, &ret).IsDisconnected()) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  delete stub;
+  delete rpc;
+}
+
+void StopServer() {
+  if (server != NULL) {
+    server->Interrupt();
+    MutexLock ml(server_mu);
+    while (server_running) {
+      server_cv->Wait();
+    }
+    delete server;
+    server = NULL;
+  }
+}
+}  // namespace
+
+class ClientApiTest {
+ public:
+  ClientApiTest() { port::InitOnce(&server_once, StartServer); }
+
+  // Open a client of the test's own with a config flag set to a given value.
+  // Other tests keep using the client shared by the api.
+  static Client* OpenClient(const char* flag, const char* value) {
+    setenv(flag, value, 1);
+    Client* cli = NULL;
+    Status s = Client::Open(&cli);
+    unsetenv(flag);
+    ASSERT_OK(s);
+    return cli;
+  }
+};
+
+namespace {
+struct WriteState {
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_ready;  // Writers that have opened their files
+  int num_done;
+  bool go;
+  int num_writes;  // Per writer
+  int num_errors;
+
+  WriteState() : cv(&mu), num_ready(0), num_done(0), go(false) {}
+};
+
+struct WriteArg {
+  WriteState* state;
+  int id;
+};
+}  // namespace
+
+// Each writer writes to a file of its own.
+static void WriteTask(void* arg) {
+  WriteArg* a = reinterpret_cast<WriteArg*>(arg);
+  WriteState* state = a->state;
+  char tmp[50];
+  snprintf(tmp, sizeof(tmp), "/bench_%d", a->id);
+  char data[64];
+  memset(data, 'x', sizeof(data));
+  int errors = 0;
+  const int fd = deltafs_open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd == -1) {
+    errors++;
+  }
+  {
+    MutexLock ml(&state->mu);
+    state->num_ready++;
+    state->cv.SignalAll();
+    while (!state->go) {
+      state->cv.Wait();
+    }
+  }
+  for (int i = 0; fd != -1 && i < state->num_writes; i++) {
+    if (deltafs_write(fd, data, sizeof(data)) != sizeof(data)) {
+      errors++;
+    }
+  }
+  if (fd != -1 && deltafs_close(fd) != 0) {
+    errors++;
+  }
+  MutexLock ml(&state->mu);
+  state->num_errors += errors;
+  state->num_done++;
+  state->cv.SignalAll();
+}
+
+// Writers owning distinct descriptors should not contend with each other
+// inside the client.
+TEST(ClientApiTest, ConcurrentWrites) {
+  Env* const env = Env::Default();
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    WriteState state;
+    state.num_writes = 20000;
+    state.num_errors = 0;
+    std::vector<WriteArg> args(threads);
+    for (int i = 0; i < threads; i++) {
+      args[i].state = &state;
+      args[i].id = i;
+      env->StartThread(WriteTask, &args[i]);
+    }
+    uint64_t start;
+    {
+      MutexLock ml(&state.mu);
+      while (state.num_ready < threads) {
+        state.cv.Wait();
+      }
+      start = env->NowMicros();
+      state.go = true;
+      state.cv.SignalAll();
+      while (state.num_done < threads) {
+        state.cv.Wait();
+      }
+    }
+    const uint64_t dura = env->NowMicros() - start;
+    const int ops = threads * state.num_writes;
+    fprintf(stderr, "%d threads: %d writes in %.3f ms (%.0f ops/s)\n",
+            threads, ops, dura / 1000.0, ops * 1000000.0 / dura);
+    ASSERT_EQ(state.num_errors, 0);
+  }
+  struct stat buf;
+  ASSERT_EQ(deltafs_stat("/bench_0", &buf), 0);
+  ASSERT_EQ(buf.st_size, 20000 * 64);
+}
+
+// Writes stay visible through the descriptor they were written to.
+TEST(ClientApiTest, ReadYourWrites) {
+  const int fd = deltafs_open("/buffered", O_CREAT | O_RDWR | O_TRUNC, 0644);
+  ASSERT_TRUE(fd != -1);
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    char tmp[20];
+    const int n = snprintf(tmp, sizeof(tmp), "r%04d;", i);
+    ASSERT_EQ(deltafs_write(fd, tmp, n), n);
+    expected.append(tmp, n);
+  }
+  struct stat buf;
+  ASSERT_EQ(deltafs_fstat(fd, &buf), 0);
+  ASSERT_EQ(buf.st_size, expected.size());
+  ASSERT_EQ(deltafs_pwrite(fd, "abc", 3, expected.size()), 3);
+  expected += "abc";
+  ASSERT_EQ(deltafs_pwrite(fd, "def", 3, expected.size()), 3);
+  expected += "def";
+  ASSERT_EQ(deltafs_pwrite(fd, "R", 1, 0), 1);  // Not contiguous
+  expected[0] = 'R';
+  char scratch[1000];
+  ASSERT_EQ(deltafs_pread(fd, scratch, sizeof(scratch), 0), expected.size());
+  ASSERT_EQ(std::string(scratch, expected.size()), expected);
+  ASSERT_EQ(deltafs_close(fd), 0);
+  ASSERT_EQ(deltafs_stat("/buffered", &buf), 0);
+  ASSERT_EQ(buf.st_size, expected.size());
+}
+
+// Small writes are coalesced by clients with a write buffer. Write the same
+// records with and without one and check that both files read back the same,
+// through the writing descriptor and through another client.
+TEST(ClientApiTest, BufferedWrites) {
+  const size_t kRecordSize = 7;
+  std::string expected;
+  for (int i = 0; i < 10000; i++) {
+    char tmp[20];
+    snprintf(tmp, sizeof(tmp), "r%05d;", i);
+    expected.append(tmp, kRecordSize);
+  }
+  Env* const env = Env::Default();
+  const char* const sizes[] = {"0", "4k"};
+  for (int k = 0; k < 2; k++) {
+    Client* const cli = OpenClient("DELTAFS_SizeOfCliWriteBuffer", sizes[k]);
+    char path[50];
+    snprintf(path, sizeof(path), "/buffered_%s", sizes[k]);
+    FileInfo info;
+    ASSERT_OK(cli->Fopen(path, O_CREAT | O_RDWR | O_TRUNC, 0644, &info));
+    const uint64_t start = env->NowMicros();
+    for (size_t off = 0; off < expected.size(); off += kRecordSize) {
+      ASSERT_OK(cli->Write(info.fd, Slice(expected.data() + off, kRecordSize)));
+    }
+    const uint64_t dura = env->NowMicros() - start;
+    const int ops = static_cast<int>(expected.size() / kRecordSize);
+    fprintf(stderr, "write buffer %s: %d writes in %.3f ms (%.0f ops/s)\n",
+            sizes[k], ops, dura / 1000.0, ops * 1000000.0 / dura);
+    std::string scratch(expected.size(), 0);
+    Slice result;
+    ASSERT_OK(cli->Pread(info.fd, &result, 0, scratch.size(), &scratch[0]));
+    ASSERT_EQ(result.ToString(), expected);
+    ASSERT_OK(cli->Close(info.fd));
+    delete cli;
+
+    const int fd = deltafs_open(path, O_RDONLY, 0);
+    ASSERT_TRUE(fd != -1);
+    ASSERT_EQ(deltafs_pread(fd, &scratch[0], scratch.size(), 0),
+              expected.size());
+    ASSERT_EQ(scratch, expected);
+    ASSERT_EQ(deltafs_close(fd), 0);
+  }
+}
+
+// Stream a file in small reads through a client with readahead, then read
+// it at random offsets.
+TEST(ClientApiTest, SequentialReads) {
+  const size_t kFileSize = 4 << 20;
+  const size_t kReadSize = 16 << 10;
+  std::string data(kFileSize, 0);
+  for (size_t i = 0; i < kFileSize; i++) {
+    data[i] = static_cast<char>(i % 251);
+  }
+  const int wfd = deltafs_open("/stream", O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  ASSERT_TRUE(wfd != -1);
+  ASSERT_EQ(deltafs_write(wfd, data.data(), kFileSize), kFileSize);
+  ASSERT_EQ(deltafs_close(wfd), 0);
+
+  Client* const cli = OpenClient("DELTAFS_SizeOfCliReadahead", "256k");
+  std::string scratch(kReadSize, 0);
+  FileInfo info;
+  ASSERT_OK(cli->Fopen("/stream", O_RDONLY, 0, &info));
+  size_t off = 0;
+  for (;;) {
+    Slice result;
+    ASSERT_OK(cli->Read(info.fd, &result, kReadSize, &scratch[0]));
+    if (result.empty()) break;
+    ASSERT_TRUE(memcmp(result.data(), data.data() + off, result.size()) == 0);
+    off += result.size();
+  }
+  ASSERT_EQ(off, kFileSize);
+
+  Random rnd(301);
+  for (int i = 0; i < 100; i++) {
+    const size_t o = rnd.Uniform(kFileSize - kReadSize);
+    Slice result;
+    ASSERT_OK(cli->Pread(info.fd, &result, o, kReadSize, &scratch[0]));
+    ASSERT_EQ(result.size(), kReadSize);
+    ASSERT_TRUE(memcmp(result.data(), data.data() + o, kReadSize) == 0);
+  }
+  ASSERT_OK(cli->Close(info.fd));
+  std::string stats;
+  cli->Clistats(&stats);
+  delete cli;
+  unsigned long long reads = 0;
+  unsigned long long hits = 0;
+  ASSERT_EQ(sscanf(stats.c_str(), "readahead: %llu reads, %llu hits", &reads,
+                   &hits),
+            2);
+  ASSERT_GT(reads, 0);
+  // All but the first sequential read should hit
+  ASSERT_GE(hits, kFileSize / kReadSize - 1);
+}
+
+}  // namespace pdlfs
+
+int main(int argc, char** argv) {
+  int r = ::pdlfs::test::RunAllTests(&argc, &argv);
+  ::pdlfs::StopServer();
+  return r;
+}
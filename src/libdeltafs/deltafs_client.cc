@@ -10,7 +10,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sched.h>
 #include <unistd.h>
+#include <new>
 #include <set>
 
 #include "deltafs_client.h"
@@ -57,7 +59,7 @@ class ReadablePlfsDir {
   ReadablePlfsDir& operator=(const ReadablePlfsDir&);
   ReadablePlfsDir(const ReadablePlfsDir&);
 
-  int refs;
+  std::atomic<int> refs;
 
  public:
   ReadablePlfsDir() : refs(0), reader(NULL) {}
@@ -65,9 +67,9 @@ class ReadablePlfsDir {
   void Ref() { refs++; }
 
   void Unref() {
-    assert(refs > 0);
-    refs--;
-    if (refs == 0) {
+    const int r = refs.fetch_sub(1);
+    assert(r > 0);
+    if (r == 1) {
       delete this;
     }
   }
@@ -128,7 +130,7 @@ class WritablePlfsDir {
   WritablePlfsDir& operator=(const WritablePlfsDir&);
   WritablePlfsDir(const WritablePlfsDir&);
 
-  int refs;
+  std::atomic<int> refs;
 
  public:
   WritablePlfsDir() : refs(0), writer(NULL) {}
@@ -136,9 +138,9 @@ class WritablePlfsDir {
   void Ref() { refs++; }
 
   void Unref() {
-    assert(refs > 0);
-    refs--;
-    if (refs == 0) {
+    const int r = refs.fetch_sub(1);
+    assert(r > 0);
+    if (r == 1) {
       delete this;
     }
   }
@@ -183,21 +185,41 @@ static inline WritablePlfsFile* ToWritablePlfsFile(Fio::Handle* fh) {
 #endif
 }
 
-Client::Client(size_t max_open_files) {
+Client::Client(size_t max_open_files, size_t write_buffer_size)
+    : bg_cv_(&mutex_), num_bg_readaheads_(0) {
   mask_.Release_Store(reinterpret_cast<void*>(S_IWGRP | S_IWOTH));
   has_curroot_set_.Release_Store(NULL);
   has_curdir_set_.Release_Store(NULL);
   dummy_.prev = &dummy_;
   dummy_.next = &dummy_;
   max_open_fds_ = max_open_files;
-  fds_ = new File*[max_open_fds_]();
+  write_buf_size_ = write_buffer_size;
+  max_readahead_ = 0;
+  readahead_pool_ = NULL;
+  num_ra_reads_.store(0);
+  num_ra_hits_.store(0);
+  ra_bytes_.store(0);
+  ra_wasted_bytes_.store(0);
+  fds_ = new FileSlot[max_open_fds_];
+  for (size_t i = 0; i < max_open_fds_; i++) {
+    fds_[i].file.store(NULL, std::memory_order_relaxed);
+    fds_[i].pins.store(0, std::memory_order_relaxed);
+  }
   num_open_fds_ = 0;
   fd_slot_ = 0;
 }
 
 Client::~Client() {
+  mutex_.Lock();
+  while (num_bg_readaheads_ != 0) {
+    bg_cv_.Wait();
+  }
+  mutex_.Unlock();
+  delete readahead_pool_;
   delete[] fds_;
   delete mdscli_;
+  delete listdir_pool_;
+  delete bg_pool_;
   delete mdsfty_;
   delete fio_;
   delete env_;
@@ -209,22 +231,27 @@ Client::~Client() {
 size_t Client::Alloc(File* f) {
   mutex_.AssertHeld();
   assert(num_open_fds_ < max_open_fds_);
-  while (fds_[fd_slot_] != NULL) {
+  while (fds_[fd_slot_].file.load(std::memory_order_relaxed) != NULL) {
     fd_slot_ = (1 + fd_slot_) % max_open_fds_;
   }
-  fds_[fd_slot_] = f;
+  fds_[fd_slot_].file.store(f);
   num_open_fds_++;
   return fd_slot_;
 }
 
-// Deallocate a given file descriptor slot.
-// The associated file entry is not un-referenced.
+// Deallocate a given file descriptor slot. Wait for lookups that may
+// have found the file in the slot to finish referencing it.
+// The reference held by the slot is not dropped.
 // REQUIRES: mutex_ has been locked.
 Client::File* Client::Free(size_t index) {
   mutex_.AssertHeld();
-  File* f = fds_[index];
+  FileSlot* const slot = &fds_[index];
+  File* f = slot->file.load(std::memory_order_relaxed);
   assert(f != NULL);
-  fds_[index] = NULL;
+  slot->file.store(NULL);
+  while (slot->pins.load() != 0) {
+    sched_yield();
+  }
   assert(num_open_fds_ > 0);
   num_open_fds_--;
   return f;
@@ -234,54 +261,75 @@ Client::File* Client::Free(size_t index) {
 // REQUIRES: mutex_ has been locked.
 size_t Client::Open(const Slice& encoding, int flags, Fio::Handle* fh) {
   assert(encoding.size() != 0);
-  File* file = static_cast<File*>(malloc(sizeof(File) + encoding.size() - 1));
+  void* mem = malloc(sizeof(File) + encoding.size() - 1);
+  File* file = new (mem) File;
   memcpy(file->encoding_data, encoding.data(), encoding.size());
   file->encoding_length = encoding.size();
   file->next = &dummy_;
   file->prev = dummy_.prev;
   file->prev->next = file;
   file->next->prev = file;
-  file->seq_write = 0;
-  file->seq_flush = 0;
+  file->seq_write.store(0, std::memory_order_relaxed);
+  file->seq_flush.store(0, std::memory_order_relaxed);
   file->flags = flags;
-  file->refs = 1;
+  file->refs.store(1, std::memory_order_relaxed);  // Held by the fd slot
+  file->write_off = 0;
+  file->write_positional = false;
+  file->read_pos = 0;
+  file->ra_next = 0;
+  file->ra_window = 0;
+  file->ra_off = 0;
+  file->ra_pos = 0;
+  file->ra_pending = NULL;
+  file->ra_eof = false;
   file->fh = fh;
   return Alloc(file);
 }
 
-// REQUIRES: mutex_ has been locked.
+// Drop a reference to a file. The last reference closes the file.
+// REQUIRES: mutex_ has NOT been locked.
 void Client::Unref(File* f, const Fentry& fentry) {
-  mutex_.AssertHeld();
-  assert(f->refs > 0);
-  f->refs--;
-  if (f->refs == 0) {
-    f->next->prev = f->prev;
-    f->prev->next = f->next;
-    if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      if (S_ISREG(fentry.file_mode())) {
-        fio_->Close(fentry, f->fh);
-      } else {
-        assert(f->fh == NULL);
-      }
-    } else if (S_ISDIR(fentry.file_mode())) {
-      if ((f->flags & O_ACCMODE) == O_WRONLY) {
-        ToWritablePlfsDir(f->fh)->Unref();
-      } else if ((f->flags & O_ACCMODE) == O_RDONLY) {
-        ToReadablePlfsDir(f->fh)->Unref();
-      } else {
-        assert(false);
-      }
+  const int refs = f->refs.fetch_sub(1);
+  assert(refs > 0);
+  if (refs != 1) {
+    return;
+  }
+  if (!f->write_buf.empty()) {  // Written after the file was last flushed
+    MutexLock ml(&f->mu);
+    FlushWriteBuffer(f, fentry);  // Ignore errors
+  }
+  if (!f->ra_buf.empty() || f->ra_pending != NULL) {
+    MutexLock ml(&f->mu);
+    DropReadahead(f);
+  }
+  MutexLock ml(&mutex_);
+  f->next->prev = f->prev;
+  f->prev->next = f->next;
+  if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
+    if (S_ISREG(fentry.file_mode())) {
+      fio_->Close(fentry, f->fh);
     } else {
-      if ((f->flags & O_ACCMODE) == O_WRONLY) {
-        delete ToWritablePlfsFile(f->fh);
-      } else if ((f->flags & O_ACCMODE) == O_RDONLY) {
-        delete ToReadablePlfsFile(f->fh);
-      } else {
-        assert(false);
-      }
+      assert(f->fh == NULL);
+    }
+  } else if (S_ISDIR(fentry.file_mode())) {
+    if ((f->flags & O_ACCMODE) == O_WRONLY) {
+      ToWritablePlfsDir(f->fh)->Unref();
+    } else if ((f->flags & O_ACCMODE) == O_RDONLY) {
+      ToReadablePlfsDir(f->fh)->Unref();
+    } else {
+      assert(false);
+    }
+  } else {
+    if ((f->flags & O_ACCMODE) == O_WRONLY) {
+      delete ToWritablePlfsFile(f->fh);
+    } else if ((f->flags & O_ACCMODE) == O_RDONLY) {
+      delete ToReadablePlfsFile(f->fh);
+    } else {
+      assert(false);
     }
-    free(f);
   }
+  f->~File();
+  free(f);
 }
 
 // Sanitize path by removing all tailing slashes.
@@ -344,19 +392,23 @@ Status Client::Fopenat(int fd, const char* path, int flags, mode_t mode,
                        FileInfo* info) {
   Status s;
   Fentry fentry;
-  MutexLock ml(&mutex_);
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     s = BadDescriptor();
-  } else if (num_open_fds_ < max_open_fds_) {
-    FileAndEntry at;
-    at.ent = &fentry;
-    at.file = file;
-    std::string p = "/";
-    p += path;
-    s = InternalOpen(p, flags, mode, &at, info);
   } else {
-    s = Status::TooManyOpens(Slice());
+    mutex_.Lock();
+    if (num_open_fds_ < max_open_fds_) {
+      FileAndEntry at;
+      at.ent = &fentry;
+      at.file = file;
+      std::string p = "/";
+      p += path;
+      s = InternalOpen(p, flags, mode, &at, info);
+    } else {
+      s = Status::TooManyOpens(Slice());
+    }
+    mutex_.Unlock();
+    Unref(file, fentry);
   }
 
 #if VERBOSE >= OP_VERBOSE_LEVEL
@@ -674,11 +726,20 @@ bool Client::IsWriteOk(const File* f) {
   }
 }
 
-// REQUIRES: mutex_ has been locked.
+// Return the file opened at the given descriptor with an extra reference
+// that the caller must drop by calling Unref(), or NULL if the descriptor
+// is not in use. The descriptor slot is pinned while the reference is
+// taken so that a concurrent Close() cannot free the file in between.
 Client::File* Client::FetchFile(int fd, Fentry* result) {
   size_t index = fd;
   if (index < max_open_fds_) {
-    File* f = fds_[index];
+    FileSlot* const slot = &fds_[index];
+    slot->pins.fetch_add(1);
+    File* f = slot->file.load();
+    if (f != NULL) {
+      f->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    slot->pins.fetch_sub(1);
     if (f != NULL) {
       Slice input = f->fentry_encoding();
 #ifndef NDEBUG
@@ -695,25 +756,24 @@ Client::File* Client::FetchFile(int fd, Fentry* result) {
 }
 
 Status Client::Fstat(int fd, Stat* statbuf) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
   } else {
     Status s;
-    file->refs++;  // Ref
     if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       if (S_ISREG(fentry.file_mode())) {
-        mutex_.Unlock();
         uint64_t mtime = 0;
         uint64_t size = 0;
-        s = fio_->Fstat(fentry, file->fh, &mtime, &size);
+        s = SyncWriteBuffer(file, fentry);
+        if (s.ok()) {
+          s = fio_->Fstat(fentry, file->fh, &mtime, &size);
+        }
         if (s.ok()) {
           fentry.stat.SetModifyTime(mtime);
           fentry.stat.SetFileSize(size);
         }
-        mutex_.Lock();
       }
     }
     if (s.ok()) *statbuf = fentry.stat;
@@ -723,89 +783,87 @@ Status Client::Fstat(int fd, Stat* statbuf) {
 }
 
 Status Client::Pwrite(int fd, const Slice& data, uint64_t off) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (!S_ISREG(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+  }
+  Status s;
+  if (!S_ISREG(fentry.file_mode())) {
+    s = FileAccessModeNotMatched();
   } else if (!IsWriteOk(file)) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else {
-    Status s;
-    file->refs++;  // Ref
-    mutex_.Unlock();
     if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsFile(file->fh)->parent->writer;
       assert(writer != NULL);
       s = writer->Append(fentry.nhash, data);
+    } else if (write_buf_size_ != 0) {
+      s = BufferedWrite(file, fentry, data, true, off);
     } else {
       s = fio_->Pwrite(fentry, file->fh, data, off);
     }
-    mutex_.Lock();
     if (s.ok()) {
-      file->seq_write++;
+      file->seq_write.fetch_add(1);
     }
-    Unref(file, fentry);
-    return s;
   }
+  Unref(file, fentry);
+  return s;
 }
 
 Status Client::Write(int fd, const Slice& data) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (!S_ISREG(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+  }
+  Status s;
+  if (!S_ISREG(fentry.file_mode())) {
+    s = FileAccessModeNotMatched();
   } else if (!IsWriteOk(file)) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else {
-    Status s;
-    file->refs++;  // Ref
-    mutex_.Unlock();
     if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsFile(file->fh)->parent->writer;
       assert(writer != NULL);
       s = writer->Append(fentry.nhash, data);
+    } else if (write_buf_size_ != 0) {
+      s = BufferedWrite(file, fentry, data, false, 0);
     } else {
       s = fio_->Write(fentry, file->fh, data);
     }
-    mutex_.Lock();
     if (s.ok()) {
-      file->seq_write++;
+      file->seq_write.fetch_add(1);
     }
-    Unref(file, fentry);
-    return s;
   }
+  Unref(file, fentry);
+  return s;
 }
 
 Status Client::Ftruncate(int fd, uint64_t len) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+  }
+  Status s;
+  if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
+    s = FileAccessModeNotMatched();
   } else if (!S_ISREG(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else if (!IsWriteOk(file)) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else {
-    Status s;
-    file->refs++;  // Ref
-    mutex_.Unlock();
-    s = fio_->Ftrunc(fentry, file->fh, len);
-    mutex_.Lock();
+    s = SyncWriteBuffer(file, fentry);
     if (s.ok()) {
-      file->seq_write++;
+      s = fio_->Ftrunc(fentry, file->fh, len);
+    }
+    if (s.ok()) {
+      file->seq_write.fetch_add(1);
     }
-    Unref(file, fentry);
-    return s;
   }
+  Unref(file, fentry);
+  return s;
 }
 
 // If fd refers to a plfs directory, we do a forced sync.
@@ -813,27 +871,33 @@ Status Client::Ftruncate(int fd, uint64_t len) {
 // If fd refers to a normal file, we sync its data and update its metadata.
 // If fd refers to a normal directory, we don't yet have that logic.
 Status Client::Fdatasync(int fd) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-    Status s;
+  }
+  Status s;
+  if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
     if (S_ISDIR(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
       assert(writer != NULL);
-      mutex_.Unlock();
       s = writer->Flush();
-      mutex_.Lock();
     }
-    return s;
   } else if (!S_ISREG(fentry.file_mode())) {
-    return Status::NotSupported(Slice());
+    s = Status::NotSupported(Slice());
   } else if (IsWriteOk(file)) {
-    return InternalFdatasync(file, fentry);
-  } else {
-    return Status::OK();
+    s = InternalFdatasync(file, fentry);
+  }
+  Unref(file, fentry);
+  return s;
+}
+
+// Advance the flush sequence of a file to the given write sequence
+// unless a concurrent flush has already advanced it further.
+static void AdvanceSeqFlush(std::atomic<uint32_t>* seq_flush,
+                            uint32_t seq_write) {
+  uint32_t seq = seq_flush->load();
+  while (seq < seq_write && !seq_flush->compare_exchange_weak(seq, seq_write)) {
   }
 }
 
@@ -841,11 +905,12 @@ Status Client::InternalFdatasync(File* file, const Fentry& fentry) {
   Status s;
   uint64_t mtime;
   uint64_t size;
-  uint32_t seq_write = file->seq_write;
-  uint32_t seq_flush = file->seq_flush;
-  file->refs++;  // Ref
-  mutex_.Unlock();
-  s = fio_->Flush(fentry, file->fh, true /*force*/);
+  uint32_t seq_write = file->seq_write.load();
+  uint32_t seq_flush = file->seq_flush.load();
+  s = SyncWriteBuffer(file, fentry);
+  if (s.ok()) {
+    s = fio_->Flush(fentry, file->fh, true /*force*/);
+  }
   if (s.ok()) {
     if (seq_flush < seq_write) {
       s = fio_->Fstat(fentry, file->fh, &mtime, &size, true /*skip_cache*/);
@@ -854,58 +919,61 @@ Status Client::InternalFdatasync(File* file, const Fentry& fentry) {
       }
     }
   }
-  mutex_.Lock();
   if (s.ok()) {
-    if (seq_write > file->seq_flush) {
-      file->seq_flush = seq_write;
-    }
+    AdvanceSeqFlush(&file->seq_flush, seq_write);
   }
-  Unref(file, fentry);
   return s;
 }
 
 Status Client::Pread(int fd, Slice* result, uint64_t off, uint64_t size,
                      char* scratch) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (!S_ISREG(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+  }
+  Status s;
+  if (!S_ISREG(fentry.file_mode())) {
+    s = FileAccessModeNotMatched();
   } else if (!IsReadOk(file)) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else {
-    Status s;
-    file->refs++;  // Ref
-    mutex_.Unlock();
-    if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      s = fio_->Pread(fentry, file->fh, result, off, size, scratch);
-    } else {
+    if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
       // TODO
+    } else if (max_readahead_ != 0 && !IsWriteOk(file)) {
+      s = ReadaheadRead(file, fentry, result, true, off, size, scratch);
+    } else {
+      s = SyncWriteBuffer(file, fentry);  // Read our own writes
+      if (s.ok()) {
+        s = fio_->Pread(fentry, file->fh, result, off, size, scratch);
+      }
     }
-    mutex_.Lock();
-    Unref(file, fentry);
-    return s;
   }
+  Unref(file, fentry);
+  return s;
 }
 
 Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (!S_ISREG(fentry.file_mode())) {
-    return FileAccessModeNotMatched();
+  }
+  Status s;
+  if (!S_ISREG(fentry.file_mode())) {
+    s = FileAccessModeNotMatched();
   } else if (!IsReadOk(file)) {
-    return FileAccessModeNotMatched();
+    s = FileAccessModeNotMatched();
   } else {
-    Status s;
-    file->refs++;  // Ref
-    mutex_.Unlock();
     if (!DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      s = fio_->Read(fentry, file->fh, result, size, scratch);
+      if (max_readahead_ != 0 && !IsWriteOk(file)) {
+        s = ReadaheadRead(file, fentry, result, false, 0, size, scratch);
+      } else {
+        s = SyncWriteBuffer(file, fentry);  // Read our own writes
+        if (s.ok()) {
+          s = fio_->Read(fentry, file->fh, result, size, scratch);
+        }
+      }
     } else {
       plfsio::DirReader* reader = ToReadablePlfsFile(file->fh)->parent->reader;
       assert(reader != NULL);
@@ -921,10 +989,9 @@ Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
         *result = Slice();
       }
     }
-    mutex_.Lock();
-    Unref(file, fentry);
-    return s;
   }
+  Unref(file, fentry);
+  return s;
 }
 
 // If fd refers to a plfs directory, we do flush epoch.
@@ -932,39 +999,37 @@ Status Client::Read(int fd, Slice* result, uint64_t size, char* scratch) {
 // If fd refers to a normal file, we flush its data and update its metadata.
 // If fd refers to a normal directory, we don't yet have that logic.
 Status Client::Flush(int fd) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
-  } else if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-    Status s;
+  }
+  Status s;
+  if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
     if (S_ISDIR(fentry.file_mode())) {
       plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
       assert(writer != NULL);
-      mutex_.Unlock();
       s = writer->EpochFlush();
-      mutex_.Lock();
     }
-    return s;
   } else if (!S_ISREG(fentry.file_mode())) {
-    return Status::NotSupported(Slice());
+    s = Status::NotSupported(Slice());
   } else if (IsWriteOk(file)) {
-    return InternalFlush(file, fentry);
-  } else {
-    return Status::OK();
+    s = InternalFlush(file, fentry);
   }
+  Unref(file, fentry);
+  return s;
 }
 
 Status Client::InternalFlush(File* file, const Fentry& fentry) {
   Status s;
   uint64_t mtime;
   uint64_t size;
-  uint32_t seq_write = file->seq_write;
-  uint32_t seq_flush = file->seq_flush;
-  file->refs++;  // Ref
-  mutex_.Unlock();
-  s = fio_->Flush(fentry, file->fh);
+  uint32_t seq_write = file->seq_write.load();
+  uint32_t seq_flush = file->seq_flush.load();
+  s = SyncWriteBuffer(file, fentry);
+  if (s.ok()) {
+    s = fio_->Flush(fentry, file->fh);
+  }
   if (s.ok()) {
     if (seq_flush < seq_write) {
       s = fio_->Fstat(fentry, file->fh, &mtime, &size);
@@ -973,50 +1038,305 @@ Status Client::InternalFlush(File* file, const Fentry& fentry) {
       }
     }
   }
-  mutex_.Lock();
   if (s.ok()) {
-    if (seq_write > file->seq_flush) {
-      file->seq_flush = seq_write;
+    AdvanceSeqFlush(&file->seq_flush, seq_write);
+  }
+  return s;
+}
+
+// Coalesce a write with earlier buffered writes it directly follows.
+// Buffered data is passed to Fio when the buffer is full, when a write
+// does not follow it, or when the file is flushed, synced, read, stat'ed,
+// truncated, or closed. Writes too large for the buffer bypass it.
+Status Client::BufferedWrite(File* file, const Fentry& fentry,
+                             const Slice& data, bool positional,
+                             uint64_t off) {
+  Status s;
+  MutexLock ml(&file->mu);
+  std::string* const buf = &file->write_buf;
+  if (!buf->empty()) {
+    bool contiguous;
+    if (positional) {
+      contiguous =
+          file->write_positional && file->write_off + buf->size() == off;
+    } else {
+      contiguous = !file->write_positional;
+    }
+    if (!contiguous || buf->size() + data.size() > write_buf_size_) {
+      s = FlushWriteBuffer(file, fentry);
+    }
+  }
+  if (!s.ok()) {
+    // Skip
+  } else if (data.size() >= write_buf_size_) {
+    if (positional) {
+      s = fio_->Pwrite(fentry, file->fh, data, off);
+    } else {
+      s = fio_->Write(fentry, file->fh, data);
+    }
+  } else {
+    if (buf->empty()) {
+      buf->reserve(write_buf_size_);
+      file->write_positional = positional;
+      file->write_off = off;
+    }
+    buf->append(data.data(), data.size());
+  }
+  return s;
+}
+
+Status Client::SyncWriteBuffer(File* file, const Fentry& fentry) {
+  if (write_buf_size_ == 0) {
+    return Status::OK();
+  } else {
+    MutexLock ml(&file->mu);
+    return FlushWriteBuffer(file, fentry);
+  }
+}
+
+// Pass buffered data to Fio. Buffered data is dropped on errors.
+Status Client::FlushWriteBuffer(File* file, const Fentry& fentry) {
+  file->mu.AssertHeld();
+  Status s;
+  std::string* const buf = &file->write_buf;
+  if (!buf->empty()) {
+    if (file->write_positional) {
+      s = fio_->Pwrite(fentry, file->fh, *buf, file->write_off);
+    } else {
+      s = fio_->Write(fentry, file->fh, *buf);
+    }
+    buf->clear();
+  }
+  return s;
+}
+
+// A readahead of a file run in the background.
+struct Client::Readahead {
+  Client* cli;
+  File* file;  // Referenced until the readahead finishes
+  Fentry fentry;
+  uint64_t off;
+  size_t size;
+  std::string buf;  // Data read
+  bool done;        // Protected by file->mu
+};
+
+// Serve a read of a read-only file from data read ahead of earlier reads,
+// and keep reading ahead of reads that continue where the previous read
+// stopped. The readahead window doubles on each such read until it reaches
+// max_readahead_. A read elsewhere drops all data read ahead and resets
+// the window. Read() uses a position kept by us rather than by Fio.
+Status Client::ReadaheadRead(File* file, const Fentry& fentry, Slice* result,
+                             bool positional, uint64_t off, uint64_t size,
+                             char* scratch) {
+  Status s;
+  MutexLock ml(&file->mu);
+  if (!positional) {
+    off = file->read_pos;
+  }
+  num_ra_reads_.fetch_add(1, std::memory_order_relaxed);
+  if (off == file->ra_next) {
+    file->ra_window = std::min<uint64_t>(
+        std::max<uint64_t>(2 * file->ra_window, size), max_readahead_);
+  } else {
+    DropReadahead(file);
+    file->ra_window = 0;
+  }
+  size_t n = CopyReadahead(file, off, size, scratch);
+  if (n < size && file->ra_pending != NULL) {
+    WaitForReadahead(file);
+    n += CopyReadahead(file, off + n, size - n, scratch + n);
+  }
+  if (n == size || (n != 0 && file->ra_eof &&
+                    off + n == file->ra_off + file->ra_buf.size())) {
+    num_ra_hits_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    Slice r;
+    s = fio_->Pread(fentry, file->fh, &r, off + n, size - n, scratch + n);
+    if (s.ok()) {
+      if (r.size() != 0 && r.data() != scratch + n) {
+        memmove(scratch + n, r.data(), r.size());
+      }
+      n += r.size();
+    }
+  }
+  if (s.ok()) {
+    *result = Slice(scratch, n);
+    file->ra_next = off + n;
+    if (!positional) {
+      file->read_pos = off + n;
+    }
+    if (file->ra_window != 0 && file->ra_pending == NULL && !file->ra_eof) {
+      uint64_t end = file->ra_off + file->ra_buf.size();
+      if (end < off + n) {  // Nothing left in the buffer
+        file->ra_buf.clear();
+        file->ra_off = off + n;
+        file->ra_pos = 0;
+        end = off + n;
+      }
+      if (end - (off + n) < file->ra_window) {
+        StartReadahead(file, fentry, end);
+      }
     }
   }
-  Unref(file, fentry);
   return s;
 }
 
+// Copy data read ahead at the given offset to dst and mark it consumed.
+// Return the number of bytes copied.
+size_t Client::CopyReadahead(File* file, uint64_t off, size_t n, char* dst) {
+  file->mu.AssertHeld();
+  const uint64_t start = file->ra_off + file->ra_pos;
+  const uint64_t end = file->ra_off + file->ra_buf.size();
+  if (off != start || start == end) {
+    return 0;
+  } else {
+    n = std::min<uint64_t>(n, end - start);
+    memcpy(dst, file->ra_buf.data() + file->ra_pos, n);
+    file->ra_pos += n;
+    return n;
+  }
+}
+
+// Read a window of data at the given offset in the background, or right
+// away if there is no pool for that.
+// REQUIRES: no readahead is in progress.
+void Client::StartReadahead(File* file, const Fentry& fentry, uint64_t off) {
+  file->mu.AssertHeld();
+  assert(file->ra_pending == NULL);
+  Readahead* ra = new Readahead;
+  ra->cli = this;
+  ra->file = file;
+  ra->fentry = fentry;
+  ra->off = off;
+  ra->size = static_cast<size_t>(file->ra_window);
+  ra->done = false;
+  file->ra_pending = ra;
+  if (readahead_pool_ != NULL) {
+    file->refs.fetch_add(1);
+    mutex_.Lock();
+    num_bg_readaheads_++;
+    mutex_.Unlock();
+    readahead_pool_->Schedule(RunReadahead, ra);
+  } else {  // Only blocks other reads of the same file
+    RunReadahead(ra);
+    WaitForReadahead(file);
+  }
+}
+
+void Client::RunReadahead(void* arg) {
+  Readahead* ra = reinterpret_cast<Readahead*>(arg);
+  Client* const cli = ra->cli;
+  File* const file = ra->file;
+  ra->buf.resize(ra->size);
+  Slice r;
+  Status s = cli->fio_->Pread(ra->fentry, file->fh, &r, ra->off, ra->size,
+                              &ra->buf[0]);
+  if (s.ok()) {
+    if (r.size() != 0 && r.data() != ra->buf.data()) {
+      memmove(&ra->buf[0], r.data(), r.size());
+    }
+    ra->buf.resize(r.size());
+  } else {
+    ra->buf.clear();  // Errors are left to the reads that need the data
+  }
+  cli->ra_bytes_.fetch_add(ra->buf.size(), std::memory_order_relaxed);
+  if (cli->readahead_pool_ != NULL) {
+    const Fentry fentry = ra->fentry;  // ra may be deleted once done
+    file->mu.Lock();
+    ra->done = true;
+    file->cv.SignalAll();
+    file->mu.Unlock();
+    cli->Unref(file, fentry);
+    MutexLock ml(&cli->mutex_);
+    assert(cli->num_bg_readaheads_ > 0);
+    cli->num_bg_readaheads_--;
+    cli->bg_cv_.SignalAll();
+  } else {
+    ra->done = true;
+  }
+}
+
+// Wait for the readahead in progress and append its data to the buffer.
+// Another reader of the file may finish the readahead while we wait.
+void Client::WaitForReadahead(File* file) {
+  file->mu.AssertHeld();
+  while (file->ra_pending != NULL && !file->ra_pending->done) {
+    file->cv.Wait();
+  }
+  Readahead* const ra = file->ra_pending;
+  if (ra == NULL) {
+    return;
+  }
+  file->ra_pending = NULL;
+  if (ra->off == file->ra_off + file->ra_buf.size()) {
+    if (ra->buf.size() < ra->size) {
+      file->ra_eof = true;
+    }
+    file->ra_off += file->ra_pos;  // Drop consumed data
+    if (file->ra_pos == file->ra_buf.size()) {
+      file->ra_buf.swap(ra->buf);
+    } else {
+      file->ra_buf.erase(0, file->ra_pos);
+      file->ra_buf.append(ra->buf);
+    }
+    file->ra_pos = 0;
+  } else {
+    ra_wasted_bytes_.fetch_add(ra->buf.size(), std::memory_order_relaxed);
+  }
+  delete ra;
+}
+
+// Drop all data read ahead, including data still being read.
+void Client::DropReadahead(File* file) {
+  file->mu.AssertHeld();
+  WaitForReadahead(file);
+  ra_wasted_bytes_.fetch_add(file->ra_buf.size() - file->ra_pos,
+                             std::memory_order_relaxed);
+  file->ra_buf.clear();
+  file->ra_off = 0;
+  file->ra_pos = 0;
+  file->ra_eof = false;
+}
+
 Status Client::Close(int fd) {
-  MutexLock ml(&mutex_);
   Fentry fentry;
   File* file = FetchFile(fd, &fentry);
   if (file == NULL) {
     return BadDescriptor();
+  }
+  if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
+    if (S_ISDIR(fentry.file_mode())) {
+      plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
+      assert(writer != NULL);
+      writer->Finish();
+    } else {
+      // Do nothing
+    }
   } else {
-    if (DELTAFS_DIR_IS_PLFS_STYLE(fentry.file_mode())) {
-      if (S_ISDIR(fentry.file_mode())) {
-        plfsio::DirWriter* writer = ToWritablePlfsDir(file->fh)->writer;
-        assert(writer != NULL);
-        mutex_.Unlock();
-        writer->Finish();
-        mutex_.Lock();
-      } else {
-        // Do nothing
+    if (S_ISREG(fentry.file_mode())) {
+      while (file->seq_flush.load() < file->seq_write.load()) {
+        InternalFlush(file, fentry);  // Ignore errors
       }
     } else {
-      if (S_ISREG(fentry.file_mode())) {
-        while (file->seq_flush < file->seq_write) {
-          mutex_.Unlock();
-          Flush(fd);  // Ignore errors
-          mutex_.Lock();
-        }
-      } else {
-        // Do nothing
-      }
+      // Do nothing
     }
+  }
 
+  bool freed = false;
+  mutex_.Lock();
+  // The descriptor may have been closed by another thread in the meantime
+  if (fds_[fd].file.load(std::memory_order_relaxed) == file) {
     Free(fd);  // Release fd slot
-
-    Unref(file, fentry);
-    return Status::OK();
+    freed = true;
   }
+  mutex_.Unlock();
+  if (freed) {
+    Unref(file, fentry);  // Drop the reference held by the fd slot
+  }
+
+  Unref(file, fentry);
+  return freed ? Status::OK() : BadDescriptor();
 }
 
 Status Client::Access(const char* path, int mode) {
@@ -1067,6 +1387,23 @@ Status Client::Listdir(const char* path, std::vector<std::string>* names) {
   return s;
 }
 
+Status Client::Listdir(const char* path, ListdirCallback callback, void* arg,
+                       bool with_stats) {
+  Status s;
+  Slice p = path;
+  std::string tmp;
+  s = ExpandPath(&p, &tmp);
+  if (s.ok()) {
+    s = mdscli_->Listdir(p, callback, arg, with_stats);
+  }
+
+#if VERBOSE >= OP_VERBOSE_LEVEL
+  OP_VERBOSE(p, s);
+#endif
+
+  return s;
+}
+
 Status Client::Lstat(const char* path, Stat* statbuf) {
   Status s;
   Slice p = path;
@@ -1174,6 +1511,58 @@ Status Client::Mkdir(const char* path, mode_t mode) {
   return s;
 }
 
+// Create many files, or directories if mode carries S_IFDIR, under an
+// existing directory. Per-name results are stored in *statuses.
+Status Client::Bcreat(const char* path, const std::vector<std::string>& names,
+                      mode_t mode, std::vector<Status>* statuses) {
+  Status s;
+  Slice p = path;
+  std::string tmp;
+  s = ExpandPath(&p, &tmp);
+  if (s.ok()) {
+    mode = MaskMode(mode);
+    s = mdscli_->Bcreat(p, names, mode, statuses);
+  }
+
+#if VERBOSE >= OP_VERBOSE_LEVEL
+  OP_VERBOSE(p, s);
+#endif
+
+  return s;
+}
+
+Status Client::Getstats(int srv_id, std::string* info) {
+  if (srv_id < 0 || size_t(srv_id) >= mdsfty_->num_srvs()) {
+    return Status::InvalidArgument("No such metadata server");
+  }
+  Status s;
+  MDS* const mds = mdsfty_->Get(srv_id);
+  MDS::GetstatsOptions options;
+  MDS::GetstatsRet ret;
+  s = mds->Getstats(options, &ret);
+  if (s.ok()) {
+    info->swap(ret.info);
+  }
+  return s;
+}
+
+Status Client::Syncmeta() { return mdscli_->Sync(); }
+
+void Client::Clistats(std::string* info) {
+  char tmp[200];
+  const uint64_t reads = num_ra_reads_.load();
+  const uint64_t hits = num_ra_hits_.load();
+  snprintf(tmp, sizeof(tmp),
+           "readahead: %llu reads, %llu hits (%.1f%%), %llu bytes read "
+           "ahead, %llu bytes wasted",
+           static_cast<unsigned long long>(reads),
+           static_cast<unsigned long long>(hits),
+           reads != 0 ? 100.0 * hits / reads : 0.0,
+           static_cast<unsigned long long>(ra_bytes_.load()),
+           static_cast<unsigned long long>(ra_wasted_bytes_.load()));
+  info->append(tmp);
+}
+
 Status Client::Chmod(const char* path, mode_t mode) {
   Status s;
   Slice p = path;
@@ -1338,10 +1727,13 @@ class Client::Builder {
   explicit Builder()
       : env_(NULL),
         mdsfty_(NULL),
+        listdir_pool_(NULL),
+        bg_pool_(NULL),
         mdscli_(NULL),
         db_(NULL),
         blkdb_(NULL),
-        fio_(NULL) {}
+        fio_(NULL),
+        readahead_pool_(NULL) {}
   ~Builder() {}
 
   Status status() const { return status_; }
@@ -1381,6 +1773,8 @@ class Client::Builder {
   Env* env_;
   MDSTopology mdstopo_;
   MDSFactoryImpl* mdsfty_;
+  ThreadPool* listdir_pool_;
+  ThreadPool* bg_pool_;
   MDSCliOptions mdscliopts_;
   MDSClient* mdscli_;
   DBOptions dbopts_;
@@ -1389,6 +1783,9 @@ class Client::Builder {
   BlkDB* blkdb_;
   Fio* fio_;
   size_t max_open_files_;
+  size_t write_buf_size_;
+  size_t max_readahead_;
+  ThreadPool* readahead_pool_;
   int cli_id_;
   int session_id_;
   int uid_;
@@ -1456,22 +1853,31 @@ static void PrintTopology(const MDSTopology& topo) {
 #endif
 }
 
+// REQUIRES: LoadIds() has been called.
 void Client::Builder::LoadMDSTopology() {
   uint64_t num_vir_srvs;
   uint64_t num_srvs;
+  uint64_t num_replicas;
 
   if (ok()) {
     status_ = config::LoadNumOfVirMetadataSrvs(&num_vir_srvs);
     if (ok()) {
       status_ = config::LoadNumOfMetadataSrvs(&num_srvs);
+      if (ok()) {
+        status_ = config::LoadNumOfMetadataReplicas(&num_replicas);
+      }
     }
   }
 
+  if (ok() && num_replicas == 0) {
+    status_ = Status::InvalidArgument("bad number of replicas");
+  }
+
   if (ok()) {
     std::string addrs = config::MetadataSrvAddrs();
     size_t num_addrs = SplitString(&mdstopo_.srv_addrs, addrs.c_str(), '&');
     if (num_addrs == 0) {
-      for (size_t i = 0; i < num_srvs; i++) {
+      for (size_t i = 0; i < num_srvs * num_replicas; i++) {
         std::string uri = TryObtainSrvUri(i);
         if (!uri.empty()) {
           mdstopo_.srv_addrs.push_back(uri);
@@ -1484,15 +1890,20 @@ void Client::Builder::LoadMDSTopology() {
   }
 
   if (ok()) {
-    if (mdstopo_.srv_addrs.size() < num_srvs) {
+    if (mdstopo_.srv_addrs.size() < num_srvs * num_replicas) {
       status_ = Status::InvalidArgument("not enough srv addrs");
-    } else if (mdstopo_.srv_addrs.size() > num_srvs) {
+    } else if (mdstopo_.srv_addrs.size() > num_srvs * num_replicas) {
       status_ = Status::InvalidArgument("too many srv addrs");
     }
   }
 
   if (ok()) {
     status_ = config::LoadMDSTracing(&mdstopo_.mds_tracing);
+    if (ok()) {
+      uint64_t max_coalesced_ops;
+      status_ = config::LoadCliCoalescedOps(&max_coalesced_ops);
+      mdstopo_.max_coalesced_ops = static_cast<int>(max_coalesced_ops);
+    }
   }
 
   if (ok()) {
@@ -1500,6 +1911,9 @@ void Client::Builder::LoadMDSTopology() {
     num_vir_srvs = std::max(num_vir_srvs, num_srvs);
     mdstopo_.num_vir_srvs = num_vir_srvs;
     mdstopo_.num_srvs = num_srvs;
+    mdstopo_.num_replicas = num_replicas;
+    // Clients are spread evenly across replicas
+    mdstopo_.replica = cli_id_ % num_replicas;
   }
 
   if (ok()) {
@@ -1590,6 +2004,7 @@ void Client::Builder::OpenDB() {
 void Client::Builder::OpenMDSCli() {
   uint64_t idx_cache_sz;
   uint64_t lookup_cache_sz;
+  uint64_t listdir_threads;
   uint64_t max_open_files;
 
   if (ok()) {
@@ -1599,11 +2014,54 @@ void Client::Builder::OpenMDSCli() {
     }
   }
 
+  if (ok()) {
+    status_ = config::LoadNumOfCliListdirThreads(&listdir_threads);
+    if (ok() && listdir_threads != 0 && mdstopo_.num_srvs > 1) {
+      listdir_pool_ = ThreadPool::NewFixed(static_cast<int>(listdir_threads));
+      bg_pool_ = ThreadPool::NewFixed(static_cast<int>(listdir_threads));
+    }
+  }
+
+  if (ok()) {
+    status_ =
+        config::LoadCliLeaseRenewalWindow(&mdscliopts_.lease_renewal_window);
+  }
+
+  if (ok()) {
+    uint64_t write_back_batch;
+    status_ = config::LoadCliWriteBackBatch(&write_back_batch);
+    mdscliopts_.write_back_batch = write_back_batch;
+    if (ok()) {
+      status_ =
+          config::LoadCliWriteBackInterval(&mdscliopts_.write_back_interval);
+    }
+  }
+
   if (ok()) {
     status_ = config::LoadMaxNumOfOpenFiles(&max_open_files);
     max_open_files_ = max_open_files;
   }
 
+  if (ok()) {
+    uint64_t write_buf_size;
+    status_ = config::LoadSizeOfCliWriteBuffer(&write_buf_size);
+    write_buf_size_ = write_buf_size;
+  }
+
+  if (ok()) {
+    uint64_t max_readahead;
+    status_ = config::LoadSizeOfCliReadahead(&max_readahead);
+    max_readahead_ = max_readahead;
+    uint64_t readahead_threads;
+    if (ok()) {
+      status_ = config::LoadNumOfCliReadaheadThreads(&readahead_threads);
+    }
+    if (ok() && max_readahead_ != 0 && readahead_threads != 0) {
+      readahead_pool_ =
+          ThreadPool::NewFixed(static_cast<int>(readahead_threads));
+    }
+  }
+
   if (ok()) {
     status_ = config::LoadAtomicPathRes(&mdscliopts_.atomic_path_resolution);
     if (ok()) {
@@ -1616,6 +2074,8 @@ void Client::Builder::OpenMDSCli() {
     mdscliopts_.factory = mdsfty_;
     mdscliopts_.index_cache_size = idx_cache_sz;
     mdscliopts_.lookup_cache_size = lookup_cache_sz;
+    mdscliopts_.listdir_pool = listdir_pool_;
+    mdscliopts_.bg_pool = bg_pool_;
     mdscliopts_.num_virtual_servers = mdstopo_.num_vir_srvs;
     mdscliopts_.num_servers = mdstopo_.num_srvs;
     mdscliopts_.session_id = session_id_;
@@ -1652,14 +2112,21 @@ Client* Client::Builder::BuildClient() {
 #endif
 
   if (ok()) {
-    Client* cli = new Client(max_open_files_);
+    Client* cli = new Client(max_open_files_, write_buf_size_);
     cli->mdscli_ = mdscli_;
+    cli->listdir_pool_ = listdir_pool_;
+    cli->bg_pool_ = bg_pool_;
     cli->mdsfty_ = mdsfty_;
     cli->fio_ = fio_;
     cli->env_ = env_;
+    cli->max_readahead_ = max_readahead_;
+    cli->readahead_pool_ = readahead_pool_;
     return cli;
   } else {
     delete mdscli_;
+    delete readahead_pool_;
+    delete listdir_pool_;
+    delete bg_pool_;
     delete mdsfty_;
     delete fio_;
     delete blkdb_;
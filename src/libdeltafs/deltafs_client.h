@@ -9,6 +9,8 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 
+#include <atomic>
+
 #include "pdlfs-common/fio.h"
 #include "pdlfs-common/map.h"
 
@@ -42,15 +44,28 @@ class Client {
   Status Access(const char* path, int mode);
   Status Accessdir(const char* path, int mode);
   Status Listdir(const char* path, std::vector<std::string>* names);
+  // Stream directory entries, optionally with their stats, to a callback
+  // instead of collecting them in memory.
+  typedef MDSClient::ListdirCallback ListdirCallback;
+  Status Listdir(const char* path, ListdirCallback callback, void* arg,
+                 bool with_stats = false);
   Status Truncate(const char* path, uint64_t len);
   Status Lstat(const char* path, Stat* result);
   Status Getattr(const char* path, Stat* result);
   Status Mkfile(const char* path, mode_t mode);
   Status Mkdirs(const char* path, mode_t mode);
   Status Mkdir(const char* path, mode_t mode);
+  Status Bcreat(const char* path, const std::vector<std::string>& names,
+                mode_t mode, std::vector<Status>* statuses);
   Status Chmod(const char* path, mode_t mode);
   Status Chown(const char* path, uid_t usr, gid_t grp);
   Status Unlink(const char* path);
+  // Fetch the op latency report of a metadata server.
+  Status Getstats(int srv_id, std::string* info);
+  // Send all buffered file creates and report their first error.
+  Status Syncmeta();
+  // Report the readahead stats of this client.
+  void Clistats(std::string* info);
 
   Status Getcwd(char* buf, size_t size);
   Status Chroot(const char* path);
@@ -60,21 +75,47 @@ class Client {
 
  private:
   class Builder;
-  Client(size_t max_open_files);  // Called only by Client::Builder
+  // Called only by Client::Builder
+  Client(size_t max_open_files, size_t write_buffer_size);
   // No copying allowed
   void operator=(const Client&);
   Client(const Client&);
 
-  // State for each opened file
+  struct Readahead;
+
+  // State for each opened file. Data path calls only touch the atomic
+  // fields below so calls on different files never share a lock.
   struct File {
+    File() : cv(&mu) {}
     size_t encoding_length;
-    File* next;
-    File* prev;
+    File* next;  // Protected by mutex_
+    File* prev;  // Protected by mutex_
     Fio::Handle* fh;
     int flags;
-    uint32_t seq_flush;  // Latest file metadata update
-    uint32_t seq_write;  // Latest data write
-    int refs;
+    std::atomic<uint32_t> seq_flush;  // Latest file metadata update
+    std::atomic<uint32_t> seq_write;  // Latest data write
+    std::atomic<int> refs;
+
+    // Writes not yet passed to Fio. Data written by Pwrite() starts at
+    // write_off. Data written by Write() goes to the current position of
+    // the file. Only used when write buffering is enabled.
+    port::Mutex mu;  // Protects the write buffer and the readahead state
+    std::string write_buf;
+    uint64_t write_off;
+    bool write_positional;  // True if write_buf holds Pwrite() data
+
+    // Data read ahead of the reads of a read-only file. Data up to
+    // ra_off + ra_pos has been consumed. Only used when readahead is
+    // enabled.
+    port::CondVar cv;    // Signaled when a readahead finishes
+    uint64_t read_pos;   // Position of the next Read()
+    uint64_t ra_next;    // Where the next read is expected to start
+    uint64_t ra_window;  // Bytes to read ahead, 0 after a random read
+    uint64_t ra_off;     // Offset of ra_buf
+    size_t ra_pos;
+    std::string ra_buf;
+    Readahead* ra_pending;  // Readahead in progress, or NULL
+    bool ra_eof;            // The last readahead reached the end of file
 
     char encoding_data[1];  // Beginning of fentry encoding
     Slice fentry_encoding() const {
@@ -82,6 +123,16 @@ class Client {
     }
   };
 
+  // A descriptor slot. Lookups pin the slot while they take a reference
+  // to its file, so a file cannot be freed between being found in the
+  // slot and being referenced. Slots are padded to a cache line so that
+  // lookups of different descriptors do not share lines.
+  struct FileSlot {
+    std::atomic<File*> file;
+    std::atomic<int> pins;  // Lookups in progress
+    char padding[64 - sizeof(std::atomic<File*>) - sizeof(std::atomic<int>)];
+  };
+
   struct FileAndEntry {
     const Fentry* ent;
     File* file;
@@ -89,10 +140,30 @@ class Client {
   // REQUIRES: mutex_ has been locked
   Status InternalOpen(const Slice& p, int flags, mode_t mode, FileAndEntry* at,
                       FileInfo* result);
-  // REQUIRES: mutex_ has been locked
+  // REQUIRES: file has been referenced by the caller
   Status InternalFdatasync(File* file, const Fentry& ent);
-  // REQUIRES: mutex_ has been locked
+  // REQUIRES: file has been referenced by the caller
   Status InternalFlush(File* file, const Fentry& ent);
+  // REQUIRES: file has been referenced by the caller
+  Status BufferedWrite(File* file, const Fentry& ent, const Slice& data,
+                       bool positional, uint64_t off);
+  // REQUIRES: file has been referenced by the caller
+  Status SyncWriteBuffer(File* file, const Fentry& ent);
+  // REQUIRES: file->mu has been locked
+  Status FlushWriteBuffer(File* file, const Fentry& ent);
+  // REQUIRES: file has been referenced by the caller
+  Status ReadaheadRead(File* file, const Fentry& ent, Slice* result,
+                       bool positional, uint64_t off, uint64_t size,
+                       char* scratch);
+  // REQUIRES: file->mu has been locked
+  size_t CopyReadahead(File* file, uint64_t off, size_t n, char* dst);
+  // REQUIRES: file->mu has been locked
+  void StartReadahead(File* file, const Fentry& ent, uint64_t off);
+  // REQUIRES: file->mu has been locked
+  void WaitForReadahead(File* file);
+  // REQUIRES: file->mu has been locked
+  void DropReadahead(File* file);
+  static void RunReadahead(void* arg);
 
   // State below is protected by mutex_
   port::Mutex mutex_;
@@ -103,21 +174,34 @@ class Client {
   std::string curroot_;  // Set by chroot
   port::AtomicPointer has_curdir_set_;
   std::string curdir_;  // Set by chdir
-  File* FetchFile(int fd, Fentry*);
+  File* FetchFile(int fd, Fentry*);  // Lock-free
   size_t Alloc(File*);
   File* Free(size_t idx);
   size_t Open(const Slice& encoding, int flags, Fio::Handle*);
   bool IsWriteOk(const File*);
   bool IsReadOk(const File*);
-  void Unref(File*, const Fentry&);
-  File dummy_;  // File table as a doubly linked list
-  File** fds_;  // File descriptor table
+  void Unref(File*, const Fentry&);  // Locks mutex_ on the last reference
+  File dummy_;     // File table as a doubly linked list
+  FileSlot* fds_;  // File descriptor table, updated with mutex_ held
   size_t num_open_fds_;
   size_t fd_slot_;
 
+  port::CondVar bg_cv_;  // Signaled when a background readahead finishes
+  int num_bg_readaheads_;
+
+  std::atomic<uint64_t> num_ra_reads_;     // Reads of read-only files
+  std::atomic<uint64_t> num_ra_hits_;      // Reads served from readahead
+  std::atomic<uint64_t> ra_bytes_;         // Bytes read ahead
+  std::atomic<uint64_t> ra_wasted_bytes_;  // Bytes read ahead but not used
+
   // Constant after construction
   size_t max_open_fds_;
+  size_t write_buf_size_;       // Write buffering is disabled if 0
+  size_t max_readahead_;        // Readahead is disabled if 0
+  ThreadPool* readahead_pool_;  // NULL if readahead runs in the foreground
   MDSFactoryImpl* mdsfty_;
+  ThreadPool* listdir_pool_;
+  ThreadPool* bg_pool_;
   MDSClient* mdscli_;
   Fio* fio_;
   Env* env_;
@@ -50,11 +50,25 @@ DEFINE_FLAG(InstanceId, "0")
 DEFINE_FLAG(RPCProto, "bmi+tcp")
 DEFINE_FLAG(MDSTracing, "false")
 DEFINE_FLAG(MetadataSrvAddrs, "")
+DEFINE_FLAG(NumOfMetadataReplicas, "1")
+DEFINE_FLAG(ReadonlyMetadata, "false")
 DEFINE_FLAG(MaxNumOfOpenFiles, "1000")
 DEFINE_FLAG(SizeOfSrvLeaseTable, "4k")
 DEFINE_FLAG(SizeOfSrvDirTable, "1k")
+DEFINE_FLAG(SizeOfSrvNodeCache, "4M")
+DEFINE_FLAG(DirSplitThreshold, "0")
 DEFINE_FLAG(SizeOfCliLookupCache, "4k")
 DEFINE_FLAG(SizeOfCliIndexCache, "1k")
+DEFINE_FLAG(NumOfCliListdirThreads, "4")
+DEFINE_FLAG(CliLeaseRenewalWindow, "200000")
+DEFINE_FLAG(CliWriteBackBatch, "0")
+DEFINE_FLAG(CliWriteBackInterval, "100000")
+DEFINE_FLAG(CliCoalescedOps, "0")
+DEFINE_FLAG(SizeOfCliWriteBuffer, "0")
+DEFINE_FLAG(SizeOfCliReadahead, "0")
+DEFINE_FLAG(NumOfCliReadaheadThreads, "2")
+DEFINE_FLAG(NumOfSrvBatchThreads, "4")
+DEFINE_FLAG(NumOfSrvSharedWorkers, "0")
 DEFINE_FLAG(SizeOfMetadataWriteBuffer, "32M")
 DEFINE_FLAG(SizeOfMetadataTables, "32M")
 DEFINE_FLAG(DisableMetadataCompaction, "true")
@@ -51,11 +51,25 @@ CONF_LOADER_UI64(NumOfMetadataSrvs)
 CONF_LOADER_UI64(NumOfVirMetadataSrvs)
 CONF_LOADER_UI64(InstanceId)
 CONF_LOADER_BOOL(MDSTracing)
+CONF_LOADER_UI64(NumOfMetadataReplicas)
+CONF_LOADER_BOOL(ReadonlyMetadata)
 CONF_LOADER_UI64(MaxNumOfOpenFiles)
 CONF_LOADER_UI64(SizeOfSrvLeaseTable)
 CONF_LOADER_UI64(SizeOfSrvDirTable)
+CONF_LOADER_UI64(SizeOfSrvNodeCache)
+CONF_LOADER_UI64(DirSplitThreshold)
 CONF_LOADER_UI64(SizeOfCliLookupCache)
 CONF_LOADER_UI64(SizeOfCliIndexCache)
+CONF_LOADER_UI64(NumOfCliListdirThreads)
+CONF_LOADER_UI64(CliLeaseRenewalWindow)
+CONF_LOADER_UI64(CliWriteBackBatch)
+CONF_LOADER_UI64(CliWriteBackInterval)
+CONF_LOADER_UI64(CliCoalescedOps)
+CONF_LOADER_UI64(SizeOfCliWriteBuffer)
+CONF_LOADER_UI64(SizeOfCliReadahead)
+CONF_LOADER_UI64(NumOfCliReadaheadThreads)
+CONF_LOADER_UI64(NumOfSrvBatchThreads)
+CONF_LOADER_UI64(NumOfSrvSharedWorkers)
 CONF_LOADER_UI64(SizeOfMetadataWriteBuffer)
 CONF_LOADER_UI64(SizeOfMetadataTables)
 CONF_LOADER_BOOL(DisableMetadataCompaction)
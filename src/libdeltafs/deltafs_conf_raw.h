@@ -32,6 +32,15 @@ extern std::string MDSTracing();
 // Return an ordered array of server addrs. Addrs are separated by ','.
 // e.g. 10.0.0.1:10000,10.0.0.1:20000
 extern std::string MetadataSrvAddrs();
+// Return the number of servers serving each part of the namespace.
+// Replicas require read-only metadata. Server addrs are ordered by
+// replica, so addr r * NumOfMetadataSrvs + i is replica r of server i.
+// e.g. 1, 4
+extern std::string NumOfMetadataReplicas();
+// Indicate if metadata servers should serve a finished namespace
+// read-only instead of opening it for writes.
+// e.g. true, yes
+extern std::string ReadonlyMetadata();
 // Return the max number of files that could be opened per client process.
 // e.g. 1024
 extern std::string MaxNumOfOpenFiles();
@@ -41,12 +50,69 @@ extern std::string SizeOfSrvLeaseTable();
 // Return the size of directory table at each metadata server.
 // e.g. 4096, 16k
 extern std::string SizeOfSrvDirTable();
+// Return the memory budget in bytes for caching directory entries,
+// including absent names, at each metadata server. Disabled if 0.
+// e.g. 0, 4M
+extern std::string SizeOfSrvNodeCache();
+// Return the number of entries at which a directory partition is split.
+// Directories are pre-split across all servers if 0.
+// e.g. 0, 8k
+extern std::string DirSplitThreshold();
 // Return the size of lookup cache at each metadata client.
 // e.g. 4096, 16k
 extern std::string SizeOfCliLookupCache();
 // Return the size of directory index cache at each metadata client.
 // e.g. 4096, 16k
 extern std::string SizeOfCliIndexCache();
+// Return the number of threads each metadata client uses to list
+// directories across servers. Servers are listed one by one if 0.
+// A second pool of the same size refreshes expired paths and sends
+// buffered creates in the background.
+// e.g. 0, 4
+extern std::string NumOfCliListdirThreads();
+// Return the time in microseconds before lease expiration at which
+// each metadata client renews its cached lookup leases in batches.
+// Leases are not renewed if 0.
+// e.g. 0, 200000
+extern std::string CliLeaseRenewalWindow();
+// Return the number of exclusive file creates each metadata client may
+// buffer per directory before sending them in one batch. Buffered creates
+// are answered locally and their errors are reported by deltafs_syncmeta().
+// Creates are sent one by one if 0.
+// e.g. 0, 64
+extern std::string CliWriteBackBatch();
+// Return the time in microseconds after which creates buffered by a
+// metadata client are sent even if their batch is not full.
+// e.g. 100000
+extern std::string CliWriteBackInterval();
+// Return the max number of small ops a metadata client may coalesce into
+// one message to a server when many threads call the server at the same
+// time. Ops are sent one by one if 0.
+// e.g. 0, 16
+extern std::string CliCoalescedOps();
+// Return the size of the buffer in which each client coalesces small
+// writes to an open file before passing them to the file's storage.
+// Writes are passed through one by one if 0.
+// e.g. 0, 64k
+extern std::string SizeOfCliWriteBuffer();
+// Return the max number of bytes each client reads ahead of sequential
+// reads of a read-only file. Up to twice this much may be held per open
+// file. Files are not read ahead if 0.
+// e.g. 0, 1m
+extern std::string SizeOfCliReadahead();
+// Return the number of threads each client uses to read ahead. Data is
+// read ahead by the reading threads themselves if 0.
+// e.g. 0, 2
+extern std::string NumOfCliReadaheadThreads();
+// Return the number of threads each metadata server uses to execute the
+// ops of coalesced messages. Ops are executed one by one if 0.
+// e.g. 0, 4
+extern std::string NumOfSrvBatchThreads();
+// Return the number of workers each metadata server shares among all
+// its listening ports, with idle workers taking over work queued for busy
+// ones. Each port has a dedicated pool of workers if 0.
+// e.g. 0, 8
+extern std::string NumOfSrvSharedWorkers();
 // Indicate if deltafs should ensure atomic pathname resolutions.
 // e.g. true, yes
 extern std::string AtomicPathRes();
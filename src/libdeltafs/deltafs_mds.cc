@@ -10,6 +10,7 @@
 #include "deltafs_mds.h"
 #include "deltafs_conf_loader.h"
 #include "mds_factory.h"
+#include "pdlfs-common/leveldb/db/readonly.h"
 #include "pdlfs-common/logging.h"
 #include "pdlfs-common/mutexlock.h"
 
@@ -40,10 +41,19 @@ Status MetadataServer::Dispose() {
     delete wrapper_;
     wrapper_ = NULL;
   }
+  if (batch_pool_ != NULL) {
+    delete batch_pool_;
+    batch_pool_ = NULL;
+  }
   if (mds_ != NULL) {
     delete mds_;
     mds_ = NULL;
   }
+  if (peers_ != NULL) {
+    peers_->Stop();
+    delete peers_;
+    peers_ = NULL;
+  }
   if (mdsmon_ != NULL) {
     delete mdsmon_;
     mdsmon_ = NULL;
@@ -56,6 +66,9 @@ Status MetadataServer::Dispose() {
     FlushOptions options;
     options.wait = true;
     s = db_->FlushMemTable(options);
+    if (s.IsReadOnly()) {
+      s = Status::OK();  // Read-only metadata has nothing to flush
+    }
     delete db_;
     db_ = NULL;
   }
@@ -70,7 +83,12 @@ Status MetadataServer::Dispose() {
   return s;
 }
 
-void MetadataServer::PrintStatus(const Status& status, const MDSMonitor* mon) {
+void MetadataServer::PrintStatus(const Status& status, const MDSMonitor* mon,
+                                 RPCServer* rpc) {
+  std::string rpc_report;
+  if (rpc != NULL) {
+    rpc->AppendReport(&rpc_report);
+  }
   Info(__LOG_ARGS__,
        "Deltafs status: %s ["
        "FCRET: %llu"
@@ -80,12 +98,15 @@ void MetadataServer::PrintStatus(const Status& status, const MDSMonitor* mon) {
        "FSTAT: %llu"
        " | "
        "LOKUP: %llu"
-       "]",
-       status.ToString().c_str(),  //
-       mon->Get_Fcreat_count(),    //
-       mon->Get_Mkdir_count(),     //
-       mon->Get_Fstat_count(),     //
-       mon->Get_Lookup_count()     //
+       "]%s%s%s",
+       status.ToString().c_str(),            //
+       mon->Get_Fcreat_count(),              //
+       mon->Get_Mkdir_count(),               //
+       mon->Get_Fstat_count(),               //
+       mon->Get_Lookup_count(),              //
+       rpc_report.empty() ? "" : " rpc: [",  //
+       rpc_report.c_str(),                   //
+       rpc_report.empty() ? "" : "]"         //
        );
 }
 
@@ -103,7 +124,7 @@ Status MetadataServer::RunTillInterruptionOrError() {
         if (rpc_ != NULL) {
           s = rpc_->status();
         }
-        PrintStatus(s, mdsmon_);
+        PrintStatus(s, mdsmon_, rpc_);
         if (!s.ok()) {
           break;
         }
@@ -131,10 +152,12 @@ class MetadataServer::Builder {
   explicit Builder()
       : myenv_(NULL),
         wrapper_(NULL),
+        batch_pool_(NULL),
         rpc_(NULL),
         db_(NULL),
         mdb_(NULL),
         mds_(NULL),
+        peers_(NULL),
         mdsmon_(NULL) {}
   ~Builder() {}
 
@@ -156,6 +179,7 @@ class MetadataServer::Builder {
   MDSEnv* myenv_;
   MDSTopology mdstopo_;
   RPCWrapper* wrapper_;
+  ThreadPool* batch_pool_;
   RPCServer* rpc_;
   DBOptions dbopts_;
   DB* db_;
@@ -163,9 +187,12 @@ class MetadataServer::Builder {
   MDB* mdb_;
   MDSOptions mdsopts_;
   MDS* mds_;
+  MDSFactoryImpl* peers_;
   MDSMonitor* mdsmon_;
   uint64_t snap_id_;  // snapshot id
   uint64_t reg_id_;   // registry id
+  bool read_only_;
+  int instance_id_;  // Replicas of a same server have different instance ids
   int srv_id_;
 };
 
@@ -175,10 +202,14 @@ void MetadataServer::Builder::LoadIds() {
   if (ok()) {
     status_ = config::LoadInstanceId(&instance_id);
     if (ok()) {
-      srv_id_ = static_cast<int>(instance_id);
+      instance_id_ = static_cast<int>(instance_id);
     }
   }
 
+  if (ok()) {
+    status_ = config::LoadReadonlyMetadata(&read_only_);
+  }
+
   if (ok()) {
     snap_id_ = 0;  // FIXME
     reg_id_ = 0;
@@ -228,20 +259,32 @@ static std::string GetLocalUri(int srv_id) {
   return "";
 }
 
+// REQUIRES: LoadIds() has been called.
 void MetadataServer::Builder::LoadMDSTopology() {
   uint64_t num_vir_srvs;
   uint64_t num_srvs;
+  uint64_t num_replicas;
 
   if (ok()) {
     status_ = config::LoadNumOfVirMetadataSrvs(&num_vir_srvs);
     if (ok()) {
       status_ = config::LoadNumOfMetadataSrvs(&num_srvs);
+      if (ok()) {
+        status_ = config::LoadNumOfMetadataReplicas(&num_replicas);
+      }
     }
   }
 
   if (ok()) {
-    if (srv_id_ >= num_srvs) {
+    if (num_replicas == 0) {
+      status_ = Status::InvalidArgument("bad number of replicas");
+    } else if (num_replicas > 1 && !read_only_) {
+      status_ = Status::InvalidArgument("replicas require read-only metadata");
+    } else if (instance_id_ >= num_srvs * num_replicas) {
       status_ = Status::InvalidArgument("bad instance id");
+    } else {
+      // Replicas of a same server open the same db image
+      srv_id_ = instance_id_ % num_srvs;
     }
   }
 
@@ -249,20 +292,20 @@ void MetadataServer::Builder::LoadMDSTopology() {
     std::string addrs = config::MetadataSrvAddrs();
     size_t num_addrs = SplitString(&mdstopo_.srv_addrs, addrs.c_str(), '&');
     if (num_addrs == 0) {
-      std::string uri = GetLocalUri(srv_id_);
+      std::string uri = GetLocalUri(instance_id_);
       if (uri.empty()) {
         status_ = Status::IOError("cannot obtain local uri");
       } else {
-        mdstopo_.srv_addrs = std::vector<std::string>(num_srvs);
-        mdstopo_.srv_addrs[srv_id_] = uri;
+        mdstopo_.srv_addrs = std::vector<std::string>(num_srvs * num_replicas);
+        mdstopo_.srv_addrs[instance_id_] = uri;
       }
     }
   }
 
   if (ok()) {
-    if (mdstopo_.srv_addrs.size() < num_srvs) {
+    if (mdstopo_.srv_addrs.size() < num_srvs * num_replicas) {
       status_ = Status::InvalidArgument("not enough srv addrs");
-    } else if (mdstopo_.srv_addrs.size() > num_srvs) {
+    } else if (mdstopo_.srv_addrs.size() > num_srvs * num_replicas) {
       status_ = Status::InvalidArgument("too many srv addrs");
     }
   }
@@ -276,6 +319,8 @@ void MetadataServer::Builder::LoadMDSTopology() {
     num_vir_srvs = std::max(num_vir_srvs, num_srvs);
     mdstopo_.num_vir_srvs = num_vir_srvs;
     mdstopo_.num_srvs = num_srvs;
+    mdstopo_.num_replicas = num_replicas;
+    mdstopo_.replica = instance_id_ / num_srvs;
   }
 }
 
@@ -302,7 +347,7 @@ void MetadataServer::Builder::LoadMDSEnv() {
   }
 }
 
-// REQUIRES: both LoadIds() and LoadMDSEnv() have been called.
+// REQUIRES: both LoadMDSTopology() and LoadMDSEnv() have been called.
 void MetadataServer::Builder::OpenDB() {
   std::string output_root;
   bool disable_table_compaction;
@@ -330,8 +375,8 @@ void MetadataServer::Builder::OpenDB() {
   }
 
   if (ok()) {
-    dbopts_.error_if_exists = true;
-    dbopts_.create_if_missing = true;
+    dbopts_.error_if_exists = !read_only_;
+    dbopts_.create_if_missing = !read_only_;
     dbopts_.compression = kSnappyCompression;
     dbopts_.disable_compaction = disable_table_compaction;
     dbopts_.disable_seek_compaction = disable_table_compaction;
@@ -347,7 +392,12 @@ void MetadataServer::Builder::OpenDB() {
     char tmp[30];
     snprintf(tmp, sizeof(tmp), "/shard-%08d", srv_id_);
     dbhome += tmp;
-    status_ = DB::Open(dbopts_, dbhome, &db_);
+    if (read_only_) {
+      // Skip recovery and compaction. Only flushed updates are visible.
+      status_ = ReadonlyDB::Open(dbopts_, dbhome, &db_);
+    } else {
+      status_ = DB::Open(dbopts_, dbhome, &db_);
+    }
     if (ok()) {
       mdbopts_.db = db_;
       mdb_ = new MDB(mdbopts_);
@@ -359,11 +409,34 @@ void MetadataServer::Builder::OpenDB() {
 void MetadataServer::Builder::OpenMDS() {
   uint64_t lease_table_size;
   uint64_t dir_table_size;
+  uint64_t node_cache_size;
+  uint64_t split_threshold;
 
   if (ok()) {
     status_ = config::LoadSizeOfSrvLeaseTable(&lease_table_size);
     if (ok()) {
       status_ = config::LoadSizeOfSrvDirTable(&dir_table_size);
+      if (ok()) {
+        status_ = config::LoadSizeOfSrvNodeCache(&node_cache_size);
+      }
+    }
+  }
+
+  if (ok()) {
+    status_ = config::LoadDirSplitThreshold(&split_threshold);
+  }
+
+  // Split partitions may need to be handed over to other servers
+  if (ok() && !read_only_ && split_threshold != 0 && mdstopo_.num_srvs > 1) {
+    MDSFactoryImpl* fty = new MDSFactoryImpl;
+    status_ = fty->Init(mdstopo_);
+    if (ok()) {
+      status_ = fty->Start();
+    }
+    if (ok()) {
+      peers_ = fty;
+    } else {
+      delete fty;
     }
   }
 
@@ -376,6 +449,11 @@ void MetadataServer::Builder::OpenMDS() {
     mdsopts_.mds_env = myenv_;
     mdsopts_.lease_table_size = lease_table_size;
     mdsopts_.dir_table_size = dir_table_size;
+    mdsopts_.node_cache_size = node_cache_size;
+    mdsopts_.split_threshold = split_threshold;
+    mdsopts_.split_dir = myenv_->output_conf + "/splits";
+    mdsopts_.peers = peers_;
+    mdsopts_.read_only = read_only_;
     mdsopts_.num_virtual_servers = mdstopo_.num_vir_srvs;
     mdsopts_.num_servers = mdstopo_.num_srvs;
     mdsopts_.snap_id = snap_id_;
@@ -394,7 +472,7 @@ void MetadataServer::Builder::OpenRPC() {
   std::string uri;
 
   if (ok()) {
-    Slice srv_addr = mdstopo_.srv_addrs[srv_id_];
+    Slice srv_addr = mdstopo_.srv_addrs[instance_id_];
     Slice proto = mdstopo_.rpc_proto;
     if (!srv_addr.starts_with(proto)) {
       uri += proto.c_str();
@@ -404,8 +482,21 @@ void MetadataServer::Builder::OpenRPC() {
   }
 
   if (ok()) {
-    wrapper_ = new RPCWrapper(mdsmon_);
-    rpc_ = new RPCServer(wrapper_);
+    uint64_t batch_threads;
+    status_ = config::LoadNumOfSrvBatchThreads(&batch_threads);
+    if (ok() && batch_threads != 0) {
+      batch_pool_ = ThreadPool::NewFixed(static_cast<int>(batch_threads));
+    }
+  }
+
+  uint64_t shared_workers = 0;
+  if (ok()) {
+    status_ = config::LoadNumOfSrvSharedWorkers(&shared_workers);
+  }
+
+  if (ok()) {
+    wrapper_ = new RPCWrapper(mdsmon_, batch_pool_);
+    rpc_ = new RPCServer(wrapper_, NULL, static_cast<int>(shared_workers));
     rpc_->AddChannel(uri, 4);  // FIXME
   }
 }
@@ -425,12 +516,12 @@ void MetadataServer::Builder::WriteRunInfo() {
     env->CreateDir(run_dir.c_str());
     std::string fname = run_dir;
     char tmp[30];
-    snprintf(tmp, sizeof(tmp), "/srv-%08d.uri", srv_id_);
+    snprintf(tmp, sizeof(tmp), "/srv-%08d.uri", instance_id_);
     fname += tmp;
     WritableFile* f;
     Status s = env->NewWritableFile(fname.c_str(), &f);
     if (s.ok()) {
-      const std::string& info = mdstopo_.srv_addrs[srv_id_];
+      const std::string& info = mdstopo_.srv_addrs[instance_id_];
       assert(info.size() != 0);
       s = f->Append(info);
       if (s.ok()) {
@@ -458,7 +549,9 @@ MetadataServer* MetadataServer::Builder::BuildServer() {
     MetadataServer* srv = new MetadataServer;
     srv->rpc_ = rpc_;
     srv->wrapper_ = wrapper_;
+    srv->batch_pool_ = batch_pool_;
     srv->mds_ = mds_;
+    srv->peers_ = peers_;
     srv->mdsmon_ = mdsmon_;
     srv->myenv_ = myenv_;
     srv->mdb_ = mdb_;
@@ -467,8 +560,10 @@ MetadataServer* MetadataServer::Builder::BuildServer() {
   } else {
     delete rpc_;
     delete wrapper_;
+    delete batch_pool_;
     delete mdsmon_;
     delete mds_;
+    delete peers_;
     delete myenv_;
     delete mdb_;
     delete db_;
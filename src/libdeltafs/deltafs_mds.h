@@ -15,6 +15,8 @@
 
 namespace pdlfs {
 
+class MDSFactoryImpl;
+
 class MetadataServer {
   typedef PseudoConcurrentMDSMonitor MDSMonitor;
   typedef MDS::RPC::SRV RPCWrapper;
@@ -35,7 +37,7 @@ class MetadataServer {
   MetadataServer(const MetadataServer&);
 
   MetadataServer() : interrupted_(NULL), cv_(&mutex_), running_(false) {}
-  static void PrintStatus(const Status&, const MDSMonitor*);
+  static void PrintStatus(const Status&, const MDSMonitor*, RPCServer*);
   MDSEnv* myenv_;
   port::AtomicPointer interrupted_;
   port::Mutex mutex_;
@@ -44,8 +46,10 @@ class MetadataServer {
 
   RPCServer* rpc_;
   RPCWrapper* wrapper_;
+  ThreadPool* batch_pool_;  // NULL if coalesced ops run one by one
 
   MDS* mds_;
+  MDSFactoryImpl* peers_;  // NULL unless partitions may move to other servers
   MDSMonitor* mdsmon_;
   MDB* mdb_;
   DB* db_;
@@ -13,11 +13,13 @@
 
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/logging.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/strutil.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -30,6 +32,7 @@ DirOptions::DirOptions()
     : total_memtable_budget(4 << 20),
       memtable_util(1.0),
       skip_sort(false),
+      memtable_dedup(false),
       key_size(8),
       value_size(32),
       bf_bits_per_key(8),
@@ -95,6 +98,10 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParsePrettyNumber(conf_value, &num)) {
         options.total_memtable_budget = num;
       }
+    } else if (conf_key == "memtable_dedup") {
+      if (ParsePrettyBool(conf_value, &flag)) {
+        options.memtable_dedup = flag;
+      }
     } else if (conf_key == "compaction_buffer") {
       if (ParsePrettyNumber(conf_value, &num)) {
         options.block_batch_size = num;
@@ -229,21 +236,22 @@ class DirWriterImpl : public DirWriter {
   virtual ~DirWriterImpl();
 
   virtual IoStats GetIoStats() const;
+  virtual bool GetProperty(const Slice& property, std::string* value) const;
 
-  virtual uint32_t TEST_num_sstables() const;
-  virtual uint32_t TEST_num_keys() const;
-  virtual uint32_t TEST_num_dropped_keys() const;
-  virtual uint32_t TEST_num_data_blocks() const;
+  virtual uint32_t num_sstables() const;
+  virtual uint32_t num_keys() const;
+  virtual uint32_t num_dropped_keys() const;
+  virtual uint32_t num_data_blocks() const;
 
-  virtual uint64_t TEST_estimated_sstable_size() const;
-  virtual uint64_t TEST_max_filter_size() const;
-  virtual uint64_t TEST_total_memory_usage() const;
+  virtual uint64_t estimated_sstable_size() const;
+  virtual uint64_t max_filter_size() const;
+  virtual uint64_t total_memory_usage() const;
 
-  virtual uint64_t TEST_raw_index_contents() const;
-  virtual uint64_t TEST_raw_filter_contents() const;
-  virtual uint64_t TEST_raw_data_contents() const;
-  virtual uint64_t TEST_key_bytes() const;
-  virtual uint64_t TEST_value_bytes() const;
+  virtual uint64_t raw_index_contents() const;
+  virtual uint64_t raw_filter_contents() const;
+  virtual uint64_t raw_data_contents() const;
+  virtual uint64_t key_bytes() const;
+  virtual uint64_t value_bytes() const;
 
   virtual Status WaitForOne();
   virtual Status Wait();
@@ -258,7 +266,11 @@ class DirWriterImpl : public DirWriter {
   Status ObtainCompactionStatus();
   Status WaitForCompaction();
   Status TryFlush(bool epoch_flush = false, bool finalize = false);
-  Status TryBatchWrites(BatchCursor* cursor);
+  Status PartitionBatch(BatchCursor* cursor, std::vector<uint32_t>* offsets,
+                        std::vector<size_t>* bounds) const;
+  Status TryBatchWrites(BatchCursor* cursor,
+                        const std::vector<uint32_t>& offsets,
+                        const std::vector<size_t>& bounds);
   Status TryAppend(const Slice& fid, const Slice& data);
   Status EnsureDataPadding(LogSink* sink, size_t footer_size);
   Status Finalize();
@@ -279,6 +291,7 @@ class DirWriterImpl : public DirWriter {
   // concurrency, though largely not needed so far
   bool has_pending_flush_;
   bool finished_;  // If Finish() has been called
+  uint64_t stall_micros_;  // Time spent waiting for buffer space
   WritableFileStats io_stats_;
   std::vector<const OutputStats*> compaction_stats_;
   std::vector<std::string*> write_bufs_;
@@ -295,6 +308,7 @@ DirWriterImpl::DirWriterImpl(const DirOptions& options)
       part_mask_(~static_cast<uint32_t>(0)),
       has_pending_flush_(false),
       finished_(false),
+      stall_micros_(0),
       dirs_(NULL),
       data_(NULL) {}
 
@@ -419,73 +433,95 @@ Status DirWriterImpl::WaitForCompaction() {
   return status;
 }
 
-Status DirWriterImpl::TryBatchWrites(BatchCursor* cursor) {
-  mutex_.AssertHeld();
-  assert(has_pending_flush_);
-  assert(options_.non_blocking);
-  Status status;
-  std::vector<std::vector<uint32_t> > waiting_list(num_parts_);
-  std::vector<std::vector<uint32_t> > queue(num_parts_);
-  bool has_more = false;  // If the entire batch is done
+// Hash all entries of a given batch and radix-partition their offsets by
+// directory partition. On return, the offsets of the entries belonging to
+// partition i are stored at (*offsets)[(*bounds)[i], (*bounds)[i + 1]),
+// in their original order. Only touches state that is constant after the
+// directory is opened so no locking is needed.
+Status DirWriterImpl::PartitionBatch(BatchCursor* cursor,
+                                     std::vector<uint32_t>* offsets,
+                                     std::vector<size_t>* bounds) const {
+  std::vector<uint32_t> raw;
+  std::vector<uint32_t> parts;
+  bounds->assign(num_parts_ + 1, 0);
   cursor->Seek(0);
   for (; cursor->Valid(); cursor->Next()) {
     Slice fid = cursor->fid();
     const uint32_t hash = Hash(fid.data(), fid.size(), 0);
     const uint32_t part = hash & part_mask_;
     assert(part < num_parts_);
-    status = dirs_[part]->Add(fid, cursor->data());
-
-    if (status.IsBufferFull()) {
-      // Try again later
-      waiting_list[part].push_back(cursor->offset());
-      status = Status::OK();
-      has_more = true;
-    } else if (!status.ok()) {
-      break;
-    } else {
-      // OK
-    }
+    (*bounds)[part + 1]++;
+    parts.push_back(part);
+    raw.push_back(cursor->offset());
+  }
+  Status status = cursor->status();
+  if (!status.ok()) {
+    return status;
   }
 
-  while (status.ok()) {
-    if (has_more) {
-      has_more = false;
-      bg_cv_.Wait();
-    } else {
-      break;
-    }
-    for (size_t i = 0; i < num_parts_; i++) {
-      waiting_list[i].swap(queue[i]);
-      waiting_list[i].clear();
+  for (size_t i = 0; i < num_parts_; i++) {
+    (*bounds)[i + 1] += (*bounds)[i];
+  }
+  if (num_parts_ == 1) {
+    offsets->swap(raw);
+  } else {
+    std::vector<size_t> next(bounds->begin(), bounds->end() - 1);
+    offsets->resize(raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+      (*offsets)[next[parts[i]]++] = raw[i];
     }
-    for (size_t i = 0; i < num_parts_; i++) {
-      if (!queue[i].empty()) {
-        std::vector<uint32_t>::iterator it = queue[i].begin();
-        for (; it != queue[i].end(); ++it) {
-          cursor->Seek(*it);
-          if (cursor->Valid()) {
-            status = dirs_[i]->Add(cursor->fid(), cursor->data());
-          } else {
-            status = cursor->status();
-          }
+  }
 
-          if (status.IsBufferFull()) {
-            // Try again later
-            waiting_list[i].assign(it, queue[i].end());
-            status = Status::OK();
-            has_more = true;
-            break;
-          } else if (!status.ok()) {
-            break;
-          } else {
-            // OK
-          }
-        }
+  return status;
+}
 
-        if (!status.ok()) {
-          break;
-        }
+// Insert a pre-partitioned batch into all directory partitions, one partition
+// at a time. Each partition copies its entries with mutex_ released so
+// compactions and status readers are not blocked meanwhile. Partitions that
+// run out of buffer space are added to a waiting list and are reattempted
+// after some compaction finishes. Return OK on success, or a non-OK status
+// on errors.
+Status DirWriterImpl::TryBatchWrites(BatchCursor* cursor,
+                                     const std::vector<uint32_t>& offsets,
+                                     const std::vector<size_t>& bounds) {
+  mutex_.AssertHeld();
+  assert(has_pending_flush_);
+  Status status;
+  std::vector<size_t> pos(bounds.begin(), bounds.end() - 1);
+  std::vector<size_t> remaining;
+  for (size_t i = 0; i < num_parts_; i++) {
+    if (pos[i] < bounds[i + 1]) remaining.push_back(i);
+  }
+  std::vector<size_t> waiting_list;
+
+  while (!remaining.empty()) {
+    waiting_list.clear();
+    for (size_t j = 0; j < remaining.size(); j++) {
+      const size_t i = remaining[j];
+      status = dirs_[i]->Add(cursor, &offsets[0], bounds[i + 1], &pos[i]);
+      if (status.IsBufferFull()) {
+        waiting_list.push_back(i);  // Try again later
+        status = Status::OK();
+      } else if (!status.ok()) {
+        break;
+      }
+    }
+
+    if (status.ok()) {
+      // mutex_ was released while filling partitions, so a compaction
+      // may have already made room. Only wait if none has.
+      bool stall = !waiting_list.empty();
+      for (size_t j = 0; stall && j < waiting_list.size(); j++) {
+        stall = dirs_[waiting_list[j]]->has_bg_compaction();
+      }
+      if (stall) {
+        const uint64_t start = options_.env->NowMicros();
+        bg_cv_.Wait();  // Waiting for buffer space
+        stall_micros_ += options_.env->NowMicros() - start;
       }
+      waiting_list.swap(remaining);
+    } else {
+      break;
     }
   }
 
@@ -527,7 +563,9 @@ Status DirWriterImpl::TryFlush(bool epoch_flush, bool finalize) {
 
     if (status.ok()) {
       if (!waiting_list.empty()) {
+        const uint64_t start = options_.env->NowMicros();
         bg_cv_.Wait();  // Waiting for buffer space
+        stall_micros_ += options_.env->NowMicros() - start;
       }
       waiting_list.swap(remaining);
     } else {
@@ -632,7 +670,13 @@ Status DirWriterImpl::Flush(int epoch) {
 }
 
 Status DirWriterImpl::Write(BatchCursor* cursor, int epoch) {
-  Status status;
+  std::vector<uint32_t> offsets;
+  std::vector<size_t> bounds;
+  // Partition the batch before locking the directory
+  Status status = PartitionBatch(cursor, &offsets, &bounds);
+  if (!status.ok()) {
+    return status;
+  }
   MutexLock ml(&mutex_);
   while (true) {
     if (finished_) {
@@ -646,7 +690,7 @@ Status DirWriterImpl::Write(BatchCursor* cursor, int epoch) {
     } else {
       // Batch writes may trigger one or more flushes
       has_pending_flush_ = true;
-      status = TryBatchWrites(cursor);
+      status = TryBatchWrites(cursor, offsets, bounds);
       has_pending_flush_ = false;
       cv_.SignalAll();
       break;
@@ -733,7 +777,7 @@ IoStats DirWriterImpl::GetIoStats() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_estimated_sstable_size() const {
+uint64_t DirWriterImpl::estimated_sstable_size() const {
   MutexLock ml(&mutex_);
   if (num_parts_ != 0) {
     return dirs_[0]->estimated_table_size();
@@ -742,7 +786,7 @@ uint64_t DirWriterImpl::TEST_estimated_sstable_size() const {
   }
 }
 
-uint64_t DirWriterImpl::TEST_max_filter_size() const {
+uint64_t DirWriterImpl::max_filter_size() const {
   MutexLock ml(&mutex_);
   if (num_parts_ != 0) {
     return dirs_[0]->max_filter_size();
@@ -751,7 +795,7 @@ uint64_t DirWriterImpl::TEST_max_filter_size() const {
   }
 }
 
-uint32_t DirWriterImpl::TEST_num_keys() const {
+uint32_t DirWriterImpl::num_keys() const {
   MutexLock ml(&mutex_);
   uint32_t result = 0;
   for (size_t i = 0; i < num_parts_; i++) {
@@ -760,7 +804,7 @@ uint32_t DirWriterImpl::TEST_num_keys() const {
   return result;
 }
 
-uint32_t DirWriterImpl::TEST_num_dropped_keys() const {
+uint32_t DirWriterImpl::num_dropped_keys() const {
   MutexLock ml(&mutex_);
   uint32_t result = 0;
   for (size_t i = 0; i < num_parts_; i++) {
@@ -769,7 +813,7 @@ uint32_t DirWriterImpl::TEST_num_dropped_keys() const {
   return result;
 }
 
-uint32_t DirWriterImpl::TEST_num_data_blocks() const {
+uint32_t DirWriterImpl::num_data_blocks() const {
   MutexLock ml(&mutex_);
   uint32_t result = 0;
   for (size_t i = 0; i < num_parts_; i++) {
@@ -778,7 +822,7 @@ uint32_t DirWriterImpl::TEST_num_data_blocks() const {
   return result;
 }
 
-uint32_t DirWriterImpl::TEST_num_sstables() const {
+uint32_t DirWriterImpl::num_sstables() const {
   MutexLock ml(&mutex_);
   uint32_t result = 0;
   for (size_t i = 0; i < num_parts_; i++) {
@@ -787,7 +831,7 @@ uint32_t DirWriterImpl::TEST_num_sstables() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_total_memory_usage() const {
+uint64_t DirWriterImpl::total_memory_usage() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < num_parts_; i++) result += dirs_[i]->memory_usage();
@@ -797,7 +841,7 @@ uint64_t DirWriterImpl::TEST_total_memory_usage() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_raw_index_contents() const {
+uint64_t DirWriterImpl::raw_index_contents() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < compaction_stats_.size(); i++) {
@@ -806,7 +850,7 @@ uint64_t DirWriterImpl::TEST_raw_index_contents() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_raw_filter_contents() const {
+uint64_t DirWriterImpl::raw_filter_contents() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < compaction_stats_.size(); i++) {
@@ -815,7 +859,7 @@ uint64_t DirWriterImpl::TEST_raw_filter_contents() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_raw_data_contents() const {
+uint64_t DirWriterImpl::raw_data_contents() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < compaction_stats_.size(); i++) {
@@ -824,7 +868,7 @@ uint64_t DirWriterImpl::TEST_raw_data_contents() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_value_bytes() const {
+uint64_t DirWriterImpl::value_bytes() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < compaction_stats_.size(); i++) {
@@ -833,7 +877,7 @@ uint64_t DirWriterImpl::TEST_value_bytes() const {
   return result;
 }
 
-uint64_t DirWriterImpl::TEST_key_bytes() const {
+uint64_t DirWriterImpl::key_bytes() const {
   MutexLock ml(&mutex_);
   uint64_t result = 0;
   for (size_t i = 0; i < compaction_stats_.size(); i++) {
@@ -842,6 +886,159 @@ uint64_t DirWriterImpl::TEST_key_bytes() const {
   return result;
 }
 
+static void AppendJson(std::string* dst, const char* name, uint64_t value) {
+  char tmp[100];
+  snprintf(tmp, sizeof(tmp), "%s\"%s\":%llu", dst->size() > 1 ? "," : "",
+           name, static_cast<unsigned long long>(value));
+  dst->append(tmp);
+}
+
+static void AppendJson(std::string* dst, const char* name, double value) {
+  char tmp[100];
+  snprintf(tmp, sizeof(tmp), "%s\"%s\":%.3f", dst->size() > 1 ? "," : "",
+           name, value);
+  dst->append(tmp);
+}
+
+static std::string NumberToString(uint64_t num) {
+  char tmp[30];
+  snprintf(tmp, sizeof(tmp), "%llu", static_cast<unsigned long long>(num));
+  return tmp;
+}
+
+static std::string NumberToString(double num) {
+  char tmp[30];
+  snprintf(tmp, sizeof(tmp), "%.3f", num);
+  return tmp;
+}
+
+// Parse "partition.<N>.<name>" into its partition number and name.
+static bool ParsePartitionProperty(Slice property, uint32_t num_parts,
+                                   uint32_t* part, Slice* name) {
+  uint64_t num;
+  if (!property.starts_with("partition.")) {
+    return false;
+  }
+  property.remove_prefix(strlen("partition."));
+  if (!ConsumeDecimalNumber(&property, &num) || num >= num_parts) {
+    return false;
+  } else if (!property.starts_with(".")) {
+    return false;
+  }
+  property.remove_prefix(1);
+  *part = static_cast<uint32_t>(num);
+  *name = property;
+  return true;
+}
+
+bool DirWriterImpl::GetProperty(const Slice& property,
+                                std::string* value) const {
+  value->clear();
+  if (property == "num_keys") {
+    *value = NumberToString(uint64_t(num_keys()));
+  } else if (property == "num_dropped_keys") {
+    *value = NumberToString(uint64_t(num_dropped_keys()));
+  } else if (property == "num_data_blocks") {
+    *value = NumberToString(uint64_t(num_data_blocks()));
+  } else if (property == "num_sstables") {
+    *value = NumberToString(uint64_t(num_sstables()));
+  } else if (property == "total_user_data") {
+    *value = NumberToString(key_bytes() + value_bytes());
+  } else if (property == "total_memory_usage") {
+    *value = NumberToString(total_memory_usage());
+  } else if (property == "sstable_data_bytes") {
+    *value = NumberToString(raw_data_contents());
+  } else if (property == "sstable_index_bytes") {
+    *value = NumberToString(raw_index_contents());
+  } else if (property == "sstable_filter_bytes") {
+    *value = NumberToString(raw_filter_contents());
+  } else if (property == "data_bytes_written") {
+    *value = NumberToString(GetIoStats().data_bytes);
+  } else if (property == "index_bytes_written") {
+    *value = NumberToString(GetIoStats().index_bytes);
+  } else if (property == "num_compactions" ||
+             property == "compaction_micros" || property == "stall_micros") {
+    MutexLock ml(&mutex_);
+    uint64_t compactions = 0;
+    uint64_t stall_micros = stall_micros_;
+    Histogram hist;
+    hist.Clear();
+    for (size_t i = 0; i < num_parts_; i++) {
+      compactions += dirs_[i]->num_compactions();
+      stall_micros += dirs_[i]->stall_micros();
+      hist.Merge(dirs_[i]->compaction_micros());
+    }
+    if (property == "num_compactions") {
+      *value = NumberToString(compactions);
+    } else if (property == "stall_micros") {
+      *value = NumberToString(stall_micros);
+    } else {
+      char tmp[100];
+      snprintf(tmp, sizeof(tmp), "avg=%.3f p50=%.3f p99=%.3f",
+               hist.Average(), hist.Median(), hist.Percentile(99));
+      *value = tmp;
+    }
+  } else if (property == "json") {
+    const IoStats io = GetIoStats();
+    std::string result = "{";
+    AppendJson(&result, "num_keys", uint64_t(num_keys()));
+    AppendJson(&result, "num_dropped_keys", uint64_t(num_dropped_keys()));
+    AppendJson(&result, "num_data_blocks", uint64_t(num_data_blocks()));
+    AppendJson(&result, "num_sstables", uint64_t(num_sstables()));
+    AppendJson(&result, "total_user_data", key_bytes() + value_bytes());
+    AppendJson(&result, "total_memory_usage", total_memory_usage());
+    AppendJson(&result, "sstable_data_bytes", raw_data_contents());
+    AppendJson(&result, "sstable_index_bytes", raw_index_contents());
+    AppendJson(&result, "sstable_filter_bytes", raw_filter_contents());
+    AppendJson(&result, "data_bytes_written", io.data_bytes);
+    AppendJson(&result, "data_write_ops", io.data_ops);
+    AppendJson(&result, "index_bytes_written", io.index_bytes);
+    AppendJson(&result, "index_write_ops", io.index_ops);
+    MutexLock ml(&mutex_);
+    uint64_t compactions = 0;
+    uint64_t stall_micros = stall_micros_;
+    Histogram hist;
+    hist.Clear();
+    std::string parts;
+    for (size_t i = 0; i < num_parts_; i++) {
+      compactions += dirs_[i]->num_compactions();
+      stall_micros += dirs_[i]->stall_micros();
+      hist.Merge(dirs_[i]->compaction_micros());
+      std::string part = "{";
+      AppendJson(&part, "memory_usage", uint64_t(dirs_[i]->memory_usage()));
+      AppendJson(&part, "index_bytes_written",
+                 dirs_[i]->io_stats_.TotalBytes());
+      AppendJson(&part, "num_compactions",
+                 uint64_t(dirs_[i]->num_compactions()));
+      part += "}";
+      if (i != 0) parts += ",";
+      parts += part;
+    }
+    AppendJson(&result, "num_compactions", compactions);
+    AppendJson(&result, "compaction_micros_avg", hist.Average());
+    AppendJson(&result, "compaction_micros_p50", hist.Median());
+    AppendJson(&result, "compaction_micros_p99", hist.Percentile(99));
+    AppendJson(&result, "stall_micros", stall_micros);
+    result += ",\"partitions\":[" + parts + "]}";
+    value->swap(result);
+  } else {
+    uint32_t part;
+    Slice name;
+    if (!ParsePartitionProperty(property, num_parts_, &part, &name)) {
+      return false;
+    }
+    MutexLock ml(&mutex_);
+    if (name == "memory_usage") {
+      *value = NumberToString(uint64_t(dirs_[part]->memory_usage()));
+    } else if (name == "index_bytes_written") {
+      *value = NumberToString(dirs_[part]->io_stats_.TotalBytes());
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
 DirWriter::~DirWriter() {}
 
 template <class T, class V>
@@ -939,6 +1136,8 @@ Status DirWriter::Open(const DirOptions& opts, const std::string& name,
           100 * options.memtable_util);
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_sort -> %s",
           int(options.skip_sort) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.memtable_dedup -> %s",
+          int(options.memtable_dedup) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_size -> %s",
           PrettySize(options.key_size).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.value_size -> %s",
@@ -1075,11 +1274,23 @@ class DirReaderImpl : public DirReader {
       );
 
   virtual IoStats GetIoStats() const;
+  virtual bool GetProperty(const Slice& property, std::string* value) const;
 
  private:
   RandomAccessFileStats io_stats_;
   friend class DirReader;
 
+  // Read stats accumulated over all successful queries.
+  // Protected by mutex_.
+  uint64_t num_queries_;
+  uint64_t num_table_seeks_;
+  uint64_t num_seeks_;
+  uint64_t num_filter_checks_;
+  uint64_t num_filter_rejects_;
+  uint64_t num_filter_false_positives_;
+  uint64_t num_memory_reads_;
+  uint64_t num_storage_reads_;
+
   DirOptions options_;
   const std::string name_;
   uint32_t num_parts_;
@@ -1092,7 +1303,15 @@ class DirReaderImpl : public DirReader {
 };
 
 DirReaderImpl::DirReaderImpl(const DirOptions& opts, const std::string& name)
-    : options_(opts),
+    : num_queries_(0),
+      num_table_seeks_(0),
+      num_seeks_(0),
+      num_filter_checks_(0),
+      num_filter_rejects_(0),
+      num_filter_false_positives_(0),
+      num_memory_reads_(0),
+      num_storage_reads_(0),
+      options_(opts),
       name_(name),
       num_parts_(0),
       part_mask_(~static_cast<uint32_t>(0)),
@@ -1230,6 +1449,14 @@ Status DirReaderImpl::ReadAll(const Slice& fid, std::string* dst, char* tmp,
     status = dirs_[part]->Read(fid, dst, tmp, tmp_length, &stats);
     dir->Unref();
     if (status.ok()) {
+      num_queries_++;
+      num_table_seeks_ += stats.total_table_seeks;
+      num_seeks_ += stats.total_seeks;
+      num_filter_checks_ += stats.total_filter_checks;
+      num_filter_rejects_ += stats.total_filter_rejects;
+      num_filter_false_positives_ += stats.total_filter_false_positives;
+      num_memory_reads_ += stats.total_memory_reads;
+      num_storage_reads_ += stats.total_storage_reads;
       if (table_seeks != NULL) {
         *table_seeks = stats.total_table_seeks;
       }
@@ -1257,6 +1484,79 @@ IoStats DirReaderImpl::GetIoStats() const {
   return result;
 }
 
+static double Ratio(uint64_t a, uint64_t b) {
+  return b != 0 ? static_cast<double>(a) / b : 0;
+}
+
+bool DirReaderImpl::GetProperty(const Slice& property,
+                                std::string* value) const {
+  value->clear();
+  if (property == "data_bytes_read") {
+    *value = NumberToString(GetIoStats().data_bytes);
+    return true;
+  } else if (property == "index_bytes_read") {
+    *value = NumberToString(GetIoStats().index_bytes);
+    return true;
+  } else if (property == "json") {
+    const IoStats io = GetIoStats();
+    MutexLock ml(&mutex_);
+    std::string result = "{";
+    AppendJson(&result, "num_queries", num_queries_);
+    AppendJson(&result, "table_seeks", num_table_seeks_);
+    AppendJson(&result, "data_blocks_fetched", num_seeks_);
+    AppendJson(&result, "blocks_per_query", Ratio(num_seeks_, num_queries_));
+    AppendJson(&result, "filter_checks", num_filter_checks_);
+    AppendJson(&result, "filter_rejects", num_filter_rejects_);
+    AppendJson(&result, "filter_false_positives",
+               num_filter_false_positives_);
+    AppendJson(&result, "filter_fpr",
+               Ratio(num_filter_false_positives_,
+                     num_filter_false_positives_ + num_filter_rejects_));
+    AppendJson(&result, "memory_block_reads", num_memory_reads_);
+    AppendJson(&result, "storage_block_reads", num_storage_reads_);
+    AppendJson(&result, "memory_hit_ratio",
+               Ratio(num_memory_reads_, num_memory_reads_ + num_storage_reads_));
+    AppendJson(&result, "data_bytes_read", io.data_bytes);
+    AppendJson(&result, "data_read_ops", io.data_ops);
+    AppendJson(&result, "index_bytes_read", io.index_bytes);
+    AppendJson(&result, "index_read_ops", io.index_ops);
+    result += "}";
+    value->swap(result);
+    return true;
+  }
+
+  MutexLock ml(&mutex_);
+  if (property == "num_queries") {
+    *value = NumberToString(num_queries_);
+  } else if (property == "table_seeks") {
+    *value = NumberToString(num_table_seeks_);
+  } else if (property == "data_blocks_fetched") {
+    *value = NumberToString(num_seeks_);
+  } else if (property == "blocks_per_query") {
+    *value = NumberToString(Ratio(num_seeks_, num_queries_));
+  } else if (property == "filter_checks") {
+    *value = NumberToString(num_filter_checks_);
+  } else if (property == "filter_rejects") {
+    *value = NumberToString(num_filter_rejects_);
+  } else if (property == "filter_false_positives") {
+    *value = NumberToString(num_filter_false_positives_);
+  } else if (property == "filter_fpr") {
+    *value = NumberToString(Ratio(
+        num_filter_false_positives_,
+        num_filter_false_positives_ + num_filter_rejects_));
+  } else if (property == "memory_block_reads") {
+    *value = NumberToString(num_memory_reads_);
+  } else if (property == "storage_block_reads") {
+    *value = NumberToString(num_storage_reads_);
+  } else if (property == "memory_hit_ratio") {
+    *value = NumberToString(
+        Ratio(num_memory_reads_, num_memory_reads_ + num_storage_reads_));
+  } else {
+    return false;
+  }
+  return true;
+}
+
 DirReader::~DirReader() {}
 
 static DirOptions SanitizeReadOptions(const DirOptions& options) {
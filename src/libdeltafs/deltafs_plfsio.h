@@ -69,6 +69,13 @@ struct DirOptions {
   // Default: false
   bool skip_sort;
 
+  // Maintain a hash index over each memtable so that duplicated keys are
+  // replaced or discarded at insertion time rather than at compaction time.
+  // Only effective when mode is kUniqueOverride or kUniqueDrop. The index
+  // is carved out of the memtable budget.
+  // Default: false
+  bool memtable_dedup;
+
   // Estimated average key size.
   // Default: 8 bytes
   size_t key_size;
@@ -348,46 +355,62 @@ class DirWriter {
   // Report the I/O stats for logging the data and the indexes.
   virtual IoStats GetIoStats() const = 0;
 
+  // Obtain the value of a named writer property. Return false if the
+  // property is not recognized. Valid property names include:
+  //
+  //  "num_keys", "num_dropped_keys", "num_data_blocks", "num_sstables",
+  //  "total_user_data", "total_memory_usage", "sstable_data_bytes",
+  //  "sstable_index_bytes", "sstable_filter_bytes" - same as the accessors
+  //     below;
+  //  "num_compactions" - number of memtable compactions done so far;
+  //  "compaction_micros" - average, p50, and p99 compaction latency;
+  //  "stall_micros" - total time writers were blocked for buffer space;
+  //  "data_bytes_written", "index_bytes_written" - bytes written per sink;
+  //  "partition.<N>.memory_usage", "partition.<N>.index_bytes_written" -
+  //     stats of memtable partition N;
+  //  "json" - a JSON snapshot of all of the above.
+  virtual bool GetProperty(const Slice& property, std::string* value) const = 0;
+
   // Return the estimated size of each table.
   // The actual size of each generated may differ.
-  virtual uint64_t TEST_estimated_sstable_size() const = 0;
+  virtual uint64_t estimated_sstable_size() const = 0;
 
   // Return the max size of each filter.
   // The actual size of each generated filter may be smaller.
-  virtual uint64_t TEST_max_filter_size() const = 0;
+  virtual uint64_t max_filter_size() const = 0;
 
   // Return the total number of keys inserted so far.
-  virtual uint32_t TEST_num_keys() const = 0;
+  virtual uint32_t num_keys() const = 0;
 
   // Return the total number of keys rejected so far.
-  virtual uint32_t TEST_num_dropped_keys() const = 0;
+  virtual uint32_t num_dropped_keys() const = 0;
 
   // Return the total number of data blocks generated so far.
-  virtual uint32_t TEST_num_data_blocks() const = 0;
+  virtual uint32_t num_data_blocks() const = 0;
 
   // Return the total number of SSTable generated so far.
-  virtual uint32_t TEST_num_sstables() const = 0;
+  virtual uint32_t num_sstables() const = 0;
 
   // Return the aggregated size of all index blocks.
   // Before compression and excluding any padding or checksum bytes.
-  virtual uint64_t TEST_raw_index_contents() const = 0;
+  virtual uint64_t raw_index_contents() const = 0;
 
   // Return the aggregated size of all filter blocks.
   // Before compression and excluding any padding or checksum bytes.
-  virtual uint64_t TEST_raw_filter_contents() const = 0;
+  virtual uint64_t raw_filter_contents() const = 0;
 
   // Return the aggregated size of all data blocks.
   // Excluding any padding or checksum bytes.
-  virtual uint64_t TEST_raw_data_contents() const = 0;
+  virtual uint64_t raw_data_contents() const = 0;
 
   // Return the aggregated size of all inserted keys.
-  virtual uint64_t TEST_key_bytes() const = 0;
+  virtual uint64_t key_bytes() const = 0;
 
   // Return the aggregated size of all inserted values.
-  virtual uint64_t TEST_value_bytes() const = 0;
+  virtual uint64_t value_bytes() const = 0;
 
   // Return the total amount of memory reserved by this directory.
-  virtual uint64_t TEST_total_memory_usage() const = 0;
+  virtual uint64_t total_memory_usage() const = 0;
 
   // Open an I/O writer against a specified plfs-style directory.
   // Return OK on success, or a non-OK status on errors.
@@ -451,6 +474,23 @@ class DirReader {
   // Return the aggregated I/O stats accumulated so far.
   virtual IoStats GetIoStats() const = 0;
 
+  // Obtain the value of a named reader property. Return false if the
+  // property is not recognized. Valid property names include:
+  //
+  //  "num_queries" - number of ReadAll() calls served so far;
+  //  "table_seeks", "data_blocks_fetched" - tables and data blocks touched;
+  //  "blocks_per_query" - average data blocks fetched per query;
+  //  "filter_checks", "filter_rejects", "filter_false_positives" - bloom
+  //     filter outcomes, a false positive being a table whose filter
+  //     matched but which did not contain the key;
+  //  "filter_fpr" - observed false positive rate of the bloom filters;
+  //  "memory_block_reads", "storage_block_reads" - blocks served directly
+  //     from in-memory log contents versus blocks copied from storage;
+  //  "memory_hit_ratio" - fraction of block reads served from memory;
+  //  "data_bytes_read", "index_bytes_read" - bytes read per source;
+  //  "json" - a JSON snapshot of all of the above.
+  virtual bool GetProperty(const Slice& property, std::string* value) const = 0;
+
  private:
   // No copying allowed
   void operator=(const DirReader&);
@@ -28,6 +28,13 @@ static inline uint32_t BloomHash(const Slice& key) {
   return Hash(key.data(), key.size(), 0xbc9f1d34);  // Magic
 }
 
+// Keys are partitioned using Hash(key, 0), so all keys of a memtable
+// partition share the same low bits under seed 0. The memtable hash
+// index must therefore use a different seed.
+static inline uint32_t IndexHash(const Slice& key) {
+  return Hash(key.data(), key.size(), 0x9e3779b9);  // Magic
+}
+
 // Return current time in microseconds.
 static inline uint64_t CurrentTimeMicros() {
   return Env::Default()->NowMicros();
@@ -235,26 +242,118 @@ void WriteBuffer::Reset() {
   finished_ = false;
   offsets_.clear();
   buffer_.clear();
+  std::fill(index_.begin(), index_.end(), 0);
+}
+
+void WriteBuffer::EnableDedup(DirMode mode) {
+  assert(num_entries_ == 0);
+  if (mode == kUniqueOverride || mode == kUniqueDrop) {
+    mode_ = mode;
+    if (index_.empty()) {
+      ResizeIndex(IndexSlots(0));
+    }
+  }
+}
+
+size_t WriteBuffer::IndexSlots(uint32_t num_entries) {
+  size_t num_slots = 16;
+  // Keep the load factor of the index at or below 50%
+  while (num_slots < 2 * static_cast<size_t>(num_entries)) {
+    num_slots *= 2;
+  }
+  return num_slots;
 }
 
 void WriteBuffer::Reserve(uint32_t num_entries, size_t buffer_size) {
   buffer_.reserve(buffer_size);
   offsets_.reserve(num_entries);
+  if (!index_.empty()) {
+    const size_t num_slots = IndexSlots(num_entries);
+    if (num_slots != index_.size()) {
+      ResizeIndex(num_slots);
+    }
+  }
+}
+
+Slice WriteBuffer::KeyAt(uint32_t offset) const {
+  Slice result;
+  const char* p = GetLengthPrefixedSlice(
+      buffer_.data() + offset, buffer_.data() + buffer_.size(), &result);
+  assert(p != NULL);
+  (void)p;
+  return result;
 }
 
-void WriteBuffer::Add(const Slice& key, const Slice& value) {
+// Return the index slot that either holds the given key or should be used to
+// hold it. The number of slots is always a power of 2 and there is always
+// at least one empty slot so that probing terminates.
+uint32_t* WriteBuffer::FindSlot(const Slice& key, uint32_t hash) {
+  assert(!index_.empty());
+  const size_t mask = index_.size() - 1;
+  size_t i = hash & mask;
+  while (index_[i] != 0) {
+    if (KeyAt(offsets_[index_[i] - 1]) == key) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return &index_[i];
+}
+
+void WriteBuffer::ResizeIndex(size_t num_slots) {
+  index_.assign(num_slots, 0);
+  for (uint32_t i = 0; i < num_entries_; i++) {
+    const Slice key = KeyAt(offsets_[i]);
+    *FindSlot(key, IndexHash(key)) = i + 1;
+  }
+}
+
+bool WriteBuffer::Add(const Slice& key, const Slice& value) {
   assert(!finished_);       // Finish() has not been called
   assert(key.size() != 0);  // Key cannot be empty
+  uint32_t* slot = NULL;
+  if (!index_.empty()) {
+    slot = FindSlot(key, IndexHash(key));
+    if (*slot != 0) {
+      if (mode_ == kUniqueDrop) {
+        return false;  // Drop the new one
+      }
+      // Override the existing entry in place if the new value fits.
+      // Otherwise, append the new entry and redirect the old one to it.
+      uint32_t* const entry = &offsets_[*slot - 1];
+      Slice input(buffer_.data() + *entry, buffer_.size() - *entry);
+      Slice old_key, old_value;
+      GetLengthPrefixedSlice(&input, &old_key);
+      GetLengthPrefixedSlice(&input, &old_value);
+      if (old_value.size() == value.size()) {
+        memcpy(const_cast<char*>(old_value.data()), value.data(),
+               value.size());
+      } else {
+        *entry = static_cast<uint32_t>(buffer_.size());
+        PutLengthPrefixedSlice(&buffer_, key);
+        PutLengthPrefixedSlice(&buffer_, value);
+      }
+      return false;
+    }
+  }
   const size_t offset = buffer_.size();
   PutLengthPrefixedSlice(&buffer_, key);
   PutLengthPrefixedSlice(&buffer_, value);
   offsets_.push_back(static_cast<uint32_t>(offset));
   num_entries_++;
+  if (slot != NULL) {
+    *slot = num_entries_;
+    if (2 * static_cast<size_t>(num_entries_) > index_.size()) {
+      ResizeIndex(2 * index_.size());
+    }
+  }
+  return true;
 }
 
 size_t WriteBuffer::memory_usage() const {
   size_t result = 0;
   result += sizeof(uint32_t) * offsets_.capacity();
+  result += sizeof(uint32_t) * index_.capacity();
   result += buffer_.capacity();
   return result;
 }
@@ -696,8 +795,10 @@ DirLogger::DirLogger(const DirOptions& options, size_t part, port::Mutex* mu,
       bg_cv_(cv),
       mu_(mu),
       part_(part),
+      num_mem_dropped_keys_(0),
       num_flush_requested_(0),
       num_flush_completed_(0),
+      stall_micros_(0),
       has_bg_compaction_(false),
       filter_(NULL),
       mem_buf_(NULL),
@@ -709,6 +810,7 @@ DirLogger::DirLogger(const DirOptions& options, size_t part, port::Mutex* mu,
       indx_(NULL),
       opened_(false),
       refs_(0) {
+  compaction_hist_.Clear();
   // Determine the right table size and bloom filter size.
   // Works best when the key and value sizes are fixed.
   //
@@ -741,6 +843,24 @@ DirLogger::DirLogger(const DirOptions& options, size_t part, port::Mutex* mu,
   entries_per_tb_ = static_cast<uint32_t>(
       ceil(8.0 * double(table_buffer) / double(total_bits_per_entry)));
 
+  const bool dedup =
+      options_.memtable_dedup &&
+      (options_.mode == kUniqueOverride || options_.mode == kUniqueDrop);
+  if (dedup) {
+    // Carve out the hash indexes of both write buffers. Shrinking the
+    // number of entries never requires more index slots, so the
+    // final index will not outgrow what is reserved here.
+    const size_t index_bytes =
+        2 * sizeof(uint32_t) * WriteBuffer::IndexSlots(entries_per_tb_);
+    if (table_buffer > index_bytes) {
+      table_buffer -= index_bytes;
+    } else {
+      table_buffer = 0;
+    }
+    entries_per_tb_ = static_cast<uint32_t>(
+        ceil(8.0 * double(table_buffer) / double(total_bits_per_entry)));
+  }
+
   tb_bytes_ = entries_per_tb_ * (bytes_per_entry - sizeof(uint32_t));
   // Compute bloom filter size (in both bits and bytes)
   bf_bits_ = entries_per_tb_ * options_.bf_bits_per_key;
@@ -761,6 +881,10 @@ DirLogger::DirLogger(const DirOptions& options, size_t part, port::Mutex* mu,
 #endif
 
   // Allocate memory
+  if (dedup) {
+    buf0_.EnableDedup(options_.mode);
+    buf1_.EnableDedup(options_.mode);
+  }
   buf0_.Reserve(entries_per_tb_, tb_bytes_);
   buf1_.Reserve(entries_per_tb_, tb_bytes_);
 
@@ -845,7 +969,9 @@ Status DirLogger::Flush(const FlushOptions& flush_options) {
     if (flush_options.dry_run || options_.non_blocking) {
       return Status::BufferFull(Slice());
     } else {
+      const uint64_t start = CurrentTimeMicros();
       bg_cv_->Wait();
+      stall_micros_ += CurrentTimeMicros() - start;
     }
   }
 
@@ -873,7 +999,53 @@ Status DirLogger::Add(const Slice& key, const Slice& value) {
   mu_->AssertHeld();
   assert(opened_);
   Status status = Prepare();
-  if (status.ok()) mem_buf_->Add(key, value);
+  if (status.ok()) {
+    if (!mem_buf_->Add(key, value)) {
+      num_mem_dropped_keys_++;
+    }
+  }
+  return status;
+}
+
+Status DirLogger::Add(BatchCursor* cursor, const uint32_t* offsets, size_t n,
+                      size_t* pos) {
+  mu_->AssertHeld();
+  assert(opened_);
+  Status status;
+  const size_t limit = static_cast<size_t>(tb_bytes_ * options_.memtable_util);
+  while (*pos < n) {
+    status = Prepare();
+    if (!status.ok()) {
+      break;
+    }
+    // Fill the current write buffer until it has no more room. Only
+    // Prepare() switches mem_buf_ and the caller is the only writer, so
+    // the buffer can be filled without holding mutex_.
+    WriteBuffer* const buf = mem_buf_;
+    uint32_t num_dropped = 0;
+    mu_->Unlock();
+    buf_mu_.Lock();
+    do {
+      cursor->Seek(offsets[*pos]);
+      if (!cursor->Valid()) {
+        status = cursor->status();
+        if (status.ok()) status = Status::Corruption("Bad batch offset");
+        break;
+      }
+      if (!buf->Add(cursor->fid(), cursor->data())) {
+        num_dropped++;
+      }
+      ++*pos;
+    } while (*pos < n && buf->CurrentBufferSize() < limit &&
+             !buf->IndexFull());
+    buf_mu_.Unlock();
+    mu_->Lock();
+    num_mem_dropped_keys_ += num_dropped;
+    if (!status.ok()) {
+      break;
+    }
+  }
+
   return status;
 }
 
@@ -887,7 +1059,8 @@ Status DirLogger::Prepare(bool force, bool epoch_flush, bool finalize) {
       break;
     } else if (!force &&
                mem_buf_->CurrentBufferSize() <
-                   static_cast<size_t>(tb_bytes_ * options_.memtable_util)) {
+                   static_cast<size_t>(tb_bytes_ * options_.memtable_util) &&
+               !mem_buf_->IndexFull()) {
       // There is room in current write buffer
       break;
     } else if (imm_buf_ != NULL) {
@@ -895,7 +1068,9 @@ Status DirLogger::Prepare(bool force, bool epoch_flush, bool finalize) {
         status = Status::BufferFull(Slice());
         break;
       } else {
+        const uint64_t start = CurrentTimeMicros();
         bg_cv_->Wait();
+        stall_micros_ += CurrentTimeMicros() - start;
       }
     } else {
       // Attempt to switch to a new write buffer
@@ -1040,6 +1215,7 @@ void DirLogger::CompactMemtable() {
   Status status = tb->status();
   delete iter;
   mu_->Lock();
+  compaction_hist_.Add(static_cast<double>(end - start));
   num_flush_completed_++;
   bg_status_ = status;
   return;
@@ -1049,8 +1225,10 @@ size_t DirLogger::memory_usage() const {
   mu_->AssertHeld();
   if (opened_) {
     size_t result = 0;
+    buf_mu_.Lock();
     result += buf0_.memory_usage();
     result += buf1_.memory_usage();
+    buf_mu_.Unlock();
     std::vector<std::string*> stores;
     stores.push_back(tb_->root_block_.buffer_store());
     stores.push_back(tb_->meta_block_.buffer_store());
@@ -1069,10 +1247,13 @@ size_t DirLogger::memory_usage() const {
   }
 }
 
+// If "in_memory" is not NULL, set *in_memory to true iff the block
+// contents were served directly from memory rather than copied out
+// of the underlying storage.
 static Status ReadBlock(LogSource* source, const DirOptions& options,
                         const BlockHandle& handle, BlockContents* result,
                         bool cached = false, char* tmp = NULL,
-                        size_t tmp_length = 0) {
+                        size_t tmp_length = 0, bool* in_memory = NULL) {
   result->data = Slice();
   result->heap_allocated = false;
   result->cachable = false;
@@ -1100,6 +1281,9 @@ static Status ReadBlock(LogSource* source, const DirOptions& options,
 
   // CRC checks
   const char* data = contents.data();  // Pointer to where read put the data
+  if (in_memory != NULL) {
+    *in_memory = (data != buf);
+  }
   if (!options.skip_checksums && options.verify_checksums) {
     const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
     const uint32_t actual = crc32c::Value(data, n + 1);
@@ -1158,12 +1342,18 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
   *exhausted = false;
   Status status;
   BlockContents contents;
+  bool in_memory = false;
   status = ReadBlock(data_, options_, h, &contents, false, opts.tmp,
-                     opts.tmp_length);
+                     opts.tmp_length, &in_memory);
   if (!status.ok()) {
     return status;
   } else {
     opts.stats->seeks++;
+    if (in_memory) {
+      opts.stats->memory_reads++;
+    } else {
+      opts.stats->storage_reads++;
+    }
   }
 
   Block* block = new Block(contents);
@@ -1242,7 +1432,9 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
     filter_handle.set_offset(h.filter_offset());
     filter_handle.set_size(h.filter_size());
     if (filter_handle.size() != 0) {  // Filter detected
+      opts.stats->filter_checks++;
       if (!KeyMayMatch(key, filter_handle)) {
+        opts.stats->filter_rejects++;
         // Assuming no false negatives
         return status;
       }
@@ -1384,6 +1576,8 @@ Status Dir::TryGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
       opts.stats = stats;
       opts.tmp_length = ctx->tmp_length;
       opts.tmp = ctx->tmp;
+      const size_t filter_checks = stats->filter_checks;
+      const size_t filter_rejects = stats->filter_rejects;
       if (options_.parallel_reads) {
         opts.saver = ParaSaveValue;
         opts.arg = &state;
@@ -1393,6 +1587,12 @@ Status Dir::TryGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
         opts.arg = &state;
         status = Fetch(opts, key, table_handle);
       }
+      if (status.ok() && !state.found) {
+        if (stats->filter_checks != filter_checks &&
+            stats->filter_rejects == filter_rejects) {
+          stats->filter_false_positives++;  // Filter matched in vain
+        }
+      }
       if (status.ok() && state.found) {
         if (options_.mode != kMultiMap) {
           break;
@@ -1424,6 +1624,11 @@ void Dir::Get(const Slice& key, uint32_t epoch, GetContext* ctx) {
   stats.table_seeks = 0;  // Number of tables touched
   // Number of data blocks fetched
   stats.seeks = 0;
+  stats.filter_checks = 0;
+  stats.filter_rejects = 0;
+  stats.filter_false_positives = 0;
+  stats.memory_reads = 0;
+  stats.storage_reads = 0;
   Status status;
   for (uint32_t dummy = epoch; dummy == epoch; dummy++) {
     std::string epoch_key = EpochKey(epoch);
@@ -1459,6 +1664,11 @@ void Dir::Get(const Slice& key, uint32_t epoch, GetContext* ctx) {
   // Increase the total seek count
   ctx->num_table_seeks += stats.table_seeks;
   ctx->num_seeks += stats.seeks;
+  ctx->num_filter_checks += stats.filter_checks;
+  ctx->num_filter_rejects += stats.filter_rejects;
+  ctx->num_filter_false_positives += stats.filter_false_positives;
+  ctx->num_memory_reads += stats.memory_reads;
+  ctx->num_storage_reads += stats.storage_reads;
   assert(ctx->num_open_reads > 0);
   ctx->num_open_reads--;
   bg_cv_->SignalAll();
@@ -1530,6 +1740,11 @@ Status Dir::Read(const Slice& key, std::string* dst, char* tmp,
   ctx.num_table_seeks = 0;  // Total number of tables touched
   // Total number of data blocks fetched
   ctx.num_seeks = 0;
+  ctx.num_filter_checks = 0;
+  ctx.num_filter_rejects = 0;
+  ctx.num_filter_false_positives = 0;
+  ctx.num_memory_reads = 0;
+  ctx.num_storage_reads = 0;
   if (!options_.parallel_reads) {
     // Pre-create the root iterator for serial reads
     ctx.rt_iter = NewRtIterator(rt_);
@@ -1572,6 +1787,11 @@ Status Dir::Read(const Slice& key, std::string* dst, char* tmp,
     if (stats != NULL) {
       stats->total_table_seeks = ctx.num_table_seeks;
       stats->total_seeks = ctx.num_seeks;
+      stats->total_filter_checks = ctx.num_filter_checks;
+      stats->total_filter_rejects = ctx.num_filter_rejects;
+      stats->total_filter_false_positives = ctx.num_filter_false_positives;
+      stats->total_memory_reads = ctx.num_memory_reads;
+      stats->total_storage_reads = ctx.num_storage_reads;
     }
     if (options_.parallel_reads) {
       Merge(&ctx);
@@ -10,10 +10,12 @@
 #pragma once
 
 #include "deltafs_plfsio.h"
+#include "deltafs_plfsio_batch.h"
 #include "deltafs_plfsio_format.h"
 #include "deltafs_plfsio_log.h"
 
 #include "pdlfs-common/env_files.h"
+#include "pdlfs-common/histogram.h"
 #include "pdlfs-common/port.h"
 
 #ifndef NDEBUG
@@ -28,27 +30,50 @@ namespace plfsio {
 // Non-thread-safe append-only in-memory table.
 class WriteBuffer {
  public:
-  explicit WriteBuffer() : num_entries_(0), finished_(false) {}
+  explicit WriteBuffer()
+      : num_entries_(0), finished_(false), mode_(kMultiMap) {}
   ~WriteBuffer() {}
 
   size_t memory_usage() const;  // Report real memory usage
 
+  // Enable the in-memory hash index so that duplicated keys are either
+  // replaced (kUniqueOverride) or discarded (kUniqueDrop) at insertion time.
+  // Other modes keep the buffer append-only.
+  // REQUIRES: no entries have been inserted.
+  void EnableDedup(DirMode mode);
+  // Return the number of index slots used to hold a given number of entries.
+  static size_t IndexSlots(uint32_t num_entries);
   void Reserve(uint32_t num_entries, size_t buffer_size);
   size_t CurrentBufferSize() const { return buffer_.size(); }
+  // Return true if the hash index has reached its maximum load factor.
+  // Further insertions would grow the index beyond its reserved size.
+  bool IndexFull() const {
+    return !index_.empty() &&
+           2 * static_cast<size_t>(num_entries_) >= index_.size();
+  }
   uint32_t NumEntries() const { return num_entries_; }
-  void Add(const Slice& key, const Slice& value);
+  // Return false if the insertion collapsed into an existing entry.
+  bool Add(const Slice& key, const Slice& value);
   Iterator* NewIterator() const;
   void Finish(bool skip_sort = false);
   void Reset();
 
  private:
   struct STLLessThan;
+  Slice KeyAt(uint32_t offset) const;
+  uint32_t* FindSlot(const Slice& key, uint32_t hash);
+  void ResizeIndex(size_t num_slots);
   // Starting offsets of inserted entries
   std::vector<uint32_t> offsets_;
   std::string buffer_;
   uint32_t num_entries_;
   bool finished_;
 
+  // Open-addressing hash index mapping keys to their (1-based) entry number.
+  // Empty unless dedup has been enabled.
+  std::vector<uint32_t> index_;
+  DirMode mode_;
+
   // No copying allowed
   void operator=(const WriteBuffer&);
   WriteBuffer(const WriteBuffer&);
@@ -172,7 +197,9 @@ class DirLogger {
   const OutputStats* output_stats() const { return &tb_->output_stats_; }
 
   uint32_t num_keys() const { return tb_->total_num_keys_; }
-  uint32_t num_dropped_keys() const { return tb_->total_num_dropped_keys_; }
+  uint32_t num_dropped_keys() const {
+    return tb_->total_num_dropped_keys_ + num_mem_dropped_keys_;
+  }
   uint32_t num_data_blocks() const { return tb_->total_num_blocks_; }
   uint32_t num_tables() const { return tb_->total_num_tables_; }
 
@@ -181,11 +208,26 @@ class DirLogger {
   size_t max_filter_size() const { return bf_bytes_; }
   size_t memory_usage() const;  // Report actual memory usage
 
+  // Report compaction and stall stats
+  // REQUIRES: mutex_ has been locked
+  uint32_t num_compactions() const { return num_flush_completed_; }
+  const Histogram& compaction_micros() const { return compaction_hist_; }
+  uint64_t stall_micros() const { return stall_micros_; }
+
   // REQUIRES: mutex_ has been locked
   bool has_bg_compaction();
   Status bg_status();  // Return latest compaction status
   // May trigger a new compaction
   Status Add(const Slice& key, const Slice& value);
+  // Insert the cursor entries located at offsets[*pos, n) in order. On return,
+  // *pos is advanced past all entries that have been inserted. In
+  // non-blocking mode, a BufferFull status is returned as soon as the
+  // remaining entries cannot be inserted without waiting.
+  // May trigger one or more compactions. Entries are copied into the
+  // write buffer with mutex_ temporarily released, so callers must
+  // ensure no other thread is adding to this partition meanwhile.
+  Status Add(BatchCursor* cursor, const uint32_t* offsets, size_t n,
+             size_t* pos);
 
   // Force a compaction and maybe wait for it
   struct FlushOptions {
@@ -247,10 +289,16 @@ class DirLogger {
   uint32_t entries_per_tb_;  // Number of entries packed per table
   size_t tb_bytes_;          // Target table size
   size_t part_;              // Partition index
+  // Protecting the contents of mem_buf_ while a batch is copied into
+  // it without holding mutex_
+  mutable port::Mutex buf_mu_;
 
   // State below is protected by mutex_
+  uint32_t num_mem_dropped_keys_;  // Duplicates collapsed by write buffers
   uint32_t num_flush_requested_;
   uint32_t num_flush_completed_;
+  uint64_t stall_micros_;  // Time spent waiting for buffer space
+  Histogram compaction_hist_;
   bool has_bg_compaction_;
   Status bg_status_;
   void* filter_;  // void* since different types of filter might be used
@@ -284,6 +332,12 @@ class Dir {
     size_t total_table_seeks;  // Total tables touched
     // Total data blocks fetched
     size_t total_seeks;
+    size_t total_filter_checks;   // Filters consulted
+    size_t total_filter_rejects;  // Tables skipped by their filters
+    // Tables whose filters matched but which did not contain the key
+    size_t total_filter_false_positives;
+    size_t total_memory_reads;   // Data blocks served from memory
+    size_t total_storage_reads;  // Data blocks copied from storage
   };
   Status Read(const Slice& key, std::string* dst, char* tmp, size_t tmp_length,
               ReadStats* stats);
@@ -356,6 +410,11 @@ class Dir {
     size_t num_table_seeks;  // Total number of tables touched
     // Total number of data blocks fetched
     size_t num_seeks;
+    size_t num_filter_checks;
+    size_t num_filter_rejects;
+    size_t num_filter_false_positives;
+    size_t num_memory_reads;
+    size_t num_storage_reads;
   };
   void Get(const Slice& key, uint32_t epoch, GetContext* ctx);
 
@@ -363,6 +422,11 @@ class Dir {
     size_t table_seeks;  // Total number of tables touched for an epoch
     // Total number of data blocks fetched for an epoch
     size_t seeks;
+    size_t filter_checks;
+    size_t filter_rejects;
+    size_t filter_false_positives;
+    size_t memory_reads;   // Data blocks served from memory
+    size_t storage_reads;  // Data blocks copied from storage
   };
   Status TryGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
                 GetContext* ctx, GetStats* stats);
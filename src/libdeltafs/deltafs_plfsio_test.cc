@@ -104,6 +104,65 @@ TEST(WriterBufTest, VariableSizedValue) {
   delete iter;
 }
 
+TEST(WriterBufTest, DedupOverride) {
+  buffer_.EnableDedup(kUniqueOverride);
+  ASSERT_TRUE(buffer_.Add("k1", "v1"));
+  ASSERT_TRUE(buffer_.Add("k2", "v2"));
+  ASSERT_FALSE(buffer_.Add("k1", "v3"));     // Same size, replaced in place
+  ASSERT_FALSE(buffer_.Add("k2", "v4444"));  // Relocated
+  ASSERT_TRUE(buffer_.Add("k0", "v5"));
+  buffer_.Finish();
+  ASSERT_EQ(buffer_.NumEntries(), 3);
+  Iterator* iter = buffer_.NewIterator();
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key().ToString(), "k0");
+  ASSERT_EQ(iter->value().ToString(), "v5");
+  iter->Next();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key().ToString(), "k1");
+  ASSERT_EQ(iter->value().ToString(), "v3");
+  iter->Next();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key().ToString(), "k2");
+  ASSERT_EQ(iter->value().ToString(), "v4444");
+  iter->Next();
+  ASSERT_FALSE(iter->Valid());
+  delete iter;
+}
+
+TEST(WriterBufTest, DedupDrop) {
+  buffer_.EnableDedup(kUniqueDrop);
+  // Insert enough keys to force the index to grow a few times
+  for (uint64_t i = 0; i < 1000; i++) {
+    std::string key;
+    PutFixed64(&key, i);
+    ASSERT_TRUE(buffer_.Add(key, "v1"));
+    ASSERT_FALSE(buffer_.Add(key, "v2"));
+  }
+  buffer_.Finish();
+  ASSERT_EQ(buffer_.NumEntries(), 1000);
+  Iterator* iter = buffer_.NewIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(iter->value().ToString(), "v1");
+  }
+  delete iter;
+}
+
+TEST(WriterBufTest, DedupIndexLimit) {
+  buffer_.EnableDedup(kUniqueDrop);
+  buffer_.Reserve(128, 4096);
+  const size_t mem = buffer_.memory_usage();
+  uint64_t i = 0;
+  for (; !buffer_.IndexFull(); i++) {
+    std::string key;
+    PutFixed64(&key, i);
+    ASSERT_TRUE(buffer_.Add(key, "v"));
+  }
+  ASSERT_EQ(i, WriteBuffer::IndexSlots(128) / 2);
+  ASSERT_EQ(buffer_.memory_usage(), mem);  // Index has not grown
+}
+
 class PlfsIoTest {
  public:
   PlfsIoTest() {
@@ -157,6 +216,12 @@ class PlfsIoTest {
     ASSERT_OK(writer_->Append(key, value, epoch_));
   }
 
+  uint64_t ReaderProperty(const Slice& property) {
+    std::string value;
+    ASSERT_TRUE(reader_->GetProperty(property, &value)) << property.ToString();
+    return strtoull(value.c_str(), NULL, 10);
+  }
+
   std::string Read(const Slice& key) {
     std::string tmp;
     if (writer_ != NULL) Finish();
@@ -299,6 +364,196 @@ TEST(PlfsIoTest, NoUniKeys) {
 
 namespace {
 
+class VectorBatch : public BatchCursor {
+ public:
+  VectorBatch() : offset_(0) {}
+  virtual ~VectorBatch() {}
+
+  void Add(const std::string& fid, const std::string& data) {
+    kvs_.push_back(std::make_pair(fid, data));
+  }
+
+  virtual Status status() const { return Status::OK(); }
+  virtual bool Valid() const { return offset_ < kvs_.size(); }
+  virtual void Seek(uint32_t offset) { offset_ = offset; }
+  virtual void Next() { offset_++; }
+  virtual uint32_t offset() const { return offset_; }
+  virtual Slice fid() const { return kvs_[offset_].first; }
+  virtual Slice data() const { return kvs_[offset_].second; }
+
+ private:
+  std::vector<std::pair<std::string, std::string> > kvs_;
+  uint32_t offset_;
+};
+
+}  // anonymous namespace
+
+TEST(PlfsIoTest, BatchWrites) {
+  options_.total_memtable_budget = 4 << 20;
+  options_.lg_parts = 2;
+  OpenWriter();
+  VectorBatch batch;
+  char tmp[20];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%04d", i);
+    batch.Add(tmp, std::string(tmp) + "v");
+  }
+  ASSERT_OK(writer_->Write(&batch, epoch_));
+  MakeEpoch();
+  ASSERT_OK(writer_->Write(&batch, epoch_));
+  MakeEpoch();
+  for (int i = 0; i < 1000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%04d", i);
+    ASSERT_EQ(Read(tmp), std::string(tmp) + "v" + std::string(tmp) + "v");
+  }
+}
+
+// Write the same batch in multiple epochs using a tiny memtable budget so
+// that each batch has to go through several rounds of compaction.
+class PlfsIoBatchTest : public PlfsIoTest {
+ public:
+  PlfsIoBatchTest() {
+    options_.total_memtable_budget = 1 << 20;  // Minimum allowed
+    options_.block_batch_size = 224 << 10;  // Leaving 32KB per partition
+    options_.block_size = 4 << 10;
+    options_.lg_parts = 2;
+    pool_ = ThreadPool::NewFixed(2);
+    options_.compaction_pool = pool_;
+  }
+
+  ~PlfsIoBatchTest() {
+    if (writer_ != NULL) {
+      delete writer_;
+      writer_ = NULL;
+    }
+    delete pool_;
+  }
+
+  void Run(bool non_blocking) {
+    options_.non_blocking = non_blocking;
+    OpenWriter();
+    const int num_keys = 4000;
+    const int num_epochs = 3;
+    char tmp[20];
+    for (int e = 0; e < num_epochs; e++) {
+      VectorBatch batch;
+      for (int i = 0; i < num_keys; i++) {
+        snprintf(tmp, sizeof(tmp), "k%04d", i);
+        batch.Add(tmp, std::string(32, 'a' + e));
+      }
+      ASSERT_OK(writer_->Write(&batch, epoch_));
+      MakeEpoch();
+    }
+    ASSERT_OK(writer_->Wait());
+    // Each epoch should have spanned multiple tables per partition
+    ASSERT_GE(writer_->num_sstables(), 2 * num_epochs * 4);
+    std::string expected;
+    for (int e = 0; e < num_epochs; e++) {
+      expected += std::string(32, 'a' + e);
+    }
+    for (int i = 0; i < num_keys; i++) {
+      snprintf(tmp, sizeof(tmp), "k%04d", i);
+      ASSERT_EQ(Read(tmp), expected);
+    }
+  }
+
+  ThreadPool* pool_;
+};
+
+TEST(PlfsIoBatchTest, Blocking) { Run(false); }
+
+TEST(PlfsIoBatchTest, NonBlocking) { Run(true); }
+
+TEST(PlfsIoTest, MemtableDedupOverride) {
+  options_.mode = kUniqueOverride;
+  options_.memtable_dedup = true;
+  Write("k1", "v1");
+  Write("k2", "v2");
+  Write("k1", "v3");
+  MakeEpoch();
+  Write("k2", "v4");
+  Write("k2", "v55");
+  MakeEpoch();
+  ASSERT_EQ(writer_->num_dropped_keys(), 2);
+  ASSERT_EQ(Read("k1"), "v3");
+  ASSERT_EQ(Read("k2"), "v2v55");
+}
+
+TEST(PlfsIoTest, MemtableDedupDrop) {
+  options_.mode = kUniqueDrop;
+  options_.memtable_dedup = true;
+  Write("k1", "v1");
+  Write("k2", "v2");
+  Write("k1", "v3");
+  MakeEpoch();
+  Write("k2", "v4");
+  Write("k2", "v5");
+  MakeEpoch();
+  ASSERT_EQ(writer_->num_dropped_keys(), 2);
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k2"), "v2v4");
+}
+
+TEST(PlfsIoTest, MemtableDedupSmallValues) {
+  options_.mode = kUniqueOverride;
+  options_.memtable_dedup = true;
+  char tmp[20];
+  // Values far smaller than options_.value_size overflow the index
+  // before the buffer, which must trigger buffer switches
+  for (int i = 0; i < 20000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Write(tmp, "v");
+  }
+  MakeEpoch();
+  ASSERT_GT(writer_->num_sstables(), 1);
+  for (int i = 0; i < 20000; i += 97) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), "v");
+  }
+}
+
+TEST(PlfsIoTest, Properties) {
+  std::string value;
+  Write("k1", "v1");
+  Write("k2", "v2");
+  MakeEpoch();
+  Write("k3", "v3");
+  MakeEpoch();
+  ASSERT_OK(writer_->Wait());
+  ASSERT_TRUE(writer_->GetProperty("num_keys", &value));
+  ASSERT_EQ(value, "3");
+  ASSERT_TRUE(writer_->GetProperty("total_user_data", &value));
+  ASSERT_EQ(value, "12");
+  ASSERT_TRUE(writer_->GetProperty("num_compactions", &value));
+  ASSERT_EQ(value, "2");
+  ASSERT_TRUE(writer_->GetProperty("partition.0.memory_usage", &value));
+  ASSERT_TRUE(writer_->GetProperty("json", &value));
+  ASSERT_TRUE(value.find("\"num_keys\":3") != std::string::npos) << value;
+  ASSERT_FALSE(writer_->GetProperty("partition.1.memory_usage", &value));
+  ASSERT_FALSE(writer_->GetProperty("no-such-property", &value));
+
+  ASSERT_EQ(Read("k1"), "v1");
+  ASSERT_EQ(Read("k3"), "v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_TRUE(reader_->GetProperty("num_queries", &value));
+  ASSERT_EQ(value, "3");
+  ASSERT_TRUE(reader_->GetProperty("data_blocks_fetched", &value));
+  ASSERT_EQ(value, "2");
+  // Tables that are not rejected by their filters are all searched
+  ASSERT_EQ(ReaderProperty("filter_checks"),
+            ReaderProperty("filter_rejects") + ReaderProperty("table_seeks") -
+                ReaderProperty("filter_false_positives"));
+  ASSERT_GT(ReaderProperty("filter_rejects"), 0);
+  ASSERT_EQ(ReaderProperty("memory_block_reads") +
+                ReaderProperty("storage_block_reads"),
+            2);
+  ASSERT_TRUE(reader_->GetProperty("json", &value));
+  ASSERT_TRUE(value.find("\"filter_rejects\":") != std::string::npos);
+  ASSERT_FALSE(reader_->GetProperty("num_keys", &value));
+}
+
+namespace {
+
 class FakeWritableFile : public WritableFileWrapper {
  public:
   explicit FakeWritableFile(uint64_t bytes_ps, Histogram* hist = NULL,
@@ -476,6 +731,7 @@ class PlfsIoBench {
     batch_size_ = GetOption("BATCH_SIZE", 4) << 10;  // Files per batch op
     ordered_keys_ = GetOption("ORDERED_KEYS", false);
     num_files_ = GetOption("NUM_FILES", 16);  // 16M files per epoch
+    num_dups_ = GetOption("NUM_DUPS", 1);     // Writes per distinct file
 
     num_threads_ = GetOption("NUM_THREADS", 4);  // Threads for bg compaction
 
@@ -486,6 +742,7 @@ class PlfsIoBench {
     options_.mode = kUniqueDrop;
     options_.lg_parts = GetOption("LG_PARTS", 2);
     options_.skip_sort = ordered_keys_ != 0;
+    options_.memtable_dedup = GetOption("MEMTABLE_DEDUP", false) != 0;
     options_.non_blocking = batched_insertion_ != 0;
     options_.compression =
         GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression;
@@ -530,12 +787,14 @@ class PlfsIoBench {
  protected:
   class BigBatch : public BatchCursor {
    public:
-    BigBatch(const DirOptions& options, int base_offset, int size)
+    BigBatch(const DirOptions& options, int base_offset, int size,
+             int num_dups = 1)
         : key_size_(options.key_size),
           dummy_val_(options.value_size, 'x'),
           base_offset_(static_cast<uint32_t>(base_offset)),
           size_(static_cast<uint32_t>(size)),
           ordered_keys_(options.skip_sort),
+          num_dups_(static_cast<uint32_t>(num_dups)),
           offset_(size_) {}
 
     virtual ~BigBatch() {}
@@ -572,10 +831,11 @@ class PlfsIoBench {
     uint32_t base_offset_;
     uint32_t size_;
     bool ordered_keys_;
+    uint32_t num_dups_;  // Number of consecutive rewrites of each key
     Status status_;
 
     void MakeKey() {
-      uint32_t offset = base_offset_ + offset_;
+      uint32_t offset = (base_offset_ + offset_) / num_dups_;
       if (!ordered_keys_) {
         uint64_t h = xxhash64(&offset, sizeof(offset), 0);
         memcpy(key_ + 8, &h, 8);
@@ -641,7 +901,8 @@ class PlfsIoBench {
     const uint64_t start = env_->NowMicros();
     fprintf(stderr, "Inserting data...\n");
     int i = 0, total_files = (num_files_ << 20);
-    BigBatch batch(options_, i, batched_insertion_ ? batch_size_ : total_files);
+    BigBatch batch(options_, i, batched_insertion_ ? batch_size_ : total_files,
+                   num_dups_);
     batch.Seek(0);
     while (i < total_files) {
       // Report progress
@@ -707,7 +968,7 @@ class PlfsIoBench {
   void PrintStats(uint64_t dura, bool owns_env) {
     const double k = 1000.0, ki = 1024.0;
     fprintf(stderr, "----------------------------------------\n");
-    const uint64_t total_memory_usage = writer_->TEST_total_memory_usage();
+    const uint64_t total_memory_usage = writer_->total_memory_usage();
     fprintf(stderr, "     Total Memory Usage: %.3f MiB\n",
             total_memory_usage / ki / ki);
     fprintf(stderr, "             Total Time: %.3f s\n", dura / k / k);
@@ -738,6 +999,9 @@ class PlfsIoBench {
     }
     fprintf(stderr, "           Ordered Keys: %s\n",
             ordered_keys_ ? "Yes" : "No");
+    fprintf(stderr, "      Writes Per Unique: %d\n", num_dups_);
+    fprintf(stderr, "         Memtable Dedup: %s\n",
+            options_.memtable_dedup ? "Yes" : "No");
     fprintf(stderr, "    Indexes Compression: %s\n",
             options_.compression == kSnappyCompression ? "Yes" : "No");
     fprintf(stderr, "              BF Budget: %d (bits pey key)\n",
@@ -747,9 +1011,9 @@ class PlfsIoBench {
     fprintf(stderr, "  Total MemTable Budget: %d MiB\n",
             int(options_.total_memtable_budget) >> 20);
     fprintf(stderr, "     Estimated SST Size: %.3f MiB\n",
-            writer_->TEST_estimated_sstable_size() / ki / ki);
+            writer_->estimated_sstable_size() / ki / ki);
     fprintf(stderr, "            Max BF Size: %.3f KiB\n",
-            writer_->TEST_max_filter_size() / ki);
+            writer_->max_filter_size() / ki);
     fprintf(stderr, "   Estimated Block Size: %d KiB (target util: %.1f%%)\n",
             int(options_.block_size) >> 10, options_.block_util * 100);
     fprintf(stderr, "Num MemTable Partitions: %d\n", 1 << options_.lg_parts);
@@ -768,9 +1032,9 @@ class PlfsIoBench {
     fprintf(stderr, "     Min Index I/O Size: %d MiB\n",
             int(options_.min_index_buffer) >> 20);
     fprintf(stderr, " Aggregated SST Indexes: %.3f MiB\n",
-            writer_->TEST_raw_index_contents() / ki / ki);
+            writer_->raw_index_contents() / ki / ki);
     fprintf(stderr, "          Aggregated BF: %.3f MiB\n",
-            writer_->TEST_raw_filter_contents() / ki / ki);
+            writer_->raw_filter_contents() / ki / ki);
     fprintf(stderr, "     Final Phys Indexes: %.3f MiB\n",
             stats.index_bytes / ki / ki);
     fprintf(stderr, "         Compaction Buf: %d MiB (x%d)\n",
@@ -780,13 +1044,13 @@ class PlfsIoBench {
     fprintf(stderr, "      Min Data I/O Size: %d MiB\n",
             int(options_.min_data_buffer) >> 20);
     const uint64_t user_bytes =
-        writer_->TEST_key_bytes() + writer_->TEST_value_bytes();
+        writer_->key_bytes() + writer_->value_bytes();
     fprintf(stderr, "        Total User Data: %.3f MiB (K+V)\n",
             1.0 * user_bytes / ki / ki);
     fprintf(stderr,
             "    Aggregated SST Data: %.3f MiB (+%.2f%% due to formatting)\n",
-            1.0 * writer_->TEST_raw_data_contents() / ki / ki,
-            1.0 * writer_->TEST_raw_data_contents() / user_bytes * 100 - 100);
+            1.0 * writer_->raw_data_contents() / ki / ki,
+            1.0 * writer_->raw_data_contents() / user_bytes * 100 - 100);
     fprintf(stderr,
             "        Final Phys Data: %.3f MiB (+%.2f%% due to formatting and "
             "padding)\n",
@@ -802,15 +1066,15 @@ class PlfsIoBench {
     } else {
       fprintf(stderr, "                   MTBW: N/A\n");
     }
-    const uint32_t num_tables = writer_->TEST_num_sstables();
+    const uint32_t num_tables = writer_->num_sstables();
     fprintf(stderr, "              Total SST: %d\n", int(num_tables));
     fprintf(stderr, "  Avg SST Per Partition: %.1f\n",
             1.0 * num_tables / (1 << options_.lg_parts));
     fprintf(stderr, "       Total SST Blocks: %d\n",
-            int(writer_->TEST_num_data_blocks()));
+            int(writer_->num_data_blocks()));
     fprintf(stderr, "         Total SST Keys: %.1f M (%d dropped)\n",
-            1.0 * writer_->TEST_num_keys() / ki / ki,
-            int(writer_->TEST_num_dropped_keys()));
+            1.0 * writer_->num_keys() / ki / ki,
+            int(writer_->num_dropped_keys()));
     fprintf(stderr, "             Value Size: %d Bytes\n",
             int(options_.value_size));
     fprintf(stderr, "               Key Size: %d Bytes\n",
@@ -822,6 +1086,7 @@ class PlfsIoBench {
   int batched_insertion_;
   int ordered_keys_;
   int num_files_;     // Number of particle files (in millions)
+  int num_dups_;      // Number of writes per distinct file
   int num_threads_;   // Number of bg compaction threads
   int force_fifo_;    // Force real-time FIFO scheduling
   int print_events_;  // Dump background events
@@ -9,8 +9,11 @@
 
 #include "mds_api.h"
 #include "mds_cli.h"
+#include "mds_readonly.h"
 #include "mds_srv.h"
 
+#include <algorithm>
+
 namespace pdlfs {
 
 Slice MDS::EncodeId(const DirId& id, char* scratch) {
@@ -22,10 +25,12 @@ Slice MDS::EncodeId(const DirId& id, char* scratch) {
 }
 
 // Deterministically map directories to their zeroth servers.
+// The result is never negative so callers may take it modulo
+// the number of virtual servers.
 int MDS::PickupServer(const DirId& id) {
   char tmp[30];
   Slice encoding = EncodeId(id, tmp);
-  int zserver = DirIndex::RandomServer(encoding, 0);
+  int zserver = DirIndex::RandomServer(encoding, 0) & 0x7FFFFFFF;
   return zserver;
 }
 
@@ -34,7 +39,13 @@ MDSOptions::MDSOptions()
       mdb(NULL),
       dir_table_size(4096),
       lease_table_size(4096),
+      node_cache_size(4 << 20),
+      num_shards(16),
+      split_threshold(0),
+      peers(NULL),
+      split_dir("/tmp/deltafs_splits"),
       lease_duration(1000 * 1000),
+      read_only(false),
       snap_id(0),
       reg_id(0),
       paranoid_checks(false),
@@ -50,19 +61,41 @@ MDS::SRV::SRV(const MDSOptions& options)
       snap_id_(options.snap_id),
       reg_id_(options.reg_id),
       srv_id_(options.srv_id),
-      loading_cv_(&mutex_),
+      num_shards_(options.num_shards > 0 ? options.num_shards : 1),
+      split_threshold_(options.split_threshold),
+      peers_(options.peers),
+      split_dir_(options.split_dir),
+      split_pool_(NULL),
+      op_stats_(new MDSOpStats),
+      bg_cv_(&bg_mu_),
+      num_bg_splits_(0),
       session_(0),
-      ino_(0) {
+      ino_(0),
+      has_error_(false) {
   giga_.num_servers = options.num_servers;
   giga_.num_virtual_servers = options.num_virtual_servers;
   giga_.paranoid_checks = options.paranoid_checks;
 
+  // Table capacities are divided evenly among all shards
   LeaseOptions lease_options;
   lease_options.max_lease_duration = options.lease_duration;
-  lease_options.max_num_leases = options.lease_table_size;
-  leases_ = new LeaseTable(lease_options);
+  lease_options.max_num_leases =
+      std::max<size_t>(1, options.lease_table_size / num_shards_);
+  const size_t dir_table_size =
+      std::max<size_t>(1, options.dir_table_size / num_shards_);
+  const size_t node_cache_size = options.node_cache_size / num_shards_;
+  shards_ = new Shard[num_shards_];
+  for (int i = 0; i < num_shards_; i++) {
+    shards_[i].leases = new LeaseTable(lease_options);
+    shards_[i].dirs = new DirTable(dir_table_size);
+    if (node_cache_size != 0) {
+      shards_[i].nodes = new NodeCache(node_cache_size);
+    }
+  }
 
-  dirs_ = new DirTable(options.dir_table_size);
+  if (split_threshold_ != 0) {
+    split_pool_ = ThreadPool::NewFixed(1);
+  }
 
   assert(srv_id_ >= 0);
   session_ = srv_id_;
@@ -72,8 +105,35 @@ MDS::SRV::SRV(const MDSOptions& options)
 }
 
 MDS::SRV::~SRV() {
-  delete leases_;
-  delete dirs_;
+  WaitForSplits();
+  delete split_pool_;
+#if VERBOSE >= 1
+  NodeCache::Stats stats;
+  GetNodeCacheStats(&stats);
+  Verbose(__LOG_ARGS__, 1,
+          "mds.node_cache: %llu hits (%llu negative), %llu misses",
+          (unsigned long long)stats.hits,
+          (unsigned long long)stats.negative_hits,
+          (unsigned long long)stats.misses);
+  LeaseStats lease_stats;
+  GetLeaseStats(&lease_stats);
+  Verbose(__LOG_ARGS__, 1,
+          "mds.leases: %llu expired, %llu table full, %llu renewed "
+          "(%llu refused), %llu write waits (%llu us)",
+          (unsigned long long)lease_stats.table.expired,
+          (unsigned long long)lease_stats.table.full,
+          (unsigned long long)lease_stats.renewed,
+          (unsigned long long)lease_stats.not_renewed,
+          (unsigned long long)lease_stats.write_waits,
+          (unsigned long long)lease_stats.write_wait_micros);
+#endif
+  for (int i = 0; i < num_shards_; i++) {
+    delete shards_[i].leases;
+    delete shards_[i].dirs;
+    delete shards_[i].nodes;
+  }
+  delete[] shards_;
+  delete op_stats_;
 }
 
 MDS* MDS::Open(const MDSOptions& options) {
@@ -86,13 +146,24 @@ MDS* MDS::Open(const MDSOptions& options) {
   Verbose(__LOG_ARGS__, 1, "mds.dir_table_size -> %zu", options.dir_table_size);
   Verbose(__LOG_ARGS__, 1, "mds.lease_table_size -> %zu",
           options.lease_table_size);
+  Verbose(__LOG_ARGS__, 1, "mds.node_cache_size -> %zu",
+          options.node_cache_size);
+  Verbose(__LOG_ARGS__, 1, "mds.num_shards -> %d", options.num_shards);
+  Verbose(__LOG_ARGS__, 1, "mds.split_threshold -> %llu",
+          (unsigned long long)options.split_threshold);
   Verbose(__LOG_ARGS__, 1, "mds.reg_id -> %llu",
           (unsigned long long)options.reg_id);
   Verbose(__LOG_ARGS__, 1, "mds.snap_id -> %llu",
           (unsigned long long)options.snap_id);
+  Verbose(__LOG_ARGS__, 1, "mds.read_only -> %d", int(options.read_only));
   Verbose(__LOG_ARGS__, 1, "mds.srv_id -> %d", options.srv_id);
 #endif
-  MDS* mds = new SRV(options);
+  MDS* mds;
+  if (options.read_only) {
+    mds = new ReadonlySRV(options);
+  } else {
+    mds = new SRV(options);
+  }
   return mds;
 }
 
@@ -106,6 +177,11 @@ MDSCliOptions::MDSCliOptions()
       paranoid_checks(false),
       atomic_path_resolution(false),
       max_redirects_allowed(20),
+      lease_renewal_window(0),
+      listdir_pool(NULL),
+      bg_pool(NULL),
+      write_back_batch(0),
+      write_back_interval(100 * 1000),
       num_virtual_servers(1),
       num_servers(1),
       session_id(0),
@@ -119,19 +195,41 @@ MDS::CLI::CLI(const MDSCliOptions& options)
       paranoid_checks_(options.paranoid_checks),
       atomic_path_resolution_(options.atomic_path_resolution),
       max_redirects_allowed_(options.max_redirects_allowed),
+      lease_renewal_window_(options.lease_renewal_window),
+      listdir_pool_(options.listdir_pool),
+      bg_pool_(options.bg_pool),
+      write_back_batch_(options.write_back_batch),
+      write_back_interval_(options.write_back_interval),
       session_id_(options.session_id),
       cli_id_(options.cli_id),
       uid_(options.uid),
-      gid_(options.gid) {
+      gid_(options.gid),
+      num_buffered_(0),
+      wb_cv_(&wb_mu_),
+      flusher_running_(false),
+      shutting_down_(false) {
   giga_.num_servers = options.num_servers;
   giga_.num_virtual_servers = options.num_virtual_servers;
   giga_.paranoid_checks = options.paranoid_checks;
 
   lookup_cache_ = new LookupCache(options.lookup_cache_size);
   index_cache_ = new IndexCache(options.index_cache_size);
+
+  if (write_back_batch_ != 0 && write_back_interval_ != 0) {
+    flusher_running_ = true;
+    env_->StartThread(FlushBGWork, this);
+  }
 }
 
 MDS::CLI::~CLI() {
+  wb_mu_.Lock();
+  shutting_down_ = true;
+  wb_cv_.SignalAll();
+  while (flusher_running_) {
+    wb_cv_.Wait();
+  }
+  wb_mu_.Unlock();
+  Sync();  // Errors can no longer be reported
   delete index_cache_;
   delete lookup_cache_;
 }
@@ -9,11 +9,41 @@
 
 #include "mds_api.h"
 
+#include "pdlfs-common/mutexlock.h"
+
+#include <atomic>
+#include <deque>
+
 namespace pdlfs {
 
 MDS::~MDS() {}
 
-MDS::RPC::CLI::~CLI() {}
+#define DEF_ASYNC_OP(OP)                                                   \
+  void MDS::Async##OP(const OP##Options& options, OP##Ret* ret,            \
+                      AsyncCallback cb, void* arg) {                       \
+    Status s;                                                              \
+    Redirect re;                                                           \
+    bool redirected = false;                                               \
+    try {                                                                  \
+      s = OP(options, ret);                                                \
+    } catch (Redirect & r) {                                               \
+      re.swap(r);                                                          \
+      redirected = true;                                                   \
+    }                                                                      \
+    if (redirected) {                                                      \
+      cb(arg, Status::TryAgain("redirected"), &re);                        \
+    } else {                                                               \
+      cb(arg, s, NULL);                                                    \
+    }                                                                      \
+  }
+
+DEF_ASYNC_OP(Fstat)
+DEF_ASYNC_OP(Fcreat)
+DEF_ASYNC_OP(Mkdir)
+DEF_ASYNC_OP(Unlink)
+DEF_ASYNC_OP(Lookup)
+
+#undef DEF_ASYNC_OP
 
 MDS::RPC::SRV::~SRV() {}
 
@@ -64,17 +94,192 @@ enum {
   kUnlink, kLookup, kListdir, kReadidx,
   kOpensession,
   kGetinput,
-  kGetoutput
+  kGetoutput,
+  kBcreat,
+  kAddpart,
+  kRenew,
+  kGetstats,
+  kResolve,
+  kBatch
 };
 /* clang-format on */
 }  // namespace
 
+namespace {
+// Lend a pooled buffer to a message as its extra buffer for the lifetime
+// of an object. Large requests and replies are encoded and decoded into
+// buffers that have already grown to size.
+class PooledBuffer {
+ public:
+  PooledBuffer(rpc::BufferPool* pool, rpc::If::Message* msg)
+      : pool_(pool), buf_(&msg->extra_buf) {
+    pool_->Get(buf_);
+  }
+
+  ~PooledBuffer() { pool_->Put(buf_); }
+
+ private:
+  // No copying allowed
+  void operator=(const PooledBuffer&);
+  PooledBuffer(const PooledBuffer&);
+
+  rpc::BufferPool* const pool_;
+  std::string* const buf_;
+};
+}  // namespace
+
 // Convenient method that adds op code to a message.
 static inline rpc::If::Message& AddOp(rpc::If::Message& msg, int op) {
   msg.op = op;
   return msg;
 }
 
+// Queue of ops sent by concurrent threads. The thread whose op is at
+// the front of the queue sends it together with the ops queued behind it
+// as one multi-op message, and then hands the replies back to the other
+// threads. At most kMaxInflight messages are outstanding at a time, so
+// the first kMaxInflight concurrent ops are sent right away and ops are
+// only coalesced once all slots are taken.
+class MDS::RPC::CLI::Coalescer {
+ public:
+  Coalescer(rpc::If* stub, rpc::BufferPool* buffers, int max_ops)
+      : stub_(stub), buffers_(buffers), max_ops_(max_ops), num_inflight_(0) {}
+
+  Status Send(Msg& in, Msg& out);
+
+ private:
+  enum { kMaxInflight = 4 };
+  struct Op {
+    explicit Op(port::Mutex* mu) : done(false), cv(mu) {}
+    Msg* in;
+    Msg* out;
+    Status status;
+    bool done;
+    port::CondVar cv;
+  };
+  void SendOps(Op** ops, size_t n);
+
+  // No copying allowed
+  void operator=(const Coalescer&);
+  Coalescer(const Coalescer&);
+
+  // Constant after construction
+  rpc::If* const stub_;
+  rpc::BufferPool* const buffers_;
+  const size_t max_ops_;
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  std::deque<Op*> queue_;
+  int num_inflight_;
+};
+
+Status MDS::RPC::CLI::Coalescer::Send(Msg& in, Msg& out) {
+  Op op(&mu_);
+  op.in = &in;
+  op.out = &out;
+  MutexLock ml(&mu_);
+  queue_.push_back(&op);
+  while (!op.done &&
+         (&op != queue_.front() || num_inflight_ >= kMaxInflight)) {
+    op.cv.Wait();
+  }
+  if (op.done) {
+    return op.status;
+  }
+
+  // We are at the front of the queue and there is a free slot
+  std::vector<Op*> ops;
+  while (!queue_.empty() && ops.size() < max_ops_) {
+    ops.push_back(queue_.front());
+    queue_.pop_front();
+  }
+  num_inflight_++;
+  if (!queue_.empty() && num_inflight_ < kMaxInflight) {
+    queue_.front()->cv.Signal();
+  }
+  mu_.Unlock();
+  SendOps(&ops[0], ops.size());
+  mu_.Lock();
+  num_inflight_--;
+  for (size_t i = 0; i < ops.size(); i++) {
+    if (ops[i] != &op) {
+      ops[i]->done = true;
+      ops[i]->cv.Signal();
+    }
+  }
+  if (!queue_.empty()) {
+    queue_.front()->cv.Signal();
+  }
+  return op.status;
+}
+
+// Send ops as a single message and set their replies and statuses.
+// A multi-op message carries the count of ops followed by the type and
+// the body of each op. Its reply carries the error code and the body of
+// each op in the same order.
+void MDS::RPC::CLI::Coalescer::SendOps(Op** ops, size_t n) {
+  if (n == 1) {
+    ops[0]->status = stub_->Call(*ops[0]->in, *ops[0]->out);
+    return;
+  }
+  Msg in;
+  PooledBuffer in_buf(buffers_, &in);
+  PutVarint32(&in.extra_buf, static_cast<uint32_t>(n));
+  for (size_t i = 0; i < n; i++) {
+    PutVarint32(&in.extra_buf, static_cast<uint32_t>(ops[i]->in->op));
+    PutLengthPrefixedSlice(&in.extra_buf, ops[i]->in->contents);
+  }
+  in.contents = Slice(in.extra_buf);
+  Msg out;
+  PooledBuffer out_buf(buffers_, &out);
+  Status s = stub_->Call(AddOp(in, kBatch), out);
+  if (s.ok() && out.err != 0) {
+    s = Status::FromCode(out.err);
+  }
+  Slice input = out.contents;
+  for (size_t i = 0; i < n; i++) {
+    Msg* const reply = ops[i]->out;
+    uint32_t err;
+    Slice contents;
+    if (s.ok()) {
+      if (!GetVarint32(&input, &err) ||
+          !GetLengthPrefixedSlice(&input, &contents)) {
+        s = Status::Corruption(Slice());
+      }
+    }
+    ops[i]->status = s;
+    if (s.ok()) {
+      reply->err = static_cast<int>(err);
+      if (contents.size() <= sizeof(reply->buf)) {
+        memcpy(reply->buf, contents.data(), contents.size());
+        reply->contents = Slice(reply->buf, contents.size());
+      } else {
+        reply->extra_buf.assign(contents.data(), contents.size());
+        reply->contents = Slice(reply->extra_buf);
+      }
+    }
+  }
+}
+
+MDS::RPC::CLI::CLI(rpc::If* stub, int max_coalesced_ops)
+    : stub_(stub), coalescer_(NULL) {
+  if (max_coalesced_ops > 1) {
+    coalescer_ = new Coalescer(stub_, &buffers_, max_coalesced_ops);
+  }
+}
+
+MDS::RPC::CLI::~CLI() { delete coalescer_; }
+
+// Send a small op, which may be coalesced with ops of other threads.
+Status MDS::RPC::CLI::Send(Msg& in, Msg& out) {
+  if (coalescer_ != NULL) {
+    return coalescer_->Send(in, out);
+  } else {
+    return stub_->Call(in, out);
+  }
+}
+
 // RPC dispatcher
 Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
   switch (in.op) {
@@ -96,6 +301,9 @@ Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
     case kMkdir:
       MKDIR(in, out);
       break;
+    case kBcreat:
+      BCRET(in, out);
+      break;
     case kChmod:
       CHMOD(in, out);
       break;
@@ -123,6 +331,21 @@ Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
     case kGetoutput:
       GOUPT(in, out);
       break;
+    case kGetstats:
+      GSTAT(in, out);
+      break;
+    case kAddpart:
+      ADDPT(in, out);
+      break;
+    case kRenew:
+      RENEW(in, out);
+      break;
+    case kResolve:
+      RSOLV(in, out);
+      break;
+    case kBatch:
+      BATCH(in, out);
+      break;
     case kNonop:
       out.err = 0;
       break;
@@ -133,41 +356,68 @@ Status MDS::RPC::SRV::Call(Msg& in, Msg& out) RPCNOEXCEPT {
   return Status::OK();
 }
 
-Status MDS::RPC::CLI::Fstat(const FstatOptions& options, FstatRet* ret) {
+bool MDS::RPC::SRV::IsUrgent(const Msg& in) RPCNOEXCEPT {
+  switch (in.op) {
+    case kLookup:
+    case kResolve:
+    case kReadidx:
+    case kRenew:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static Status EncodeFstat(const MDS::FstatOptions& options,
+                          rpc::If::Message* in) {
   Status s;
-  Msg in;
   if (!kDebugRPC) {
-    char* scratch = &in.buf[0];
+    char* scratch = &in->buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
     p = EncodeLengthPrefixedSlice(p, options.name_hash);
     p = EncodeLengthPrefixedSlice(p, options.name);
     p = EncodeVarint32(p, options.session_id);
     p = EncodeVarint64(p, options.op_due);
-    in.contents = Slice(scratch, p - scratch);
+    in->contents = Slice(scratch, p - scratch);
   } else {
-    PutDirId(&in.extra_buf, options.dir_id);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name);
-    PutVarint32(&in.extra_buf, options.session_id);
-    PutVarint64(&in.extra_buf, options.op_due);
-    in.contents = Slice(in.extra_buf);
-    if (in.contents.size() > sizeof(in.buf)) {
+    PutDirId(&in->extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name);
+    PutVarint32(&in->extra_buf, options.session_id);
+    PutVarint64(&in->extra_buf, options.op_due);
+    in->contents = Slice(in->extra_buf);
+    if (in->contents.size() > sizeof(in->buf)) {
       s = Status::BufferFull(Slice());
     }
   }
 
+  return s;
+}
+
+// REQUIRES: out is not a redirect.
+static Status DecodeFstat(const rpc::If::Message& out, MDS::FstatRet* ret) {
+  Status s;
+  if (out.err != 0) {
+    s = Status::FromCode(out.err);
+  } else if (!ret->stat.DecodeFrom(out.contents)) {
+    s = Status::Corruption(Slice());
+  }
+  return s;
+}
+
+Status MDS::RPC::CLI::Fstat(const FstatOptions& options, FstatRet* ret) {
+  Msg in;
+  Status s = EncodeFstat(options, &in);
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kFstat), out);
+    s = Send(AddOp(in, kFstat), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
         throw re;
-      } else if (out.err != 0) {
-        s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(out.contents)) {
-        s = Status::Corruption(Slice());
+      } else {
+        s = DecodeFstat(out, ret);
       }
     }
   }
@@ -204,11 +454,11 @@ void MDS::RPC::SRV::FSTAT(Msg& in, Msg& out) {
   }
 }
 
-Status MDS::RPC::CLI::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
+static Status EncodeFcreat(const MDS::FcreatOptions& options,
+                           rpc::If::Message* in) {
   Status s;
-  Msg in;
   if (!kDebugRPC) {
-    char* scratch = &in.buf[0];
+    char* scratch = &in->buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
     p = EncodeLengthPrefixedSlice(p, options.name_hash);
@@ -219,39 +469,54 @@ Status MDS::RPC::CLI::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
     p = EncodeVarint32(p, options.gid);
     p = EncodeVarint32(p, options.session_id);
     p = EncodeVarint64(p, options.op_due);
-    in.contents = Slice(scratch, p - scratch);
+    in->contents = Slice(scratch, p - scratch);
   } else {
-    PutDirId(&in.extra_buf, options.dir_id);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name);
-    PutVarint32(&in.extra_buf, options.flags);
-    PutVarint32(&in.extra_buf, options.mode);
-    PutVarint32(&in.extra_buf, options.uid);
-    PutVarint32(&in.extra_buf, options.gid);
-    PutVarint32(&in.extra_buf, options.session_id);
-    PutVarint64(&in.extra_buf, options.op_due);
-    in.contents = Slice(in.extra_buf);
-    if (in.contents.size() > sizeof(in.buf)) {
+    PutDirId(&in->extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name);
+    PutVarint32(&in->extra_buf, options.flags);
+    PutVarint32(&in->extra_buf, options.mode);
+    PutVarint32(&in->extra_buf, options.uid);
+    PutVarint32(&in->extra_buf, options.gid);
+    PutVarint32(&in->extra_buf, options.session_id);
+    PutVarint64(&in->extra_buf, options.op_due);
+    in->contents = Slice(in->extra_buf);
+    if (in->contents.size() > sizeof(in->buf)) {
       s = Status::BufferFull(Slice());
     }
   }
 
+  return s;
+}
+
+// REQUIRES: out is not a redirect.
+static Status DecodeFcreat(const rpc::If::Message& out, MDS::FcreatRet* ret) {
+  Status s;
+  Slice contents = out.contents;
+  if (out.err != 0) {
+    s = Status::FromCode(out.err);
+  } else if (!ret->stat.DecodeFrom(&contents)) {
+    s = Status::Corruption(Slice());
+  } else if (contents.empty()) {
+    s = Status::Corruption(Slice());
+  } else {
+    ret->created = contents[0];
+  }
+  return s;
+}
+
+Status MDS::RPC::CLI::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
+  Msg in;
+  Status s = EncodeFcreat(options, &in);
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kFcreat), out);
+    s = Send(AddOp(in, kFcreat), out);
     if (s.ok()) {
-      Slice contents = out.contents;
       if (out.err == -1) {
-        Redirect re(contents.data(), contents.size());
+        Redirect re(out.contents.data(), out.contents.size());
         throw re;
-      } else if (out.err != 0) {
-        s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(&contents)) {
-        s = Status::Corruption(Slice());
-      } else if (contents.empty()) {
-        s = Status::Corruption(Slice());
       } else {
-        ret->created = contents[0];
+        s = DecodeFcreat(out, ret);
       }
     }
   }
@@ -294,11 +559,11 @@ void MDS::RPC::SRV::FCRET(Msg& in, Msg& out) {
   }
 }
 
-Status MDS::RPC::CLI::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
+static Status EncodeMkdir(const MDS::MkdirOptions& options,
+                          rpc::If::Message* in) {
   Status s;
-  Msg in;
   if (!kDebugRPC) {
-    char* scratch = &in.buf[0];
+    char* scratch = &in->buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
     p = EncodeLengthPrefixedSlice(p, options.name_hash);
@@ -309,34 +574,49 @@ Status MDS::RPC::CLI::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
     p = EncodeVarint32(p, options.gid);
     p = EncodeVarint32(p, options.session_id);
     p = EncodeVarint64(p, options.op_due);
-    in.contents = Slice(scratch, p - scratch);
+    in->contents = Slice(scratch, p - scratch);
   } else {
-    PutDirId(&in.extra_buf, options.dir_id);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name);
-    PutVarint32(&in.extra_buf, options.flags);
-    PutVarint32(&in.extra_buf, options.mode);
-    PutVarint32(&in.extra_buf, options.uid);
-    PutVarint32(&in.extra_buf, options.gid);
-    PutVarint32(&in.extra_buf, options.session_id);
-    PutVarint64(&in.extra_buf, options.op_due);
-    in.contents = Slice(in.extra_buf);
-    if (in.contents.size() > sizeof(in.buf)) {
+    PutDirId(&in->extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name);
+    PutVarint32(&in->extra_buf, options.flags);
+    PutVarint32(&in->extra_buf, options.mode);
+    PutVarint32(&in->extra_buf, options.uid);
+    PutVarint32(&in->extra_buf, options.gid);
+    PutVarint32(&in->extra_buf, options.session_id);
+    PutVarint64(&in->extra_buf, options.op_due);
+    in->contents = Slice(in->extra_buf);
+    if (in->contents.size() > sizeof(in->buf)) {
       s = Status::BufferFull(Slice());
     }
   }
 
+  return s;
+}
+
+// REQUIRES: out is not a redirect.
+static Status DecodeMkdir(const rpc::If::Message& out, MDS::MkdirRet* ret) {
+  Status s;
+  if (out.err != 0) {
+    s = Status::FromCode(out.err);
+  } else if (!ret->stat.DecodeFrom(out.contents)) {
+    s = Status::Corruption(Slice());
+  }
+  return s;
+}
+
+Status MDS::RPC::CLI::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
+  Msg in;
+  Status s = EncodeMkdir(options, &in);
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kMkdir), out);
+    s = Send(AddOp(in, kMkdir), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
         throw re;
-      } else if (out.err != 0) {
-        s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(out.contents)) {
-        s = Status::Corruption(Slice());
+      } else {
+        s = DecodeMkdir(out, ret);
       }
     }
   }
@@ -377,41 +657,168 @@ void MDS::RPC::SRV::MKDIR(Msg& in, Msg& out) {
   }
 }
 
-Status MDS::RPC::CLI::Lookup(const LookupOptions& options, LookupRet* ret) {
+// Batched creates always go through extra_buf since the encoding of
+// many entries does not generally fit in the fixed message buffer.
+Status MDS::RPC::CLI::Bcreat(const BcreatOptions& options, BcreatRet* ret) {
   Status s;
   Msg in;
+  PooledBuffer in_buf(&buffers_, &in);
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutVarint32(&in.extra_buf, options.flags);
+  PutVarint32(&in.extra_buf, options.uid);
+  PutVarint32(&in.extra_buf, options.gid);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutVarint32(&in.extra_buf, options.entries.size());
+  for (size_t i = 0; i < options.entries.size(); i++) {
+    const BcreatEntry& entry = options.entries[i];
+    PutLengthPrefixedSlice(&in.extra_buf, entry.name_hash);
+    PutLengthPrefixedSlice(&in.extra_buf, entry.name);
+    PutVarint32(&in.extra_buf, entry.mode);
+  }
+  in.contents = Slice(in.extra_buf);
+
+  Msg out;
+  PooledBuffer out_buf(&buffers_, &out);
+  s = stub_->Call(AddOp(in, kBcreat), out);
+  if (s.ok()) {
+    if (out.err == -1) {
+      Redirect re(out.contents.data(), out.contents.size());
+      throw re;
+    } else if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else {
+      Slice input = out.contents;
+      uint32_t num;
+      if (!GetVarint32(&input, &num) || num != options.entries.size()) {
+        s = Status::Corruption(Slice());
+      } else {
+        ret->statuses.assign(num, Status::OK());
+        ret->stats.resize(num);
+        Slice encoding;
+        uint32_t err;
+        for (uint32_t i = 0; i < num; i++) {
+          if (!GetVarint32(&input, &err)) {
+            s = Status::Corruption(Slice());
+            break;
+          } else if (err != 0) {
+            ret->statuses[i] = Status::FromCode(err);
+          } else if (!GetLengthPrefixedSlice(&input, &encoding) ||
+                     !ret->stats[i].DecodeFrom(encoding)) {
+            s = Status::Corruption(Slice());
+            break;
+          }
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::BCRET(Msg& in, Msg& out) {
+  Status s;
+  BcreatOptions options;
+  BcreatRet ret;
+  assert(in.op == kBcreat);
+  Slice input = in.contents;
+  uint32_t num = 0;
+  if (!GetDirId(&input, &options.dir_id) ||
+      !GetVarint32(&input, &options.flags) ||
+      !GetVarint32(&input, &options.uid) ||
+      !GetVarint32(&input, &options.gid) ||
+      !GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due) || !GetVarint32(&input, &num)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    options.entries.resize(num);
+    for (uint32_t i = 0; i < num; i++) {
+      BcreatEntry* const entry = &options.entries[i];
+      if (!GetLengthPrefixedSlice(&input, &entry->name_hash) ||
+          !GetLengthPrefixedSlice(&input, &entry->name) ||
+          !GetVarint32(&input, &entry->mode)) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      }
+    }
+  }
+  if (s.ok()) {
+    try {
+      s = mds_->Bcreat(options, &ret);
+    } catch (Redirect& re) {
+      out.extra_buf.swap(re);
+      out.contents = Slice(out.extra_buf);
+      out.err = -1;
+      return;
+    }
+  }
+  if (s.ok()) {
+    char tmp[sizeof(Stat)];
+    PutVarint32(&out.extra_buf, num);
+    for (uint32_t i = 0; i < num; i++) {
+      if (ret.statuses[i].ok()) {
+        PutVarint32(&out.extra_buf, 0);
+        PutLengthPrefixedSlice(&out.extra_buf, ret.stats[i].EncodeTo(tmp));
+      } else {
+        PutVarint32(&out.extra_buf, ret.statuses[i].err_code());
+      }
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+static Status EncodeLookup(const MDS::LookupOptions& options,
+                           rpc::If::Message* in) {
+  Status s;
   if (!kDebugRPC) {
-    char* scratch = &in.buf[0];
+    char* scratch = &in->buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
     p = EncodeLengthPrefixedSlice(p, options.name_hash);
     p = EncodeLengthPrefixedSlice(p, options.name);
     p = EncodeVarint32(p, options.session_id);
     p = EncodeVarint64(p, options.op_due);
-    in.contents = Slice(scratch, p - scratch);
+    in->contents = Slice(scratch, p - scratch);
   } else {
-    PutDirId(&in.extra_buf, options.dir_id);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name);
-    PutVarint32(&in.extra_buf, options.session_id);
-    PutVarint64(&in.extra_buf, options.op_due);
-    in.contents = Slice(in.extra_buf);
-    if (in.contents.size() > sizeof(in.buf)) {
+    PutDirId(&in->extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name);
+    PutVarint32(&in->extra_buf, options.session_id);
+    PutVarint64(&in->extra_buf, options.op_due);
+    in->contents = Slice(in->extra_buf);
+    if (in->contents.size() > sizeof(in->buf)) {
       s = Status::BufferFull(Slice());
     }
   }
 
+  return s;
+}
+
+// REQUIRES: out is not a redirect.
+static Status DecodeLookup(const rpc::If::Message& out, MDS::LookupRet* ret) {
+  Status s;
+  if (out.err != 0) {
+    s = Status::FromCode(out.err);
+  } else if (!ret->stat.DecodeFrom(out.contents)) {
+    s = Status::Corruption(Slice());
+  }
+  return s;
+}
+
+Status MDS::RPC::CLI::Lookup(const LookupOptions& options, LookupRet* ret) {
+  Msg in;
+  Status s = EncodeLookup(options, &in);
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kLookup), out);
+    s = Send(AddOp(in, kLookup), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
         throw re;
-      } else if (out.err != 0) {
-        s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(out.contents)) {
-        s = Status::Corruption(Slice());
+      } else {
+        s = DecodeLookup(out, ret);
       }
     }
   }
@@ -476,7 +883,7 @@ Status MDS::RPC::CLI::Chmod(const ChmodOptions& options, ChmodRet* ret) {
 
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kChmod), out);
+    s = Send(AddOp(in, kChmod), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
@@ -552,7 +959,7 @@ Status MDS::RPC::CLI::Chown(const ChownOptions& options, ChownRet* ret) {
 
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kChown), out);
+    s = Send(AddOp(in, kChown), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
@@ -631,7 +1038,7 @@ Status MDS::RPC::CLI::Uperm(const UpermOptions& options, UpermRet* ret) {
 
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kUperm), out);
+    s = Send(AddOp(in, kUperm), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
@@ -709,7 +1116,7 @@ Status MDS::RPC::CLI::Utime(const UtimeOptions& options, UtimeRet* ret) {
 
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kUtime), out);
+    s = Send(AddOp(in, kUtime), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
@@ -786,7 +1193,7 @@ Status MDS::RPC::CLI::Trunc(const TruncOptions& options, TruncRet* ret) {
 
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kTrunc), out);
+    s = Send(AddOp(in, kTrunc), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
@@ -833,11 +1240,11 @@ void MDS::RPC::SRV::TRUNC(Msg& in, Msg& out) {
   }
 }
 
-Status MDS::RPC::CLI::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
+static Status EncodeUnlink(const MDS::UnlinkOptions& options,
+                           rpc::If::Message* in) {
   Status s;
-  Msg in;
   if (!kDebugRPC) {
-    char* scratch = &in.buf[0];
+    char* scratch = &in->buf[0];
     char* p = scratch;
     p = EncodeDirId(p, options.dir_id);
     p = EncodeLengthPrefixedSlice(p, options.name_hash);
@@ -845,31 +1252,46 @@ Status MDS::RPC::CLI::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
     p = EncodeVarint32(p, options.flags);
     p = EncodeVarint32(p, options.session_id);
     p = EncodeVarint64(p, options.op_due);
-    in.contents = Slice(scratch, p - scratch);
+    in->contents = Slice(scratch, p - scratch);
   } else {
-    PutDirId(&in.extra_buf, options.dir_id);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name_hash);
-    PutLengthPrefixedSlice(&in.extra_buf, options.name);
-    PutVarint32(&in.extra_buf, options.flags);
-    PutVarint32(&in.extra_buf, options.session_id);
-    PutVarint64(&in.extra_buf, options.op_due);
-    in.contents = Slice(in.extra_buf);
-    if (in.contents.size() > sizeof(in.buf)) {
+    PutDirId(&in->extra_buf, options.dir_id);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name_hash);
+    PutLengthPrefixedSlice(&in->extra_buf, options.name);
+    PutVarint32(&in->extra_buf, options.flags);
+    PutVarint32(&in->extra_buf, options.session_id);
+    PutVarint64(&in->extra_buf, options.op_due);
+    in->contents = Slice(in->extra_buf);
+    if (in->contents.size() > sizeof(in->buf)) {
       s = Status::BufferFull(Slice());
     }
   }
 
+  return s;
+}
+
+// REQUIRES: out is not a redirect.
+static Status DecodeUnlink(const rpc::If::Message& out, MDS::UnlinkRet* ret) {
+  Status s;
+  if (out.err != 0) {
+    s = Status::FromCode(out.err);
+  } else if (!ret->stat.DecodeFrom(out.contents)) {
+    s = Status::Corruption(Slice());
+  }
+  return s;
+}
+
+Status MDS::RPC::CLI::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
+  Msg in;
+  Status s = EncodeUnlink(options, &in);
   Msg out;
   if (s.ok()) {
-    s = stub_->Call(AddOp(in, kUnlink), out);
+    s = Send(AddOp(in, kUnlink), out);
     if (s.ok()) {
       if (out.err == -1) {
         Redirect re(out.contents.data(), out.contents.size());
         throw re;
-      } else if (out.err != 0) {
-        s = Status::FromCode(out.err);
-      } else if (!ret->stat.DecodeFrom(out.contents)) {
-        s = Status::Corruption(Slice());
+      } else {
+        s = DecodeUnlink(out, ret);
       }
     }
   }
@@ -915,30 +1337,49 @@ Status MDS::RPC::CLI::Listdir(const ListdirOptions& options, ListdirRet* ret) {
   p = EncodeDirId(p, options.dir_id);
   p = EncodeVarint32(p, options.session_id);
   p = EncodeVarint64(p, options.op_due);
+  p = EncodeLengthPrefixedSlice(p, options.start_hash);
+  p = EncodeVarint32(p, options.max_entries);
+  *p = static_cast<char>(options.with_stats);
+  p++;
   in.contents = Slice(scratch, p - scratch);
   Msg out;
+  PooledBuffer out_buf(&buffers_, &out);
   s = stub_->Call(AddOp(in, kListdir), out);
   if (s.ok()) {
     std::vector<std::string>* names = ret->names;
+    std::vector<Stat>* stats = ret->stats;
     if (out.err != 0) {
       s = Status::FromCode(out.err);
     } else {
+      uint32_t num;
       Slice name;
+      Slice stat_encoding;
+      Slice next_hash;
+      Stat stat;
       Slice encoding = out.contents;
-      if (encoding.size() < 4) {
+      if (!GetVarint32(&encoding, &num)) {
         s = Status::Corruption(Slice());
-      } else {
-        uint32_t num = DecodeFixed32(encoding.data() + encoding.size() - 4);
-        encoding.remove_suffix(4);
-        while (num-- != 0) {
-          if (GetLengthPrefixedSlice(&encoding, &name)) {
-            names->push_back(name.ToString());
-          } else {
-            s = Status::Corruption(Slice());
-            break;
+      }
+      while (s.ok() && num-- != 0) {
+        if (!GetLengthPrefixedSlice(&encoding, &name) ||
+            (options.with_stats &&
+             (!GetLengthPrefixedSlice(&encoding, &stat_encoding) ||
+              !stat.DecodeFrom(stat_encoding)))) {
+          s = Status::Corruption(Slice());
+        } else {
+          names->push_back(name.ToString());
+          if (options.with_stats) {
+            stats->push_back(stat);
           }
         }
       }
+      if (s.ok()) {
+        if (!GetLengthPrefixedSlice(&encoding, &next_hash)) {
+          s = Status::Corruption(Slice());
+        } else {
+          ret->next_hash = next_hash.ToString();
+        }
+      }
     }
   }
   return s;
@@ -948,28 +1389,42 @@ void MDS::RPC::SRV::LSDIR(Msg& in, Msg& out) {
   Status s;
   ListdirOptions options;
   std::vector<std::string> names;
+  std::vector<Stat> stats;
   ListdirRet ret;
   ret.names = &names;
+  ret.stats = &stats;
   assert(in.op == kListdir);
   Slice input = in.contents;
   if (!GetDirId(&input, &options.dir_id) ||
       !GetVarint32(&input, &options.session_id) ||
-      !GetVarint64(&input, &options.op_due)) {
+      !GetVarint64(&input, &options.op_due) ||
+      !GetLengthPrefixedSlice(&input, &options.start_hash) ||
+      !GetVarint32(&input, &options.max_entries) || input.size() < 1) {
     s = Status::InvalidArgument(Slice());
   } else {
+    options.with_stats = (input[0] != 0);
     s = mds_->Listdir(options, &ret);
   }
   if (s.ok()) {
-    size_t num_entries = 0;
-    for (std::vector<std::string>::iterator it = names.begin();
-         it != names.end(); ++it) {
-      PutLengthPrefixedSlice(&out.extra_buf, *it);
-      num_entries++;
-      if (out.extra_buf.size() >= 1000) {
-        break;  // Silently discard rest entries
+    // Size the reply up front so it is never copied as it grows
+    const size_t kVarint32 = 5;  // Max length of a varint32
+    size_t bytes = 2 * kVarint32 + ret.next_hash.size();
+    for (size_t i = 0; i < names.size(); i++) {
+      bytes += kVarint32 + names[i].size();
+      if (options.with_stats) {
+        bytes += kVarint32 + sizeof(Stat);
       }
     }
-    PutFixed32(&out.extra_buf, num_entries);
+    out.extra_buf.reserve(bytes);
+    char tmp[sizeof(Stat)];
+    PutVarint32(&out.extra_buf, names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      PutLengthPrefixedSlice(&out.extra_buf, names[i]);
+      if (options.with_stats) {
+        PutLengthPrefixedSlice(&out.extra_buf, stats[i].EncodeTo(tmp));
+      }
+    }
+    PutLengthPrefixedSlice(&out.extra_buf, ret.next_hash);
     out.contents = Slice(out.extra_buf);
     out.err = 0;
   } else {
@@ -991,6 +1446,9 @@ Status MDS::RPC::CLI::Readidx(const ReadidxOptions& options, ReadidxRet* ret) {
   if (s.ok()) {
     if (out.err != 0) {
       s = Status::FromCode(out.err);
+    } else if (out.contents.data() == out.extra_buf.data() &&
+               out.contents.size() == out.extra_buf.size()) {
+      ret->idx.swap(out.extra_buf);  // Take over the reply without a copy
     } else {
       ret->idx.assign(out.contents.data(), out.contents.size());
     }
@@ -1146,10 +1604,326 @@ void MDS::RPC::SRV::GOUPT(Msg& in, Msg& out) {
   }
 }
 
+Status MDS::RPC::CLI::Getstats(const GetstatsOptions& options,
+                               GetstatsRet* ret) {
+  Status s;
+  Msg in;
+  Msg out;
+  s = stub_->Call(AddOp(in, kGetstats), out);
+  if (s.ok()) {
+    if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else {
+      Slice msg = out.contents;
+      Slice info;
+      if (!GetLengthPrefixedSlice(&msg, &info)) {
+        s = Status::Corruption(Slice());
+      } else {
+        ret->info = info.ToString();
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::GSTAT(Msg& in, Msg& out) {
+  Status s;
+  GetstatsOptions options;
+  GetstatsRet ret;
+  assert(in.op == kGetstats);
+  s = mds_->Getstats(options, &ret);
+  if (s.ok()) {
+    PutLengthPrefixedSlice(&out.extra_buf, ret.info);
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+Status MDS::RPC::CLI::Addpart(const AddpartOptions& options,
+                              AddpartRet* ret) {
+  Status s;
+  Msg in;
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutVarint32(&in.extra_buf, options.partition);
+  PutVarint64(&in.extra_buf, options.num_entries);
+  PutLengthPrefixedSlice(&in.extra_buf, options.index);
+  PutLengthPrefixedSlice(&in.extra_buf, options.table_dir);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  in.contents = Slice(in.extra_buf);
+  Msg out;
+  s = stub_->Call(AddOp(in, kAddpart), out);
+  if (s.ok()) {
+    if (out.err == -1) {
+      Redirect re(out.contents.data(), out.contents.size());
+      throw re;
+    } else if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::ADDPT(Msg& in, Msg& out) {
+  Status s;
+  AddpartOptions options;
+  AddpartRet ret;
+  assert(in.op == kAddpart);
+  Slice input = in.contents;
+  if (!GetDirId(&input, &options.dir_id) ||
+      !GetVarint32(&input, &options.partition) ||
+      !GetVarint64(&input, &options.num_entries) ||
+      !GetLengthPrefixedSlice(&input, &options.index) ||
+      !GetLengthPrefixedSlice(&input, &options.table_dir) ||
+      !GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    try {
+      s = mds_->Addpart(options, &ret);
+    } catch (Redirect& re) {
+      out.extra_buf.swap(re);
+      out.contents = Slice(out.extra_buf);
+      out.err = -1;
+      return;
+    }
+  }
+  if (s.ok()) {
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+Status MDS::RPC::CLI::Renew(const RenewOptions& options, RenewRet* ret) {
+  Status s;
+  Msg in;
+  PooledBuffer in_buf(&buffers_, &in);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutVarint32(&in.extra_buf, options.leases.size());
+  for (size_t i = 0; i < options.leases.size(); i++) {
+    const RenewEntry& lease = options.leases[i];
+    PutDirId(&in.extra_buf, lease.dir_id);
+    PutLengthPrefixedSlice(&in.extra_buf, lease.name_hash);
+    PutVarint64(&in.extra_buf, lease.lease_due);
+  }
+  in.contents = Slice(in.extra_buf);
+  Msg out;
+  s = stub_->Call(AddOp(in, kRenew), out);
+  if (s.ok()) {
+    if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else {
+      Slice input = out.contents;
+      uint32_t num;
+      if (!GetVarint32(&input, &num) || num != options.leases.size()) {
+        s = Status::Corruption(Slice());
+      } else {
+        ret->lease_dues.resize(num);
+        for (uint32_t i = 0; i < num; i++) {
+          if (!GetVarint64(&input, &ret->lease_dues[i])) {
+            s = Status::Corruption(Slice());
+            break;
+          }
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::RENEW(Msg& in, Msg& out) {
+  Status s;
+  RenewOptions options;
+  RenewRet ret;
+  assert(in.op == kRenew);
+  Slice input = in.contents;
+  uint32_t num = 0;
+  if (!GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due) || !GetVarint32(&input, &num)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    options.leases.resize(num);
+    for (uint32_t i = 0; i < num; i++) {
+      RenewEntry* const lease = &options.leases[i];
+      if (!GetDirId(&input, &lease->dir_id) ||
+          !GetLengthPrefixedSlice(&input, &lease->name_hash) ||
+          !GetVarint64(&input, &lease->lease_due)) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      }
+    }
+  }
+  if (s.ok()) {
+    s = mds_->Renew(options, &ret);
+  }
+  if (s.ok()) {
+    PutVarint32(&out.extra_buf, ret.lease_dues.size());
+    for (size_t i = 0; i < ret.lease_dues.size(); i++) {
+      PutVarint64(&out.extra_buf, ret.lease_dues[i]);
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+Status MDS::RPC::CLI::Resolve(const ResolveOptions& options,
+                              ResolveRet* ret) {
+  Status s;
+  Msg in;
+  PooledBuffer in_buf(&buffers_, &in);
+  PutDirId(&in.extra_buf, options.dir_id);
+  PutVarint32(&in.extra_buf, options.session_id);
+  PutVarint64(&in.extra_buf, options.op_due);
+  PutVarint32(&in.extra_buf, options.names.size());
+  for (size_t i = 0; i < options.names.size(); i++) {
+    PutLengthPrefixedSlice(&in.extra_buf, options.names[i]);
+  }
+  in.contents = Slice(in.extra_buf);
+  Msg out;
+  PooledBuffer out_buf(&buffers_, &out);
+  s = stub_->Call(AddOp(in, kResolve), out);
+  if (s.ok()) {
+    if (out.err == -1) {
+      Redirect re(out.contents.data(), out.contents.size());
+      throw re;
+    } else if (out.err != 0) {
+      s = Status::FromCode(out.err);
+    } else {
+      Slice input = out.contents;
+      uint32_t num;
+      Slice encoding;
+      if (!GetVarint32(&input, &num) || num > options.names.size()) {
+        s = Status::Corruption(Slice());
+      } else {
+        ret->stats.resize(num);
+        for (uint32_t i = 0; i < num; i++) {
+          if (!GetLengthPrefixedSlice(&input, &encoding) ||
+              !ret->stats[i].DecodeFrom(encoding)) {
+            s = Status::Corruption(Slice());
+            break;
+          }
+        }
+      }
+    }
+  }
+  return s;
+}
+
+void MDS::RPC::SRV::RSOLV(Msg& in, Msg& out) {
+  Status s;
+  ResolveOptions options;
+  ResolveRet ret;
+  assert(in.op == kResolve);
+  Slice input = in.contents;
+  uint32_t num = 0;
+  if (!GetDirId(&input, &options.dir_id) ||
+      !GetVarint32(&input, &options.session_id) ||
+      !GetVarint64(&input, &options.op_due) || !GetVarint32(&input, &num)) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    options.names.resize(num);
+    for (uint32_t i = 0; i < num; i++) {
+      if (!GetLengthPrefixedSlice(&input, &options.names[i])) {
+        s = Status::InvalidArgument(Slice());
+        break;
+      }
+    }
+  }
+  if (s.ok()) {
+    try {
+      s = mds_->Resolve(options, &ret);
+    } catch (Redirect& re) {
+      out.extra_buf.swap(re);
+      out.contents = Slice(out.extra_buf);
+      out.err = -1;
+      return;
+    }
+  }
+  if (s.ok()) {
+    char tmp[sizeof(out.buf)];
+    PutVarint32(&out.extra_buf, ret.stats.size());
+    for (size_t i = 0; i < ret.stats.size(); i++) {
+      PutLengthPrefixedSlice(&out.extra_buf, ret.stats[i].EncodeTo(tmp));
+    }
+    out.contents = Slice(out.extra_buf);
+    out.err = 0;
+  } else {
+    out.err = s.err_code();
+  }
+}
+
+namespace {
+// State of an asynchronous RPC call. Messages must not be moved while
+// the call is pending so the state is allocated on the heap.
+template <typename R>
+struct AsyncRPCState {
+  rpc::If::Message in;
+  rpc::If::Message out;
+  Status (*decode)(const rpc::If::Message&, R*);
+  R* ret;
+  MDS::AsyncCallback cb;
+  void* arg;
+};
+
+template <typename R>
+void AsyncRPCDone(void* arg, const Status& status) {
+  AsyncRPCState<R>* state = reinterpret_cast<AsyncRPCState<R>*>(arg);
+  MDS::AsyncCallback cb = state->cb;
+  void* cb_arg = state->arg;
+  Status s = status;
+  if (s.ok()) {
+    if (state->out.err == -1) {
+      const Slice& contents = state->out.contents;
+      MDS::Redirect re(contents.data(), contents.size());
+      delete state;
+      cb(cb_arg, Status::TryAgain("redirected"), &re);
+      return;
+    } else {
+      s = state->decode(state->out, state->ret);
+    }
+  }
+  delete state;
+  cb(cb_arg, s, NULL);
+}
+}  // namespace
+
+#define DEF_ASYNC_OP(OP)                                                    \
+  void MDS::RPC::CLI::Async##OP(const OP##Options& options, OP##Ret* ret,   \
+                                AsyncCallback cb, void* arg) {              \
+    AsyncRPCState<OP##Ret>* state = new AsyncRPCState<OP##Ret>;             \
+    Status s = Encode##OP(options, &state->in);                             \
+    if (!s.ok()) {                                                          \
+      delete state;                                                         \
+      cb(arg, s, NULL);                                                     \
+    } else {                                                                \
+      state->decode = Decode##OP;                                           \
+      state->ret = ret;                                                     \
+      state->cb = cb;                                                       \
+      state->arg = arg;                                                     \
+      stub_->AsyncCall(AddOp(state->in, k##OP), state->out,                 \
+                       AsyncRPCDone<OP##Ret>, state);                       \
+    }                                                                       \
+  }
+
+DEF_ASYNC_OP(Fstat)
+DEF_ASYNC_OP(Fcreat)
+DEF_ASYNC_OP(Mkdir)
+DEF_ASYNC_OP(Unlink)
+DEF_ASYNC_OP(Lookup)
+
+#undef DEF_ASYNC_OP
+
 void PseudoConcurrentMDSMonitor::Reset() {
   Reset_Fstat_count();
   Reset_Fcreat_count();
   Reset_Mkdir_count();
+  Reset_Bcreat_count();
   Reset_Chmod_count();
   Reset_Chown_count();
   Reset_Uperm_count();
@@ -1157,6 +1931,8 @@ void PseudoConcurrentMDSMonitor::Reset() {
   Reset_Trunc_count();
   Reset_Unlink_count();
   Reset_Lookup_count();
+  Reset_Renew_count();
+  Reset_Resolve_count();
   Reset_Listdir_count();
   Reset_Readidx_count();
 }
@@ -1165,6 +1941,7 @@ void SimpleMDSMonitor::Reset() {
   Reset_Fstat_count();
   Reset_Fcreat_count();
   Reset_Mkdir_count();
+  Reset_Bcreat_count();
   Reset_Chmod_count();
   Reset_Chown_count();
   Reset_Uperm_count();
@@ -1172,8 +1949,91 @@ void SimpleMDSMonitor::Reset() {
   Reset_Trunc_count();
   Reset_Unlink_count();
   Reset_Lookup_count();
+  Reset_Renew_count();
+  Reset_Resolve_count();
   Reset_Listdir_count();
   Reset_Readidx_count();
 }
 
+namespace {
+// Ops of a multi-op message shared by the threads executing them.
+struct BatchState {
+  BatchState() : cv(&mu), num_tasks(0) {}
+  MDS::RPC::SRV* srv;
+  rpc::If::Message* ins;
+  rpc::If::Message* outs;
+  size_t n;
+  std::atomic<size_t> next;  // The next op to execute
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_tasks;  // Pool tasks not yet finished
+};
+}  // namespace
+
+static void RunBatch(BatchState* state) {
+  size_t i;
+  while ((i = state->next.fetch_add(1)) < state->n) {
+    state->srv->Call(state->ins[i], state->outs[i]);
+  }
+}
+
+static void RunBatchTask(void* arg) {
+  BatchState* const state = reinterpret_cast<BatchState*>(arg);
+  RunBatch(state);
+  MutexLock ml(&state->mu);
+  if (--state->num_tasks == 0) {
+    state->cv.SignalAll();
+  }
+}
+
+void MDS::RPC::SRV::BATCH(Msg& in, Msg& out) {
+  assert(in.op == kBatch);
+  Slice input = in.contents;
+  uint32_t n;
+  if (!GetVarint32(&input, &n) || n > input.size()) {
+    out.err = Status::kInvalidArgument;
+    return;
+  }
+  std::vector<Msg> ins(n);
+  std::vector<Msg> outs(n);
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t op;
+    if (!GetVarint32(&input, &op) ||
+        !GetLengthPrefixedSlice(&input, &ins[i].contents)) {
+      out.err = Status::kInvalidArgument;
+      return;
+    }
+    // Multi-op messages do not nest
+    ins[i].op = op != kBatch ? static_cast<int>(op) : -1;
+  }
+  if (n != 0) {
+    BatchState state;
+    state.srv = this;
+    state.ins = &ins[0];
+    state.outs = &outs[0];
+    state.n = n;
+    state.next.store(0);
+    if (pool_ != NULL) {
+      // Each task executes ops until there is none left, so tasks starting
+      // late return right away
+      state.num_tasks = static_cast<int>(n - 1);
+      for (uint32_t i = 0; i < n - 1; i++) {
+        pool_->Schedule(RunBatchTask, &state);
+      }
+    }
+    RunBatch(&state);
+    MutexLock ml(&state.mu);
+    while (state.num_tasks != 0) {
+      state.cv.Wait();
+    }
+  }
+  out.extra_buf.clear();
+  for (uint32_t i = 0; i < n; i++) {
+    PutVarint32(&out.extra_buf, static_cast<uint32_t>(outs[i].err));
+    PutLengthPrefixedSlice(&out.extra_buf, outs[i].contents);
+  }
+  out.contents = Slice(out.extra_buf);
+  out.err = 0;
+}
+
 }  // namespace pdlfs
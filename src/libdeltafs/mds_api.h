@@ -25,6 +25,7 @@ namespace pdlfs {
 class Env;
 class Fio;
 class MDB;
+class MDSFactory;
 
 #define DELTAFS_MAX_MICROS ((uint64_t(1) << 63) - 1) /* Max future */
 
@@ -54,7 +55,25 @@ struct MDSOptions {
   MDB* mdb;
   size_t dir_table_size;
   size_t lease_table_size;
+  // Memory budget in bytes for caching entries read from the DB, including
+  // names known to be absent. Caching is disabled if zero.
+  size_t node_cache_size;
+  int num_shards;  // Directory and lease tables are split across shards
+  // If not zero, new directories start with a single partition and a
+  // partition is split in half by GIGA+ once it holds this many entries.
+  // If zero, new directories are pre-split across all virtual servers.
+  uint64_t split_threshold;
+  // Used to reach other servers when migrating split partitions.
+  // Partitions are only split locally if NULL.
+  MDSFactory* peers;
+  // Staging area for the table files of migrated partitions.
+  // Must be accessible by all servers.
+  std::string split_dir;
   uint64_t lease_duration;
+  // If true, serve a finished namespace without ever changing it. mdb
+  // should be backed by a ReadonlyDB. Leases are not issued and all
+  // mutations are rejected.
+  bool read_only;
   uint64_t snap_id;
   uint64_t reg_id;
   bool paranoid_checks;
@@ -114,6 +133,27 @@ class MDS {
   MDS_OP_RET(Mkdir) { Stat stat; };
   MDS_OP(Mkdir)
 
+  // Create many names under a single parent directory in one call.
+  // An entry whose mode carries S_IFDIR becomes a directory, otherwise
+  // a regular file. All entries must belong to the receiving server.
+  // Per-entry results are returned in order.
+  struct BcreatEntry {
+    Slice name_hash;
+    Slice name;
+    uint32_t mode;
+  };
+  MDS_OP_OPTIONS(Bcreat) {
+    uint32_t flags;
+    uint32_t uid;
+    uint32_t gid;
+    std::vector<BcreatEntry> entries;
+  };
+  MDS_OP_RET(Bcreat) {
+    std::vector<Status> statuses;
+    std::vector<Stat> stats;  // Only valid for entries with an OK status
+  };
+  MDS_OP(Bcreat)
+
   MDS_OP_OPTIONS(Chmod) { uint32_t mode; };
   MDS_OP_RET(Chmod) { Stat stat; };
   MDS_OP(Chmod)
@@ -155,8 +195,45 @@ class MDS {
   MDS_OP_RET(Lookup) { LookupStat stat; };
   MDS_OP(Lookup)
 
-  MDS_OP_OPTIONS(Listdir){};
-  MDS_OP_RET(Listdir) { std::vector<std::string>* names; };
+  // Extend many lookup state leases in one call. Each lease is named by
+  // its parent directory and name hash, along with the due previously
+  // granted to the caller. A lease is only extended if that due has not
+  // yet passed, no write is pending against the lease, and the lease is
+  // still held by the receiving server. New dues are returned in order,
+  // with zero for each lease that was not extended. Never redirects.
+  struct RenewEntry {
+    DirId dir_id;
+    Slice name_hash;
+    uint64_t lease_due;
+  };
+  MDS_OP_OPTIONS(Renew) { std::vector<RenewEntry> leases; };
+  MDS_OP_RET(Renew) { std::vector<uint64_t> lease_dues; };
+  MDS_OP(Renew)
+
+  // Look up a run of path components in one call. The first name is
+  // looked up under dir_id, and each following name under the directory
+  // found before it. Components are resolved for as long as the receiving
+  // server holds them, and one stat, with its own lease, is returned for
+  // each component resolved. Redirects if the first name is held by
+  // another server. Errors on later names end the run without failing
+  // the call.
+  MDS_OP_OPTIONS(Resolve) { std::vector<Slice> names; };
+  MDS_OP_RET(Resolve) { std::vector<LookupStat> stats; };
+  MDS_OP(Resolve)
+
+  // Directories are listed one page at a time. Each page resumes from the
+  // cursor returned by the previous page. An empty cursor starts a new
+  // listing. When stats are requested, one stat is returned for each name.
+  MDS_OP_OPTIONS(Listdir) {
+    Slice start_hash;      // Cursor of the first entry to list
+    uint32_t max_entries;  // Max entries per page, 0 for a server default
+    bool with_stats;
+  };
+  MDS_OP_RET(Listdir) {
+    std::vector<std::string>* names;
+    std::vector<Stat>* stats;  // Only used when stats are requested
+    std::string next_hash;     // Cursor of the next page, empty at the end
+  };
   MDS_OP(Listdir)
 
   MDS_OP_OPTIONS(Readidx){};
@@ -185,6 +262,49 @@ class MDS {
   MDS_OP_RET(Getoutput) { std::string info; };
   MDS_OP(Getoutput)
 
+  // Obtain a text report of the latency distributions of the ops
+  // served so far, one line per op and phase.
+  MDS_OP_OPTIONS(Getstats){};
+  MDS_OP_RET(Getstats) { std::string info; };
+  MDS_OP(Getstats)
+
+  // Take over a partition split off by another server. The entries of the
+  // partition are bulk inserted from the table files under table_dir. The
+  // given index is merged with the local one. Only called by servers.
+  MDS_OP_OPTIONS(Addpart) {
+    uint32_t partition;
+    uint64_t num_entries;
+    Slice index;
+    Slice table_dir;
+  };
+  MDS_OP_RET(Addpart){};
+  MDS_OP(Addpart)
+
+  // -------------
+  // MDS async interface
+  // -------------
+
+  // Callback of an asynchronous op. Invoked exactly once with the status
+  // of the op. A redirected op gets a TryAgain status along with the
+  // redirect. Other ops get a NULL redirect. The callback may be invoked
+  // by the calling thread before the op returns, or by an RPC thread, in
+  // which case it must not block.
+  typedef void (*AsyncCallback)(void* arg, const Status&, const Redirect*);
+
+  // Start an op without waiting for it to finish. Options are no longer
+  // needed once the call returns, but ret must stay valid until the
+  // callback is invoked. By default, the op is done synchronously.
+#define MDS_ASYNC_OP(OP)                                              \
+  virtual void Async##OP(const OP##Options&, OP##Ret*, AsyncCallback, \
+                         void* arg);
+
+  MDS_ASYNC_OP(Fstat)
+  MDS_ASYNC_OP(Fcreat)
+  MDS_ASYNC_OP(Mkdir)
+  MDS_ASYNC_OP(Unlink)
+  MDS_ASYNC_OP(Lookup)
+
+#undef MDS_ASYNC_OP
 #undef MDS_OP_RET
 #undef MDS_OP_OPTIONS
 #undef MDS_OP
@@ -192,6 +312,7 @@ class MDS {
   static Slice EncodeId(const DirId& id, char* scratch);
   static int PickupServer(const DirId& id);
   class SRV;
+  class ReadonlySRV;
   class CLI;
 
  private:
@@ -202,7 +323,8 @@ class MDS {
 
 // Helper class that forwards all calls to another MDS if one exists.
 // May be useful to clients who wish to implement just part of the
-// functionality of MDS.
+// functionality of MDS. Async ops are not forwarded. They are done
+// synchronously through the ops below so subclasses see all calls.
 class MDSWrapper : public MDS {
  public:
   explicit MDSWrapper(MDS* base = NULL) : base_(base) {}
@@ -220,6 +342,7 @@ class MDSWrapper : public MDS {
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
   DEF_OP(Mkdir)
+  DEF_OP(Bcreat)
   DEF_OP(Chmod)
   DEF_OP(Chown)
   DEF_OP(Uperm)
@@ -227,11 +350,15 @@ class MDSWrapper : public MDS {
   DEF_OP(Trunc)
   DEF_OP(Unlink)
   DEF_OP(Lookup)
+  DEF_OP(Renew)
+  DEF_OP(Resolve)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
   DEF_OP(Opensession)
   DEF_OP(Getinput)
   DEF_OP(Getoutput)
+  DEF_OP(Getstats)
+  DEF_OP(Addpart)
 
 #undef DEF_OP
 
@@ -264,6 +391,7 @@ class SimpleMDSMonitor : public MDSWrapper {
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
   DEF_OP(Mkdir)
+  DEF_OP(Bcreat)
   DEF_OP(Chmod)
   DEF_OP(Chown)
   DEF_OP(Uperm)
@@ -271,6 +399,8 @@ class SimpleMDSMonitor : public MDSWrapper {
   DEF_OP(Trunc)
   DEF_OP(Unlink)
   DEF_OP(Lookup)
+  DEF_OP(Renew)
+  DEF_OP(Resolve)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
 
@@ -317,6 +447,7 @@ class PseudoConcurrentMDSMonitor : public MDSWrapper {
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
   DEF_OP(Mkdir)
+  DEF_OP(Bcreat)
   DEF_OP(Chmod)
   DEF_OP(Chown)
   DEF_OP(Uperm)
@@ -324,6 +455,8 @@ class PseudoConcurrentMDSMonitor : public MDSWrapper {
   DEF_OP(Trunc)
   DEF_OP(Unlink)
   DEF_OP(Lookup)
+  DEF_OP(Renew)
+  DEF_OP(Resolve)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
 
@@ -370,9 +503,12 @@ class MDSTracer : public MDSWrapper {
   DEF_OP(Opensession)
   DEF_OP(Getinput)
   DEF_OP(Getoutput)
+  DEF_OP(Getstats)
+  DEF_OP(Addpart)
   DEF_OP(Fstat)
   DEF_OP(Fcreat)
   DEF_OP(Mkdir)
+  DEF_OP(Bcreat)
   DEF_OP(Chmod)
   DEF_OP(Chown)
   DEF_OP(Uperm)
@@ -380,6 +516,8 @@ class MDSTracer : public MDSWrapper {
   DEF_OP(Trunc)
   DEF_OP(Unlink)
   DEF_OP(Lookup)
+  DEF_OP(Renew)
+  DEF_OP(Resolve)
   DEF_OP(Listdir)
   DEF_OP(Readidx)
 
@@ -399,7 +537,12 @@ class MDS::RPC::CLI : public MDS {
   typedef rpc::If::Message Msg;
 
  public:
-  CLI(rpc::If* stub) : stub_(stub) {}
+  // Small ops sent by concurrent threads may be coalesced into multi-op
+  // messages of up to max_coalesced_ops ops each. Ops only wait for each
+  // other while earlier messages are still in flight, so ops sent at low
+  // load go out right away. Ops are never coalesced if max_coalesced_ops
+  // is 0 or 1.
+  explicit CLI(rpc::If* stub, int max_coalesced_ops = 0);
   virtual ~CLI();
 
 #define DEC_OP(OP) virtual Status OP(const OP##Options&, OP##Ret*);
@@ -407,6 +550,7 @@ class MDS::RPC::CLI : public MDS {
   DEC_OP(Fstat)
   DEC_OP(Fcreat)
   DEC_OP(Mkdir)
+  DEC_OP(Bcreat)
   DEC_OP(Chmod)
   DEC_OP(Chown)
   DEC_OP(Uperm)
@@ -414,16 +558,41 @@ class MDS::RPC::CLI : public MDS {
   DEC_OP(Trunc)
   DEC_OP(Unlink)
   DEC_OP(Lookup)
+  DEC_OP(Renew)
+  DEC_OP(Resolve)
   DEC_OP(Listdir)
   DEC_OP(Readidx)
   DEC_OP(Opensession)
   DEC_OP(Getinput)
   DEC_OP(Getoutput)
+  DEC_OP(Getstats)
+  DEC_OP(Addpart)
 
 #undef DEC_OP
 
+#define DEC_ASYNC_OP(OP)                                             \
+  virtual void Async##OP(const OP##Options&, OP##Ret*, AsyncCallback, \
+                         void* arg);
+
+  DEC_ASYNC_OP(Fstat)
+  DEC_ASYNC_OP(Fcreat)
+  DEC_ASYNC_OP(Mkdir)
+  DEC_ASYNC_OP(Unlink)
+  DEC_ASYNC_OP(Lookup)
+
+#undef DEC_ASYNC_OP
+
  private:
+  class Coalescer;
+  Status Send(Msg& in, Msg& out);
+
+  // No copying allowed
+  void operator=(const CLI&);
+  CLI(const CLI&);
+
   rpc::If* stub_;
+  rpc::BufferPool buffers_;  // Reused for large requests and replies
+  Coalescer* coalescer_;     // NULL if ops are not coalesced
 };
 
 class MDS::RPC::SRV : public rpc::If {
@@ -432,7 +601,12 @@ class MDS::RPC::SRV : public rpc::If {
  public:
   // Always return OK.
   virtual Status Call(Msg& in, Msg& out) RPCNOEXCEPT;
-  SRV(MDS* mds) : mds_(mds) {}
+  // Lookups, path resolutions, index reads, and lease renewals are urgent
+  // since clients cannot send their next op before they are answered.
+  virtual bool IsUrgent(const Msg& in) RPCNOEXCEPT;
+  // Ops in a multi-op message are spread over pool if it is not NULL.
+  // The pool must not be the one calling us.
+  explicit SRV(MDS* mds, ThreadPool* pool = NULL) : mds_(mds), pool_(pool) {}
   virtual ~SRV();
 
 #define DEC_RPC(OP) void OP(Msg& in, Msg& out);
@@ -440,6 +614,7 @@ class MDS::RPC::SRV : public rpc::If {
   DEC_RPC(FSTAT)
   DEC_RPC(MKDIR)
   DEC_RPC(FCRET)
+  DEC_RPC(BCRET)
   DEC_RPC(CHMOD)
   DEC_RPC(CHOWN)
   DEC_RPC(UPERM)
@@ -447,16 +622,22 @@ class MDS::RPC::SRV : public rpc::If {
   DEC_RPC(TRUNC)
   DEC_RPC(UNLNK)
   DEC_RPC(LOKUP)
+  DEC_RPC(RENEW)
+  DEC_RPC(RSOLV)
   DEC_RPC(LSDIR)
   DEC_RPC(RDIDX)
   DEC_RPC(OPSES)
   DEC_RPC(GINPT)
   DEC_RPC(GOUPT)
+  DEC_RPC(GSTAT)
+  DEC_RPC(ADDPT)
+  DEC_RPC(BATCH)
 
 #undef DEC_RPC
 
  private:
   MDS* mds_;
+  ThreadPool* pool_;
 };
 
 }  // namespace pdlfs
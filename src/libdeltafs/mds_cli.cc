@@ -11,6 +11,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <deque>
+#include <map>
 #include <set>
 
 #include "pdlfs-common/mutexlock.h"
@@ -21,14 +23,11 @@ namespace pdlfs {
 
 #define MDS_OP_VERBOSE_LEVEL 8
 
-Status MDS::CLI::FetchIndex(const DirId& id, int zserver,
-                            IndexHandle** result) {
-  mutex_.AssertHeld();
+Status MDS::CLI::FetchIndex(const DirId& id, int zserver, IndexHandle** result,
+                            bool refresh) {
   Status s;
   IndexHandle* h = index_cache_->Lookup(id);
-  if (h == NULL) {
-    mutex_.Unlock();
-
+  if (h == NULL || refresh) {
     DirIndex* idx = new DirIndex(&giga_);
     ReadidxOptions options;
     options.op_due = DELTAFS_MAX_MICROS;
@@ -41,10 +40,15 @@ Status MDS::CLI::FetchIndex(const DirId& id, int zserver,
     if (s.ok()) {
       if (!idx->Update(ret.idx) || idx->ZerothServer() != zserver) {
         s = Status::Corruption(Slice());
+      } else if (h != NULL) {
+        idx->Update(*index_cache_->Value(h));
       }
     }
 
-    mutex_.Lock();
+    if (h != NULL) {
+      index_cache_->Release(h);
+      h = NULL;
+    }
     if (s.ok()) {
       h = index_cache_->Insert(id, idx);
     } else {
@@ -55,12 +59,35 @@ Status MDS::CLI::FetchIndex(const DirId& id, int zserver,
   return s;
 }
 
+// Max number of path components looked up by a single Resolve call.
+static const size_t kMaxResolveNames = 16;
+
+// Store into *names the names of the directories named by a relative path,
+// excluding the last name, which is not looked up as a directory.
+// Stop at the first "." or "..", or when max names have been stored.
+static void GetDirNames(Slice path, size_t max, std::vector<Slice>* names) {
+  while (names->size() < max) {
+    const char* p =
+        static_cast<const char*>(memchr(path.data(), '/', path.size()));
+    if (p == NULL) {
+      break;
+    }
+    Slice name(path.data(), p - path.data());
+    path.remove_prefix(name.size() + 1);
+    if (name == "." || name == "..") {
+      break;
+    } else if (!name.empty()) {
+      names->push_back(name);
+    }
+  }
+}
+
 Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
-                        uint64_t op_due, LookupHandle** result) {
+                        uint64_t op_due, LookupHandle** result,
+                        const Slice& rest) {
   Status s;
   char tmp[20];
   Slice nhash = DirIndex::Hash(name, tmp);
-  mutex_.AssertHeld();
 
   uint64_t now = Env::Default()->NowMicros();
   LookupHandle* h = lookup_cache_->Lookup(pid, nhash);
@@ -83,7 +110,34 @@ Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
         options.name = name;
       }
       LookupRet ret;
-      s = _Lookup(index_cache_->Value(idxh), options, &ret);
+      ResolveOptions resolve_options;
+      GetDirNames(rest, kMaxResolveNames - 1, &resolve_options.names);
+      if (!resolve_options.names.empty()) {
+        *static_cast<BaseOptions*>(&resolve_options) =
+            static_cast<const BaseOptions&>(options);
+        resolve_options.names.insert(resolve_options.names.begin(), name);
+        ResolveRet resolve_ret;
+        s = _Resolve(index_cache_->Value(idxh), resolve_options, &resolve_ret);
+        if (s.ok()) {
+          ret.stat = resolve_ret.stats[0];
+          // Cache the directories resolved below the current one
+          DirId dir_id = DirId(ret.stat);
+          for (size_t i = 1; i < resolve_ret.stats.size(); i++) {
+            const LookupStat& stat = resolve_ret.stats[i];
+            char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+            Slice hash = DirIndex::Hash(resolve_options.names[i], tmp);
+            if (stat.LeaseDue() != 0) {
+              lookup_cache_->Release(
+                  lookup_cache_->Insert(dir_id, hash, new LookupStat(stat)));
+            }
+            dir_id = DirId(stat);
+          }
+        } else if (s.IsNotSupported()) {
+          s = _Lookup(index_cache_->Value(idxh), options, &ret);
+        }
+      } else {
+        s = _Lookup(index_cache_->Value(idxh), options, &ret);
+      }
       if (s.ok()) {
         LookupStat* stat = new LookupStat(ret.stat);
         h = lookup_cache_->Insert(pid, nhash, stat);
@@ -101,12 +155,10 @@ Status MDS::CLI::Lookup(const DirId& pid, const Slice& name, int zserver,
 Status MDS::CLI::_Lookup(const DirIndex* idx, const LookupOptions& options,
                          LookupRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -137,7 +189,6 @@ Status MDS::CLI::_Lookup(const DirIndex* idx, const LookupOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -151,6 +202,219 @@ Status MDS::CLI::_Lookup(const DirIndex* idx, const LookupOptions& options,
   return s;
 }
 
+Status MDS::CLI::_Resolve(const DirIndex* idx, const ResolveOptions& options,
+                          ResolveRet* ret) {
+  Status s;
+  DirIndex* tmp_idx = NULL;
+  assert(idx != NULL);
+  const DirIndex* latest_idx = idx;
+  int remaining_redirects = max_redirects_allowed_;
+
+  do {
+    try {
+      assert(latest_idx != NULL);
+      size_t server = latest_idx->HashToServer(options.name_hash);
+      assert(server < giga_.num_servers);
+      s = factory_->Get(server)->Resolve(options, ret);
+    } catch (Redirect& re) {
+      if (tmp_idx == NULL) {
+        tmp_idx = new DirIndex(&giga_);
+        tmp_idx->Update(*idx);
+      }
+      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
+        s = Status::Corruption("bad giga+ index");
+      } else {
+        s = Status::TryAgain(Slice());
+      }
+      assert(tmp_idx != NULL);
+      latest_idx = tmp_idx;
+    }
+  } while (s.IsTryAgain());
+
+  if (s.ok()) {
+    if (ret->stats.empty()) {
+      s = Status::Corruption(Slice());
+    } else if (paranoid_checks_) {
+      for (size_t i = 0; i < ret->stats.size(); i++) {
+        if (!S_ISDIR(ret->stats[i].DirMode())) {
+          s = Status::Corruption(Slice());
+        }
+      }
+    }
+  }
+
+  if (tmp_idx != NULL) {
+    if (s.ok()) {
+      const DirId& pid = options.dir_id;
+      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
+      index_cache_->Release(h);
+    } else {
+      delete tmp_idx;
+    }
+  }
+
+  return s;
+}
+
+struct MDS::CLI::RefreshState {
+  RefreshState() : cv(&mu), num_running(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+};
+
+void MDS::CLI::RefreshBGWork(void* arg) {
+  RefreshWork* w = reinterpret_cast<RefreshWork*>(arg);
+  try {
+    w->status = w->mds->Lookup(w->options, &w->ret);
+  } catch (Redirect& re) {
+    w->status = Status::TryAgain("redirected");
+  }
+  RefreshState* const state = w->state;
+  MutexLock ml(&state->mu);
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+// Walk a path through the lookup cache and refresh all components whose
+// leases have expired with parallel lookups. Only called once path
+// resolution has found a component without a valid lease. Expired entries
+// still tell the directory ids of later components, so their lookups can be
+// sent without waiting for earlier ones. A guessed directory id that turns
+// out to be stale only costs a wasted lookup: results are cached under the
+// directory ids they were looked up with, so later path resolution never
+// uses them for a different directory. Lookups under a directory whose
+// index is not cached are sent to its zeroth server, and are simply
+// dropped if redirected. Components below the first one not cached at all
+// are left to regular path resolution.
+void MDS::CLI::RefreshPath(const DirId& start, int zserver, const Slice& path) {
+  std::vector<Slice> names;
+  GetDirNames(path, kMaxResolveNames, &names);
+  const uint64_t now = Env::Default()->NowMicros();
+  std::vector<RefreshWork*> works;
+  DirId pid = start;
+  for (size_t i = 0; i < names.size(); i++) {
+    char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+    Slice nhash = DirIndex::Hash(names[i], tmp);
+    LookupHandle* h = lookup_cache_->Lookup(pid, nhash);
+    if (h == NULL || (now + 10) > lookup_cache_->Value(h)->LeaseDue()) {
+      size_t server = zserver % giga_.num_servers;
+      IndexHandle* idxh = index_cache_->Lookup(pid);
+      if (idxh != NULL) {
+        server = index_cache_->Value(idxh)->HashToServer(nhash);
+        index_cache_->Release(idxh);
+      }
+      RefreshWork* w = new RefreshWork;
+      w->mds = factory_->Get(server);
+      w->nhash = nhash.ToString();
+      w->options.op_due = DELTAFS_MAX_MICROS;
+      w->options.session_id = session_id_;
+      w->options.dir_id = pid;
+      w->options.name_hash = w->nhash;
+      if (paranoid_checks_) {
+        w->options.name = names[i];
+      }
+      works.push_back(w);
+    }
+    if (h == NULL) {
+      break;
+    }
+    pid = DirId(*lookup_cache_->Value(h));
+    zserver = lookup_cache_->Value(h)->ZerothServer();
+    lookup_cache_->Release(h);
+  }
+
+  // A single lookup is left to regular path resolution
+  if (works.size() > 1) {
+    RefreshState state;
+    state.num_running = static_cast<int>(works.size());
+    for (size_t i = 0; i < works.size(); i++) {
+      works[i]->state = &state;
+      // The last lookup is always sent by the calling thread
+      if (i + 1 < works.size()) {
+        bg_pool_->Schedule(RefreshBGWork, works[i]);
+      } else {
+        RefreshBGWork(works[i]);
+      }
+    }
+    state.mu.Lock();
+    while (state.num_running > 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+
+    for (size_t i = 0; i < works.size(); i++) {
+      RefreshWork* const w = works[i];
+      if (w->status.ok() && w->ret.stat.LeaseDue() != 0) {
+        lookup_cache_->Release(lookup_cache_->Insert(
+            w->options.dir_id, w->nhash, new LookupStat(w->ret.stat)));
+      }
+    }
+  }
+
+  for (size_t i = 0; i < works.size(); i++) {
+    delete works[i];
+  }
+}
+
+// Extend the given cached leases, sending a single call to each server
+// involved. Leases whose directory index is not cached are skipped. Errors
+// are ignored as leases not renewed are looked up again once expired.
+void MDS::CLI::RenewLeases(const std::vector<PendingRenewal>& leases) {
+  std::map<size_t, RenewOptions> batches;
+  for (size_t i = 0; i < leases.size(); i++) {
+    const PendingRenewal& lease = leases[i];
+    IndexHandle* idxh = index_cache_->Lookup(lease.pid);
+    if (idxh != NULL) {
+      size_t server = index_cache_->Value(idxh)->HashToServer(lease.nhash);
+      index_cache_->Release(idxh);
+      RenewEntry entry;
+      entry.dir_id = lease.pid;
+      entry.name_hash = lease.nhash;
+      entry.lease_due = lease.lease_due;
+      batches[server].leases.push_back(entry);
+    }
+  }
+
+  std::map<size_t, RenewRet> rets;
+  for (std::map<size_t, RenewOptions>::iterator it = batches.begin();
+       it != batches.end(); ++it) {
+    RenewOptions& options = it->second;
+    options.op_due = DELTAFS_MAX_MICROS;
+    options.session_id = session_id_;
+    options.dir_id = DirId(0, 0, 0);
+    Status s = factory_->Get(it->first)->Renew(options, &rets[it->first]);
+    if (!s.ok()) {
+      rets.erase(it->first);
+    }
+  }
+
+  for (std::map<size_t, RenewRet>::iterator it = rets.begin();
+       it != rets.end(); ++it) {
+    const std::vector<RenewEntry>& entries = batches[it->first].leases;
+    const std::vector<uint64_t>& dues = it->second.lease_dues;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (dues[i] != 0) {
+        LookupHandle* h =
+            lookup_cache_->Lookup(entries[i].dir_id, entries[i].name_hash);
+        if (h != NULL) {
+          const LookupStat* const stat = lookup_cache_->Value(h);
+          // Skip leases replaced in the meantime. Cached stats may be read
+          // by other threads so a renewed copy is inserted instead.
+          if (stat->LeaseDue() == entries[i].lease_due) {
+            LookupStat* renewed = new LookupStat(*stat);
+            renewed->SetLeaseDue(dues[i]);
+            lookup_cache_->Release(lookup_cache_->Insert(
+                entries[i].dir_id, entries[i].name_hash, renewed));
+          }
+          lookup_cache_->Release(h);
+        }
+      }
+    }
+  }
+}
+
 bool MDS::CLI::IsReadDirOk(const PathInfo* info) {
   if (info == NULL) {
     return false;
@@ -201,8 +465,6 @@ bool MDS::CLI::IsLookupOk(const PathInfo* info) {
 
 Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
                              const Fentry* at, std::string* missing_parent) {
-  mutex_.AssertHeld();
-
   Status s;
   Slice input(path);
   assert(input.size() != 0);
@@ -229,7 +491,14 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
   }
 
   input.remove_prefix(1);
+  // Set once the rest of the path has been checked for expired leases
+  bool refreshed = bg_pool_ == NULL;
   std::vector<PathInfo> parents(2, *result);
+  std::vector<PendingRenewal> renewals;
+  const uint64_t renew_due =
+      lease_renewal_window_ != 0
+          ? Env::Default()->NowMicros() + lease_renewal_window_
+          : 0;
   uint64_t lease_due = result->lease_due;
   int depth = result->depth;
   if (!input.empty()) {
@@ -256,12 +525,39 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
           result->name = name;
           parents.push_back(*result);
           LookupHandle* lh = NULL;
-          s = Lookup(result->pid, name, result->zserver, lease_due, &lh);
+          // Components found with valid leases are resolved inline. The
+          // first one that is not has the rest of the path refreshed in
+          // parallel before the walk goes on.
+          if (!refreshed) {
+            char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+            Slice nhash = DirIndex::Hash(name, tmp);
+            lh = lookup_cache_->Lookup(result->pid, nhash);
+            if (lh == NULL || (Env::Default()->NowMicros() + 10) >
+                                  lookup_cache_->Value(lh)->LeaseDue()) {
+              refreshed = true;
+              RefreshPath(result->pid, result->zserver,
+                          Slice(q, input.data() + input.size() - q));
+            }
+            if (lh != NULL) {
+              lookup_cache_->Release(lh);
+              lh = NULL;
+            }
+          }
+          s = Lookup(result->pid, name, result->zserver, lease_due, &lh,
+                     input);
           if (s.ok()) {
             assert(lh != NULL);
             const LookupStat* stat = lookup_cache_->Value(lh);
             assert(stat != NULL);
             lease_due = std::min(lease_due, stat->LeaseDue());
+            if (stat->LeaseDue() < renew_due) {
+              PendingRenewal renewal;
+              renewal.pid = result->pid;
+              char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+              renewal.nhash = DirIndex::Hash(name, tmp).ToString();
+              renewal.lease_due = stat->LeaseDue();
+              renewals.push_back(renewal);
+            }
 
             result->pid = DirId(*stat);
             result->zserver = stat->ZerothServer();
@@ -307,6 +603,10 @@ Status MDS::CLI::ResolvePath(const Slice& path, PathInfo* result,
     }
   }
 
+  if (!renewals.empty()) {
+    RenewLeases(renewals);
+  }
+
 #if VERBOSE >= MDS_OP_VERBOSE_LEVEL
   if (s.ok()) {
     Verbose(__LOG_ARGS__, MDS_OP_VERBOSE_LEVEL,
@@ -337,8 +637,10 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
   }
 
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, at);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.ok()) {
     if (path.depth == 0) {  // Path is root or pseudo root
       if (at == NULL || DirId(at->stat) == DirId(0, 0, 0)) {
@@ -438,12 +740,10 @@ Status MDS::CLI::Fstat(const Slice& p, Fentry* ent, const Fentry* at) {
 Status MDS::CLI::_Fstat(const DirIndex* idx, const FstatOptions& options,
                         FstatRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -466,7 +766,6 @@ Status MDS::CLI::_Fstat(const DirIndex* idx, const FstatOptions& options,
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -491,7 +790,6 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
 
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, at);
   if (s.ok()) {
     if (path.depth == 0) {
@@ -526,7 +824,11 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
 
     } else if (path.name.size() > DELTAFS_NAME_MAX) {
       s = FileNameExceeedsLimit();
+    } else if (write_back_batch_ != 0 && error_if_exists && ent == NULL &&
+               created == NULL) {
+      BufferCreate(path, mode);
     } else {
+      FlushCreates(path.pid);
       IndexHandle* idxh = NULL;
       s = FetchIndex(path.pid, path.zserver, &idxh);
       if (s.ok()) {
@@ -564,12 +866,10 @@ Status MDS::CLI::Fcreat(const Slice& p, mode_t mode, Fentry* ent,
 Status MDS::CLI::_Fcreat(const DirIndex* idx, const FcreatOptions& options,
                          FcreatRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -600,7 +900,6 @@ Status MDS::CLI::_Fcreat(const DirIndex* idx, const FcreatOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -625,8 +924,10 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
   }
 
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, at);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.ok()) {
     if (path.depth == 0) {
       s = Status::FileExpected(Slice());
@@ -672,12 +973,10 @@ Status MDS::CLI::Unlink(const Slice& p, Fentry* ent, bool error_if_absent,
 Status MDS::CLI::_Unlink(const DirIndex* idx, const UnlinkOptions& options,
                          UnlinkRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -700,7 +999,6 @@ Status MDS::CLI::_Unlink(const DirIndex* idx, const UnlinkOptions& options,
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -721,11 +1019,12 @@ Status MDS::CLI::Mkdir(
   Status s;
   PathInfo path;
   std::string missing_parent;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path, NULL, &missing_parent);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.IsNotFound() && create_if_missing) {
     if (!missing_parent.empty()) {
-      mutex_.Unlock();
       s = Mkdir(missing_parent,
                 mode & ~DELTAFS_DIR_MASK,  // avoid special directory modes
                 NULL, true,  // recursively creating missing parents
@@ -735,7 +1034,6 @@ Status MDS::CLI::Mkdir(
         s = Mkdir(p, mode, ent, true,  // retry the original request
                   error_if_exists);
       }
-      mutex_.Lock();
     }
 
   } else if (s.ok()) {
@@ -786,12 +1084,10 @@ Status MDS::CLI::Mkdir(
 Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
                         MkdirRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -822,7 +1118,6 @@ Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
     }
   }
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -836,11 +1131,593 @@ Status MDS::CLI::_Mkdir(const DirIndex* idx, const MkdirOptions& options,
   return s;
 }
 
+Status MDS::CLI::Bcreat(const Slice& p, const std::vector<std::string>& names,
+                        mode_t mode, std::vector<Status>* statuses,
+                        bool error_if_exists) {
+  Status s;
+  assert(p.size() != 0);
+  assert(p.size() == 1 || !p.ends_with("/"));
+  std::string fake_path = p.ToString();
+  fake_path += "/_";
+  statuses->assign(names.size(), Status::OK());
+  PathInfo path;
+  s = ResolvePath(fake_path, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
+  if (s.ok()) {
+    if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("bcreat under plfs dirs");
+    } else {
+      IndexHandle* idxh = NULL;
+      s = FetchIndex(path.pid, path.zserver, &idxh);
+      if (s.ok()) {
+        assert(idxh != NULL);
+        IndexGuard idxg(index_cache_, idxh);
+        std::vector<std::string> hashes(names.size());
+        BcreatOptions options;
+        options.op_due =
+            atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
+        options.session_id = session_id_;
+        options.dir_id = path.pid;
+        options.flags = error_if_exists ? O_EXCL : 0;
+        options.uid = uid_;
+        options.gid = gid_;
+        for (size_t i = 0; i < names.size(); i++) {
+          if (names[i].empty()) {
+            (*statuses)[i] = Status::InvalidArgument("empty name");
+          } else if (names[i].size() > DELTAFS_NAME_MAX) {
+            (*statuses)[i] = FileNameExceeedsLimit();
+          } else {
+            DirIndex::PutHash(&hashes[i], names[i]);
+            BcreatEntry entry;
+            entry.name_hash = hashes[i];
+            entry.name = names[i];
+            entry.mode = mode;
+            options.entries.push_back(entry);
+          }
+        }
+        BcreatRet ret;
+        if (!options.entries.empty()) {
+          s = _Bcreat(index_cache_->Value(idxh), options, &ret);
+        }
+        if (s.ok()) {
+          size_t j = 0;
+          for (size_t i = 0; i < names.size(); i++) {
+            if ((*statuses)[i].ok()) {
+              assert(j < ret.statuses.size());
+              (*statuses)[i] = ret.statuses[j++];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return s;
+}
+
+// Entries are grouped by the server they belong to and sent in chunks
+// of at most kMaxBcreatEntries to bound the size of each RPC message.
+// A redirect updates the index and re-partitions the remaining entries.
+// The redirect limit applies to each chunk separately.
+static const size_t kMaxBcreatEntries = 64;
+
+Status MDS::CLI::_Bcreat(const DirIndex* idx, const BcreatOptions& options,
+                         BcreatRet* ret) {
+  Status s;
+  DirIndex* tmp_idx = NULL;
+  assert(idx != NULL);
+  const DirIndex* latest_idx = idx;
+  int remaining_redirects = max_redirects_allowed_;
+
+  const size_t num_entries = options.entries.size();
+  ret->statuses.assign(num_entries, Status::OK());
+  ret->stats.resize(num_entries);
+  std::vector<size_t> remaining;
+  for (size_t i = 0; i < num_entries; i++) {
+    remaining.push_back(num_entries - 1 - i);  // Handled from the back
+  }
+  BcreatOptions batch = options;
+  BcreatRet batch_ret;
+  std::vector<size_t> members;
+  while (s.ok() && !remaining.empty()) {
+    assert(latest_idx != NULL);
+    size_t server =
+        latest_idx->HashToServer(options.entries[remaining.back()].name_hash);
+    assert(server < giga_.num_servers);
+    batch.entries.clear();
+    members.clear();
+    for (size_t k = remaining.size(); k != 0; k--) {
+      const size_t i = remaining[k - 1];
+      if (latest_idx->HashToServer(options.entries[i].name_hash) == server) {
+        batch.entries.push_back(options.entries[i]);
+        members.push_back(i);
+        if (members.size() >= kMaxBcreatEntries) {
+          break;
+        }
+      }
+    }
+    try {
+      batch_ret.statuses.clear();
+      batch_ret.stats.clear();
+      s = factory_->Get(server)->Bcreat(batch, &batch_ret);
+      if (s.ok()) {
+        std::set<size_t> done;
+        for (size_t j = 0; j < members.size(); j++) {
+          const size_t i = members[j];
+          ret->statuses[i] = batch_ret.statuses[j];
+          ret->stats[i] = batch_ret.stats[j];
+          done.insert(i);
+        }
+        std::vector<size_t> rest;
+        for (size_t k = 0; k < remaining.size(); k++) {
+          if (done.count(remaining[k]) == 0) {
+            rest.push_back(remaining[k]);
+          }
+        }
+        remaining.swap(rest);
+        remaining_redirects = max_redirects_allowed_;
+      }
+    } catch (Redirect& re) {
+      if (tmp_idx == NULL) {
+        tmp_idx = new DirIndex(&giga_);
+        tmp_idx->Update(*idx);
+      }
+      if (--remaining_redirects == 0 || !tmp_idx->Update(re)) {
+        s = Status::Corruption("bad giga+ index");
+      }
+      assert(tmp_idx != NULL);
+      latest_idx = tmp_idx;
+    }
+  }
+
+  if (tmp_idx != NULL) {
+    if (s.ok()) {
+      const DirId& pid = options.dir_id;
+      IndexHandle* h = index_cache_->Insert(pid, tmp_idx);
+      index_cache_->Release(h);
+    } else {
+      delete tmp_idx;
+    }
+  }
+
+  return s;
+}
+
+// Buffer an exclusive file create under the parent of a resolved path.
+// Batches that are full or have waited too long are taken out of the
+// buffer and sent, through the background pool if there is one.
+void MDS::CLI::BufferCreate(const PathInfo& path, mode_t mode) {
+  std::vector<PendingCreates*> ready;
+  {
+    char tmp[30];
+    std::string key = EncodeId(path.pid, tmp).ToString();
+    const uint64_t now = env_->NowMicros();
+    MutexLock ml(&wb_mu_);
+    PendingCreates*& c = pending_[key];
+    if (c == NULL) {
+      c = new PendingCreates;
+      c->pid = path.pid;
+      c->zserver = path.zserver;
+      c->since = now;
+    }
+    c->names.push_back(path.name.ToString());
+    c->modes.push_back(mode);
+    num_buffered_++;
+    std::map<std::string, PendingCreates*>::iterator it = pending_.begin();
+    while (it != pending_.end()) {
+      PendingCreates* const pc = it->second;
+      if (pc->names.size() >= write_back_batch_ ||
+          pc->since + write_back_interval_ <= now) {
+        pending_.erase(it++);
+        TakeCreates(pc, &ready);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  SendReadyCreates(ready);
+}
+
+// Count a batch just taken out of the buffer as being sent.
+void MDS::CLI::TakeCreates(PendingCreates* c,
+                           std::vector<PendingCreates*>* ready) {
+  wb_mu_.AssertHeld();
+  char tmp[30];
+  sending_[EncodeId(c->pid, tmp).ToString()]++;
+  ready->push_back(c);
+}
+
+void MDS::CLI::SendReadyCreates(const std::vector<PendingCreates*>& ready) {
+  for (size_t i = 0; i < ready.size(); i++) {
+    if (bg_pool_ != NULL) {
+      SendCreatesWork* w = new SendCreatesWork;
+      w->cli = this;
+      w->creates = ready[i];
+      bg_pool_->Schedule(SendCreatesBGWork, w);
+    } else {
+      SendCreates(ready[i]);
+    }
+  }
+}
+
+void MDS::CLI::SendCreatesBGWork(void* arg) {
+  SendCreatesWork* w = reinterpret_cast<SendCreatesWork*>(arg);
+  w->cli->SendCreates(w->creates);
+  delete w;
+}
+
+// Send a batch of buffered creates that has been taken out of the buffer
+// and counted in sending_. Errors are kept for the next Sync().
+void MDS::CLI::SendCreates(PendingCreates* c) {
+  Status s;
+  IndexHandle* idxh = NULL;
+  s = FetchIndex(c->pid, c->zserver, &idxh);
+  if (s.ok()) {
+    assert(idxh != NULL);
+    IndexGuard idxg(index_cache_, idxh);
+    std::vector<std::string> hashes(c->names.size());
+    BcreatOptions options;
+    options.op_due = DELTAFS_MAX_MICROS;
+    options.session_id = session_id_;
+    options.dir_id = c->pid;
+    options.flags = O_EXCL;
+    options.uid = uid_;
+    options.gid = gid_;
+    for (size_t i = 0; i < c->names.size(); i++) {
+      DirIndex::PutHash(&hashes[i], c->names[i]);
+      BcreatEntry entry;
+      entry.name_hash = hashes[i];
+      entry.name = c->names[i];
+      entry.mode = c->modes[i];
+      options.entries.push_back(entry);
+    }
+    BcreatRet ret;
+    s = _Bcreat(index_cache_->Value(idxh), options, &ret);
+    for (size_t i = 0; s.ok() && i < ret.statuses.size(); i++) {
+      s = ret.statuses[i];
+    }
+  }
+
+  char tmp[30];
+  std::string key = EncodeId(c->pid, tmp).ToString();
+  const size_t n = c->names.size();
+  delete c;
+  MutexLock ml(&wb_mu_);
+  if (!s.ok() && wb_status_.ok()) {
+    wb_status_ = s;
+  }
+  std::map<std::string, int>::iterator it = sending_.find(key);
+  assert(it != sending_.end() && it->second > 0);
+  if (--it->second == 0) {
+    sending_.erase(it);
+  }
+  num_buffered_ -= n;
+  wb_cv_.SignalAll();
+}
+
+void MDS::CLI::FlushCreates(const DirId& pid) {
+  if (write_back_batch_ == 0 || num_buffered_ == 0) {
+    return;
+  }
+  char tmp[30];
+  std::string key = EncodeId(pid, tmp).ToString();
+  MutexLock ml(&wb_mu_);
+  std::map<std::string, PendingCreates*>::iterator it = pending_.find(key);
+  if (it != pending_.end()) {
+    std::vector<PendingCreates*> ready;
+    TakeCreates(it->second, &ready);
+    pending_.erase(it);
+    wb_mu_.Unlock();
+    SendCreates(ready[0]);
+    wb_mu_.Lock();
+  }
+  // Batches of the same directory may still be on their way
+  while (sending_.count(key) != 0) {
+    wb_cv_.Wait();
+  }
+}
+
+void MDS::CLI::FlushBGWork(void* arg) {
+  reinterpret_cast<CLI*>(arg)->DoFlush();
+}
+
+void MDS::CLI::DoFlush() {
+  MutexLock ml(&wb_mu_);
+  while (!shutting_down_) {
+    wb_cv_.TimedWait(write_back_interval_);
+    std::vector<PendingCreates*> ready;
+    const uint64_t now = env_->NowMicros();
+    std::map<std::string, PendingCreates*>::iterator it = pending_.begin();
+    while (it != pending_.end()) {
+      PendingCreates* const c = it->second;
+      if (c->since + write_back_interval_ <= now) {
+        pending_.erase(it++);
+        TakeCreates(c, &ready);
+      } else {
+        ++it;
+      }
+    }
+    if (!ready.empty()) {
+      wb_mu_.Unlock();
+      SendReadyCreates(ready);
+      wb_mu_.Lock();
+    }
+  }
+  flusher_running_ = false;
+  wb_cv_.SignalAll();
+}
+
+Status MDS::CLI::Sync() {
+  MutexLock ml(&wb_mu_);
+  while (!pending_.empty()) {
+    std::vector<PendingCreates*> ready;
+    TakeCreates(pending_.begin()->second, &ready);
+    pending_.erase(pending_.begin());
+    wb_mu_.Unlock();
+    SendCreates(ready[0]);
+    wb_mu_.Lock();
+  }
+  while (!sending_.empty()) {
+    wb_cv_.Wait();
+  }
+  Status s = wb_status_;
+  wb_status_ = Status::OK();
+  return s;
+}
+
+struct MDS::CLI::AsyncOp {
+  enum Type { kFstat, kFcreat, kMkdir, kUnlink };
+  CLI* cli;
+  int type;
+  DirId pid;
+  std::string nhash;
+  std::string name;  // Empty unless needed by the op
+  int zserver;
+  uint64_t op_due;
+  mode_t mode;
+  IndexHandle* idxh;  // Index of the parent, held until the op finishes
+  DirIndex* tmp_idx;  // Updated copy of the index after a redirect
+  int remaining_redirects;
+  FstatRet fstat_ret;
+  FcreatRet fcreat_ret;
+  MkdirRet mkdir_ret;
+  UnlinkRet unlink_ret;
+  Fentry* ent;
+  Callback cb;
+  void* arg;
+};
+
+void MDS::CLI::StartAsyncOp(int type, const PathInfo& path, mode_t mode,
+                            Fentry* ent, Callback cb, void* arg) {
+  IndexHandle* idxh = NULL;
+  Status s = FetchIndex(path.pid, path.zserver, &idxh);
+  if (!s.ok()) {
+    cb(arg, s);
+    return;
+  }
+  assert(idxh != NULL);
+  AsyncOp* op = new AsyncOp;
+  op->cli = this;
+  op->type = type;
+  op->pid = path.pid;
+  op->nhash = path.nhash.ToString();
+  if (type == AsyncOp::kFcreat || type == AsyncOp::kMkdir ||
+      paranoid_checks_) {
+    op->name = path.name.ToString();
+  }
+  op->zserver = path.zserver;
+  op->op_due = atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
+  op->mode = mode;
+  op->idxh = idxh;
+  op->tmp_idx = NULL;
+  op->remaining_redirects = max_redirects_allowed_;
+  op->ent = ent;
+  op->cb = cb;
+  op->arg = arg;
+  SendAsyncOp(op);
+}
+
+// Send an async op to the server the latest index of its parent points to.
+// Options are encoded before the send returns so they can stay on stack.
+void MDS::CLI::SendAsyncOp(AsyncOp* op) {
+  CLI* const cli = op->cli;
+  const DirIndex* idx = op->tmp_idx;
+  if (idx == NULL) {
+    idx = cli->index_cache_->Value(op->idxh);
+  }
+  size_t server = idx->HashToServer(op->nhash);
+  assert(server < cli->giga_.num_servers);
+  MDS* const mds = cli->factory_->Get(server);
+  if (op->type == AsyncOp::kFstat) {
+    FstatOptions options;
+    options.op_due = op->op_due;
+    options.session_id = cli->session_id_;
+    options.dir_id = op->pid;
+    options.name_hash = op->nhash;
+    options.name = op->name;
+    mds->AsyncFstat(options, &op->fstat_ret, AsyncOpDone, op);
+  } else if (op->type == AsyncOp::kFcreat) {
+    FcreatOptions options;
+    options.op_due = op->op_due;
+    options.session_id = cli->session_id_;
+    options.dir_id = op->pid;
+    options.flags = O_EXCL;
+    options.mode = op->mode;
+    options.uid = cli->uid_;
+    options.gid = cli->gid_;
+    options.name_hash = op->nhash;
+    options.name = op->name;
+    mds->AsyncFcreat(options, &op->fcreat_ret, AsyncOpDone, op);
+  } else if (op->type == AsyncOp::kMkdir) {
+    MkdirOptions options;
+    options.op_due = op->op_due;
+    options.session_id = cli->session_id_;
+    options.dir_id = op->pid;
+    options.flags = O_EXCL;
+    options.mode = op->mode;
+    options.uid = cli->uid_;
+    options.gid = cli->gid_;
+    options.name_hash = op->nhash;
+    options.name = op->name;
+    mds->AsyncMkdir(options, &op->mkdir_ret, AsyncOpDone, op);
+  } else {
+    assert(op->type == AsyncOp::kUnlink);
+    UnlinkOptions options;
+    options.op_due = op->op_due;
+    options.session_id = cli->session_id_;
+    options.dir_id = op->pid;
+    options.flags = O_EXCL;
+    options.name_hash = op->nhash;
+    options.name = op->name;
+    mds->AsyncUnlink(options, &op->unlink_ret, AsyncOpDone, op);
+  }
+}
+
+// Follow a redirect by updating a private copy of the index and sending
+// the op again, the same way the synchronous ops do.
+void MDS::CLI::AsyncOpDone(void* arg, const Status& s, const Redirect* re) {
+  AsyncOp* op = reinterpret_cast<AsyncOp*>(arg);
+  if (re != NULL) {
+    if (op->tmp_idx == NULL) {
+      op->tmp_idx = new DirIndex(&op->cli->giga_);
+      op->tmp_idx->Update(*op->cli->index_cache_->Value(op->idxh));
+    }
+    if (--op->remaining_redirects == 0 || !op->tmp_idx->Update(*re)) {
+      FinishAsyncOp(op, Status::Corruption("bad giga+ index"));
+    } else {
+      SendAsyncOp(op);
+    }
+  } else {
+    FinishAsyncOp(op, s);
+  }
+}
+
+void MDS::CLI::FinishAsyncOp(AsyncOp* op, const Status& s) {
+  CLI* const cli = op->cli;
+  if (op->tmp_idx != NULL) {
+    if (s.ok()) {
+      IndexHandle* h = cli->index_cache_->Insert(op->pid, op->tmp_idx);
+      cli->index_cache_->Release(h);
+    } else {
+      delete op->tmp_idx;
+    }
+  }
+  cli->index_cache_->Release(op->idxh);
+  if (s.ok() && op->ent != NULL) {
+    Fentry* const ent = op->ent;
+    ent->pid = op->pid;
+    ent->nhash = op->nhash;
+    ent->zserver = op->zserver;
+    if (op->type == AsyncOp::kFstat) {
+      ent->stat = op->fstat_ret.stat;
+    } else if (op->type == AsyncOp::kFcreat) {
+      ent->stat = op->fcreat_ret.stat;
+    } else if (op->type == AsyncOp::kMkdir) {
+      ent->stat = op->mkdir_ret.stat;
+    } else {
+      ent->stat = op->unlink_ret.stat;
+    }
+  }
+  Callback cb = op->cb;
+  void* cb_arg = op->arg;
+  delete op;
+  cb(cb_arg, s);
+}
+
+void MDS::CLI::AsyncFstat(const Slice& p, Fentry* ent, Callback cb,
+                          void* arg) {
+  PathInfo path;
+  Status s = ResolvePath(p, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+    if (path.depth == 0 || DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Fstat(p, ent);  // Answered without contacting any server
+    } else {
+      StartAsyncOp(AsyncOp::kFstat, path, 0, ent, cb, arg);
+      return;
+    }
+  }
+  cb(arg, s);
+}
+
+void MDS::CLI::AsyncFcreat(const Slice& p, mode_t mode, Fentry* ent,
+                           Callback cb, void* arg) {
+  PathInfo path;
+  Status s = ResolvePath(p, &path);
+  if (s.ok()) {
+    if (path.depth == 0) {
+      s = Status::AlreadyExists(Slice());
+    } else if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("O_EXCL not supported under plfs dirs");
+    } else if (path.name.size() > DELTAFS_NAME_MAX) {
+      s = FileNameExceeedsLimit();
+    } else if (write_back_batch_ != 0 && ent == NULL) {
+      BufferCreate(path, mode);
+    } else {
+      FlushCreates(path.pid);
+      StartAsyncOp(AsyncOp::kFcreat, path, mode, ent, cb, arg);
+      return;
+    }
+  }
+  cb(arg, s);
+}
+
+void MDS::CLI::AsyncMkdir(const Slice& p, mode_t mode, Fentry* ent,
+                          Callback cb, void* arg) {
+  PathInfo path;
+  Status s = ResolvePath(p, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+    if (path.depth == 0) {
+      s = Status::AlreadyExists(Slice());
+    } else if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("mkdir under plfs dirs");
+    } else if (path.name.size() > DELTAFS_NAME_MAX) {
+      s = FileNameExceeedsLimit();
+    } else {
+      StartAsyncOp(AsyncOp::kMkdir, path, mode, ent, cb, arg);
+      return;
+    }
+  }
+  cb(arg, s);
+}
+
+void MDS::CLI::AsyncUnlink(const Slice& p, Fentry* ent, Callback cb,
+                           void* arg) {
+  PathInfo path;
+  Status s = ResolvePath(p, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+    if (path.depth == 0) {
+      s = Status::FileExpected(Slice());
+    } else if (!IsWriteDirOk(&path)) {
+      s = Status::AccessDenied(Slice());
+    } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
+      s = Status::NotSupported("unlink files under plfs dirs");
+    } else {
+      StartAsyncOp(AsyncOp::kUnlink, path, 0, ent, cb, arg);
+      return;
+    }
+  }
+  cb(arg, s);
+}
+
 Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.ok()) {
     if (path.depth == 0) {
       s = Status::NotSupported("updating root directory");
@@ -882,12 +1759,10 @@ Status MDS::CLI::Chmod(const Slice& p, mode_t mode, Fentry* ent) {
 Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
                         ChmodRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -910,7 +1785,6 @@ Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -927,8 +1801,10 @@ Status MDS::CLI::_Chmod(const DirIndex* idx, const ChmodOptions& options,
 Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
   Status s;
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(p, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.ok()) {
     if (path.depth == 0) {
       s = Status::NotSupported("updating root directory");
@@ -971,12 +1847,10 @@ Status MDS::CLI::Chown(const Slice& p, uid_t usr, gid_t grp, Fentry* ent) {
 Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
                         ChownRet* ret) {
   Status s;
-  mutex_.AssertHeld();
   DirIndex* tmp_idx = NULL;
   assert(idx != NULL);
   const DirIndex* latest_idx = idx;
   int remaining_redirects = max_redirects_allowed_;
-  mutex_.Unlock();
 
   do {
     try {
@@ -999,7 +1873,6 @@ Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
     }
   } while (s.IsTryAgain());
 
-  mutex_.Lock();
   if (tmp_idx != NULL) {
     if (s.ok()) {
       const DirId& pid = options.dir_id;
@@ -1028,11 +1901,8 @@ Status MDS::CLI::_Chown(const DirIndex* idx, const ChownOptions& options,
 Status MDS::CLI::Ftruncate(const Fentry& ent, uint64_t mtime, uint64_t size) {
   Status s;
   IndexHandle* idxh = NULL;
-  MutexLock ml(&mutex_);
   s = FetchIndex(ent.pid, ent.zserver, &idxh);
   if (s.ok()) {
-    mutex_.Unlock();
-
     assert(idxh != NULL);
     const DirIndex* idx = index_cache_->Value(idxh);
     assert(idx != NULL);
@@ -1074,7 +1944,6 @@ Status MDS::CLI::Ftruncate(const Fentry& ent, uint64_t mtime, uint64_t size) {
       }
     }
 
-    mutex_.Lock();
     index_cache_->Release(idxh);
     if (tmp_idx != NULL) {
       if (s.ok()) {
@@ -1088,37 +1957,123 @@ Status MDS::CLI::Ftruncate(const Fentry& ent, uint64_t mtime, uint64_t size) {
   return s;
 }
 
-Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
+// A page of entries fetched from a single server
+struct MDS::CLI::ListdirPage {
+  std::vector<std::string> names;
+  std::vector<Stat> stats;  // Only used when stats are requested
+};
+
+struct MDS::CLI::ListdirState {
+  ListdirState() : cv(&mu), max_pages(0), num_running(0), stopped(false) {}
+  ListdirOptions options;  // Copied by each server before paging
+  port::Mutex mu;
+  port::CondVar cv;
+  std::deque<ListdirPage*> pages;  // Fetched but not yet passed on
+  size_t max_pages;  // Max pages fetched ahead of the calling thread
+  std::vector<ListdirWork*> parked;  // Servers waiting for queue space
+  int num_running;  // Number of servers still being listed
+  bool stopped;     // Set when the callback asks to stop or on errors
+  Status status;
+};
+
+// Fetch the page of entries starting at *cursor from a server and set
+// *cursor to the start of the next page, or clear it at the end.
+static Status ListPage(MDS* mds, MDS::ListdirOptions* options,
+                       std::string* cursor, std::vector<std::string>* names,
+                       std::vector<Stat>* stats) {
+  MDS::ListdirRet ret;
+  ret.names = names;
+  ret.stats = stats;
+  options->start_hash = *cursor;
+  Status s = mds->Listdir(*options, &ret);
+  if (s.ok() && options->with_stats && stats->size() != names->size()) {
+    s = Status::Corruption("listdir stats mismatch");
+  }
+  cursor->swap(ret.next_hash);
+  return s;
+}
+
+// Pass a page of entries to the user callback. Return false if the
+// callback asks to stop.
+static bool DeliverPage(const std::vector<std::string>& names,
+                        const std::vector<Stat>& stats, bool with_stats,
+                        MDS::CLI::ListdirCallback callback, void* arg) {
+  for (size_t i = 0; i < names.size(); i++) {
+    if (callback(names[i], with_stats ? &stats[i] : NULL, arg) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Page through the entries of a directory kept by one server and queue
+// them for the calling thread. Pages are fetched outside the shared lock
+// so servers can be listed in parallel. Once max_pages are queued, a
+// server is parked and its work returns to the pool. It is scheduled
+// again when the calling thread has made room. Pool threads therefore
+// never wait on the calling thread. User callbacks are only made by the
+// calling thread, so they may issue other ops through the same client,
+// including nested listings.
+void MDS::CLI::ListdirBGWork(void* arg) {
+  ListdirWork* const w = reinterpret_cast<ListdirWork*>(arg);
+  ListdirState* const state = w->state;
+  ListdirOptions options = state->options;
+  MutexLock ml(&state->mu);
+  while (!state->stopped) {
+    if (state->pages.size() >= state->max_pages) {
+      state->parked.push_back(w);
+      return;
+    }
+    state->mu.Unlock();
+    ListdirPage* page = new ListdirPage;
+    Status s = ListPage(w->mds, &options, &w->cursor, &page->names,
+                        &page->stats);
+    state->mu.Lock();
+    if (!s.ok()) {
+      if (state->status.ok()) {
+        state->status = s;
+      }
+      state->stopped = true;
+      delete page;
+    } else {
+      state->pages.push_back(page);
+    }
+    state->cv.SignalAll();
+    if (w->cursor.empty()) {
+      break;
+    }
+  }
+  assert(state->num_running > 0);
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+Status MDS::CLI::Listdir(const Slice& p, ListdirCallback callback, void* arg,
+                         bool with_stats) {
   Status s;
   assert(p.size() != 0);
   assert(p.size() == 1 || !p.ends_with("/"));
   std::string fake_path = p.ToString();
   fake_path += "/_";
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(fake_path, &path);
+  if (s.ok()) {
+    FlushCreates(path.pid);
+  }
   if (s.ok()) {
     if (!IsReadDirOk(&path)) {
       s = Status::AccessDenied(Slice());
     } else if (DELTAFS_DIR_IS_PLFS_STYLE(path.mode)) {
       s = Status::NotSupported("listdir under plfs dirs");
     } else {
+      // The cached index may miss partitions split off since it was read
       IndexHandle* idxh = NULL;
-      s = FetchIndex(path.pid, path.zserver, &idxh);
+      s = FetchIndex(path.pid, path.zserver, &idxh, true);
       if (s.ok()) {
-        mutex_.Unlock();
-
         assert(idxh != NULL);
         const DirIndex* idx = index_cache_->Value(idxh);
         assert(idx != NULL);
-        ListdirOptions options;
-        options.op_due =
-            atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
-        options.session_id = session_id_;
-        options.dir_id = path.pid;
-        ListdirRet ret;
-        ret.names = names;
-
+        std::vector<size_t> servers;
         std::set<size_t> visited;
         int num_parts = 1 << idx->Radix();
         for (int i = 0; i < num_parts; i++) {
@@ -1126,7 +2081,7 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
             size_t server = idx->GetServerForIndex(i);
             assert(server < giga_.num_servers);
             if (visited.count(server) == 0) {
-              factory_->Get(server)->Listdir(options, &ret);
+              servers.push_back(server);
               visited.insert(server);
               if (visited.size() >= giga_.num_servers) {
                 break;
@@ -1134,9 +2089,72 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
             }
           }
         }
-
-        mutex_.Lock();
         index_cache_->Release(idxh);
+
+        ListdirOptions options;
+        options.op_due =
+            atomic_path_resolution_ ? path.lease_due : DELTAFS_MAX_MICROS;
+        options.session_id = session_id_;
+        options.dir_id = path.pid;
+        options.max_entries = 0;  // Use server default
+        options.with_stats = with_stats;
+        if (listdir_pool_ == NULL || servers.size() < 2) {
+          std::vector<std::string> names;
+          std::vector<Stat> stats;
+          bool more = true;
+          for (size_t i = 0; more && i < servers.size(); i++) {
+            MDS* const mds = factory_->Get(servers[i]);
+            std::string cursor;
+            do {
+              names.clear();
+              stats.clear();
+              s = ListPage(mds, &options, &cursor, &names, &stats);
+              more = s.ok() &&
+                     DeliverPage(names, stats, with_stats, callback, arg);
+            } while (more && !cursor.empty());
+          }
+        } else {
+          ListdirState state;
+          state.options = options;
+          state.max_pages = 2 * servers.size();
+          state.num_running = static_cast<int>(servers.size());
+          std::vector<ListdirWork> works(servers.size());
+          for (size_t i = 0; i < servers.size(); i++) {
+            works[i].state = &state;
+            works[i].mds = factory_->Get(servers[i]);
+            listdir_pool_->Schedule(ListdirBGWork, &works[i]);
+          }
+          // Pages are passed to the callback without holding the lock.
+          // Pages queued after a stop are discarded.
+          MutexLock ml(&state.mu);
+          while (!state.pages.empty() || state.num_running > 0) {
+            if (state.stopped && !state.parked.empty()) {
+              state.num_running -= static_cast<int>(state.parked.size());
+              state.parked.clear();
+              continue;
+            } else if (state.pages.empty()) {
+              state.cv.Wait();
+              continue;
+            }
+            ListdirPage* const page = state.pages.front();
+            state.pages.pop_front();
+            if (!state.parked.empty()) {  // Room for another page
+              listdir_pool_->Schedule(ListdirBGWork, state.parked.back());
+              state.parked.pop_back();
+            }
+            if (!state.stopped) {
+              state.mu.Unlock();
+              const bool more = DeliverPage(page->names, page->stats,
+                                            with_stats, callback, arg);
+              state.mu.Lock();
+              if (!more) {
+                state.stopped = true;
+              }
+            }
+            delete page;
+          }
+          s = state.status;
+        }
       }
     }
   }
@@ -1144,6 +2162,20 @@ Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
   return s;
 }
 
+namespace {
+struct NameSaver {
+  static int Save(const Slice& name, const Stat* stat, void* arg) {
+    reinterpret_cast<std::vector<std::string>*>(arg)->push_back(
+        name.ToString());
+    return 0;
+  }
+};
+}  // namespace
+
+Status MDS::CLI::Listdir(const Slice& p, std::vector<std::string>* names) {
+  return Listdir(p, NameSaver::Save, names);
+}
+
 Status MDS::CLI::Accessdir(const Slice& p, int mode) {
   Status s;
   assert(p.size() != 0);
@@ -1151,7 +2183,6 @@ Status MDS::CLI::Accessdir(const Slice& p, int mode) {
   std::string fake_path = p.ToString();
   fake_path += "/_";
   PathInfo path;
-  MutexLock ml(&mutex_);
   s = ResolvePath(fake_path, &path);
   if (s.ok()) {
     if ((mode & R_OK) == R_OK && !IsReadDirOk(&path)) {
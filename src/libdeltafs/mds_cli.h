@@ -16,6 +16,9 @@
 #include "pdlfs-common/lookup_cache.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
+#include <map>
+
 namespace pdlfs {
 
 class MDSFactory {
@@ -35,6 +38,29 @@ struct MDSCliOptions {
   bool paranoid_checks;
   bool atomic_path_resolution;
   int max_redirects_allowed;
+  // Cached lookup leases due within this many microseconds are renewed
+  // in batches, one call per server, after each pathname resolution.
+  // Leases are never renewed if zero.
+  uint64_t lease_renewal_window;
+  // Used to fetch the entries of a directory from all its servers in
+  // parallel. Entries are still passed to listing callbacks by the
+  // calling thread. Servers are contacted one after another if NULL.
+  ThreadPool* listdir_pool;
+  // Used to refresh expired path components in parallel before resolving
+  // a path, and to send buffered creates in the background. Kept apart
+  // from listdir_pool so neither kind of work waits behind the other.
+  // Both are done by the calling thread if NULL.
+  ThreadPool* bg_pool;
+  // If non-zero, exclusive file creates that do not ask for their results
+  // are buffered per parent directory and answered locally. Buffered
+  // creates of a directory are sent with Bcreat once this many are pending,
+  // or once the oldest has been buffered for write_back_interval
+  // microseconds, as checked whenever a create is buffered and by a
+  // background thread waking up once every interval. They are also sent
+  // before any other operation under that directory and by Sync(). Batches
+  // taken out of the buffer are sent through bg_pool when it is not NULL.
+  size_t write_back_batch;
+  uint64_t write_back_interval;
   int num_virtual_servers;
   int num_servers;
   int session_id;
@@ -56,13 +82,50 @@ class MDS::CLI {
   Status Ftruncate(const Fentry&, uint64_t mtime, uint64_t size);
   Status Mkdir(const Slice& path, mode_t mode, Fentry* result = NULL,
                bool create_if_missing = false, bool error_if_exists = true);
+  // Create a batch of files, or directories if mode carries S_IFDIR, under
+  // an existing parent directory. Return OK if the parent directory could be
+  // accessed, in which case a separate status is stored for each name.
+  Status Bcreat(const Slice& path, const std::vector<std::string>& names,
+                mode_t mode, std::vector<Status>* statuses,
+                bool error_if_exists = true);
   Status Chmod(const Slice& path, mode_t mode, Fentry* result = NULL);
   Status Chown(const Slice& path, uid_t usr, gid_t grp, Fentry* result = NULL);
   Status Unlink(const Slice& path, Fentry* result = NULL,
                 bool error_if_absent = true, const Fentry* at = NULL);
+  // Invoked once for each entry found by Listdir(). "stat" is NULL unless
+  // stats are requested. Return non-zero to stop the listing.
+  typedef int (*ListdirCallback)(const Slice& name, const Stat* stat,
+                                 void* arg);
+  // List a directory page by page, contacting all servers holding its
+  // partitions in parallel. Callbacks are made by the calling thread, but
+  // entries from different servers may interleave.
+  Status Listdir(const Slice& path, ListdirCallback callback, void* arg,
+                 bool with_stats = false);
   Status Listdir(const Slice& path, std::vector<std::string>* names);
   Status Accessdir(const Slice& path, int mode);
   Status Access(const Slice& path, int mode);
+  // Send all buffered creates and wait for them to finish. Return the first
+  // error hit by a buffered create since the last call, such as a name that
+  // already exists.
+  Status Sync();
+
+  // Callback of an asynchronous op. Invoked exactly once with the status
+  // the same synchronous op would have returned. May be invoked by the
+  // calling thread before the op returns, or by an RPC thread, in which
+  // case it must not block.
+  typedef void (*Callback)(void* arg, const Status&);
+  // Asynchronous versions of Fstat, Fcreat, Mkdir, and Unlink, with
+  // error_if_exists and error_if_absent set. Paths are resolved by the
+  // calling thread, which blocks only when a path component or a directory
+  // index is not cached, after which the op is sent to its server without
+  // waiting for the reply. Redirects are followed without blocking.
+  // If result is not NULL, it must stay valid until the callback is invoked.
+  void AsyncFstat(const Slice& path, Fentry* result, Callback, void* arg);
+  void AsyncFcreat(const Slice& path, mode_t mode, Fentry* result, Callback,
+                   void* arg);
+  void AsyncMkdir(const Slice& path, mode_t mode, Fentry* result, Callback,
+                  void* arg);
+  void AsyncUnlink(const Slice& path, Fentry* result, Callback, void* arg);
 
   uid_t uid() const { return uid_; }
   gid_t gid() const { return gid_; }
@@ -80,11 +143,12 @@ class MDS::CLI {
 #define HELPER(OP) \
   Status _##OP(const DirIndex*, const OP##Options& opts, OP##Ret* ret)
 
-  // REQUIRES: mutex_ has been locked.
   HELPER(Lookup);
+  HELPER(Resolve);
   HELPER(Fstat);
   HELPER(Fcreat);
   HELPER(Mkdir);
+  HELPER(Bcreat);
   HELPER(Chmod);
   HELPER(Chown);
   HELPER(Unlink);
@@ -117,12 +181,82 @@ class MDS::CLI {
   bool IsLookupOk(const PathInfo*);
 
   typedef LookupCache::Handle LookupHandle;
+  // On a cache miss, the directories named by rest, the remaining part of
+  // the path being resolved, are looked up in the same call whenever the
+  // server holds them.
   Status Lookup(const DirId&, const Slice& name, int zserver, uint64_t op_due,
-                LookupHandle**);
+                LookupHandle**, const Slice& rest = Slice());
+  // Look up in parallel the path components whose cached leases have
+  // expired, using the directory ids still cached for their parents.
+  void RefreshPath(const DirId& pid, int zserver, const Slice& path);
+  struct RefreshState;
+  struct RefreshWork {
+    RefreshState* state;
+    MDS* mds;
+    LookupOptions options;
+    std::string nhash;
+    LookupRet ret;
+    Status status;
+  };
+  static void RefreshBGWork(void*);
+  // Cached lookup leases that are about to expire
+  struct PendingRenewal {
+    DirId pid;
+    std::string nhash;
+    uint64_t lease_due;
+  };
+  void RenewLeases(const std::vector<PendingRenewal>& leases);
   typedef IndexCache::Handle IndexHandle;
-  Status FetchIndex(const DirId&, int zserver, IndexHandle**);
+  // If "refresh" is true, re-read the index from the zeroth server even if
+  // it is cached and merge the two.
+  Status FetchIndex(const DirId&, int zserver, IndexHandle**,
+                    bool refresh = false);
   typedef RefGuard<IndexCache, IndexHandle> IndexGuard;
 
+  // Creates buffered for a single parent directory
+  struct PendingCreates {
+    DirId pid;
+    int zserver;
+    uint64_t since;  // Time the first create was buffered
+    std::vector<std::string> names;
+    std::vector<uint32_t> modes;
+  };
+  void BufferCreate(const PathInfo&, mode_t mode);
+  // REQUIRES: wb_mu_ has been locked.
+  void TakeCreates(PendingCreates*, std::vector<PendingCreates*>* ready);
+  void SendCreates(PendingCreates*);
+  void SendReadyCreates(const std::vector<PendingCreates*>& ready);
+  struct SendCreatesWork {
+    CLI* cli;
+    PendingCreates* creates;
+  };
+  static void SendCreatesBGWork(void*);
+  // Send the creates buffered under a directory, if any, and wait for all
+  // creates of that directory being sent to finish.
+  void FlushCreates(const DirId&);
+  // Send batches that have been buffered for write_back_interval once every
+  // interval until the client is closed.
+  static void FlushBGWork(void*);
+  void DoFlush();
+
+  // An async op whose path has been resolved
+  struct AsyncOp;
+  void StartAsyncOp(int type, const PathInfo&, mode_t mode, Fentry* result,
+                    Callback, void* arg);
+  static void SendAsyncOp(AsyncOp*);
+  static void AsyncOpDone(void* arg, const Status&, const Redirect*);
+  static void FinishAsyncOp(AsyncOp*, const Status&);
+
+  // State shared by the servers of a single directory listing
+  struct ListdirPage;
+  struct ListdirState;
+  struct ListdirWork {
+    ListdirState* state;
+    MDS* mds;
+    std::string cursor;  // Start of the next page to fetch
+  };
+  static void ListdirBGWork(void*);
+
   // Constant after construction
   Env* env_;
   MDSFactory* factory_;
@@ -131,16 +265,33 @@ class MDS::CLI {
   bool paranoid_checks_;
   bool atomic_path_resolution_;
   int max_redirects_allowed_;
+  uint64_t lease_renewal_window_;
+  ThreadPool* listdir_pool_;
+  ThreadPool* bg_pool_;
+  size_t write_back_batch_;
+  uint64_t write_back_interval_;
   int session_id_;
   int cli_id_;
   int uid_;
   int gid_;
 
   friend class MDS;
-  // State below is protected by mutex_
-  port::Mutex mutex_;
+  // Both caches are internally synchronized, so no client-wide lock is held
+  // while resolving paths or sending calls.
   LookupCache* lookup_cache_;
   IndexCache* index_cache_;
+  // Creates buffered or being sent. Lets operations skip wb_mu_ when
+  // nothing has been buffered.
+  std::atomic<size_t> num_buffered_;
+  // State below is protected by wb_mu_
+  port::Mutex wb_mu_;
+  port::CondVar wb_cv_;
+  std::map<std::string, PendingCreates*> pending_;  // Keyed by parent dir
+  // Number of batches being sent, keyed by parent dir
+  std::map<std::string, int> sending_;
+  Status wb_status_;  // First error hit by a buffered create
+  bool flusher_running_;
+  bool shutting_down_;
   // No copying allowed
   void operator=(const CLI&);
   CLI(const CLI&);
@@ -33,8 +33,12 @@ Status MDSFactoryImpl::Init(const MDSTopology& topo) {
       full_uri.append(*it);
       uri = &full_uri;
     }
-    AddTarget(*uri, topo.mds_tracing);
+    AddTarget(*uri, topo.mds_tracing, topo.max_coalesced_ops);
   }
+  num_srvs_ = topo.num_srvs;
+  replica_ = topo.replica;
+  assert(replica_ < topo.num_replicas);
+  assert(stubs_.size() == num_srvs_ * topo.num_replicas);
   return s;
 }
 
@@ -50,11 +54,12 @@ Status MDSFactoryImpl::Stop() {
   return rpc_->Stop();
 }
 
-void MDSFactoryImpl::AddTarget(const std::string& target_uri, bool trace) {
+void MDSFactoryImpl::AddTarget(const std::string& target_uri, bool trace,
+                               int max_coalesced_ops) {
   StubInfo info;
   assert(rpc_ != NULL);
   info.stub = rpc_->OpenClientFor(target_uri);
-  info.wrapper = new MDSWrapper(info.stub);
+  info.wrapper = new MDSWrapper(info.stub, max_coalesced_ops);
   if (trace) {
     info.mds = new MDSTracer(target_uri, info.wrapper);
   } else {
@@ -64,8 +69,8 @@ void MDSFactoryImpl::AddTarget(const std::string& target_uri, bool trace) {
 }
 
 MDS* MDSFactoryImpl::Get(size_t srv_id) {
-  assert(srv_id < stubs_.size());
-  return stubs_[srv_id].mds;
+  assert(srv_id < num_srvs_);
+  return stubs_[replica_ * num_srvs_ + srv_id].mds;
 }
 
 MDSFactoryImpl::~MDSFactoryImpl() {
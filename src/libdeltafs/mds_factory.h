@@ -14,11 +14,16 @@
 namespace pdlfs {
 
 struct MDSTopology {
+  MDSTopology() : num_replicas(1), replica(0), max_coalesced_ops(0) {}
   bool mds_tracing;
   std::string rpc_proto;
+  // Ordered by replica: num_srvs addrs for each replica
   std::vector<std::string> srv_addrs;
   int num_vir_srvs;
   int num_srvs;
+  int num_replicas;       // Number of servers serving a same part of namespace
+  int replica;            // The replica we talk to
+  int max_coalesced_ops;  // Small ops are sent one by one if 0
 };
 
 class MDSFactoryImpl : public MDSFactory {
@@ -31,7 +36,9 @@ class MDSFactoryImpl : public MDSFactory {
 
  public:
   virtual MDS* Get(size_t srv_id);
-  explicit MDSFactoryImpl(Env* env = NULL) : env_(env), rpc_(NULL) {}
+  size_t num_srvs() const { return num_srvs_; }
+  explicit MDSFactoryImpl(Env* env = NULL)
+      : env_(env), num_srvs_(0), replica_(0), rpc_(NULL) {}
   virtual ~MDSFactoryImpl();
   Status Init(const MDSTopology&);
   Status Start();
@@ -43,8 +50,10 @@ class MDSFactoryImpl : public MDSFactory {
   MDSFactoryImpl(const MDSFactoryImpl&);
 
   Env* env_;  // okay to be NULL
-  void AddTarget(const std::string& uri, bool trace);
+  void AddTarget(const std::string& uri, bool trace, int max_coalesced_ops);
   std::vector<StubInfo> stubs_;
+  size_t num_srvs_;
+  int replica_;
   RPC* rpc_;
 };
 
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "mds_readonly.h"
+
+#include <sys/stat.h>
+
+namespace pdlfs {
+
+MDS::ReadonlySRV::ReadonlySRV(const MDSOptions& options)
+    : mds_env_(options.mds_env),
+      mdb_(options.mdb),
+      paranoid_checks_(options.paranoid_checks),
+      srv_id_(options.srv_id),
+      split_threshold_(options.split_threshold),
+      idx_cache_(NewLRUCache(options.dir_table_size)),
+      op_stats_(new MDSOpStats),
+      session_(options.srv_id) {
+  giga_.num_servers = options.num_servers;
+  giga_.num_virtual_servers = options.num_virtual_servers;
+  giga_.paranoid_checks = options.paranoid_checks;
+  assert(srv_id_ >= 0);
+}
+
+MDS::ReadonlySRV::~ReadonlySRV() {
+  delete idx_cache_;
+  delete op_stats_;
+}
+
+static void DeleteIndex(const Slice& key, void* value) {
+  delete reinterpret_cast<DirIndex*>(value);
+}
+
+// Obtain the index of a directory. Indices missing from the DB belong to
+// directories that were never accessed when the namespace was written,
+// and are initialized the same way a writable server would do.
+// Return OK on success, in which case the caller should release the
+// returned handle when it is no longer needed.
+// Thread-safe. Two threads may load a same index at the same time, in
+// which case the last one loaded is kept.
+Status MDS::ReadonlySRV::FetchIndex(const DirId& id, Cache::Handle** handle) {
+  char tmp[30];
+  Slice key = EncodeId(id, tmp);
+  Status s;
+  *handle = idx_cache_->Lookup(key);
+  if (*handle == NULL) {
+    DirIndex* index = new DirIndex(&giga_);
+    s = mdb_->GetIdx(id, index, NULL);
+    if (s.IsNotFound()) {
+      int zserver = 0;  // Clients always look for the root at server 0
+      if (id.ino != 0) {
+        zserver = PickupServer(id) % giga_.num_virtual_servers;
+      }
+      DirIndex tmp_index(zserver, &giga_);
+      if (split_threshold_ == 0) {
+        tmp_index.SetAll();  // Pre-split to all servers
+      }
+      index->Swap(tmp_index);
+      s = Status::OK();
+    }
+    if (s.ok()) {
+      *handle = idx_cache_->Insert(key, index, 1, DeleteIndex);
+    } else {
+      delete index;
+    }
+  }
+
+  return s;
+}
+
+// Read a name from the DB after making sure it belongs to us.
+// Throws a redirect if not.
+Status MDS::ReadonlySRV::GetNode(const DirId& id, const Slice& name_hash,
+                                 MDSOpTimer* timer, Stat* stat) {
+  Cache::Handle* h;
+  Status s = FetchIndex(id, &h);
+  if (s.ok()) {
+    const DirIndex* const index = IndexOf(h);
+    if (index->HashToServer(name_hash) != srv_id_) {
+      Slice encoding = index->Encode();
+      Redirect re(encoding.data(), encoding.size());
+      idx_cache_->Release(h);
+      throw re;
+    }
+    idx_cache_->Release(h);
+    Slice name;
+    const uint64_t read_start = timer->Now();
+    s = mdb_->GetNode(id, name_hash, stat, &name, NULL);
+    timer->Charge(MDSOpStats::kDbRead, read_start);
+    if (s.ok() && paranoid_checks_) {
+      std::string tmp;
+      DirIndex::PutHash(&tmp, name);
+      if (name_hash.compare(tmp) != 0) {
+        s = Status::Corruption("name and hash don't match");
+      }
+    }
+  }
+
+  return s;
+}
+
+Status MDS::ReadonlySRV::Fstat(const FstatOptions& options, FstatRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kFstat);
+  Status s;
+  if (options.name_hash.empty()) {
+    s = Status::InvalidArgument("empty name hash");
+  } else {
+    s = GetNode(options.dir_id, options.name_hash, &timer, &ret->stat);
+  }
+
+  if (s.ok()) {
+    ret->stat.AssertAllSet();
+  }
+  return s;
+}
+
+// Lookup results never become stale so they come with leases that
+// never expire.
+Status MDS::ReadonlySRV::Lookup(const LookupOptions& options, LookupRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kLookup);
+  Status s;
+  Stat stat;
+  if (options.name_hash.empty()) {
+    s = Status::InvalidArgument(Slice());
+  } else {
+    s = GetNode(options.dir_id, options.name_hash, &timer, &stat);
+  }
+
+  if (s.ok()) {
+    if (!S_ISDIR(stat.FileMode())) {
+      s = Status::DirExpected(Slice());
+    }
+  }
+
+  if (s.ok()) {
+    ret->stat.CopyFrom(stat);
+    ret->stat.SetLeaseDue(DELTAFS_MAX_MICROS);
+    ret->stat.AssertAllSet();
+  }
+  return s;
+}
+
+// All leases we issue never expire.
+Status MDS::ReadonlySRV::Renew(const RenewOptions& options, RenewRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kRenew);
+  ret->lease_dues.assign(options.leases.size(), DELTAFS_MAX_MICROS);
+  return Status::OK();
+}
+
+// Look up a run of path components the same way a writable server does.
+Status MDS::ReadonlySRV::Resolve(const ResolveOptions& options,
+                                 ResolveRet* ret) {
+  Status s;
+  ret->stats.clear();
+  LookupOptions lookup_options;
+  *static_cast<BaseOptions*>(&lookup_options) =
+      static_cast<const BaseOptions&>(options);
+  for (size_t i = 0; i < options.names.size(); i++) {
+    char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+    lookup_options.name_hash = DirIndex::Hash(options.names[i], tmp);
+    lookup_options.name = options.names[i];
+    LookupRet lookup_ret;
+    if (i == 0) {
+      s = Lookup(lookup_options, &lookup_ret);  // May redirect
+      if (!s.ok()) {
+        break;
+      }
+    } else {
+      try {
+        if (!Lookup(lookup_options, &lookup_ret).ok()) {
+          break;
+        }
+      } catch (Redirect& re) {
+        break;
+      }
+    }
+    ret->stats.push_back(lookup_ret.stat);
+    lookup_options.dir_id = DirId(lookup_ret.stat);
+  }
+
+  return s;
+}
+
+Status MDS::ReadonlySRV::Listdir(const ListdirOptions& options,
+                                 ListdirRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kListdir);
+  static const uint32_t kMaxEntries = 1000;
+  uint32_t limit = options.max_entries;
+  if (limit == 0 || limit > kMaxEntries) {
+    limit = kMaxEntries;
+  }
+  const uint64_t read_start = timer.Now();
+  mdb_->List(options.dir_id, options.start_hash,
+             options.with_stats ? ret->stats : NULL, ret->names,
+             &ret->next_hash, NULL, limit);
+  timer.Charge(MDSOpStats::kDbRead, read_start);
+  return Status::OK();
+}
+
+Status MDS::ReadonlySRV::Readidx(const ReadidxOptions& options,
+                                 ReadidxRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kReadidx);
+  Cache::Handle* h;
+  Status s = FetchIndex(options.dir_id, &h);
+  if (s.ok()) {
+    Slice encoding = IndexOf(h)->Encode();
+    ret->idx.assign(encoding.data(), encoding.size());
+    idx_cache_->Release(h);
+  }
+
+  return s;
+}
+
+Status MDS::ReadonlySRV::Opensession(const OpensessionOptions&,
+                                     OpensessionRet* ret) {
+  ret->env_name = mds_env_->env_name;
+  ret->env_conf = mds_env_->env_conf;
+  ret->fio_name = mds_env_->fio_name;
+  ret->fio_conf = mds_env_->fio_conf;
+  ret->session_id =
+      session_.fetch_add(giga_.num_servers) + giga_.num_servers;
+  return Status::OK();
+}
+
+Status MDS::ReadonlySRV::Getinput(const GetinputOptions&, GetinputRet* ret) {
+  ret->info = mds_env_->input_conf;
+  return Status::OK();
+}
+
+Status MDS::ReadonlySRV::Getoutput(const GetoutputOptions&,
+                                   GetoutputRet* ret) {
+  ret->info = mds_env_->output_conf;
+  return Status::OK();
+}
+
+Status MDS::ReadonlySRV::Getstats(const GetstatsOptions&, GetstatsRet* ret) {
+  ret->info.clear();
+  op_stats_->AppendReport(&ret->info);
+  return Status::OK();
+}
+
+#define READONLY_OP(OP)                                       \
+  Status MDS::ReadonlySRV::OP(const OP##Options&, OP##Ret*) { \
+    return Status::ReadOnly(Slice());                         \
+  }
+
+READONLY_OP(Fcreat)
+READONLY_OP(Mkdir)
+READONLY_OP(Bcreat)
+READONLY_OP(Chmod)
+READONLY_OP(Chown)
+READONLY_OP(Uperm)
+READONLY_OP(Utime)
+READONLY_OP(Trunc)
+READONLY_OP(Unlink)
+READONLY_OP(Addpart)
+
+#undef READONLY_OP
+
+}  // namespace pdlfs
@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "mds_api.h"
+#include "mds_stats.h"
+
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/gigaplus.h"
+
+#include <atomic>
+
+namespace pdlfs {
+
+// Metadata server on top of a finished namespace opened through a
+// ReadonlyDB. Since nothing ever changes, no directory states, leases,
+// or transactions are kept. Reads go straight to the DB without taking
+// any server lock, and each lookup comes with a lease that never
+// expires. Directory indices are cached in an LRU-cache and are never
+// invalidated. Multiple servers may be opened on a same DB image to
+// spread read load. All mutations fail with a read-only error.
+class MDS::ReadonlySRV : public MDS {
+ public:
+  ReadonlySRV(const MDSOptions&);
+  virtual ~ReadonlySRV();
+
+#define DEC_OP(OP) virtual Status OP(const OP##Options&, OP##Ret*);
+
+  DEC_OP(Fstat)
+  DEC_OP(Fcreat)
+  DEC_OP(Mkdir)
+  DEC_OP(Bcreat)
+  DEC_OP(Chmod)
+  DEC_OP(Chown)
+  DEC_OP(Uperm)
+  DEC_OP(Utime)
+  DEC_OP(Trunc)
+  DEC_OP(Unlink)
+  DEC_OP(Lookup)
+  DEC_OP(Renew)
+  DEC_OP(Resolve)
+  DEC_OP(Listdir)
+  DEC_OP(Readidx)
+  DEC_OP(Opensession)
+  DEC_OP(Getinput)
+  DEC_OP(Getoutput)
+  DEC_OP(Getstats)
+  DEC_OP(Addpart)
+
+#undef DEC_OP
+
+ private:
+  Status FetchIndex(const DirId& id, Cache::Handle** handle);
+  const DirIndex* IndexOf(Cache::Handle* handle) {
+    return reinterpret_cast<DirIndex*>(idx_cache_->Value(handle));
+  }
+  Status GetNode(const DirId& id, const Slice& name_hash, MDSOpTimer* timer,
+                 Stat* stat);
+
+  // Constant after construction
+  MDSEnv* mds_env_;
+  MDB* mdb_;
+  typedef DirIndexOptions GIGA;
+  GIGA giga_;
+  bool paranoid_checks_;
+  int srv_id_;
+  uint64_t split_threshold_;  // Zero if directories are pre-split
+
+  Cache* idx_cache_;
+  MDSOpStats* op_stats_;  // Latency of the ops served so far
+  std::atomic<uint32_t> session_;  // The last session id we allocated
+
+  // No copying allowed
+  void operator=(const ReadonlySRV&);
+  ReadonlySRV(const ReadonlySRV&);
+};
+
+}  // namespace pdlfs
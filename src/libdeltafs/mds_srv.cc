@@ -12,14 +12,18 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include "pdlfs-common/dirlock.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/mutexlock.h"
 
+#include "mds_cli.h"
 #include "mds_srv.h"
 
 namespace pdlfs {
 
-// NOTE: can be called while mutex_ is NOT locked.
+// NOTE: can be called while no shard mutex is locked.
 Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
   Status s;
   MDB::Tx* mdb_tx = NULL;
@@ -37,9 +41,14 @@ Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
   if (s.ok()) {
     s = mdb_->GetIdx(id, index, mdb_tx);
     if (s.IsNotFound()) {
-      int zserver = PickupServer(id) % giga_.num_virtual_servers;
+      int zserver = 0;  // Clients always look for the root at server 0
+      if (id.ino != 0) {
+        zserver = PickupServer(id) % giga_.num_virtual_servers;
+      }
       DirIndex tmp(zserver, &giga_);
-      tmp.SetAll();  // Pre-split to all servers
+      if (split_threshold_ == 0) {
+        tmp.SetAll();  // Pre-split to all servers
+      }
       if (mdb_tx == NULL) {
         mdb_tx = mdb_->CreateTx();
       }
@@ -66,43 +75,46 @@ Status MDS::SRV::LoadDir(const DirId& id, DirInfo* info, DirIndex* index) {
 // Errors might occur when the directory being searched does not exist, when
 // the LRU-cache is full, when the data read from DB is corrupted, and
 // when there are bugs somewhere in the codebase :-|
-// REQUIRES: mutex_ has been locked.
-Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
+// REQUIRES: sh->mu has been locked.
+Status MDS::SRV::FetchDir(Shard* sh, const DirId& id, Dir::Ref** ref) {
   char tmp[30];
   Slice id_encoding = EncodeId(id, tmp);
-  mutex_.AssertHeld();
+  sh->mu.AssertHeld();
   *ref = NULL;
   Status s;
 
   while (s.ok() && (*ref) == NULL) {
-    Dir::Ref* r = dirs_->Lookup(id);
+    Dir::Ref* r = sh->dirs->Lookup(id);
     if (r != NULL) {
       *ref = r;
     } else {
       // Prevent multiple threads from loading a same directory at the same time
-      if (loading_dirs_.Contains(id_encoding)) {
+      if (sh->loading_dirs.Contains(id_encoding)) {
         do {
-          loading_cv_.Wait();
-        } while (loading_dirs_.Contains(id_encoding));
+          sh->loading_cv.Wait();
+        } while (sh->loading_dirs.Contains(id_encoding));
       } else {
-        loading_dirs_.Insert(id_encoding);
-        mutex_.Unlock();
+        sh->loading_dirs.Insert(id_encoding);
+        sh->mu.Unlock();
         DirInfo dir_info;
         DirIndex dir_index(&giga_);
         s = LoadDir(id, &dir_info, &dir_index);
-        mutex_.Lock();
+        sh->mu.Lock();
         if (s.ok()) {
-          Dir* d = new Dir(&mutex_, &giga_);
+          Dir* d = new Dir(&sh->mu, &giga_);
           d->mtime = dir_info.mtime;
           assert(dir_info.size >= 0);
           d->size = dir_info.size;
           d->num_leases = 0;
           d->index.Swap(dir_index);
           d->tx.NoBarrier_Store(NULL);
+          d->group = NULL;
+          d->committing = NULL;
           d->seq = 0;
+          d->node_seq = 0;
           d->locked = false;
           try {
-            r = dirs_->Insert(id, d);
+            r = sh->dirs->Insert(id, d);
           } catch (int err) {
             // Not expecting errors other than "buffer-full", which happens
             // when the directory cache is full and no entries can be evicted
@@ -117,9 +129,9 @@ Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
           }
         }
 
-        assert(loading_dirs_.Contains(id_encoding));
-        loading_dirs_.Erase(id_encoding);
-        loading_cv_.SignalAll();
+        assert(sh->loading_dirs.Contains(id_encoding));
+        sh->loading_dirs.Erase(id_encoding);
+        sh->loading_cv.SignalAll();
       }
     }
   }
@@ -127,13 +139,30 @@ Status MDS::SRV::FetchDir(const DirId& id, Dir::Ref** ref) {
   return s;
 }
 
+MDS::SRV::Shard* MDS::SRV::ShardOf(const DirId& id) {
+  char tmp[30];
+  Slice encoding = EncodeId(id, tmp);
+  // Use a seed different from the one used inside each table so
+  // entries remain evenly spread within every shard
+  uint32_t hash = Hash(encoding.data(), encoding.size(), 0x5d3a9b1f);
+  return &shards_[hash % num_shards_];
+}
+
+void MDS::SRV::SetError(const Status& s) {
+  MutexLock ml(&status_mu_);
+  if (status_.ok()) {
+    status_ = s;
+    has_error_.store(true, std::memory_order_release);
+  }
+}
+
 // Quickly check background status. Return OK on success.
 // Return a non-OK status when the directory (or the server as a whole)
 // contains errors and must be fenced from online operations.
-// REQUIRES: mutex_ has been locked.
+// REQUIRES: the shard mutex of the directory has been locked.
 Status MDS::SRV::ProbeDir(const Dir* d) {
-  mutex_.AssertHeld();
-  if (!status_.ok()) {
+  if (has_error_.load(std::memory_order_acquire)) {
+    MutexLock ml(&status_mu_);
     return status_;
   } else if (!d->status.ok()) {
     return d->status;
@@ -142,34 +171,476 @@ Status MDS::SRV::ProbeDir(const Dir* d) {
   }
 }
 
-// REQUIRES: mutex_ has been locked.
+// Thread-safe. Does not require any lock.
 uint64_t MDS::SRV::NextIno() {
-  mutex_.AssertHeld();
-  uint64_t result = ++ino_;
+  uint64_t result = ino_.fetch_add(1) + 1;
   if (paranoid_checks_) {
     assert(srv_id_ >= 0);
     uint64_t limit = srv_id_ + 1;
     limit <<= 32;
     if (result + 1 >= limit) {
-      status_ = Status::BufferFull("No more free inodes");
+      SetError(Status::BufferFull("No more free inodes"));
     }
   }
   return result;
 }
 
-// REQUIRES: mutex_ has been locked.
+// Give back an unused ino if no one else has allocated a newer one.
+// Thread-safe. Does not require any lock.
 void MDS::SRV::TryReuseIno(uint64_t ino) {
-  mutex_.AssertHeld();
-  if (ino == ino_) {
-    --ino_;
-  }
+  uint64_t expected = ino;
+  ino_.compare_exchange_strong(expected, ino - 1);
 }
 
-// REQUIRES: mutex_ has been locked.
+// Thread-safe. Does not require any lock.
 uint32_t MDS::SRV::NextSession() {
-  mutex_.AssertHeld();
-  session_ += giga_.num_servers;
-  return session_;
+  return session_.fetch_add(giga_.num_servers) + giga_.num_servers;
+}
+
+// Check if a name has been mutated by a group that has not yet been
+// committed. If so, store the latest state of the name in *stat and
+// *exists, store the group in *group, and return true.
+// REQUIRES: the shard mutex of the directory has been locked.
+bool MDS::SRV::FindPendingNode(const Dir* d, const Slice& name_hash,
+                               Stat* stat, bool* exists, Dir::Group** group) {
+  Dir::Group* const groups[] = {d->group, d->committing};
+  const std::string key = name_hash.ToString();
+  for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+    if (groups[i] != NULL) {
+      std::map<std::string, Dir::Group::Node>::const_iterator it =
+          groups[i]->nodes.find(key);
+      if (it != groups[i]->nodes.end()) {
+        *exists = it->second.exists;
+        *stat = it->second.stat;
+        *group = groups[i];
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Return the group currently open for new mutations against the given
+// directory, creating one if necessary. The returned group is referenced
+// and must be handed to CommitGroup().
+// REQUIRES: the shard mutex of the directory has been locked.
+Dir::Group* MDS::SRV::JoinGroup(Dir* d) {
+  if (d->group == NULL) {
+    d->group = new Dir::Group(mdb_);
+  }
+  d->group->Ref();
+  return d->group;
+}
+
+// Wait until a given group has been committed and return its commit status.
+// If no other group of the directory is being committed, the calling thread
+// becomes the leader and commits the group on behalf of all its members,
+// along with a single info record covering the directory size and mtime
+// changes made by the group. Mutations arriving while the leader writes
+// to the DB are accumulated into the next group.
+// REQUIRES: the shard mutex of the directory has been locked.
+Status MDS::SRV::CommitGroup(Shard* sh, const DirId& id, Dir* d,
+                             Dir::Group* g) {
+  sh->mu.AssertHeld();
+  while (!g->done) {
+    if (d->committing == NULL && d->group == g) {
+      d->group = NULL;
+      d->committing = g;
+      DirInfo dir_info;
+      dir_info.mtime = std::max(d->mtime, g->mtime);
+      dir_info.size = d->size + g->size_delta;
+      sh->mu.Unlock();
+
+      Status s = mdb_->SetInfo(id, dir_info, g->rep());
+      if (s.ok()) {
+        s = mdb_->Commit(g->rep());
+      }
+
+      sh->mu.Lock();
+      if (s.ok()) {
+        assert(dir_info.size >= 0);
+        d->size = dir_info.size;
+        d->mtime = dir_info.mtime;
+      }
+      // Cache the committed state of every name mutated by the group
+      d->node_seq++;
+      if (sh->nodes != NULL) {
+        std::map<std::string, Dir::Group::Node>::const_iterator it;
+        for (it = g->nodes.begin(); it != g->nodes.end(); ++it) {
+          if (s.ok()) {
+            const Stat* stat = it->second.exists ? &it->second.stat : NULL;
+            sh->nodes->Release(sh->nodes->Insert(id, it->first, stat));
+          } else {
+            sh->nodes->Erase(id, it->first);
+          }
+        }
+      }
+      assert(d->committing == g);
+      d->committing = NULL;
+      g->status = s;
+      g->done = true;
+      d->cv.SignalAll();
+    } else {
+      d->cv.Wait();
+    }
+  }
+
+  Status result = g->status;
+  if (g->Unref()) {
+    g->Dispose(mdb_);
+  }
+  return result;
+}
+
+// Commit all pending groups of a directory. Used by mutations that are not
+// group committed so they always observe an up-to-date directory.
+// REQUIRES: the directory has been locked via Dir::Lock().
+// REQUIRES: the shard mutex of the directory has been locked.
+void MDS::SRV::DrainGroups(Shard* sh, const DirId& id, Dir* d) {
+  sh->mu.AssertHeld();
+  assert(d->locked);
+  if (d->group != NULL) {
+    Dir::Group* const g = d->group;
+    g->Ref();
+    CommitGroup(sh, id, d, g);  // Members will see the status
+  }
+  while (d->committing != NULL) {
+    d->cv.Wait();
+  }
+}
+
+// Look up a name in the node cache. Return true on a hit, in which case
+// either *stat is set to the cached stat, or *status is set to NotFound if
+// the name is known to be absent.
+// REQUIRES: the shard mutex of the directory has been locked.
+bool MDS::SRV::LookupNodeCache(Shard* sh, const DirId& id,
+                               const Slice& name_hash, Stat* stat,
+                               Status* status) {
+  sh->mu.AssertHeld();
+  if (sh->nodes == NULL) {
+    return false;
+  }
+  NodeCache::Handle* const h = sh->nodes->Lookup(id, name_hash);
+  if (h == NULL) {
+    return false;
+  }
+  const Stat* const cached = sh->nodes->Value(h);
+  if (cached != NULL) {
+    *stat = *cached;
+  } else {
+    *status = Status::NotFound(Slice());
+  }
+  sh->nodes->Release(h);
+  return true;
+}
+
+// Cache the result of a DB read unless the directory has been mutated since
+// node_seq was sampled, in which case the result may already be stale.
+// REQUIRES: the shard mutex of the directory has been locked.
+void MDS::SRV::MaybeCacheNode(Shard* sh, const DirId& id, const Dir* d,
+                              uint64_t node_seq, const Slice& name_hash,
+                              const Stat* stat, const Status& status) {
+  sh->mu.AssertHeld();
+  if (sh->nodes != NULL && d->node_seq == node_seq) {
+    if (status.ok()) {
+      sh->nodes->Release(sh->nodes->Insert(id, name_hash, stat));
+    } else if (status.IsNotFound()) {
+      sh->nodes->Release(sh->nodes->Insert(id, name_hash, NULL));
+    }
+  }
+}
+
+// Drop a name from the node cache after it has been updated in the DB.
+// Reads that started before the update will not be cached.
+// REQUIRES: the shard mutex of the directory has been locked.
+void MDS::SRV::InvalidateNode(Shard* sh, const DirId& id, Dir* d,
+                              const Slice& name_hash) {
+  sh->mu.AssertHeld();
+  d->node_seq++;
+  if (sh->nodes != NULL) {
+    sh->nodes->Erase(id, name_hash);
+  }
+}
+
+void MDS::SRV::GetNodeCacheStats(NodeCache::Stats* stats) {
+  for (int i = 0; i < num_shards_; i++) {
+    MutexLock ml(&shards_[i].mu);
+    if (shards_[i].nodes != NULL) {
+      shards_[i].nodes->AddStats(stats);
+    }
+  }
+}
+
+void MDS::SRV::GetLeaseStats(LeaseStats* stats) {
+  for (int i = 0; i < num_shards_; i++) {
+    MutexLock ml(&shards_[i].mu);
+    const LeaseStats& sh_stats = shards_[i].lease_stats;
+    shards_[i].leases->AddStats(&stats->table);
+    stats->renewed += sh_stats.renewed;
+    stats->not_renewed += sh_stats.not_renewed;
+    stats->write_waits += sh_stats.write_waits;
+    stats->write_wait_micros += sh_stats.write_wait_micros;
+  }
+}
+
+// Track the size of a counted local partition after a name is inserted
+// into or removed from it. Sizes are adjusted as mutations are recorded so
+// they may run ahead of a failed commit. They only drive split decisions.
+// REQUIRES: the shard mutex of the directory has been locked.
+void MDS::SRV::NotePartitionChange(Dir* d, const Slice& name_hash, int delta) {
+  if (split_threshold_ != 0) {
+    std::map<int, int>::iterator it =
+        d->partition_sizes.find(d->index.HashToIndex(name_hash));
+    if (it != d->partition_sizes.end()) {
+      it->second += delta;
+    }
+  }
+}
+
+// Count the entries of a local partition by scanning its hash range.
+// Entries in the range that belong to other partitions are skipped.
+// REQUIRES: the directory has been locked via Dir::Lock().
+// REQUIRES: the shard mutex of the directory has been locked.
+Status MDS::SRV::CountPartition(Shard* sh, const DirId& id, Dir* d,
+                                int index) {
+  sh->mu.AssertHeld();
+  assert(d->locked);
+  std::string start;
+  std::string limit;
+  DirIndex::PutHashRange(index, &start, &limit);
+  std::vector<std::string> hashes;
+  sh->mu.Unlock();
+  mdb_->ListHashes(id, start, limit, &hashes, NULL);
+  sh->mu.Lock();
+  int size = 0;
+  for (size_t i = 0; i < hashes.size(); i++) {
+    if (d->index.HashToIndex(hashes[i]) == index) {
+      size++;
+    }
+  }
+  d->partition_sizes[index] = size;
+  return Status::OK();
+}
+
+// Remove a staging directory along with any table files left in it.
+void MDS::SRV::DeleteTables(const std::string& dir) {
+  Env* const env = mds_env_->env;
+  std::vector<std::string> names;
+  env->GetChildren(dir.c_str(), &names);  // Ignoring errors
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] != "." && names[i] != "..") {
+      env->DeleteFile((dir + "/" + names[i]).c_str());
+    }
+  }
+  env->DeleteDir(dir.c_str());
+}
+
+struct MDS::SRV::SplitJob {
+  SRV* srv;
+  DirId id;
+  std::string name_hash;
+};
+
+// Schedule a background split of the partition holding a given name if it
+// has become too large. The caller returns without waiting for the split.
+// Split failures are logged and otherwise ignored since the mutation that
+// triggered the split has already been committed.
+// REQUIRES: the shard mutex of the directory has been locked.
+void MDS::SRV::MaybeSplitDir(Shard* sh, const DirId& id, Dir* d,
+                             const Slice& name_hash) {
+  sh->mu.AssertHeld();
+  if (split_threshold_ == 0) {
+    return;
+  }
+  // Cheap checks first to avoid scheduling needless splits
+  const int index = d->index.HashToIndex(name_hash);
+  if (d->index.GetServerForIndex(index) != srv_id_ ||
+      !d->index.IsSplittable(index)) {
+    return;
+  }
+  const int child = d->index.NewIndexForSplitting(index);
+  if (d->index.GetServerForIndex(child) != srv_id_ && peers_ == NULL) {
+    return;
+  }
+  std::map<int, int>::iterator it = d->partition_sizes.find(index);
+  if (it != d->partition_sizes.end()) {
+    if (static_cast<uint64_t>(it->second) < split_threshold_) {
+      return;
+    }
+  } else if (static_cast<uint64_t>(d->size) < split_threshold_) {
+    return;  // No partition can be larger than the entire directory
+  }
+
+  char tmp[30];
+  Slice id_encoding = EncodeId(id, tmp);
+  if (sh->splitting_dirs.Contains(id_encoding)) {
+    return;  // The pending split will recheck all conditions
+  }
+  sh->splitting_dirs.Insert(id_encoding);
+  SplitJob* const job = new SplitJob;
+  job->srv = this;
+  job->id = id;
+  job->name_hash = name_hash.ToString();
+  bg_mu_.Lock();
+  num_bg_splits_++;
+  bg_mu_.Unlock();
+  split_pool_->Schedule(BGSplitWork, job);
+}
+
+void MDS::SRV::BGSplitWork(void* arg) {
+  SplitJob* const job = reinterpret_cast<SplitJob*>(arg);
+  job->srv->DoSplit(job->id, job->name_hash);
+  delete job;
+}
+
+// Run a split scheduled by MaybeSplitDir(). The directory is locked for
+// the duration of the split so no other mutations may be made to it
+// meanwhile, but the thread that scheduled the split is not blocked.
+void MDS::SRV::DoSplit(const DirId& id, const Slice& name_hash) {
+  Shard* const sh = ShardOf(id);
+  Status s;
+  {
+    MutexLock ml(&sh->mu);
+    Dir::Ref* ref;
+    s = FetchDir(sh, id, &ref);
+    if (s.ok()) {
+      assert(ref != NULL);
+      Dir::Guard guard(sh->dirs, ref);
+      Dir* const d = ref->value;
+      assert(d != NULL);
+      DirLock dl(d);
+      DrainGroups(sh, id, d);
+      s = SplitDir(sh, id, d, name_hash);
+    }
+    char tmp[30];
+    sh->splitting_dirs.Erase(EncodeId(id, tmp));
+  }
+  if (!s.ok()) {
+    Error(__LOG_ARGS__, "Fail to split %s: %s", id.DebugString().c_str(),
+          s.ToString().c_str());
+  }
+
+  MutexLock ml(&bg_mu_);
+  assert(num_bg_splits_ > 0);
+  num_bg_splits_--;
+  bg_cv_.SignalAll();
+}
+
+void MDS::SRV::WaitForSplits() {
+  MutexLock ml(&bg_mu_);
+  while (num_bg_splits_ != 0) {
+    bg_cv_.Wait();
+  }
+}
+
+// Split the partition holding a given name by moving the entries of its
+// next child partition to the server responsible for that child. Entries
+// are extracted as table files, bulk inserted into the DB of the target
+// server, and then removed locally. The local index is updated before the
+// removal so requests for the moved entries are redirected from then on.
+// REQUIRES: the directory has been locked via Dir::Lock().
+// REQUIRES: the shard mutex of the directory has been locked.
+Status MDS::SRV::SplitDir(Shard* sh, const DirId& id, Dir* d,
+                          const Slice& name_hash) {
+  sh->mu.AssertHeld();
+  assert(d->locked);
+  assert(d->group == NULL && d->committing == NULL);
+  Status s = ProbeDir(d);
+  if (!s.ok()) {
+    return s;
+  }
+  // Things may have changed since we last checked
+  const int index = d->index.HashToIndex(name_hash);
+  if (d->index.GetServerForIndex(index) != srv_id_ ||
+      !d->index.IsSplittable(index)) {
+    return s;
+  }
+  const int child = d->index.NewIndexForSplitting(index);
+  const int target = d->index.GetServerForIndex(child);
+  if (target != srv_id_ && peers_ == NULL) {
+    return s;
+  }
+  if (d->partition_sizes.count(index) == 0) {
+    s = CountPartition(sh, id, d, index);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (static_cast<uint64_t>(d->partition_sizes[index]) < split_threshold_) {
+    return s;
+  }
+
+  DirIndex new_index(&giga_);
+  new_index.Update(d->index);
+  new_index.Set(child);
+  std::string start;
+  std::string limit;
+  DirIndex::PutHashRange(child, &start, &limit);
+  std::vector<std::string> hashes;
+  sh->mu.Unlock();
+
+  // No new entries may be inserted while we hold the directory lock
+  // so listing and extracting the entries see the same set
+  MDB::Tx* snap = mdb_->CreateTx();
+  mdb_->ListHashes(id, start, limit, &hashes, snap);
+  if (target != srv_id_) {
+    char tmp[100];
+    snprintf(tmp, sizeof(tmp), "/%llu-%llu-%llu-%d-%d",
+             (unsigned long long)id.reg, (unsigned long long)id.snap,
+             (unsigned long long)id.ino, child, srv_id_);
+    const std::string table_dir = split_dir_ + tmp;
+    mds_env_->env->CreateDir(split_dir_.c_str());  // Ignoring errors
+    DeleteTables(table_dir);  // Remove junk left by earlier attempts
+    s = mdb_->DumpEntries(id, start, limit, table_dir, snap);
+    if (s.ok()) {
+      AddpartOptions options;
+      options.dir_id = id;
+      options.session_id = 0;
+      options.op_due = DELTAFS_MAX_MICROS;
+      options.partition = child;
+      options.num_entries = hashes.size();
+      options.index = new_index.Encode();
+      options.table_dir = table_dir;
+      AddpartRet ret;
+      try {
+        s = peers_->Get(target)->Addpart(options, &ret);
+      } catch (Redirect& re) {
+        s = Status::Corruption("partition rejected by target server");
+      }
+    }
+    DeleteTables(table_dir);
+  }
+  mdb_->Release(snap);
+
+  sh->mu.Lock();
+  if (s.ok()) {
+    d->index.Set(child);
+    d->node_seq++;
+    if (target != srv_id_ && sh->nodes != NULL) {
+      for (size_t i = 0; i < hashes.size(); i++) {
+        sh->nodes->Erase(id, hashes[i]);
+      }
+    }
+    const int num_moved = static_cast<int>(hashes.size());
+    d->partition_sizes[index] -= num_moved;
+    Dir::Group* const g = JoinGroup(d);
+    if (target != srv_id_) {
+      for (size_t i = 0; i < hashes.size(); i++) {
+        mdb_->DelNode(id, hashes[i], g->rep());
+      }
+      g->size_delta -= num_moved;
+    } else {
+      d->partition_sizes[child] = num_moved;
+    }
+    mdb_->SetIdx(id, d->index, g->rep());
+    s = CommitGroup(sh, id, d, g);
+#if VERBOSE >= 2
+    Verbose(__LOG_ARGS__, 2, "Split %s: partition %d -> %d (srv %d), %d moved",
+            id.DebugString().c_str(), index, child, target, num_moved);
+#endif
+  }
+
+  return s;
 }
 
 // Read file or directory stats. Return OK on success.
@@ -183,6 +654,7 @@ uint32_t MDS::SRV::NextSession() {
 // directory, when the data read from DB is corrupted, and when other internal
 // or external errors occur...
 Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kFstat);
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -199,11 +671,12 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       const Dir* const d = ref->value;
       assert(d != NULL);
       s = ProbeDir(d);
@@ -215,8 +688,13 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
           throw re;
         }
       }
+      bool cached = false;
       if (s.ok()) {
-        mutex_.Unlock();
+        cached = LookupNodeCache(sh, dir_id, name_hash, &ret->stat, &s);
+      }
+      if (s.ok() && !cached) {
+        const uint64_t node_seq = d->node_seq;
+        sh->mu.Unlock();
 
         MDB::Tx* mdb_tx = NULL;
         tx = reinterpret_cast<Dir::Tx*>(d->tx.Acquire_Load());
@@ -226,7 +704,9 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
         }
 
         Slice name;
+        const uint64_t read_start = timer.Now();
         s = mdb_->GetNode(dir_id, name_hash, &ret->stat, &name, mdb_tx);
+        timer.Charge(MDSOpStats::kDbRead, read_start);
 
         if (s.ok() && paranoid_checks_) {
           std::string tmp;
@@ -239,13 +719,23 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
                 name.ToString().c_str(), s.ToString().c_str());
         }
 
-        mutex_.Lock();
+        timer.Lock(&sh->mu);
         if (tx != NULL) {
           bool last_ref = tx->Unref();
           if (!last_ref) {
             tx = NULL;
           }
         }
+        // The name may have just been moved away by a partition split
+        if (s.IsNotFound() && d->index.HashToServer(name_hash) != srv_id_) {
+          if (tx != NULL) {
+            tx->Dispose(mdb_);
+          }
+          Slice encoding = d->index.Encode();
+          Redirect re(encoding.data(), encoding.size());
+          throw re;
+        }
+        MaybeCacheNode(sh, dir_id, d, node_seq, name_hash, &ret->stat, s);
       }
     }
   }
@@ -270,12 +760,14 @@ Status MDS::SRV::Fstat(const FstatOptions& options, FstatRet* ret) {
 // name, when data would not go into the db, and when other
 // internal or external errors occur...
 //
-// Write operations against the same parent directory must be serialized
-// so they always proceed one after another. Write operations
+// Write operations against the same parent directory are checked one after
+// another but committed in groups: mutations arriving while an earlier group
+// is being written are merged into a single write batch. Write operations
 // should not block any concurrent read operations.
 Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kFcreat);
   Status s;
-  Dir::Tx* tx = NULL;
+  Dir::Group* group = NULL;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -290,104 +782,116 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
-      s = ProbeDir(d);
-      if (s.ok()) {
-        int srv_id = d->index.HashToServer(name_hash);
-        if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
-          throw re;
-        }
-      }
-      if (s.ok()) {
-        bool entry_exists = false;
-        uint64_t my_time = NowMicros();
-        uint64_t my_ino = NextIno();
-        mutex_.Unlock();
-
-        tx = new Dir::Tx(mdb_);
-        tx->Ref();
-        assert(d->tx.Acquire_Load() == NULL);
-        d->tx.Release_Store(tx);
-        MDB::Tx* mdb_tx = tx->rep();
-
-        Stat* stat = &ret->stat;
-        Slice name;
-        s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
-
-        if (s.ok() && paranoid_checks_) {
-          std::string tmp;
-          DirIndex::PutHash(&tmp, name);
-          if (name_hash.compare(tmp) != 0) {
-            s = Status::Corruption("name and hash don't match");
-
-            Error(__LOG_ARGS__, "%s/%s: %s",
-                  options.dir_id.DebugString().c_str(), name.ToString().c_str(),
-                  s.ToString().c_str());
+      uint64_t my_ino = 0;
+      {
+        MDSDirLock dl(d, &timer);
+        s = ProbeDir(d);
+        if (s.ok()) {
+          int srv_id = d->index.HashToServer(name_hash);
+          if (srv_id != srv_id_) {
+            Slice encoding = d->index.Encode();
+            Redirect re(encoding.data(), encoding.size());
+            throw re;
           }
         }
-
         if (s.ok()) {
-          if ((options.flags & O_EXCL) == O_EXCL) {
-            s = Status::AlreadyExists(Slice());
-          } else if (!S_ISREG(stat->FileMode())) {
-            s = Status::FileExpected(Slice());
+          bool entry_exists = false;
+          Stat* stat = &ret->stat;
+          if (FindPendingNode(d, name_hash, stat, &entry_exists, &group)) {
+            group->Ref();  // Wait for the pending mutation to commit
+            if (!entry_exists) {
+              s = Status::NotFound(Slice());
+            }
+          } else if (LookupNodeCache(sh, dir_id, name_hash, stat, &s)) {
+            entry_exists = s.ok();
+          } else {
+            const uint64_t node_seq = d->node_seq;
+            sh->mu.Unlock();
+            Slice name;
+            const uint64_t read_start = timer.Now();
+            s = mdb_->GetNode(dir_id, name_hash, stat, &name, NULL);
+            timer.Charge(MDSOpStats::kDbRead, read_start);
+            if (s.ok() && paranoid_checks_) {
+              std::string tmp;
+              DirIndex::PutHash(&tmp, name);
+              if (name_hash.compare(tmp) != 0) {
+                s = Status::Corruption("name and hash don't match");
+
+                Error(__LOG_ARGS__, "%s/%s: %s",
+                      options.dir_id.DebugString().c_str(),
+                      name.ToString().c_str(), s.ToString().c_str());
+              }
+            }
+            timer.Lock(&sh->mu);
+            MaybeCacheNode(sh, dir_id, d, node_seq, name_hash, stat, s);
+            entry_exists = s.ok();
           }
 
-          entry_exists = true;
-        } else if (s.IsNotFound()) {
-          uint32_t mode = S_IFREG | (options.mode & ACCESSPERMS);
-          stat->SetRegId(reg_id_);
-          stat->SetSnapId(snap_id_);
-          stat->SetInodeNo(my_ino);
-          stat->SetFileSize(0);
-          stat->SetFileMode(mode);
-          stat->SetUserId(options.uid);
-          stat->SetGroupId(options.gid);
-          stat->SetZerothServer(0);
-          stat->SetModifyTime(my_time);
-          stat->SetChangeTime(my_time);
-          s = mdb_->SetNode(dir_id, name_hash, *stat, options.name, mdb_tx);
-        }
-
-        ret->created = !entry_exists;
-
-        if (!entry_exists) {
           if (s.ok()) {
-            DirInfo dir_info;
-            dir_info.mtime = my_time;
-            dir_info.size = 1 + d->size;
-            s = mdb_->SetInfo(dir_id, dir_info, mdb_tx);
+            if ((options.flags & O_EXCL) == O_EXCL) {
+              s = Status::AlreadyExists(Slice());
+            } else if (!S_ISREG(stat->FileMode())) {
+              s = Status::FileExpected(Slice());
+            }
+          } else if (s.IsNotFound()) {
+            uint64_t my_time = NowMicros();
+            my_ino = NextIno();
+            uint32_t mode = S_IFREG | (options.mode & ACCESSPERMS);
+            stat->SetRegId(reg_id_);
+            stat->SetSnapId(snap_id_);
+            stat->SetInodeNo(my_ino);
+            stat->SetFileSize(0);
+            stat->SetFileMode(mode);
+            stat->SetUserId(options.uid);
+            stat->SetGroupId(options.gid);
+            stat->SetZerothServer(0);
+            stat->SetModifyTime(my_time);
+            stat->SetChangeTime(my_time);
+            if (group != NULL) {
+              if (group->Unref()) {
+                group->Dispose(mdb_);
+              }
+            }
+            group = JoinGroup(d);
+            s = mdb_->SetNode(dir_id, name_hash, *stat, options.name,
+                              group->rep());
+            if (s.ok()) {
+              Dir::Group::Node* const node =
+                  &group->nodes[name_hash.ToString()];
+              node->exists = true;
+              node->stat = *stat;
+              group->size_delta++;
+              group->mtime = std::max(group->mtime, my_time);
+              NotePartitionChange(d, name_hash, 1);
+            }
           }
 
-          if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
-          }
+          ret->created = !entry_exists;
         }
+      }
 
-        mutex_.Lock();
-        if (s.ok() && !entry_exists) {
-          d->size = 1 + d->size;
-          assert(my_time >= d->mtime);
-          d->mtime = my_time;
-        } else {
-          TryReuseIno(my_ino);
-        }
-        assert(d->tx.NoBarrier_Load() == tx);
-        d->tx.NoBarrier_Store(NULL);
-        assert(tx != NULL);
-        bool last_ref = tx->Unref();
-        if (!last_ref) {
-          tx = NULL;
+      if (group != NULL) {
+        const uint64_t commit_start = timer.Now();
+        Status commit_status = CommitGroup(sh, dir_id, d, group);
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+        if (s.ok()) {
+          s = commit_status;
         }
+        group = NULL;
+      }
+      if (!s.ok() && my_ino != 0) {
+        TryReuseIno(my_ino);
+      }
+      if (s.ok() && my_ino != 0) {
+        MaybeSplitDir(sh, dir_id, d, name_hash);
       }
     }
   }
@@ -395,9 +899,6 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
   if (s.ok()) {
     ret->stat.AssertAllSet();
   }
-  if (tx != NULL) {
-    tx->Dispose(mdb_);
-  }
   return s;
 }
 
@@ -410,12 +911,14 @@ Status MDS::SRV::Fcreat(const FcreatOptions& options, FcreatRet* ret) {
 // the right one for the specific name, when data would not go
 // to the db, and when other internal or external errors occur...
 //
-// Write operations against the same parent directory must be serialized
-// so they always proceed one after another. Write operations
+// Write operations against the same parent directory are checked one after
+// another but committed in groups: mutations arriving while an earlier group
+// is being written are merged into a single write batch. Write operations
 // should not block any concurrent read operations.
 Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kUnlink);
   Status s;
-  Dir::Tx* tx = NULL;
+  Dir::Group* group = NULL;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -430,100 +933,105 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
-      s = ProbeDir(d);
-      if (s.ok()) {
-        int srv_id = d->index.HashToServer(name_hash);
-        if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
-          throw re;
-        }
-      }
-      if (s.ok()) {
-        bool entry_exists = false;
-        uint64_t my_time = NowMicros();
-        mutex_.Unlock();
-
-        tx = new Dir::Tx(mdb_);
-        tx->Ref();
-        assert(d->tx.Acquire_Load() == NULL);
-        d->tx.Release_Store(tx);
-        MDB::Tx* mdb_tx = tx->rep();
-
-        Stat* stat = &ret->stat;
-        Slice name;
-        s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
-
-        if (s.ok() && paranoid_checks_) {
-          std::string tmp;
-          DirIndex::PutHash(&tmp, name);
-          if (name_hash.compare(tmp) != 0) {
-            s = Status::Corruption("name and hash don't match");
+      {
+        MDSDirLock dl(d, &timer);
+        s = ProbeDir(d);
+        if (s.ok()) {
+          int srv_id = d->index.HashToServer(name_hash);
+          if (srv_id != srv_id_) {
+            Slice encoding = d->index.Encode();
+            Redirect re(encoding.data(), encoding.size());
+            throw re;
           }
-
-          Error(__LOG_ARGS__, "%s/%s: %s", options.dir_id.DebugString().c_str(),
-                name.ToString().c_str(), s.ToString().c_str());
         }
-
         if (s.ok()) {
-          if (!S_ISREG(stat->FileMode())) {
-            s = Status::FileExpected(Slice());
+          bool entry_exists = false;
+          Stat* stat = &ret->stat;
+          if (FindPendingNode(d, name_hash, stat, &entry_exists, &group)) {
+            group->Ref();  // Wait for the pending mutation to commit
+            if (!entry_exists) {
+              s = Status::NotFound(Slice());
+            }
+          } else if (LookupNodeCache(sh, dir_id, name_hash, stat, &s)) {
+            entry_exists = s.ok();
           } else {
-            s = mdb_->DelNode(dir_id, name_hash, mdb_tx);
-          }
-
-          entry_exists = true;
-        } else if (s.IsNotFound()) {
-          if ((options.flags & O_EXCL) != O_EXCL) {
-            stat->SetRegId(0);
-            stat->SetSnapId(0);
-            stat->SetInodeNo(0);
-            stat->SetFileSize(0);
-            stat->SetFileMode(0);
-            stat->SetZerothServer(0);
-            stat->SetUserId(0);
-            stat->SetGroupId(0);
-            stat->SetModifyTime(0);
-            stat->SetChangeTime(0);
-            s = Status::OK();
-          }
-        }
-
-        if (entry_exists) {
-          if (s.ok()) {
-            DirInfo dir_info;
-            dir_info.mtime = my_time;
-            dir_info.size = d->size - 1;
-            s = mdb_->SetInfo(dir_id, dir_info, mdb_tx);
+            const uint64_t node_seq = d->node_seq;
+            sh->mu.Unlock();
+            Slice name;
+            const uint64_t read_start = timer.Now();
+            s = mdb_->GetNode(dir_id, name_hash, stat, &name, NULL);
+            timer.Charge(MDSOpStats::kDbRead, read_start);
+            if (s.ok() && paranoid_checks_) {
+              std::string tmp;
+              DirIndex::PutHash(&tmp, name);
+              if (name_hash.compare(tmp) != 0) {
+                s = Status::Corruption("name and hash don't match");
+
+                Error(__LOG_ARGS__, "%s/%s: %s",
+                      options.dir_id.DebugString().c_str(),
+                      name.ToString().c_str(), s.ToString().c_str());
+              }
+            }
+            timer.Lock(&sh->mu);
+            MaybeCacheNode(sh, dir_id, d, node_seq, name_hash, stat, s);
+            entry_exists = s.ok();
           }
 
           if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
+            if (!S_ISREG(stat->FileMode())) {
+              s = Status::FileExpected(Slice());
+            } else {
+              if (group != NULL) {
+                if (group->Unref()) {
+                  group->Dispose(mdb_);
+                }
+              }
+              group = JoinGroup(d);
+              s = mdb_->DelNode(dir_id, name_hash, group->rep());
+              if (s.ok()) {
+                Dir::Group::Node* const node =
+                    &group->nodes[name_hash.ToString()];
+                node->exists = false;
+                node->stat = *stat;
+                group->size_delta--;
+                group->mtime = std::max(group->mtime, NowMicros());
+                NotePartitionChange(d, name_hash, -1);
+              }
+            }
+          } else if (s.IsNotFound()) {
+            if ((options.flags & O_EXCL) != O_EXCL) {
+              stat->SetRegId(0);
+              stat->SetSnapId(0);
+              stat->SetInodeNo(0);
+              stat->SetFileSize(0);
+              stat->SetFileMode(0);
+              stat->SetZerothServer(0);
+              stat->SetUserId(0);
+              stat->SetGroupId(0);
+              stat->SetModifyTime(0);
+              stat->SetChangeTime(0);
+              s = Status::OK();
+            }
           }
         }
+      }
 
-        mutex_.Lock();
-        if (s.ok() && entry_exists) {
-          assert(d->size > 1);
-          d->size = -1 + d->size;
-          assert(my_time >= d->mtime);
-          d->mtime = my_time;
-        }
-        assert(d->tx.NoBarrier_Load() == tx);
-        d->tx.NoBarrier_Store(NULL);
-        assert(tx != NULL);
-        bool last_ref = tx->Unref();
-        if (!last_ref) {
-          tx = NULL;  // To be disposed by the last reader
+      if (group != NULL) {
+        const uint64_t commit_start = timer.Now();
+        Status commit_status = CommitGroup(sh, dir_id, d, group);
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+        if (s.ok()) {
+          s = commit_status;
         }
+        group = NULL;
       }
     }
   }
@@ -531,9 +1039,6 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
   if (s.ok()) {
     ret->stat.AssertAllSet();
   }
-  if (tx != NULL) {
-    tx->Dispose(mdb_);
-  }
   return s;
 }
 
@@ -545,12 +1050,14 @@ Status MDS::SRV::Unlink(const UnlinkOptions& options, UnlinkRet* ret) {
 // the current server is not the right one for the new directory, when data
 // would not go into the DB, and when other internal or external errors occur...
 //
-// Write operations against the same parent directory must be serialized so
-// they always proceed one after another. Write operations should not block any
-// concurrent read operations.
+// Write operations against the same parent directory are checked one after
+// another but committed in groups: mutations arriving while an earlier group
+// is being written are merged into a single write batch. Write operations
+// should not block any concurrent read operations.
 Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kMkdir);
   Status s;
-  Dir::Tx* tx = NULL;
+  Dir::Group* group = NULL;
   Dir::Ref* ref;
   const DirId& dir_id = options.dir_id;
   const Slice& name_hash = options.name_hash;
@@ -565,66 +1072,250 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
-      s = ProbeDir(d);
-      if (s.ok()) {
-        int srv_id = d->index.HashToServer(name_hash);
-        if (srv_id != srv_id_) {
-          Slice encoding = d->index.Encode();
-          Redirect re(encoding.data(), encoding.size());
-          throw re;
+      uint64_t my_ino = 0;
+      {
+        MDSDirLock dl(d, &timer);
+        s = ProbeDir(d);
+        if (s.ok()) {
+          int srv_id = d->index.HashToServer(name_hash);
+          if (srv_id != srv_id_) {
+            Slice encoding = d->index.Encode();
+            Redirect re(encoding.data(), encoding.size());
+            throw re;
+          }
+        }
+        if (s.ok()) {
+          bool entry_exists = false;
+          Stat* stat = &ret->stat;
+          if (FindPendingNode(d, name_hash, stat, &entry_exists, &group)) {
+            group->Ref();  // Wait for the pending mutation to commit
+            if (!entry_exists) {
+              s = Status::NotFound(Slice());
+            }
+          } else if (LookupNodeCache(sh, dir_id, name_hash, stat, &s)) {
+            entry_exists = s.ok();
+          } else {
+            const uint64_t node_seq = d->node_seq;
+            sh->mu.Unlock();
+            Slice name;
+            const uint64_t read_start = timer.Now();
+            s = mdb_->GetNode(dir_id, name_hash, stat, &name, NULL);
+            timer.Charge(MDSOpStats::kDbRead, read_start);
+            if (s.ok() && paranoid_checks_) {
+              std::string tmp;
+              DirIndex::PutHash(&tmp, name);
+              if (name_hash.compare(tmp) != 0) {
+                s = Status::Corruption("name and hash don't match");
+
+                Error(__LOG_ARGS__, "%s/%s: %s",
+                      options.dir_id.DebugString().c_str(),
+                      name.ToString().c_str(), s.ToString().c_str());
+              }
+            }
+            timer.Lock(&sh->mu);
+            MaybeCacheNode(sh, dir_id, d, node_seq, name_hash, stat, s);
+            entry_exists = s.ok();
+          }
+
+          if (s.ok()) {
+            if ((options.flags & O_EXCL) == O_EXCL) {
+              s = Status::AlreadyExists(Slice());
+            } else if (!S_ISDIR(stat->FileMode())) {
+              s = Status::DirExpected(Slice());
+            }
+          } else if (s.IsNotFound()) {
+            uint64_t my_time = NowMicros();
+            my_ino = NextIno();
+            DirId my_id(reg_id_, snap_id_, my_ino);
+            uint32_t mode = S_IFDIR;
+            mode |= (options.mode & ACCESSPERMS);
+            mode |= (options.mode & DELTAFS_DIR_MASK);
+            int rserver = PickupServer(my_id);
+            int zserver = rserver % giga_.num_virtual_servers;
+            stat->SetRegId(reg_id_);
+            stat->SetSnapId(snap_id_);
+            stat->SetInodeNo(my_ino);
+            stat->SetFileSize(0);
+            stat->SetFileMode(mode);
+            stat->SetUserId(options.uid);
+            stat->SetGroupId(options.gid);
+            stat->SetZerothServer(zserver);
+            stat->SetModifyTime(my_time);
+            stat->SetChangeTime(my_time);
+            if (group != NULL) {
+              if (group->Unref()) {
+                group->Dispose(mdb_);
+              }
+            }
+            group = JoinGroup(d);
+            s = mdb_->SetNode(dir_id, name_hash, *stat, options.name,
+                              group->rep());
+            if (s.ok()) {
+              Dir::Group::Node* const node =
+                  &group->nodes[name_hash.ToString()];
+              node->exists = true;
+              node->stat = *stat;
+              group->size_delta++;
+              group->mtime = std::max(group->mtime, my_time);
+              NotePartitionChange(d, name_hash, 1);
+            }
+          }
         }
       }
-      if (s.ok()) {
-        bool entry_exists = false;
-        uint64_t my_time = NowMicros();
-        uint64_t my_ino = NextIno();
-        DirId my_id(reg_id_, snap_id_, my_ino);
-        mutex_.Unlock();
 
-        tx = new Dir::Tx(mdb_);
-        tx->Ref();
-        assert(d->tx.Acquire_Load() == NULL);
-        d->tx.Release_Store(tx);
-        MDB::Tx* mdb_tx = tx->rep();
+      if (group != NULL) {
+        const uint64_t commit_start = timer.Now();
+        Status commit_status = CommitGroup(sh, dir_id, d, group);
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+        if (s.ok()) {
+          s = commit_status;
+        }
+        group = NULL;
+      }
+      if (!s.ok() && my_ino != 0) {
+        TryReuseIno(my_ino);
+      }
+      if (s.ok() && my_ino != 0) {
+        MaybeSplitDir(sh, dir_id, d, name_hash);
+      }
+    }
+  }
 
-        Stat* stat = &ret->stat;
-        Slice name;
-        s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
+  if (s.ok()) {
+    ret->stat.AssertAllSet();
+  }
+  return s;
+}
 
-        if (s.ok() && paranoid_checks_) {
-          std::string tmp;
-          DirIndex::PutHash(&tmp, name);
-          if (name_hash.compare(tmp) != 0) {
-            s = Status::Corruption("name and hash don't match");
+// Create a batch of files and directories under a single parent directory.
+// Return OK if the parent directory could be accessed, in which case a
+// separate status is returned for each entry. All new entries are written
+// to the DB in a single write batch, together with a single update to the
+// parent directory's size and mtime.
+//
+// If any name in the batch does not belong to the current server, the entire
+// batch is redirected and no entry is created. Entries are otherwise handled
+// exactly as Fcreat() or Mkdir() would, in order, so a name repeated within a
+// batch observes its earlier creation.
+Status MDS::SRV::Bcreat(const BcreatOptions& options, BcreatRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kBcreat);
+  Status s;
+  Dir::Group* group = NULL;
+  Dir::Ref* ref;
+  const DirId& dir_id = options.dir_id;
+  const size_t num_entries = options.entries.size();
+  ret->statuses.assign(num_entries, Status::OK());
+  ret->stats.resize(num_entries);
+  // Groups containing mutations that entries depend on
+  std::vector<Dir::Group*> waits(num_entries, NULL);
+  std::vector<uint64_t> my_inos;
+  std::vector<size_t> created;
+  for (size_t i = 0; i < num_entries; i++) {
+    const BcreatEntry& entry = options.entries[i];
+    if (entry.name_hash.empty() || entry.name.empty()) {
+      ret->statuses[i] = Status::InvalidArgument("empty name and hash");
+    } else if (paranoid_checks_) {
+      std::string tmp;
+      DirIndex::PutHash(&tmp, entry.name);
+      if (entry.name_hash.compare(tmp) != 0) {
+        ret->statuses[i] = Status::InvalidArgument("name and hash don't match");
+      }
+    }
+  }
 
-            Error(__LOG_ARGS__, "%s/%s: %s",
-                  options.dir_id.DebugString().c_str(), name.ToString().c_str(),
-                  s.ToString().c_str());
+  Shard* const sh = ShardOf(dir_id);
+  MDSMutexLock ml(&sh->mu, &timer);
+  s = FetchDir(sh, dir_id, &ref);
+  if (s.ok()) {
+    assert(ref != NULL);
+    Dir::Guard guard(sh->dirs, ref);
+    Dir* const d = ref->value;
+    assert(d != NULL);
+    {
+      MDSDirLock dl(d, &timer);
+      s = ProbeDir(d);
+      if (s.ok()) {
+        for (size_t i = 0; i < num_entries; i++) {
+          if (ret->statuses[i].ok()) {
+            const Slice& name_hash = options.entries[i].name_hash;
+            int srv_id = d->index.HashToServer(name_hash);
+            if (srv_id != srv_id_) {
+              Slice encoding = d->index.Encode();
+              Redirect re(encoding.data(), encoding.size());
+              throw re;
+            }
           }
         }
+      }
+      for (size_t i = 0; s.ok() && i < num_entries; i++) {
+        if (!ret->statuses[i].ok()) {
+          continue;
+        }
+        const BcreatEntry& entry = options.entries[i];
+        const Slice& name_hash = entry.name_hash;
+        const bool is_dir = S_ISDIR(entry.mode);
+        Stat* const stat = &ret->stats[i];
+        Status r;
+        Dir::Group* pending = NULL;
+        bool entry_exists = false;
+        if (FindPendingNode(d, name_hash, stat, &entry_exists, &pending)) {
+          if (pending != group) {  // Our own group needs no extra waiting
+            pending->Ref();
+            waits[i] = pending;
+          }
+          if (!entry_exists) {
+            r = Status::NotFound(Slice());
+          }
+        } else {
+          sh->mu.Unlock();
+          Slice name;
+          const uint64_t read_start = timer.Now();
+          r = mdb_->GetNode(dir_id, name_hash, stat, &name, NULL);
+          timer.Charge(MDSOpStats::kDbRead, read_start);
+          if (r.ok() && paranoid_checks_) {
+            std::string tmp;
+            DirIndex::PutHash(&tmp, name);
+            if (name_hash.compare(tmp) != 0) {
+              r = Status::Corruption("name and hash don't match");
+
+              Error(__LOG_ARGS__, "%s/%s: %s", dir_id.DebugString().c_str(),
+                    name.ToString().c_str(), r.ToString().c_str());
+            }
+          }
+          timer.Lock(&sh->mu);
+        }
 
-        if (s.ok()) {
+        if (r.ok()) {
           if ((options.flags & O_EXCL) == O_EXCL) {
-            s = Status::AlreadyExists(Slice());
-          } else if (!S_ISDIR(stat->FileMode())) {
-            s = Status::DirExpected(Slice());
+            r = Status::AlreadyExists(Slice());
+          } else if (is_dir && !S_ISDIR(stat->FileMode())) {
+            r = Status::DirExpected(Slice());
+          } else if (!is_dir && !S_ISREG(stat->FileMode())) {
+            r = Status::FileExpected(Slice());
+          }
+        } else if (r.IsNotFound()) {
+          uint64_t my_time = NowMicros();
+          uint64_t my_ino = NextIno();
+          my_inos.push_back(my_ino);
+          uint32_t mode;
+          int zserver = 0;
+          if (is_dir) {
+            mode = S_IFDIR;
+            mode |= (entry.mode & ACCESSPERMS);
+            mode |= (entry.mode & DELTAFS_DIR_MASK);
+            int rserver = PickupServer(DirId(reg_id_, snap_id_, my_ino));
+            zserver = rserver % giga_.num_virtual_servers;
+          } else {
+            mode = S_IFREG | (entry.mode & ACCESSPERMS);
           }
-
-          entry_exists = true;
-        } else if (s.IsNotFound()) {
-          uint32_t mode = S_IFDIR;
-          mode |= (options.mode & ACCESSPERMS);
-          mode |= (options.mode & DELTAFS_DIR_MASK);
-          int rserver = PickupServer(my_id);
-          int zserver = rserver % giga_.num_virtual_servers;
           stat->SetRegId(reg_id_);
           stat->SetSnapId(snap_id_);
           stat->SetInodeNo(my_ino);
@@ -635,46 +1326,67 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
           stat->SetZerothServer(zserver);
           stat->SetModifyTime(my_time);
           stat->SetChangeTime(my_time);
-          s = mdb_->SetNode(dir_id, name_hash, *stat, options.name, mdb_tx);
-        }
-
-        if (!entry_exists) {
-          if (s.ok()) {
-            DirInfo dir_info;
-            dir_info.mtime = my_time;
-            dir_info.size = 1 + d->size;
-            s = mdb_->SetInfo(dir_id, dir_info, mdb_tx);
+          if (group == NULL) {
+            group = JoinGroup(d);
           }
-
-          if (s.ok()) {
-            s = mdb_->Commit(mdb_tx);
+          r = mdb_->SetNode(dir_id, name_hash, *stat, entry.name,
+                            group->rep());
+          if (r.ok()) {
+            Dir::Group::Node* const node = &group->nodes[name_hash.ToString()];
+            node->exists = true;
+            node->stat = *stat;
+            group->size_delta++;
+            group->mtime = std::max(group->mtime, my_time);
+            NotePartitionChange(d, name_hash, 1);
+            created.push_back(i);
+          } else {
+            s = r;  // Write batch may have been left in an unknown state
           }
         }
 
-        mutex_.Lock();
-        if (s.ok() && !entry_exists) {
-          d->size = 1 + d->size;
-          assert(my_time >= d->mtime);
-          d->mtime = my_time;
-        } else {
-          TryReuseIno(my_ino);
-        }
-        assert(d->tx.NoBarrier_Load() == tx);
-        d->tx.NoBarrier_Store(NULL);
-        assert(tx != NULL);
-        bool last_ref = tx->Unref();
-        if (!last_ref) {
-          tx = NULL;
+        ret->statuses[i] = r;
+      }
+    }
+
+    // Entries created by this batch share the fate of our group.
+    // Entries depending on earlier mutations share the fate of those.
+    if (group != NULL) {
+      const uint64_t commit_start = timer.Now();
+      Status commit_status = CommitGroup(sh, dir_id, d, group);
+      timer.Charge(MDSOpStats::kDbCommit, commit_start);
+      if (s.ok()) {
+        s = commit_status;
+      }
+      group = NULL;
+    }
+    for (size_t i = 0; i < num_entries; i++) {
+      if (waits[i] != NULL) {
+        const uint64_t commit_start = timer.Now();
+        Status commit_status = CommitGroup(sh, dir_id, d, waits[i]);
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+        if (ret->statuses[i].ok()) {
+          ret->statuses[i] = commit_status;
         }
+        waits[i] = NULL;
       }
     }
+    if (!s.ok()) {
+      while (!my_inos.empty()) {
+        TryReuseIno(my_inos.back());
+        my_inos.pop_back();
+      }
+    }
+    for (size_t i = 0; s.ok() && i < created.size(); i++) {
+      MaybeSplitDir(sh, dir_id, d, options.entries[created[i]].name_hash);
+    }
   }
 
   if (s.ok()) {
-    ret->stat.AssertAllSet();
-  }
-  if (tx != NULL) {
-    tx->Dispose(mdb_);
+    for (size_t i = 0; i < num_entries; i++) {
+      if (ret->statuses[i].ok()) {
+        ret->stats[i].AssertAllSet();
+      }
+    }
   }
   return s;
 }
@@ -688,6 +1400,7 @@ Status MDS::SRV::Mkdir(const MkdirOptions& options, MkdirRet* ret) {
 // when the data read from the DB is corrupted, and when other
 // internal or external errors occur...
 Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kUtime);
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -704,14 +1417,15 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
+      MDSDirLock dl(d, &timer);
       s = ProbeDir(d);
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
@@ -722,8 +1436,11 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
         }
       }
       if (s.ok()) {
+        const uint64_t drain_start = timer.Now();
+        DrainGroups(sh, dir_id, d);
+        timer.Charge(MDSOpStats::kDirLockWait, drain_start);
         uint64_t my_time = NowMicros();
-        mutex_.Unlock();
+        sh->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -733,7 +1450,9 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
 
         Slice name;
         Stat* stat = &ret->stat;
+        const uint64_t read_start = timer.Now();
         s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
+        timer.Charge(MDSOpStats::kDbRead, read_start);
         // TODO: paranoid checks
         if (s.ok()) {
           stat->SetModifyTime(options.mtime);
@@ -742,12 +1461,15 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
         }
 
         if (s.ok()) {
+          const uint64_t commit_start = timer.Now();
           s = mdb_->Commit(mdb_tx);
+          timer.Charge(MDSOpStats::kDbCommit, commit_start);
         }
 
-        mutex_.Lock();
+        timer.Lock(&sh->mu);
         assert(d->tx.NoBarrier_Load() == tx);
         d->tx.NoBarrier_Store(NULL);
+        InvalidateNode(sh, dir_id, d, name_hash);
         assert(tx != NULL);
         bool last_ref = tx->Unref();
         if (!last_ref) {
@@ -775,6 +1497,7 @@ Status MDS::SRV::Utime(const UtimeOptions& options, UtimeRet* ret) {
 // execute the call, when the data read from DB is corrupted,
 // and when other internal or external error occur...
 Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kTrunc);
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -791,14 +1514,15 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
+      MDSDirLock dl(d, &timer);
       s = ProbeDir(d);
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
@@ -809,8 +1533,11 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
         }
       }
       if (s.ok()) {
+        const uint64_t drain_start = timer.Now();
+        DrainGroups(sh, dir_id, d);
+        timer.Charge(MDSOpStats::kDirLockWait, drain_start);
         uint64_t my_time = NowMicros();
-        mutex_.Unlock();
+        sh->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -820,7 +1547,9 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
 
         Slice name;
         Stat* stat = &ret->stat;
+        const uint64_t read_start = timer.Now();
         s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
+        timer.Charge(MDSOpStats::kDbRead, read_start);
         // TODO: paranoid checks
         if (s.ok()) {
           if (!S_ISREG(stat->FileMode())) {
@@ -834,12 +1563,15 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
         }
 
         if (s.ok()) {
+          const uint64_t commit_start = timer.Now();
           s = mdb_->Commit(mdb_tx);
+          timer.Charge(MDSOpStats::kDbCommit, commit_start);
         }
 
-        mutex_.Lock();
+        timer.Lock(&sh->mu);
         assert(d->tx.NoBarrier_Load() == tx);
         d->tx.NoBarrier_Store(NULL);
+        InvalidateNode(sh, dir_id, d, name_hash);
         assert(tx != NULL);
         bool last_ref = tx->Unref();
         if (!last_ref) {
@@ -918,6 +1650,7 @@ Status MDS::SRV::Trunc(const TruncOptions& options, TruncRet* ret) {
 // when the data being read from DB is corrupted, and when other internal
 // or external error occurs...
 Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kLookup);
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -934,11 +1667,12 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       const Dir* const d = ref->value;
       assert(d != NULL);
       s = ProbeDir(d);
@@ -953,21 +1687,30 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
       if (s.ok()) {
         uint64_t my_start = NowMicros();
         uint64_t my_seq = d->seq;
-        mutex_.Unlock();
-
-        MDB::Tx* mdb_tx = NULL;
-        tx = reinterpret_cast<Dir::Tx*>(d->tx.Acquire_Load());
-        if (tx != NULL) {
-          mdb_tx = tx->rep();
-          tx->Ref();
-        }
+        const uint64_t node_seq = d->node_seq;
+        Stat stat;
+        Status r;
+        const bool cached = LookupNodeCache(sh, dir_id, name_hash, &stat, &r);
+        sh->mu.Unlock();
 
         ret->stat.SetLeaseDue(0);
 
-        Slice name;
-        Stat stat;
-        s = mdb_->GetNode(dir_id, name_hash, &stat, &name, mdb_tx);
-        // TODO: paranoid checks
+        if (!cached) {
+          MDB::Tx* mdb_tx = NULL;
+          tx = reinterpret_cast<Dir::Tx*>(d->tx.Acquire_Load());
+          if (tx != NULL) {
+            mdb_tx = tx->rep();
+            tx->Ref();
+          }
+
+          Slice name;
+          const uint64_t read_start = timer.Now();
+          r = mdb_->GetNode(dir_id, name_hash, &stat, &name, mdb_tx);
+          timer.Charge(MDSOpStats::kDbRead, read_start);
+          // TODO: paranoid checks
+        }
+
+        s = r;
         if (s.ok()) {
           if (!S_ISDIR(stat.FileMode())) {
             s = Status::DirExpected(Slice());
@@ -978,11 +1721,14 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
           ret->stat.CopyFrom(stat);
         }
 
-        mutex_.Lock();
+        timer.Lock(&sh->mu);
+        if (!cached) {
+          MaybeCacheNode(sh, dir_id, d, node_seq, name_hash, &stat, r);
+        }
         uint64_t my_end = NowMicros();
         // No lease either we timeout or have a negative result, otherwise...
         if (s.ok() && (my_end - my_start) < (lease_duration_ - 10)) {
-          Lease::Ref* lref = leases_->Lookup(dir_id, name_hash);
+          Lease::Ref* lref = sh->leases->Lookup(dir_id, name_hash);
           if (lref == NULL) {
             Lease* new_lease = new Lease;
             new_lease->state = kLeaseFree;
@@ -990,7 +1736,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
             new_lease->due = 0;
             new_lease->seq = 0;
             try {
-              lref = leases_->Insert(dir_id, name_hash, new_lease);
+              lref = sh->leases->Insert(dir_id, name_hash, new_lease);
             } catch (int err) {
               // Not expecting errors other than ENOBUFS
               assert(err == ENOBUFS);
@@ -1006,7 +1752,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
           }
           // No lease will be issued if the lease table is full, otherwise...
           if (lref != NULL) {
-            Lease::Guard lguard(leases_, lref);
+            Lease::Guard lguard(sh->leases, lref);
             Lease* const lease = lref->value;
             assert(lease != NULL);
             // No lease if the data is possibly stale, otherwise...
@@ -1030,6 +1776,15 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
             tx = NULL;
           }
         }
+        // The name may have just been moved away by a partition split
+        if (s.IsNotFound() && d->index.HashToServer(name_hash) != srv_id_) {
+          if (tx != NULL) {
+            tx->Dispose(mdb_);
+          }
+          Slice encoding = d->index.Encode();
+          Redirect re(encoding.data(), encoding.size());
+          throw re;
+        }
       }
     }
   }
@@ -1043,6 +1798,93 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
   return s;
 }
 
+// Extend a batch of lookup state leases on behalf of a client that has
+// been granted them earlier. Return OK unless the request is malformed.
+// Leases that cannot be extended get a zero due and must be
+// obtained again through Lookup.
+//
+// A granted due that has not yet passed implies no write has been
+// applied to the entry since the lease was granted, because each write
+// waits until all granted dues have passed before it completes. Locked
+// leases are never extended so pending writes are not further delayed.
+Status MDS::SRV::Renew(const RenewOptions& options, RenewRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kRenew);
+  ret->lease_dues.assign(options.leases.size(), 0);
+  for (size_t i = 0; i < options.leases.size(); i++) {
+    const RenewEntry& entry = options.leases[i];
+    Shard* const sh = ShardOf(entry.dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    const uint64_t now = NowMicros();
+    if (entry.lease_due > now) {
+      Lease::Ref* lref = sh->leases->Lookup(entry.dir_id, entry.name_hash);
+      if (lref != NULL) {
+        Lease::Guard lguard(sh->leases, lref);
+        Lease* const lease = lref->value;
+        assert(lease != NULL);
+        // The entry may have been moved away by a partition split
+        if (lease->state == kLeaseShared && lease->due >= entry.lease_due &&
+            lease->parent->index.HashToServer(entry.name_hash) == srv_id_) {
+          assert(now + lease_duration_ >= lease->due);
+          lease->due = now + lease_duration_;
+          ret->lease_dues[i] = lease->due;
+        }
+      }
+    }
+    if (ret->lease_dues[i] != 0) {
+      sh->lease_stats.renewed++;
+    } else {
+      sh->lease_stats.not_renewed++;
+    }
+  }
+
+  return Status::OK();
+}
+
+// Look up a run of path components, one Lookup at a time, so each
+// component is granted its own lease. Return OK if the first component
+// is found. Resolution descends into a directory only if its states
+// belong here, which is always the case for directories pre-split
+// across all servers, and stops at the first component that is
+// missing or held by another server.
+Status MDS::SRV::Resolve(const ResolveOptions& options, ResolveRet* ret) {
+  Status s;
+  ret->stats.clear();
+  LookupOptions lookup_options;
+  *static_cast<BaseOptions*>(&lookup_options) =
+      static_cast<const BaseOptions&>(options);
+  for (size_t i = 0; i < options.names.size(); i++) {
+    char tmp[DELTAFS_NAME_HASH_BUFSIZE];
+    lookup_options.name_hash = DirIndex::Hash(options.names[i], tmp);
+    lookup_options.name = options.names[i];
+    LookupRet lookup_ret;
+    if (i == 0) {
+      s = Lookup(lookup_options, &lookup_ret);  // May redirect
+      if (!s.ok()) {
+        break;
+      }
+    } else {
+      try {
+        if (!Lookup(lookup_options, &lookup_ret).ok()) {
+          break;
+        }
+      } catch (Redirect& re) {
+        break;
+      }
+    }
+    ret->stats.push_back(lookup_ret.stat);
+    const LookupStat& stat = lookup_ret.stat;
+    if (DELTAFS_DIR_IS_PLFS_STYLE(stat.DirMode())) {
+      break;
+    } else if (split_threshold_ != 0 &&
+               stat.ZerothServer() % giga_.num_servers != srv_id_) {
+      break;
+    }
+    lookup_options.dir_id = DirId(stat);
+  }
+
+  return s;
+}
+
 // Change the permission of a given file or directory. Return OK on success.
 // Write operations within a single parent directory are executed
 // sequentially. No write operation should block concurrent read operations.
@@ -1060,6 +1902,7 @@ Status MDS::SRV::Lookup(const LookupOptions& options, LookupRet* ret) {
 // data read from db is corrupted or new data would not go into the db,
 // and when other internal or external errors occur...
 Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kUperm);
   Status s;
   Dir::Tx* tx = NULL;
   Dir::Ref* ref;
@@ -1076,14 +1919,15 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
   }
 
   if (s.ok()) {
-    MutexLock ml(&mutex_);
-    s = FetchDir(dir_id, &ref);
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
     if (s.ok()) {
       assert(ref != NULL);
-      Dir::Guard guard(dirs_, ref);
+      Dir::Guard guard(sh->dirs, ref);
       Dir* const d = ref->value;
       assert(d != NULL);
-      DirLock dl(d);
+      MDSDirLock dl(d, &timer);
       s = ProbeDir(d);
       if (s.ok()) {
         int srv_id = d->index.HashToServer(name_hash);
@@ -1094,8 +1938,11 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
         }
       }
       if (s.ok()) {
+        const uint64_t drain_start = timer.Now();
+        DrainGroups(sh, dir_id, d);
+        timer.Charge(MDSOpStats::kDirLockWait, drain_start);
         uint64_t my_start = NowMicros();
-        mutex_.Unlock();
+        sh->mu.Unlock();
 
         tx = new Dir::Tx(mdb_);
         tx->Ref();
@@ -1105,7 +1952,9 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
 
         Stat* stat = &ret->stat;
         Slice name;
+        const uint64_t read_start = timer.Now();
         s = mdb_->GetNode(dir_id, name_hash, stat, &name, mdb_tx);
+        timer.Charge(MDSOpStats::kDbRead, read_start);
 
         if (s.ok() && paranoid_checks_) {
           std::string tmp;
@@ -1141,14 +1990,16 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
         }
 
         if (s.ok()) {
+          const uint64_t commit_start = timer.Now();
           s = mdb_->Commit(mdb_tx);
+          timer.Charge(MDSOpStats::kDbCommit, commit_start);
         }
 
-        mutex_.Lock();
+        timer.Lock(&sh->mu);
         uint64_t my_end = NowMicros();
         // Wait until lease expiration if the target is a directory
         if (s.ok() && S_ISDIR(stat->FileMode())) {
-          Lease::Ref* lease_ref = leases_->Lookup(dir_id, name_hash);
+          Lease::Ref* lease_ref = sh->leases->Lookup(dir_id, name_hash);
           if (lease_ref == NULL) {
             Lease* new_lease = new Lease;
             new_lease->state = kLeaseFree;
@@ -1157,7 +2008,7 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
             new_lease->seq = 0;
             while (lease_ref == NULL) {
               try {
-                lease_ref = leases_->Insert(dir_id, name_hash, new_lease);
+                lease_ref = sh->leases->Insert(dir_id, name_hash, new_lease);
               } catch (int err) {
                 // Not expecting errors other than ENOBUFS
                 assert(err == ENOBUFS);
@@ -1168,25 +2019,29 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
                 // TODO: a possible alternative is too force injecting a
                 // lease entry even when the lease table is full
                 lease_ref = NULL;
-                mutex_.Unlock();
+                sh->lease_stats.write_waits++;
+                sh->lease_stats.write_wait_micros += lease_duration_ + 10;
+                sh->mu.Unlock();
                 SleepForMicroseconds(lease_duration_ + 10);
-                mutex_.Lock();
+                timer.Lock(&sh->mu);
                 my_end = NowMicros();
               }
             }
             d->num_leases++;
           }
           assert(lease_ref != NULL);
-          Lease::Guard lguard(leases_, lease_ref);
+          Lease::Guard lguard(sh->leases, lease_ref);
           Lease* const lease = lease_ref->value;
           assert(lease != NULL && lease->state != kLeaseLocked);
           while (lease->state == kLeaseShared && lease->due > my_end) {
             lease->state = kLeaseLocked;
             uint64_t diff = lease->due - my_end + 10;
-            mutex_.Unlock();
+            sh->lease_stats.write_waits++;
+            sh->lease_stats.write_wait_micros += diff;
+            sh->mu.Unlock();
             // Wait past lease due
             SleepForMicroseconds(diff);
-            mutex_.Lock();
+            timer.Lock(&sh->mu);
             my_end = NowMicros();
           }
           assert(lease->parent == d);
@@ -1202,6 +2057,7 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
         }
         assert(d->tx.NoBarrier_Load() == tx);
         d->tx.NoBarrier_Store(NULL);
+        InvalidateNode(sh, dir_id, d, name_hash);
         assert(tx != NULL);
         bool last_ref = tx->Unref();
         if (!last_ref) {
@@ -1220,26 +2076,39 @@ Status MDS::SRV::Uperm(const UpermOptions& options, UpermRet* ret) {
   return s;
 }
 
-// Fetch the entries under a parent directory. Return OK on success.
+// Fetch a page of entries under a parent directory, optionally along with
+// their stats. Return OK on success. The cursor of the next page is
+// returned so a directory of any size can be listed page by page.
 // Directory listing does not have to return a serializable view of
 // the file system. So all list operations will go without synchronizing
 // with other concurrent read or write operations.
 // Errors are mostly masked so an empty list is returned in worst case.
 Status MDS::SRV::Listdir(const ListdirOptions& options, ListdirRet* ret) {
-  static const size_t kSizeLimit = 1000;
-  mdb_->List(options.dir_id, NULL, ret->names, NULL, kSizeLimit);
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kListdir);
+  static const uint32_t kMaxEntries = 1000;
+  uint32_t limit = options.max_entries;
+  if (limit == 0 || limit > kMaxEntries) {
+    limit = kMaxEntries;
+  }
+  const uint64_t read_start = timer.Now();
+  mdb_->List(options.dir_id, options.start_hash,
+             options.with_stats ? ret->stats : NULL, ret->names,
+             &ret->next_hash, NULL, limit);
+  timer.Charge(MDSOpStats::kDbRead, read_start);
   return Status::OK();
 }
 
 // Return the index encoding of a parent directory. Return OK on success
 Status MDS::SRV::Readidx(const ReadidxOptions& options, ReadidxRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kReadidx);
   Status s;
   Dir::Ref* ref;
-  MutexLock ml(&mutex_);
-  s = FetchDir(options.dir_id, &ref);
+  Shard* const sh = ShardOf(options.dir_id);
+  MDSMutexLock ml(&sh->mu, &timer);
+  s = FetchDir(sh, options.dir_id, &ref);
   if (s.ok()) {
     assert(ref != NULL);
-    Dir::Guard guard(dirs_, ref);
+    Dir::Guard guard(sh->dirs, ref);
     const Dir* const d = ref->value;
     assert(d != NULL);
     s = ProbeDir(d);
@@ -1262,9 +2131,7 @@ Status MDS::SRV::Opensession(const OpensessionOptions&, OpensessionRet* ret) {
   ret->env_conf = mds_env_->env_conf;
   ret->fio_name = mds_env_->fio_name;
   ret->fio_conf = mds_env_->fio_conf;
-  mutex_.Lock();
   ret->session_id = NextSession();
-  mutex_.Unlock();
   return s;
 }
 
@@ -1282,4 +2149,74 @@ Status MDS::SRV::Getoutput(const GetoutputOptions&, GetoutputRet* ret) {
   return Status::OK();
 }
 
+// Obtain the latency distributions of all ops served so far.
+// Return OK on success.
+Status MDS::SRV::Getstats(const GetstatsOptions&, GetstatsRet* ret) {
+  ret->info.clear();
+  op_stats_->AppendReport(&ret->info);
+  return Status::OK();
+}
+
+// Take over a partition split off by another server. Return OK on success.
+// Entries are bulk inserted before the partition is added to the local
+// index, so requests for the partition keep being redirected to the
+// splitting server until all its entries are available here.
+//
+// Errors may occur when the partition does not belong to the current
+// server, when the table files cannot be inserted into the DB, and when
+// other internal or external errors occur...
+Status MDS::SRV::Addpart(const AddpartOptions& options, AddpartRet* ret) {
+  MDSOpTimer timer(op_stats_, mds_env_->env, MDSOpStats::kAddpart);
+  Status s;
+  Dir::Ref* ref;
+  const DirId& dir_id = options.dir_id;
+  const int partition = options.partition;
+  DirIndex index(&giga_);
+  if (partition <= 0 || partition >= giga_.num_virtual_servers) {
+    s = Status::InvalidArgument("bad partition");
+  } else if (!index.Update(options.index) || !index.IsSet(partition)) {
+    s = Status::InvalidArgument("bad giga+ index");
+  } else if (index.GetServerForIndex(partition) != srv_id_) {
+    s = Status::InvalidArgument("partition not owned by server");
+  }
+
+  if (s.ok()) {
+    Shard* const sh = ShardOf(dir_id);
+    MDSMutexLock ml(&sh->mu, &timer);
+    s = FetchDir(sh, dir_id, &ref);
+    if (s.ok()) {
+      assert(ref != NULL);
+      Dir::Guard guard(sh->dirs, ref);
+      Dir* const d = ref->value;
+      assert(d != NULL);
+      s = ProbeDir(d);
+      if (s.ok()) {
+        if (d->index.ZerothServer() != index.ZerothServer()) {
+          s = Status::Corruption("zeroth server mismatch");
+        }
+      }
+      if (s.ok()) {
+        sh->mu.Unlock();
+        const uint64_t commit_start = timer.Now();
+        s = mdb_->AddEntries(options.table_dir.ToString());
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+        timer.Lock(&sh->mu);
+      }
+      if (s.ok()) {
+        d->index.Update(index);
+        d->node_seq++;  // Earlier reads may have missed the new entries
+        d->partition_sizes[partition] = options.num_entries;
+        Dir::Group* const g = JoinGroup(d);
+        g->size_delta += options.num_entries;
+        mdb_->SetIdx(dir_id, d->index, g->rep());
+        const uint64_t commit_start = timer.Now();
+        s = CommitGroup(sh, dir_id, d, g);
+        timer.Charge(MDSOpStats::kDbCommit, commit_start);
+      }
+    }
+  }
+
+  return s;
+}
+
 }  // namespace pdlfs
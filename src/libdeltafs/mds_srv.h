@@ -10,12 +10,16 @@
  */
 
 #include "mds_api.h"
+#include "mds_stats.h"
 
 #include "pdlfs-common/dcntl.h"
 #include "pdlfs-common/lease.h"
 #include "pdlfs-common/map.h"
+#include "pdlfs-common/node_cache.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
+
 namespace pdlfs {
 
 class MDS::SRV : public MDS {
@@ -28,6 +32,7 @@ class MDS::SRV : public MDS {
   DEC_OP(Fstat)
   DEC_OP(Fcreat)
   DEC_OP(Mkdir)
+  DEC_OP(Bcreat)
   DEC_OP(Chmod)
   DEC_OP(Chown)
   DEC_OP(Uperm)
@@ -35,19 +40,93 @@ class MDS::SRV : public MDS {
   DEC_OP(Trunc)
   DEC_OP(Unlink)
   DEC_OP(Lookup)
+  DEC_OP(Renew)
+  DEC_OP(Resolve)
   DEC_OP(Listdir)
   DEC_OP(Readidx)
   DEC_OP(Opensession)
   DEC_OP(Getinput)
   DEC_OP(Getoutput)
+  DEC_OP(Getstats)
+  DEC_OP(Addpart)
 
 #undef DEC_OP
 
+  // Add the lookup counters of all node caches to *stats.
+  void GetNodeCacheStats(NodeCache::Stats* stats);
+
+  struct LeaseStats {
+    LeaseStats()
+        : renewed(0), not_renewed(0), write_waits(0), write_wait_micros(0) {}
+    LeaseTable::Stats table;
+    uint64_t renewed;
+    uint64_t not_renewed;
+    uint64_t write_waits;  // Writes that had to wait for leases to expire
+    uint64_t write_wait_micros;
+  };
+  // Add the lease counters of all shards to *stats.
+  void GetLeaseStats(LeaseStats* stats);
+
+  // Wait for all partition splits scheduled so far to finish.
+  void WaitForSplits();
+
  private:
+  // Directory states and the leases issued against the entries of those
+  // directories are partitioned into independently locked shards by
+  // parent directory id. Operations against different shards never
+  // contend with each other.
+  struct Shard {
+    Shard() : loading_cv(&mu), leases(NULL), dirs(NULL), nodes(NULL) {}
+    // State below is protected by mu
+    port::Mutex mu;
+    HashSet loading_dirs;  // A set of dirs being loaded into a memory cache
+    port::CondVar loading_cv;
+    HashSet splitting_dirs;  // A set of dirs with a split scheduled
+    LeaseTable* leases;
+    LeaseStats lease_stats;  // Table counters are kept by leases
+    DirTable* dirs;
+    NodeCache* nodes;  // NULL if node caching is disabled
+  };
+  Shard* ShardOf(const DirId& id);
+
   Status LoadDir(const DirId& id, DirInfo* info, DirIndex* index);
-  Status FetchDir(const DirId& id, Dir::Ref** ref);
+  Status FetchDir(Shard* sh, const DirId& id, Dir::Ref** ref);
   Status ProbeDir(const Dir* dir);
 
+  // Group commit of directory mutations. All require the shard mutex
+  // of the directory to be locked.
+  bool FindPendingNode(const Dir* d, const Slice& name_hash, Stat* stat,
+                       bool* exists, Dir::Group** group);
+  Dir::Group* JoinGroup(Dir* d);
+  Status CommitGroup(Shard* sh, const DirId& id, Dir* d, Dir::Group* group);
+  void DrainGroups(Shard* sh, const DirId& id, Dir* d);
+
+  // Node caching. Readers only insert what they have read from the DB if
+  // no mutations have been made to the directory in the meantime. Writers
+  // invalidate after their updates have reached the DB. All require the
+  // shard mutex of the directory to be locked.
+  bool LookupNodeCache(Shard* sh, const DirId& id, const Slice& name_hash,
+                       Stat* stat, Status* status);
+  void MaybeCacheNode(Shard* sh, const DirId& id, const Dir* d,
+                      uint64_t node_seq, const Slice& name_hash,
+                      const Stat* stat, const Status& status);
+  void InvalidateNode(Shard* sh, const DirId& id, Dir* d,
+                      const Slice& name_hash);
+
+  // Incremental GIGA+ splitting. Splits are scheduled by the mutations
+  // that grow a partition and run in the background. Except for the
+  // background work, all require the shard mutex of the directory to
+  // be locked.
+  void NotePartitionChange(Dir* d, const Slice& name_hash, int delta);
+  void MaybeSplitDir(Shard* sh, const DirId& id, Dir* d,
+                     const Slice& name_hash);
+  struct SplitJob;
+  static void BGSplitWork(void*);
+  void DoSplit(const DirId& id, const Slice& name_hash);
+  Status SplitDir(Shard* sh, const DirId& id, Dir* d, const Slice& name_hash);
+  Status CountPartition(Shard* sh, const DirId& id, Dir* d, int index);
+  void DeleteTables(const std::string& dir);
+
   // Constant after construction
   MDSEnv* mds_env_;
   uint64_t NowMicros() { return mds_env_->env->NowMicros(); }
@@ -63,18 +142,31 @@ class MDS::SRV : public MDS {
   uint64_t reg_id_;
   int srv_id_;
 
-  // State below is protected by mutex_
-  port::Mutex mutex_;
-  LeaseTable* leases_;
-  HashSet loading_dirs_;  // A set of dirs being loaded into a memory cache
-  port::CondVar loading_cv_;
-  DirTable* dirs_;
+  Shard* shards_;
+  int num_shards_;
+  uint64_t split_threshold_;  // Zero if directories are pre-split
+  MDSFactory* peers_;
+  std::string split_dir_;
+  ThreadPool* split_pool_;  // NULL if directories are pre-split
+  MDSOpStats* op_stats_;  // Latency of the ops served so far
+
+  // Background splits still pending or running
+  port::Mutex bg_mu_;
+  port::CondVar bg_cv_;
+  int num_bg_splits_;  // Protected by bg_mu_
+
+  // Lock-free allocation of session ids and inode numbers
   uint32_t NextSession();
-  uint32_t session_;  // The last session id we allocated
+  std::atomic<uint32_t> session_;  // The last session id we allocated
   void TryReuseIno(uint64_t ino);
   uint64_t NextIno();
-  uint64_t ino_;  // The last ino num we allocated
-  Status status_;
+  std::atomic<uint64_t> ino_;  // The last ino num we allocated
+
+  // Server-wide background status. Set at most once.
+  void SetError(const Status& s);
+  std::atomic<bool> has_error_;
+  port::Mutex status_mu_;
+  Status status_;  // Protected by status_mu_
 
   friend class MDS;
   // No copying allowed
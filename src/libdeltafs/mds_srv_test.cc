@@ -12,14 +12,20 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <vector>
+
+#include "mds_cli.h"
 #include "mds_srv.h"
+#include "pdlfs-common/leveldb/db/readonly.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
 namespace pdlfs {
 
 class ServerTest {
- private:
+ protected:
   std::string dbname_;
   MDSEnv mds_env_;
   MDS* mds_;
@@ -39,9 +45,16 @@ class ServerTest {
     mdbopts.db = db_;
     mdb_ = new MDB(mdbopts);
     mds_env_.env = env;
+    mds_ = NULL;
+    Reopen(MDSOptions().num_shards);
+  }
+
+  void Reopen(int num_shards) {
+    delete mds_;
     MDSOptions mdsopts;
     mdsopts.mds_env = &mds_env_;
     mdsopts.mdb = mdb_;
+    mdsopts.num_shards = num_shards;
     mds_ = MDS::Open(mdsopts);
   }
 
@@ -118,20 +131,307 @@ class ServerTest {
     }
   }
 
-  int Listdir(int dir_ino) {
+  // Return the lease due granted by a lookup, or 0 on errors.
+  uint64_t Lookup(int dir_ino, int nod_no) {
+    MDS::LookupOptions options;
+    options.dir_id = DirId(0, 0, dir_ino);
+    std::string name = NodeName(nod_no);
+    options.name = name;
+    std::string name_hash;
+    DirIndex::PutHash(&name_hash, name);
+    options.name_hash = name_hash;
+    MDS::LookupRet ret;
+    Status s = mds_->Lookup(options, &ret);
+    if (s.ok()) {
+      return ret.stat.LeaseDue();
+    } else {
+      return 0;
+    }
+  }
+
+  // Return the new lease due, or 0 if the lease was not renewed.
+  // Leases are renewed through the RPC adaptors.
+  uint64_t Renew(int dir_ino, int nod_no, uint64_t lease_due) {
+    MDS::RPC::SRV srv(mds_);
+    MDS::RPC::CLI cli(&srv);
+    MDS::RenewOptions options;
+    options.dir_id = DirId(0, 0, 0);
+    options.session_id = 0;
+    options.op_due = DELTAFS_MAX_MICROS;
+    std::string name_hash;
+    DirIndex::PutHash(&name_hash, NodeName(nod_no));
+    MDS::RenewEntry entry;
+    entry.dir_id = DirId(0, 0, dir_ino);
+    entry.name_hash = name_hash;
+    entry.lease_due = lease_due;
+    options.leases.push_back(entry);
+    MDS::RenewRet ret;
+    ASSERT_OK(cli.Renew(options, &ret));
+    ASSERT_EQ(ret.lease_dues.size(), 1);
+    return ret.lease_dues[0];
+  }
+
+  // Return the number of entries listed page by page, or "-err_code".
+  int Listdir(int dir_ino, uint32_t page_size = 0) {
     MDS::ListdirOptions options;
     options.dir_id = DirId(0, 0, dir_ino);
+    options.max_entries = page_size;
+    options.with_stats = false;
     std::vector<std::string> names;
     MDS::ListdirRet ret;
     ret.names = &names;
-    Status s = mds_->Listdir(options, &ret);
-    if (s.ok()) {
-      return names.size();
-    } else {
-      return -1 * s.err_code();
+    ret.stats = NULL;
+    std::string cursor;
+    do {
+      options.start_hash = cursor;
+      Status s = mds_->Listdir(options, &ret);
+      if (!s.ok()) {
+        return -1 * s.err_code();
+      }
+      cursor.swap(ret.next_hash);
+    } while (!cursor.empty());
+    return names.size();
+  }
+};
+
+namespace {
+struct CreatState {
+  ServerTest* test;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_files;
+  std::vector<int> inos;  // Inos of successful creates
+  CreatState() : cv(&mu), num_running(0) {}
+};
+
+struct CreatArg {
+  CreatState* state;
+  int dir_ino;
+  int first_name;
+};
+
+}  // namespace
+
+static void CreatWork(void* arg) {
+  CreatArg* a = reinterpret_cast<CreatArg*>(arg);
+  CreatState* state = a->state;
+  std::vector<int> inos;
+  for (int i = 0; i < state->num_files; i++) {
+    int r = state->test->Mknod(a->dir_ino, a->first_name + i);
+    if (r > 0) {
+      inos.push_back(r);
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->inos.insert(state->inos.end(), inos.begin(), inos.end());
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+// Run all creates in parallel and return the time they took in micros.
+static uint64_t RunCreates(CreatState* state, CreatArg* args, int n) {
+  const uint64_t start = Env::Default()->NowMicros();
+  state->num_running = n;
+  for (int i = 0; i < n; i++) {
+    args[i].state = state;
+    Env::Default()->StartThread(CreatWork, &args[i]);
+  }
+  state->mu.Lock();
+  while (state->num_running > 0) {
+    state->cv.Wait();
+  }
+  state->mu.Unlock();
+  return Env::Default()->NowMicros() - start;
+}
+
+static bool AllUnique(std::vector<int>* inos) {
+  std::sort(inos->begin(), inos->end());
+  return std::unique(inos->begin(), inos->end()) == inos->end();
+}
+
+// Create files from multiple threads, each in a private directory, and
+// report the throughput with a single shard versus the default sharding.
+TEST(ServerTest, ConcurrentCreates) {
+  const int kThreads = 8;
+  const int kShards[] = {1, MDSOptions().num_shards};
+  for (int r = 0; r < 2; r++) {
+    Reopen(kShards[r]);
+    CreatState state;
+    state.test = this;
+    state.num_files = 500;
+    CreatArg args[kThreads];
+    for (int i = 0; i < kThreads; i++) {
+      args[i].dir_ino = 100 * (r + 1) + i;
+      args[i].first_name = 0;
+    }
+    const uint64_t dura = RunCreates(&state, args, kThreads);
+    fprintf(stderr, "%d shard(s): %d creates in %.3f ms (%.0f ops/s)\n",
+            kShards[r], kThreads * state.num_files, dura / 1000.0,
+            kThreads * state.num_files * 1000000.0 / dura);
+    // All creates should succeed with a distinct ino
+    ASSERT_EQ(state.inos.size(), kThreads * state.num_files);
+    ASSERT_TRUE(AllUnique(&state.inos));
+    for (int i = 0; i < kThreads; i++) {
+      ASSERT_EQ(Listdir(args[i].dir_ino), state.num_files);
+    }
+  }
+}
+
+// Run creates through the RPC adaptors over an in-process transport to
+// measure the CPU cost of the MDS RPC stack without a network.
+TEST(ServerTest, InprocCreates) {
+  const int kThreads = 8;
+  const std::string uri = "inproc://mds_srv_test";
+  MDS::RPC::SRV srv(mds_);
+  RPCOptions rpcopts;
+  rpcopts.uri = uri;
+  rpcopts.num_io_threads = 2;
+  rpcopts.fs = &srv;
+  RPC* rpc = RPC::Open(rpcopts);
+  ASSERT_OK(rpc->Start());
+  rpc::If* stub = rpc->OpenClientFor(uri);
+  MDS::RPC::CLI cli(stub);
+  MDS* const mds = mds_;
+  mds_ = &cli;  // Creates below go through rpc
+  CreatState state;
+  state.test = this;
+  state.num_files = 500;
+  CreatArg args[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    args[i].dir_ino = 100 + i;
+    args[i].first_name = 0;
+  }
+  const uint64_t dura = RunCreates(&state, args, kThreads);
+  mds_ = mds;
+  fprintf(stderr, "%d creates over inproc rpc in %.3f ms (%.0f ops/s)\n",
+          kThreads * state.num_files, dura / 1000.0,
+          kThreads * state.num_files * 1000000.0 / dura);
+  delete stub;
+  delete rpc;
+  ASSERT_EQ(state.inos.size(), kThreads * state.num_files);
+  ASSERT_TRUE(AllUnique(&state.inos));
+  for (int i = 0; i < kThreads; i++) {
+    ASSERT_EQ(Listdir(args[i].dir_ino), state.num_files);
+  }
+}
+
+namespace {
+// Hold calls until opened and count the messages sent to a server.
+class GatedStub : public rpc::If {
+ public:
+  explicit GatedStub(rpc::If* base)
+      : base_(base), cv_(&mu_), open_(false), num_calls_(0) {}
+
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    mu_.Lock();
+    num_calls_++;
+    while (!open_) {
+      cv_.Wait();
     }
+    mu_.Unlock();
+    return base_->Call(in, out);
+  }
+
+  static void OpenLater(void* arg) {
+    GatedStub* stub = reinterpret_cast<GatedStub*>(arg);
+    Env::Default()->SleepForMicroseconds(200 * 1000);
+    MutexLock ml(&stub->mu_);
+    stub->open_ = true;
+    stub->cv_.SignalAll();
+  }
+
+  int num_calls() {
+    MutexLock ml(&mu_);
+    return num_calls_;
   }
+
+ private:
+  rpc::If* base_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  bool open_;
+  int num_calls_;
 };
+}  // namespace
+
+// Creates queued behind calls in flight are coalesced into multi-op
+// messages and keep their own results.
+TEST(ServerTest, CoalescedCreates) {
+  const int kThreads = 16;
+  ASSERT_TRUE(Mknod(1, 0) > 0);
+  ThreadPool* pool = ThreadPool::NewFixed(2);
+  MDS::RPC::SRV srv(mds_, pool);
+  GatedStub stub(&srv);
+  MDS::RPC::CLI cli(&stub, 8);
+  MDS* const mds = mds_;
+  mds_ = &cli;  // Creates below go through rpc
+  CreatState state;
+  state.test = this;
+  state.num_files = 1;
+  CreatArg args[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    args[i].dir_ino = 1;
+    args[i].first_name = i;
+  }
+  Env::Default()->StartThread(GatedStub::OpenLater, &stub);
+  RunCreates(&state, args, kThreads);
+  mds_ = mds;
+  delete pool;
+  fprintf(stderr, "%d creates sent in %d messages\n", kThreads,
+          stub.num_calls());
+  ASSERT_LT(stub.num_calls(), kThreads);
+  // Node 0 already exists
+  ASSERT_EQ(state.inos.size(), kThreads - 1);
+  ASSERT_TRUE(AllUnique(&state.inos));
+  ASSERT_EQ(Listdir(1), kThreads);
+}
+
+// Create distinct files in a shared directory from multiple threads so
+// their updates are group committed.
+TEST(ServerTest, SharedDirCreates) {
+  const int kThreads = 8;
+  CreatState state;
+  state.test = this;
+  state.num_files = 100;
+  CreatArg args[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    args[i].dir_ino = 1;
+    args[i].first_name = i * state.num_files;
+  }
+  const uint64_t dura = RunCreates(&state, args, kThreads);
+  fprintf(stderr, "%d creates in a shared dir in %.3f ms (%.0f ops/s)\n",
+          kThreads * state.num_files, dura / 1000.0,
+          kThreads * state.num_files * 1000000.0 / dura);
+  ASSERT_EQ(state.inos.size(), kThreads * state.num_files);
+  ASSERT_TRUE(AllUnique(&state.inos));
+  ASSERT_EQ(Listdir(1), kThreads * state.num_files);
+  // Directory size must account for every create
+  DirInfo info;
+  ASSERT_OK(mdb_->GetInfo(DirId(0, 0, 1), &info, NULL));
+  ASSERT_EQ(info.size, kThreads * state.num_files);
+}
+
+// Race exclusive creates of the same names. Exactly one create per name
+// should succeed even when competing creates land in one group.
+TEST(ServerTest, SharedDirRaces) {
+  const int kThreads = 8;
+  CreatState state;
+  state.test = this;
+  state.num_files = 100;
+  CreatArg args[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    args[i].dir_ino = 2;
+    args[i].first_name = 0;
+  }
+  RunCreates(&state, args, kThreads);
+  ASSERT_EQ(state.inos.size(), state.num_files);
+  ASSERT_TRUE(AllUnique(&state.inos));
+  ASSERT_EQ(Listdir(2), state.num_files);
+  DirInfo info;
+  ASSERT_OK(mdb_->GetInfo(DirId(0, 0, 2), &info, NULL));
+  ASSERT_EQ(info.size, state.num_files);
+}
 
 TEST(ServerTest, StartStop) {
   // empty
@@ -159,6 +459,255 @@ TEST(ServerTest, Dirs) {
   ASSERT_TRUE(r4 == -1 * Status::kAlreadyExists);
 }
 
+// Batch creates go through the RPC encoding to exercise the whole path.
+TEST(ServerTest, Batch) {
+  ASSERT_TRUE(Mknod(0, 1) > 0);
+  const int nodes[] = {1, 2, 3, 2};
+  const uint32_t modes[] = {ACCESSPERMS, ACCESSPERMS, S_IFDIR | ACCESSPERMS,
+                            ACCESSPERMS};
+  const int n = sizeof(nodes) / sizeof(nodes[0]);
+  std::string names[n + 1];
+  std::string hashes[n + 1];
+  MDS::BcreatOptions options;
+  options.dir_id = DirId(0, 0, 0);
+  options.flags = O_EXCL;
+  options.uid = 0;
+  options.gid = 0;
+  for (int i = 0; i < n + 1; i++) {
+    MDS::BcreatEntry entry;
+    if (i < n) {  // The last entry is left empty
+      names[i] = NodeName(nodes[i]);
+      DirIndex::PutHash(&hashes[i], names[i]);
+      entry.mode = modes[i];
+    } else {
+      entry.mode = ACCESSPERMS;
+    }
+    entry.name_hash = hashes[i];
+    entry.name = names[i];
+    options.entries.push_back(entry);
+  }
+  MDS::RPC::SRV srv(mds_);
+  MDS::RPC::CLI cli(&srv);
+  MDS::BcreatRet ret;
+  ASSERT_OK(cli.Bcreat(options, &ret));
+  ASSERT_EQ(ret.statuses.size(), n + 1);
+  ASSERT_TRUE(ret.statuses[0].IsAlreadyExists());
+  ASSERT_OK(ret.statuses[1]);
+  ASSERT_TRUE(S_ISREG(ret.stats[1].FileMode()));
+  ASSERT_EQ(Fstat(0, 2), ret.stats[1].InodeNo());
+  ASSERT_OK(ret.statuses[2]);
+  ASSERT_TRUE(S_ISDIR(ret.stats[2].FileMode()));
+  ASSERT_EQ(Fstat(0, 3), ret.stats[2].InodeNo());
+  ASSERT_TRUE(ret.statuses[3].IsAlreadyExists());  // Created earlier
+  ASSERT_TRUE(ret.statuses[4].IsInvalidArgument());
+  DirInfo info;
+  ASSERT_OK(mdb_->GetInfo(DirId(0, 0, 0), &info, NULL));
+  ASSERT_EQ(info.size, 3);
+  // Without O_EXCL, existing names of the right type are reported as is
+  options.flags = 0;
+  options.entries.pop_back();
+  ASSERT_OK(cli.Bcreat(options, &ret));
+  for (int i = 0; i < n; i++) {
+    ASSERT_OK(ret.statuses[i]);
+    ASSERT_EQ(Fstat(0, nodes[i]), ret.stats[i].InodeNo());
+  }
+}
+
+// Page through a directory with stats through the RPC encoding.
+TEST(ServerTest, Pages) {
+  const int kFiles = 2500;  // More than a single page can hold
+  for (int i = 0; i < kFiles; i++) {
+    ASSERT_TRUE(Mknod(0, i) > 0);
+  }
+  ASSERT_EQ(Listdir(0), kFiles);
+  ASSERT_EQ(Listdir(0, 7), kFiles);
+  MDS::RPC::SRV srv(mds_);
+  MDS::RPC::CLI cli(&srv);
+  MDS::ListdirOptions options;
+  options.dir_id = DirId(0, 0, 0);
+  options.session_id = 0;
+  options.op_due = DELTAFS_MAX_MICROS;
+  options.max_entries = 100;
+  options.with_stats = true;
+  std::vector<std::string> names;
+  std::vector<Stat> stats;
+  MDS::ListdirRet ret;
+  ret.names = &names;
+  ret.stats = &stats;
+  std::string cursor;
+  int num_pages = 0;
+  do {
+    options.start_hash = cursor;
+    ASSERT_OK(cli.Listdir(options, &ret));
+    cursor.swap(ret.next_hash);
+    num_pages++;
+  } while (!cursor.empty());
+  ASSERT_EQ(num_pages, kFiles / 100);
+  ASSERT_EQ(names.size(), kFiles);
+  ASSERT_EQ(stats.size(), kFiles);
+  std::vector<int> inos;
+  for (size_t i = 0; i < names.size(); i++) {
+    int n;
+    ASSERT_EQ(sscanf(names[i].c_str(), "node%d", &n), 1);
+    ASSERT_EQ(Fstat(0, n), stats[i].InodeNo());
+    inos.push_back(n);
+  }
+  ASSERT_TRUE(AllUnique(&inos));
+}
+
+TEST(ServerTest, NodeCache) {
+  MDS::SRV* const srv = static_cast<MDS::SRV*>(mds_);
+  NodeCache::Stats s0;
+  srv->GetNodeCacheStats(&s0);
+  ASSERT_EQ(Fstat(0, 1), -1 * Status::kNotFound);
+  ASSERT_EQ(Fstat(0, 1), -1 * Status::kNotFound);  // Negative hit
+  NodeCache::Stats s1;
+  srv->GetNodeCacheStats(&s1);
+  ASSERT_EQ(s1.negative_hits - s0.negative_hits, 1);
+  // Creates must replace negative entries
+  int ino = Mknod(0, 1);
+  ASSERT_TRUE(ino > 0);
+  ASSERT_EQ(Fstat(0, 1), ino);
+  ASSERT_EQ(Fstat(0, 1), ino);
+  NodeCache::Stats s2;
+  srv->GetNodeCacheStats(&s2);
+  ASSERT_EQ(s2.hits - s1.hits, 3);  // Including the check made by the create
+  ASSERT_EQ(s2.negative_hits - s1.negative_hits, 1);
+  // Updates must be seen by later reads
+  MDS::ChmodOptions options;
+  options.dir_id = DirId(0, 0, 0);
+  options.mode = S_IRUSR;
+  std::string name = NodeName(1);
+  std::string name_hash;
+  DirIndex::PutHash(&name_hash, name);
+  options.name = name;
+  options.name_hash = name_hash;
+  MDS::ChmodRet ret;
+  ASSERT_OK(mds_->Chmod(options, &ret));
+  MDS::FstatOptions fstat_options;
+  *static_cast<MDS::BaseOptions*>(&fstat_options) = options;
+  MDS::FstatRet fstat_ret;
+  ASSERT_OK(mds_->Fstat(fstat_options, &fstat_ret));
+  ASSERT_EQ(fstat_ret.stat.FileMode() & ACCESSPERMS, S_IRUSR);
+  MDS::UnlinkOptions unlink_options;
+  *static_cast<MDS::BaseOptions*>(&unlink_options) = options;
+  unlink_options.flags = 0;
+  MDS::UnlinkRet unlink_ret;
+  ASSERT_OK(mds_->Unlink(unlink_options, &unlink_ret));
+  ASSERT_EQ(Fstat(0, 1), -1 * Status::kNotFound);
+}
+
+TEST(ServerTest, Leases) {
+  delete mds_;
+  MDSOptions mdsopts;
+  mdsopts.mds_env = &mds_env_;
+  mdsopts.mdb = mdb_;
+  mdsopts.lease_duration = 50 * 1000;
+  mds_ = MDS::Open(mdsopts);
+  MDS::SRV* const srv = static_cast<MDS::SRV*>(mds_);
+  ASSERT_TRUE(Mkdir(0, 1) > 0);
+  ASSERT_TRUE(Mkdir(0, 2) > 0);
+  uint64_t due = Lookup(0, 1);
+  ASSERT_TRUE(due != 0);
+  uint64_t new_due = Renew(0, 1, due);
+  ASSERT_GE(new_due, due);
+  ASSERT_EQ(Renew(0, 2, new_due), 0);  // Never granted
+  ASSERT_EQ(Renew(0, 1, 1), 0);        // Already expired
+  // Expired leases are reclaimed as new leases are inserted
+  Env::Default()->SleepForMicroseconds(2 * mdsopts.lease_duration);
+  ASSERT_TRUE(Lookup(0, 2) != 0);
+  MDS::SRV::LeaseStats s1;
+  srv->GetLeaseStats(&s1);
+  ASSERT_GE(s1.table.expired, 1);
+  ASSERT_EQ(s1.renewed, 1);
+  ASSERT_EQ(s1.not_renewed, 2);
+  // Writes wait for leases to expire and void them
+  due = Lookup(0, 1);
+  ASSERT_TRUE(due != 0);
+  MDS::ChmodOptions options;
+  options.dir_id = DirId(0, 0, 0);
+  options.mode = S_IRWXU;
+  std::string name = NodeName(1);
+  std::string name_hash;
+  DirIndex::PutHash(&name_hash, name);
+  options.name = name;
+  options.name_hash = name_hash;
+  MDS::ChmodRet ret;
+  ASSERT_OK(mds_->Chmod(options, &ret));
+  ASSERT_EQ(Renew(0, 1, due), 0);
+  MDS::SRV::LeaseStats s2;
+  srv->GetLeaseStats(&s2);
+  ASSERT_EQ(s2.write_waits - s1.write_waits, 1);
+  ASSERT_GT(s2.write_wait_micros, s1.write_wait_micros);
+}
+
+TEST(ServerTest, Stats) {
+  ASSERT_TRUE(Mknod(0, 1) > 0);
+  ASSERT_TRUE(Mknod(0, 2) > 0);
+  ASSERT_TRUE(Fstat(0, 1) > 0);
+  ASSERT_TRUE(Fstat(0, 3) < 0);
+  MDS::RPC::SRV srv(mds_);
+  MDS::RPC::CLI cli(&srv);
+  MDS::GetstatsOptions options;
+  MDS::GetstatsRet ret;
+  ASSERT_OK(cli.Getstats(options, &ret));
+  ASSERT_TRUE(ret.info.find("Fcreat.total count=2 ") != std::string::npos);
+  ASSERT_TRUE(ret.info.find("Fcreat.db_commit count=2 ") != std::string::npos);
+  ASSERT_TRUE(ret.info.find("Fstat.total count=2 ") != std::string::npos);
+  // Cached names are found without reading the db
+  ASSERT_TRUE(ret.info.find("Fstat.db_read count=") != std::string::npos);
+  ASSERT_TRUE(ret.info.find("Mkdir.") == std::string::npos);
+}
+
+// Serve a finished namespace through a read-only db image. A second
+// server is opened on the same image as a replica.
+TEST(ServerTest, Readonly) {
+  ASSERT_TRUE(Mkdir(0, 1) > 0);
+  ASSERT_TRUE(Mknod(0, 2) > 0);
+  ASSERT_TRUE(Mknod(1, 3) > 0);
+  delete mds_;
+  mds_ = NULL;
+  FlushOptions flushopts;
+  flushopts.wait = true;
+  ASSERT_OK(db_->FlushMemTable(flushopts));
+  MDS* replicas[2];
+  MDB* mdbs[2];
+  DB* dbs[2];
+  for (int i = 0; i < 2; i++) {
+    DBOptions dbopts;
+    dbopts.env = mds_env_.env;
+    ASSERT_OK(ReadonlyDB::Open(dbopts, dbname_, &dbs[i]));
+    MDBOptions mdbopts;
+    mdbopts.db = dbs[i];
+    mdbs[i] = new MDB(mdbopts);
+    MDSOptions mdsopts;
+    mdsopts.mds_env = &mds_env_;
+    mdsopts.mdb = mdbs[i];
+    mdsopts.read_only = true;
+    replicas[i] = MDS::Open(mdsopts);
+  }
+  for (int i = 0; i < 2; i++) {
+    mds_ = replicas[i];
+    ASSERT_TRUE(Fstat(0, 1) > 0);
+    ASSERT_TRUE(Fstat(0, 2) > 0);
+    ASSERT_TRUE(Fstat(1, 3) > 0);
+    ASSERT_EQ(Fstat(0, 3), -1 * Status::kNotFound);
+    ASSERT_EQ(Fstat(2, 1), -1 * Status::kNotFound);  // Never accessed
+    ASSERT_EQ(Lookup(0, 1), DELTAFS_MAX_MICROS);
+    ASSERT_EQ(Lookup(0, 2), 0);  // Not a directory
+    ASSERT_EQ(Listdir(0), 2);
+    ASSERT_EQ(Listdir(1, 1), 1);
+    ASSERT_EQ(Mknod(0, 4), -1 * Status::kReadOnly);
+    ASSERT_EQ(Mkdir(0, 5), -1 * Status::kReadOnly);
+  }
+  mds_ = NULL;
+  for (int i = 0; i < 2; i++) {
+    delete replicas[i];
+    delete mdbs[i];
+    delete dbs[i];
+  }
+}
+
 TEST(ServerTest, Scan) {
   Mknod(0, 1);
   Mknod(0, 2);
@@ -173,6 +722,519 @@ TEST(ServerTest, Scan) {
   ASSERT_TRUE(r == 9);
 }
 
+// A group of servers, each with a private DB, that a client reaches through
+// direct calls. Servers reach each other through the same factory.
+class SplitTest : public MDSFactory {
+ protected:
+  enum { kServers = 2, kVirtualServers = 8 };
+  std::string dbnames_[kServers];
+  MDSEnv mds_env_;
+  MDS* mds_[kServers];
+  SimpleMDSMonitor* mon_[kServers];  // Counting the ops sent to each server
+  // Ops are encoded and decoded as RPC messages on their way to servers
+  MDS::RPC::SRV* srv_[kServers];
+  MDS::RPC::CLI* stub_[kServers];
+  MDB* mdb_[kServers];
+  DB* db_[kServers];
+  ThreadPool* pool_;
+  ThreadPool* bg_pool_;
+  MDS::CLI* cli_;
+
+ public:
+  SplitTest() {
+    Env* env = Env::Default();
+    for (int i = 0; i < kServers; i++) {
+      char tmp[50];
+      snprintf(tmp, sizeof(tmp), "mds_split_test_%d", i);
+      dbnames_[i] = test::PrepareTmpDir(tmp, env);
+      DBOptions dbopts;
+      dbopts.env = env;
+      DestroyDB(dbnames_[i], dbopts);
+      dbopts.create_if_missing = true;
+      ASSERT_OK(DB::Open(dbopts, dbnames_[i], &db_[i]));
+      MDBOptions mdbopts;
+      mdbopts.db = db_[i];
+      mdb_[i] = new MDB(mdbopts);
+      mds_[i] = NULL;
+      mon_[i] = NULL;
+      srv_[i] = NULL;
+      stub_[i] = NULL;
+    }
+    mds_env_.env = env;
+    pool_ = ThreadPool::NewFixed(kServers);
+    bg_pool_ = ThreadPool::NewFixed(kServers);
+    cli_ = NULL;
+  }
+
+  virtual ~SplitTest() {
+    delete cli_;
+    delete pool_;
+    delete bg_pool_;
+    WaitForSplits();  // Splits may still be calling other servers
+    for (int i = 0; i < kServers; i++) {
+      delete stub_[i];
+      delete srv_[i];
+      delete mon_[i];
+      delete mds_[i];
+      delete mdb_[i];
+      delete db_[i];
+    }
+  }
+
+  virtual MDS* Get(size_t srv_id) {
+    ASSERT_TRUE(srv_id < kServers);
+    return stub_[srv_id];
+  }
+
+  void Open(uint64_t split_threshold, uint64_t lease_duration = 1000 * 1000) {
+    for (int i = 0; i < kServers; i++) {
+      MDSOptions mdsopts;
+      mdsopts.mds_env = &mds_env_;
+      mdsopts.mdb = mdb_[i];
+      mdsopts.split_threshold = split_threshold;
+      mdsopts.lease_duration = lease_duration;
+      mdsopts.peers = this;
+      mdsopts.split_dir = test::TmpDir() + "/mds_split_test_tables";
+      mdsopts.num_virtual_servers = kVirtualServers;
+      mdsopts.num_servers = kServers;
+      mdsopts.srv_id = i;
+      mds_[i] = MDS::Open(mdsopts);
+      mon_[i] = new SimpleMDSMonitor(mds_[i]);
+      srv_[i] = new MDS::RPC::SRV(mon_[i]);
+      stub_[i] = new MDS::RPC::CLI(srv_[i]);
+    }
+    OpenClient();
+  }
+
+  // Open a new client with an empty cache.
+  void OpenClient(size_t write_back_batch = 0) {
+    delete cli_;
+    cli_ = NewClient(write_back_batch);
+  }
+
+  MDS::CLI* NewClient(size_t write_back_batch) {
+    MDSCliOptions cliopts;
+    cliopts.write_back_batch = write_back_batch;
+    cliopts.env = mds_env_.env;
+    cliopts.factory = this;
+    cliopts.listdir_pool = pool_;
+    cliopts.bg_pool = bg_pool_;
+    cliopts.num_virtual_servers = kVirtualServers;
+    cliopts.num_servers = kServers;
+    return MDS::CLI::Open(cliopts);
+  }
+
+  // Wait for the background splits of all servers to finish.
+  void WaitForSplits() {
+    for (int i = 0; i < kServers; i++) {
+      if (mds_[i] != NULL) {
+        static_cast<MDS::SRV*>(mds_[i])->WaitForSplits();
+      }
+    }
+  }
+
+  // Sum a count over all servers.
+  unsigned long long Count(unsigned long long (SimpleMDSMonitor::*f)() const) {
+    unsigned long long r = 0;
+    for (int i = 0; i < kServers; i++) {
+      r += (mon_[i]->*f)();
+    }
+    return r;
+  }
+
+  void ResetCounts() {
+    for (int i = 0; i < kServers; i++) {
+      mon_[i]->Reset();
+    }
+  }
+
+  static std::string FileName(int i) {
+    char tmp[50];
+    snprintf(tmp, sizeof(tmp), "/file%d", i);
+    return tmp;
+  }
+
+  // Create files in the root directory and return their throughput.
+  double Creates(int n) {
+    const uint64_t start = mds_env_.env->NowMicros();
+    for (int i = 0; i < n; i++) {
+      ASSERT_OK(cli_->Fcreat(FileName(i), ACCESSPERMS));
+    }
+    const uint64_t dura = mds_env_.env->NowMicros() - start;
+    return n * 1000000.0 / dura;
+  }
+
+  // Check that all files are found and return the number of entries kept by
+  // a given server.
+  int Check(int n, int srv_id) {
+    WaitForSplits();
+    for (int i = 0; i < n; i++) {
+      ASSERT_OK(cli_->Fstat(FileName(i)));
+    }
+    ASSERT_TRUE(cli_->Fstat(FileName(n)).IsNotFound());
+    std::vector<std::string> hashes;
+    mdb_[srv_id]->ListHashes(DirId(0, 0, 0), Slice(), Slice(), &hashes, NULL);
+    DirInfo info;
+    ASSERT_OK(mdb_[srv_id]->GetInfo(DirId(0, 0, 0), &info, NULL));
+    ASSERT_EQ(info.size, hashes.size());
+    return static_cast<int>(hashes.size());
+  }
+
+  static int SaveFile(const Slice& name, const Stat* stat, void* arg) {
+    ASSERT_TRUE(stat != NULL && S_ISREG(stat->FileMode()));
+    reinterpret_cast<std::vector<std::string>*>(arg)->push_back(
+        name.ToString());
+    return 0;
+  }
+
+  // List the root directory across all servers and return the number of
+  // distinct names found.
+  int List() {
+    WaitForSplits();
+    std::vector<std::string> names;
+    ASSERT_OK(cli_->Listdir("/", SaveFile, &names, true));
+    std::sort(names.begin(), names.end());
+    ASSERT_TRUE(std::unique(names.begin(), names.end()) == names.end());
+    return static_cast<int>(names.size());
+  }
+};
+
+// Start with a single partition and let it split as files are created.
+// Split partitions are moved to the other server as table files.
+TEST(SplitTest, IncrementalSplits) {
+  const int kFiles = 2000;
+  Open(100);
+  fprintf(stderr, "%d creates with incremental splits (%.0f ops/s)\n", kFiles,
+          Creates(kFiles));
+  int total = 0;
+  for (int i = 0; i < kServers; i++) {
+    const int r = Check(kFiles, i);
+    ASSERT_GT(r, 0);  // Every server should have received a share
+    total += r;
+  }
+  ASSERT_EQ(total, kFiles);
+  ASSERT_EQ(List(), kFiles);
+  // Partitions taken over by a server are timed like other ops
+  MDS::GetstatsOptions options;
+  MDS::GetstatsRet ret;
+  ASSERT_OK(stub_[1]->Getstats(options, &ret));
+  ASSERT_TRUE(ret.info.find("Addpart.total count=") != std::string::npos);
+  ASSERT_TRUE(ret.info.find("Addpart.db_commit count=") != std::string::npos);
+}
+
+// Same workload as above but with directories pre-split across all virtual
+// servers. Creates are spread evenly from the start.
+TEST(SplitTest, PreSplits) {
+  const int kFiles = 2000;
+  Open(0);
+  fprintf(stderr, "%d creates with pre-splits (%.0f ops/s)\n", kFiles,
+          Creates(kFiles));
+  int total = 0;
+  for (int i = 0; i < kServers; i++) {
+    total += Check(kFiles, i);
+  }
+  ASSERT_EQ(total, kFiles);
+  ASSERT_EQ(List(), kFiles);
+}
+
+namespace {
+// Stat every listed entry and list every listed directory through the
+// client doing the listing
+struct NestedListing {
+  MDS::CLI* cli;
+  std::string dir;
+  int num_files;
+  int num_dirs;
+  Status status;
+
+  static int Visit(const Slice& name, const Stat* stat, void* arg) {
+    NestedListing* const l = reinterpret_cast<NestedListing*>(arg);
+    const std::string path = l->dir + "/" + name.ToString();
+    Status s = l->cli->Fstat(path);
+    if (s.ok() && S_ISDIR(stat->FileMode())) {
+      NestedListing sub = *l;
+      sub.dir = path;
+      s = l->cli->Listdir(path, Visit, &sub, true);
+      if (s.ok()) s = sub.status;
+      l->num_files = sub.num_files;
+      l->num_dirs = sub.num_dirs + 1;
+    } else if (s.ok()) {
+      l->num_files++;
+    }
+    if (!s.ok()) {
+      l->status = s;
+      return 1;
+    }
+    return 0;
+  }
+};
+}  // namespace
+
+// Listing callbacks are made by the calling thread, so they can issue
+// other ops, including nested listings, through the same client
+// without tying up pool threads.
+TEST(SplitTest, NestedListing) {
+  const int kDirs = 4;
+  const int kFiles = 200;
+  const int kRootFiles = 8000;  // Several pages per server
+  Open(0);
+  for (int i = 0; i < kRootFiles; i++) {
+    ASSERT_OK(cli_->Fcreat(FileName(kFiles + kDirs + i), ACCESSPERMS));
+  }
+  for (int i = 0; i < kDirs; i++) {
+    const std::string dir = FileName(kFiles + i);
+    ASSERT_OK(cli_->Mkdir(dir, ACCESSPERMS));
+    for (int j = 0; j < kFiles; j++) {
+      ASSERT_OK(cli_->Fcreat(dir + FileName(j), ACCESSPERMS));
+    }
+  }
+  NestedListing l;
+  l.cli = cli_;
+  l.num_files = 0;
+  l.num_dirs = 0;
+  ASSERT_OK(cli_->Listdir("/", NestedListing::Visit, &l, true));
+  ASSERT_OK(l.status);
+  ASSERT_EQ(l.num_dirs, kDirs);
+  ASSERT_EQ(l.num_files, kRootFiles + kDirs * kFiles);
+}
+
+// A fresh client resolves a deep path with a few Resolve calls instead of
+// one lookup per component. After all leases have expired, the path is
+// mostly refreshed with parallel lookups before it is walked.
+TEST(SplitTest, DeepPaths) {
+  const int kDepth = 8;
+  Open(0, 200 * 1000);
+  std::string path;
+  for (int i = 0; i < kDepth; i++) {
+    char tmp[20];
+    snprintf(tmp, sizeof(tmp), "/d%d", i);
+    path += tmp;
+    ASSERT_OK(cli_->Mkdir(path, ACCESSPERMS));
+  }
+  path += "/file";
+  ASSERT_OK(cli_->Fcreat(path, ACCESSPERMS));
+  OpenClient();
+  ResetCounts();
+  ASSERT_OK(cli_->Fstat(path));
+  const unsigned long long resolves =
+      Count(&SimpleMDSMonitor::Get_Resolve_count);
+  ASSERT_GE(resolves, 1);
+  ASSERT_LT(resolves + Count(&SimpleMDSMonitor::Get_Lookup_count), kDepth);
+  fprintf(stderr, "%d-level path resolved by %llu resolve calls\n", kDepth,
+          resolves);
+  // Paths with valid leases are resolved inline without any calls
+  ResetCounts();
+  ASSERT_OK(cli_->Fstat(path));
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Lookup_count), 0);
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Resolve_count), 0);
+  mds_env_.env->SleepForMicroseconds(300 * 1000);
+  ResetCounts();
+  ASSERT_OK(cli_->Fstat(path));
+  // Most components are refreshed ahead of the walk
+  ASSERT_GE(Count(&SimpleMDSMonitor::Get_Lookup_count), 2);
+  ASSERT_LT(Count(&SimpleMDSMonitor::Get_Resolve_count), resolves);
+}
+
+// Buffered creates are sent in batches and their errors are reported
+// at the next sync. Creates are visible to the client that made them.
+TEST(SplitTest, WriteBack) {
+  const int kFiles = 100;
+  Open(0);
+  OpenClient(16);
+  ResetCounts();
+  for (int i = 0; i < kFiles; i++) {
+    ASSERT_OK(cli_->Fcreat(FileName(i), ACCESSPERMS));
+  }
+  ASSERT_OK(cli_->Fstat(FileName(kFiles - 1)));  // Sends the rest
+  ASSERT_OK(cli_->Sync());
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Fcreat_count), 0);
+  ASSERT_GE(Count(&SimpleMDSMonitor::Get_Bcreat_count), kFiles / 16);
+  ASSERT_EQ(List(), kFiles);
+  // Conflicts are only found at the sync point
+  ASSERT_OK(cli_->Fcreat(FileName(0), ACCESSPERMS));
+  ASSERT_OK(cli_->Fcreat(FileName(kFiles), ACCESSPERMS));
+  ASSERT_TRUE(cli_->Sync().IsAlreadyExists());
+  ASSERT_OK(cli_->Sync());
+  ASSERT_OK(cli_->Fstat(FileName(kFiles)));
+  // Creates asking for results are never buffered
+  Fentry ent;
+  ASSERT_OK(cli_->Fcreat(FileName(kFiles + 1), ACCESSPERMS, &ent));
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Fcreat_count), 1);
+}
+
+// Creates left in a partial batch are sent once the write back interval has
+// passed, even if the client that buffered them goes quiet.
+TEST(SplitTest, WriteBackInterval) {
+  Open(0);
+  OpenClient(16);
+  MDS::CLI* other = NewClient(0);
+  ASSERT_OK(cli_->Fcreat(FileName(0), ACCESSPERMS));
+  const uint64_t start = mds_env_.env->NowMicros();
+  Status s = other->Fstat(FileName(0));
+  while (s.IsNotFound() && mds_env_.env->NowMicros() - start < 10000000) {
+    mds_env_.env->SleepForMicroseconds(10000);
+    s = other->Fstat(FileName(0));
+  }
+  ASSERT_OK(s);
+  ASSERT_GE(mds_env_.env->NowMicros() - start,
+            MDSCliOptions().write_back_interval / 2);
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Bcreat_count), 1);
+  delete other;
+}
+
+namespace {
+// Async ops still in flight along with the first error they hit
+struct AsyncState {
+  AsyncState() : cv(&mu), num_pending(0) {}
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_pending;
+  Status status;
+
+  void Wait() {
+    MutexLock ml(&mu);
+    while (num_pending != 0) {
+      cv.Wait();
+    }
+  }
+};
+
+void AsyncDone(void* arg, const Status& s) {
+  AsyncState* state = reinterpret_cast<AsyncState*>(arg);
+  MutexLock ml(&state->mu);
+  if (state->status.ok()) {
+    state->status = s;
+  }
+  state->num_pending--;
+  state->cv.SignalAll();
+}
+}  // namespace
+
+// Async ops follow redirects as the root directory splits, and report the
+// same results as their synchronous versions.
+TEST(SplitTest, AsyncOps) {
+  const int kFiles = 1000;
+  Open(100);
+  AsyncState state;
+  std::vector<Fentry> ents(kFiles);
+  state.num_pending = kFiles;
+  for (int i = 0; i < kFiles; i++) {
+    cli_->AsyncFcreat(FileName(i), ACCESSPERMS, &ents[i], AsyncDone, &state);
+  }
+  state.Wait();
+  ASSERT_OK(state.status);
+  ASSERT_EQ(Count(&SimpleMDSMonitor::Get_Fcreat_count), kFiles);
+  ASSERT_EQ(List(), kFiles);
+  state.num_pending = 1;
+  cli_->AsyncFcreat(FileName(0), ACCESSPERMS, NULL, AsyncDone, &state);
+  state.Wait();
+  ASSERT_TRUE(state.status.IsAlreadyExists());
+  state.status = Status::OK();
+  // A fresh client only knows the initial index of the root
+  OpenClient();
+  std::vector<Fentry> stats(kFiles);
+  state.num_pending = kFiles;
+  for (int i = 0; i < kFiles; i++) {
+    cli_->AsyncFstat(FileName(i), &stats[i], AsyncDone, &state);
+  }
+  state.Wait();
+  ASSERT_OK(state.status);
+  for (int i = 0; i < kFiles; i++) {
+    ASSERT_EQ(stats[i].stat.InodeNo(), ents[i].stat.InodeNo());
+    ASSERT_TRUE(S_ISREG(stats[i].stat.FileMode()));
+  }
+  Fentry dir;
+  state.num_pending = 1;
+  cli_->AsyncMkdir("/dir", ACCESSPERMS, &dir, AsyncDone, &state);
+  state.Wait();
+  ASSERT_OK(state.status);
+  ASSERT_TRUE(S_ISDIR(dir.stat.FileMode()));
+  state.num_pending = kFiles;
+  for (int i = 0; i < kFiles; i++) {
+    cli_->AsyncUnlink(FileName(i), NULL, AsyncDone, &state);
+  }
+  state.Wait();
+  ASSERT_OK(state.status);
+  ASSERT_TRUE(cli_->Fstat(FileName(0)).IsNotFound());
+  ASSERT_OK(cli_->Fstat("/dir"));
+}
+
+namespace {
+struct ClientState {
+  MDS::CLI* cli;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_files;
+  bool all_ok;
+  ClientState() : cv(&mu), num_running(0), all_ok(true) {}
+};
+
+struct ClientArg {
+  ClientState* state;
+  std::string dir;
+};
+
+}  // namespace
+
+// Create and then stat files under a private directory.
+static void ClientWork(void* arg) {
+  ClientArg* a = reinterpret_cast<ClientArg*>(arg);
+  ClientState* state = a->state;
+  bool ok = true;
+  char tmp[20];
+  for (int i = 0; i < state->num_files; i++) {
+    snprintf(tmp, sizeof(tmp), "/f%d", i);
+    ok = ok && state->cli->Fcreat(a->dir + tmp, ACCESSPERMS).ok();
+  }
+  for (int i = 0; i < state->num_files; i++) {
+    snprintf(tmp, sizeof(tmp), "/f%d", i);
+    ok = ok && state->cli->Fstat(a->dir + tmp).ok();
+  }
+  MutexLock ml(&state->mu);
+  state->all_ok = state->all_ok && ok;
+  state->num_running--;
+  state->cv.SignalAll();
+}
+
+// Share one client among multiple threads and report the throughput of
+// their creates and stats as more threads are added. Threads work under
+// different directories, so they only share the client's caches.
+TEST(SplitTest, ConcurrentClients) {
+  const int kThreads[] = {1, 8};
+  Open(0);
+  for (int r = 0; r < 2; r++) {
+    ClientState state;
+    state.cli = cli_;
+    state.num_files = 500;
+    std::vector<ClientArg> args(kThreads[r]);
+    for (int i = 0; i < kThreads[r]; i++) {
+      char tmp[50];
+      snprintf(tmp, sizeof(tmp), "/r%d_t%d", r, i);
+      args[i].state = &state;
+      args[i].dir = tmp;
+      ASSERT_OK(cli_->Mkdir(args[i].dir, ACCESSPERMS));
+      args[i].dir += "/a";
+      ASSERT_OK(cli_->Mkdir(args[i].dir, ACCESSPERMS));
+    }
+    const uint64_t start = mds_env_.env->NowMicros();
+    state.num_running = kThreads[r];
+    for (int i = 0; i < kThreads[r]; i++) {
+      mds_env_.env->StartThread(ClientWork, &args[i]);
+    }
+    state.mu.Lock();
+    while (state.num_running > 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+    const uint64_t dura = mds_env_.env->NowMicros() - start;
+    const int ops = 2 * kThreads[r] * state.num_files;
+    fprintf(stderr, "%d client thread(s): %d creates+stats (%.0f ops/s)\n",
+            kThreads[r], ops, ops * 1000000.0 / dura);
+    ASSERT_TRUE(state.all_ok);
+  }
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char* argv[]) {
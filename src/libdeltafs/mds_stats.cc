@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "mds_stats.h"
+
+#include "pdlfs-common/hash.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <exception>
+
+namespace pdlfs {
+
+static const char* kOpNames[MDSOpStats::kNumOps] = {
+    "Fstat",  "Fcreat", "Mkdir",   "Bcreat",  "Uperm",  "Utime", "Trunc",
+    "Unlink", "Lookup", "Renew",   "Listdir", "Readidx", "Addpart"};
+
+static const char* kPhaseNames[MDSOpStats::kNumPhases] = {
+    "total", "mutex_wait", "dirlock_wait", "db_read", "db_commit"};
+
+MDSOpStats::MDSOpStats() {
+  for (int i = 0; i < kStripes; i++) {
+    Stripe* const stripe = &stripes_[i];
+    for (int op = 0; op < kNumOps; op++) {
+      for (int phase = 0; phase < kNumPhases; phase++) {
+        Dist* const dist = &stripe->dists[op][phase];
+        for (int b = 0; b < kBuckets; b++) {
+          dist->buckets[b].store(0, std::memory_order_relaxed);
+        }
+        dist->sum.store(0, std::memory_order_relaxed);
+        dist->max.store(0, std::memory_order_relaxed);
+      }
+      stripe->redirects[op].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+MDSOpStats::Stripe* MDSOpStats::MyStripe() {
+  pthread_t tid = pthread_self();
+  uint32_t hash = Hash(reinterpret_cast<char*>(&tid), sizeof(tid), 301);
+  return &stripes_[hash % kStripes];
+}
+
+void MDSOpStats::Add(int op, int phase, uint64_t micros) {
+  int b = 0;
+  for (uint64_t v = micros; v != 0 && b < kBuckets - 1; v >>= 1) {
+    b++;
+  }
+  Dist* const dist = &MyStripe()->dists[op][phase];
+  dist->buckets[b].fetch_add(1, std::memory_order_relaxed);
+  dist->sum.fetch_add(micros, std::memory_order_relaxed);
+  uint64_t max = dist->max.load(std::memory_order_relaxed);
+  while (micros > max && !dist->max.compare_exchange_weak(
+                             max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+void MDSOpStats::AddRedirect(int op) {
+  MyStripe()->redirects[op].fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace {
+const int kMaxBuckets = 32;
+struct Merged {
+  uint64_t buckets[kMaxBuckets];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+// Estimate a percentile by interpolating within the bucket it falls in.
+double Percentile(const Merged& m, int num_buckets, double p) {
+  const double threshold = m.count * (p / 100.0);
+  double cumulative = 0;
+  for (int b = 0; b < num_buckets; b++) {
+    if (m.buckets[b] == 0) continue;
+    cumulative += m.buckets[b];
+    if (cumulative >= threshold) {
+      const double left = b == 0 ? 0 : double(uint64_t(1) << (b - 1));
+      const double right = b == 0 ? 1 : double(uint64_t(1) << b);
+      const double left_sum = cumulative - m.buckets[b];
+      double r = left + (right - left) * (threshold - left_sum) / m.buckets[b];
+      if (r > m.max) r = m.max;
+      return r;
+    }
+  }
+  return m.max;
+}
+}  // namespace
+
+void MDSOpStats::AppendReport(std::string* dst) const {
+  assert(kBuckets <= kMaxBuckets);
+  char tmp[200];
+  for (int op = 0; op < kNumOps; op++) {
+    for (int phase = 0; phase < kNumPhases; phase++) {
+      Merged m;
+      memset(&m, 0, sizeof(m));
+      for (int i = 0; i < kStripes; i++) {
+        const Dist& dist = stripes_[i].dists[op][phase];
+        for (int b = 0; b < kBuckets; b++) {
+          uint64_t n = dist.buckets[b].load(std::memory_order_relaxed);
+          m.buckets[b] += n;
+          m.count += n;
+        }
+        m.sum += dist.sum.load(std::memory_order_relaxed);
+        uint64_t max = dist.max.load(std::memory_order_relaxed);
+        if (max > m.max) m.max = max;
+      }
+      if (m.count != 0) {
+        snprintf(tmp, sizeof(tmp),
+                 "%s.%s count=%llu avg=%.1f p50=%.1f p90=%.1f p99=%.1f "
+                 "max=%llu\n",
+                 kOpNames[op], kPhaseNames[phase], (unsigned long long)m.count,
+                 double(m.sum) / m.count, Percentile(m, kBuckets, 50),
+                 Percentile(m, kBuckets, 90), Percentile(m, kBuckets, 99),
+                 (unsigned long long)m.max);
+        dst->append(tmp);
+      }
+    }
+    uint64_t redirects = 0;
+    for (int i = 0; i < kStripes; i++) {
+      redirects += stripes_[i].redirects[op].load(std::memory_order_relaxed);
+    }
+    if (redirects != 0) {
+      snprintf(tmp, sizeof(tmp), "%s.redirects %llu\n", kOpNames[op],
+               (unsigned long long)redirects);
+      dst->append(tmp);
+    }
+  }
+}
+
+MDSOpTimer::MDSOpTimer(MDSOpStats* stats, Env* env, int op)
+    : stats_(stats), env_(env), op_(op), start_(env->NowMicros()) {
+  for (int i = 0; i < MDSOpStats::kNumPhases; i++) {
+    phases_[i] = 0;
+    entered_[i] = false;
+  }
+}
+
+MDSOpTimer::~MDSOpTimer() {
+  if (std::uncaught_exception()) {
+    stats_->AddRedirect(op_);  // Redirects are the only exceptions we throw
+    return;
+  }
+  stats_->Add(op_, MDSOpStats::kTotal, Now() - start_);
+  for (int i = MDSOpStats::kTotal + 1; i < MDSOpStats::kNumPhases; i++) {
+    if (entered_[i]) {
+      stats_->Add(op_, i, phases_[i]);
+    }
+  }
+}
+
+void MDSOpTimer::Charge(int phase, uint64_t start) {
+  phases_[phase] += Now() - start;
+  entered_[phase] = true;
+}
+
+void MDSOpTimer::Lock(port::Mutex* mu) {
+  const uint64_t start = Now();
+  mu->Lock();
+  Charge(MDSOpStats::kMutexWait, start);
+}
+
+}  // namespace pdlfs
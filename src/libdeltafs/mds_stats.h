@@ -0,0 +1,153 @@
+#pragma once
+
+/*
+ * Copyright (c) 2015-2017 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/dcntl.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace pdlfs {
+
+// Latency distributions of metadata server ops, each broken down into
+// the phases of the op. Samples are added without locking into one of
+// several stripes picked by the calling thread, the same way
+// PseudoConcurrentMDSMonitor counts ops. Stripes are only merged when
+// a report is made. Implementation is thread-safe.
+class MDSOpStats {
+ public:
+  enum Op {
+    kFstat,
+    kFcreat,
+    kMkdir,
+    kBcreat,
+    kUperm,
+    kUtime,
+    kTrunc,
+    kUnlink,
+    kLookup,
+    kRenew,
+    kListdir,
+    kReadidx,
+    kAddpart,
+    kNumOps
+  };
+
+  enum Phase {
+    kTotal,
+    kMutexWait,    // Waiting for the server mutex of a directory shard
+    kDirLockWait,  // Waiting for other writers of the same directory
+    kDbRead,
+    kDbCommit,  // Including waiting for a group commit to finish
+    kNumPhases
+  };
+
+  MDSOpStats();
+
+  void Add(int op, int phase, uint64_t micros);
+  void AddRedirect(int op);
+
+  // Append one line for each phase of each op that has samples, plus one
+  // line for the redirects of each op, all of them in the form of
+  //   <op>.<phase> count=N avg=X p50=X p90=X p99=X max=X
+  //   <op>.redirects N
+  // with all times in microseconds.
+  void AppendReport(std::string* dst) const;
+
+ private:
+  enum { kStripes = 16, kBuckets = 32 };  // Bucket i holds [2^(i-1), 2^i)
+  struct Dist {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+  };
+  struct Stripe {
+    Dist dists[kNumOps][kNumPhases];
+    std::atomic<uint64_t> redirects[kNumOps];
+  };
+  Stripe* MyStripe();
+  Stripe stripes_[kStripes];
+
+  // No copying allowed
+  void operator=(const MDSOpStats&);
+  MDSOpStats(const MDSOpStats&);
+};
+
+// Time a single server op. Phases may be entered multiple times by an op,
+// in which case their times are summed. All times are recorded when the
+// op completes, except that an op leaving with a redirect only counts as
+// a redirect. Not thread-safe. Each op must use its own timer.
+class MDSOpTimer {
+ public:
+  MDSOpTimer(MDSOpStats* stats, Env* env, int op);
+  ~MDSOpTimer();
+
+  uint64_t Now() { return env_->NowMicros(); }
+  // Add the time since start to the given phase.
+  void Charge(int phase, uint64_t start);
+  // Lock mu and charge the time waited to kMutexWait.
+  void Lock(port::Mutex* mu);
+
+ private:
+  MDSOpStats* const stats_;
+  Env* const env_;
+  const int op_;
+  const uint64_t start_;
+  uint64_t phases_[MDSOpStats::kNumPhases];
+  bool entered_[MDSOpStats::kNumPhases];
+
+  // No copying allowed
+  void operator=(const MDSOpTimer&);
+  MDSOpTimer(const MDSOpTimer&);
+};
+
+// Hold a mutex for the lifetime of an object, like MutexLock, while
+// charging the time waited to an op.
+class MDSMutexLock {
+ public:
+  MDSMutexLock(port::Mutex* mu, MDSOpTimer* timer) : mu_(mu) {
+    timer->Lock(mu_);
+  }
+
+  ~MDSMutexLock() { mu_->Unlock(); }
+
+ private:
+  // No copying allowed
+  void operator=(const MDSMutexLock&);
+  MDSMutexLock(const MDSMutexLock&);
+
+  port::Mutex* const mu_;
+};
+
+// Hold a directory lock for the lifetime of an object, like DirLock,
+// while charging the time waited to an op.
+// REQUIRES: the shard mutex of the directory has been locked.
+class MDSDirLock {
+ public:
+  MDSDirLock(Dir* d, MDSOpTimer* timer) : dir_(d) {
+    const uint64_t start = timer->Now();
+    dir_->Lock();
+    timer->Charge(MDSOpStats::kDirLockWait, start);
+  }
+
+  ~MDSDirLock() { dir_->Unlock(); }
+
+ private:
+  // No copying allowed
+  void operator=(const MDSDirLock&);
+  MDSDirLock(const MDSDirLock&);
+
+  Dir* const dir_;
+};
+
+}  // namespace pdlfs